@@ -0,0 +1,363 @@
+// Асинхронный файловый ввод-вывод: io_uring или пул потоков ввода-вывода
+//
+// Режимы --input=async и --output=async держат несколько операций с файлом в полёте
+// одновременно: producer читает блоки впереди потоков сжатия, consumer отдаёт распакованные
+// блоки на запись пачками и не ждёт диска в потоках распаковки. Очередь io_uring
+// настраивается напрямую системными вызовами (liburing не нужна): запросы копятся в кольце
+// отправки и уходят ядру одним io_uring_enter. Буферы чтения регистрируются в кольце
+// (IORING_REGISTER_BUFFERS), и ядро не отображает их страницы на каждую операцию.
+// Если io_uring недоступен (старое ядро, запрет seccomp или kernel.io_uring_disabled),
+// те же запросы выполняют потоки ввода-вывода через pread/pwrite.
+//
+// Объект очереди не потокобезопасен: владелец (BlockInputSource, BlockOutputFile)
+// сам сериализует обращения и держит в полёте не больше queue_depth запросов.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register) && \
+    defined(IORING_FEAT_RW_CUR_POS)
+#define SHM_HAVE_IO_URING 1
+#endif
+
+constexpr uint32_t DEFAULT_ASYNC_IO_DEPTH = 8;     // Чтений впереди или записей в полёте
+constexpr uint32_t MAX_ASYNC_IO_DEPTH = 256;
+constexpr size_t DIRECT_IO_ALIGNMENT = 4096;       // Выравнивание буферов, смещений и длин для O_DIRECT
+constexpr size_t ASYNC_IO_THREAD_COUNT = 4;        // Потоков ввода-вывода без io_uring
+
+enum class IoBackend {
+    Auto,   // io_uring, если доступен, иначе потоки
+    Uring,  // Только io_uring (ошибка, если недоступен)
+    Threads // Пул потоков с pread/pwrite
+};
+
+static inline bool parse_io_backend(const std::string& text, IoBackend& backend) {
+    if (text == "auto") backend = IoBackend::Auto;
+    else if (text == "uring") backend = IoBackend::Uring;
+    else if (text == "threads") backend = IoBackend::Threads;
+    else return false;
+    return true;
+}
+
+// Параметры асинхронного ввода-вывода из командной строки
+struct AsyncIoOptions {
+    IoBackend backend = IoBackend::Auto;
+    uint32_t queue_depth = DEFAULT_ASYNC_IO_DEPTH;
+    bool direct_io = false; // O_DIRECT: данные идут мимо кэша страниц
+};
+
+struct AsyncIoRequest {
+    bool is_write = false;
+    int file_descriptor = -1;
+    uint8_t* buffer = nullptr;
+    uint32_t length = 0;
+    uint64_t file_offset = 0;
+    uint64_t request_tag = 0;
+    int registered_buffer = -1; // Номер буфера, зарегистрированного в очереди (-1 - обычный)
+};
+
+struct AsyncIoCompletion {
+    uint64_t request_tag = 0;
+    int32_t result = 0; // Байт прочитано или записано, либо -errno
+};
+
+class AsyncFileIo {
+public:
+    virtual ~AsyncFileIo() = default;
+
+    virtual const char* backend_name() const = 0;
+
+    // Регистрирует буферы для операций с registered_buffer; false - не поддерживается
+    virtual bool register_buffers(const std::vector<iovec>&) { return false; }
+
+    // Ставит запрос в очередь; ядру или потокам он уходит при submit или reap
+    virtual void queue(const AsyncIoRequest& request) = 0;
+
+    // Отправляет накопленные запросы одним вызовом
+    virtual void submit() = 0;
+
+    // Отправляет накопленное и забирает завершения, дожидаясь не меньше minimum_count
+    // (меньше - только при отказе очереди)
+    virtual size_t reap(std::vector<AsyncIoCompletion>& completions, size_t minimum_count) = 0;
+
+    // io_uring или пул потоков; description - что выбрано и почему
+    static std::unique_ptr<AsyncFileIo> create(IoBackend backend, uint32_t queue_depth, std::string& description);
+};
+
+// Запросы выполняют потоки ввода-вывода через pread/pwrite
+class ThreadFileIo : public AsyncFileIo {
+public:
+    ThreadFileIo() {
+        for (size_t thread_index = 0; thread_index < ASYNC_IO_THREAD_COUNT; ++thread_index) {
+            io_threads.emplace_back([this]() { io_loop(); });
+        }
+    }
+
+    ~ThreadFileIo() override {
+        {
+            std::lock_guard<std::mutex> queue_guard(queue_mutex);
+            stopping = true;
+        }
+        request_condition.notify_all();
+        for (auto& io_thread : io_threads) io_thread.join();
+    }
+
+    const char* backend_name() const override { return "потоки"; }
+
+    void queue(const AsyncIoRequest& request) override { unsubmitted_requests.push_back(request); }
+
+    void submit() override {
+        if (unsubmitted_requests.empty()) return;
+        {
+            std::lock_guard<std::mutex> queue_guard(queue_mutex);
+            for (const auto& request : unsubmitted_requests) pending_requests.push_back(request);
+        }
+        unsubmitted_requests.clear();
+        request_condition.notify_all();
+    }
+
+    size_t reap(std::vector<AsyncIoCompletion>& completions, size_t minimum_count) override {
+        submit();
+        std::unique_lock<std::mutex> queue_guard(queue_mutex);
+        completion_condition.wait(queue_guard, [&]() { return finished_requests.size() >= minimum_count; });
+        size_t reaped_count = finished_requests.size();
+        completions.insert(completions.end(), finished_requests.begin(), finished_requests.end());
+        finished_requests.clear();
+        return reaped_count;
+    }
+
+private:
+    void io_loop() {
+        std::unique_lock<std::mutex> queue_guard(queue_mutex);
+        while (true) {
+            request_condition.wait(queue_guard, [&]() { return stopping || !pending_requests.empty(); });
+            if (pending_requests.empty()) return;
+            AsyncIoRequest request = pending_requests.front();
+            pending_requests.pop_front();
+            queue_guard.unlock();
+            ssize_t transferred;
+            do {
+                transferred = request.is_write
+                    ? pwrite(request.file_descriptor, request.buffer, request.length, static_cast<off_t>(request.file_offset))
+                    : pread(request.file_descriptor, request.buffer, request.length, static_cast<off_t>(request.file_offset));
+            } while (transferred < 0 && errno == EINTR);
+            AsyncIoCompletion completion{request.request_tag, transferred < 0 ? -errno : static_cast<int32_t>(transferred)};
+            queue_guard.lock();
+            finished_requests.push_back(completion);
+            completion_condition.notify_all();
+        }
+    }
+
+    std::vector<AsyncIoRequest> unsubmitted_requests;
+    std::mutex queue_mutex;
+    std::condition_variable request_condition;
+    std::condition_variable completion_condition;
+    std::deque<AsyncIoRequest> pending_requests;
+    std::vector<AsyncIoCompletion> finished_requests;
+    std::vector<std::thread> io_threads;
+    bool stopping = false;
+};
+
+#ifdef SHM_HAVE_IO_URING
+// Очередь io_uring: кольца отправки и завершений отображены в память процесса
+class UringFileIo : public AsyncFileIo {
+public:
+    UringFileIo() = default;
+    UringFileIo(const UringFileIo&) = delete;
+    UringFileIo& operator=(const UringFileIo&) = delete;
+
+    ~UringFileIo() override {
+        if (submission_entries) munmap(submission_entries, submission_entries_length);
+        if (completion_ring && completion_ring != submission_ring) munmap(completion_ring, completion_ring_length);
+        if (submission_ring) munmap(submission_ring, submission_ring_length);
+        if (ring_descriptor >= 0) close(ring_descriptor);
+    }
+
+    // false - io_uring недоступен; error_message - причина
+    bool open(uint32_t queue_depth, std::string& error_message) {
+        io_uring_params ring_parameters;
+        memset(&ring_parameters, 0, sizeof(ring_parameters));
+        ring_descriptor = static_cast<int>(syscall(__NR_io_uring_setup, queue_depth, &ring_parameters));
+        if (ring_descriptor < 0) {
+            error_message = std::string("io_uring_setup: ") + strerror(errno);
+            return false;
+        }
+        // IORING_OP_READ и IORING_OP_WRITE появились в том же ядре, что и этот признак
+        if (!(ring_parameters.features & IORING_FEAT_RW_CUR_POS)) {
+            error_message = "ядро без IORING_OP_READ/WRITE";
+            return false;
+        }
+        submission_ring_length = ring_parameters.sq_off.array + ring_parameters.sq_entries * sizeof(uint32_t);
+        completion_ring_length = ring_parameters.cq_off.cqes + ring_parameters.cq_entries * sizeof(io_uring_cqe);
+        bool single_mapping = ring_parameters.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mapping) submission_ring_length = completion_ring_length = std::max(submission_ring_length, completion_ring_length);
+
+        submission_ring = map_ring(submission_ring_length, IORING_OFF_SQ_RING);
+        if (!submission_ring) {
+            error_message = std::string("mmap кольца отправки: ") + strerror(errno);
+            return false;
+        }
+        completion_ring = single_mapping ? submission_ring : map_ring(completion_ring_length, IORING_OFF_CQ_RING);
+        submission_entries_length = ring_parameters.sq_entries * sizeof(io_uring_sqe);
+        submission_entries = static_cast<io_uring_sqe*>(map_ring(submission_entries_length, IORING_OFF_SQES));
+        if (!completion_ring || !submission_entries) {
+            error_message = std::string("mmap колец io_uring: ") + strerror(errno);
+            return false;
+        }
+
+        submission_tail = ring_field(submission_ring, ring_parameters.sq_off.tail);
+        submission_mask = *ring_field(submission_ring, ring_parameters.sq_off.ring_mask);
+        submission_array = ring_field(submission_ring, ring_parameters.sq_off.array);
+        completion_head = ring_field(completion_ring, ring_parameters.cq_off.head);
+        completion_tail = ring_field(completion_ring, ring_parameters.cq_off.tail);
+        completion_mask = *ring_field(completion_ring, ring_parameters.cq_off.ring_mask);
+        completion_entries = reinterpret_cast<io_uring_cqe*>(static_cast<uint8_t*>(completion_ring) + ring_parameters.cq_off.cqes);
+        submission_capacity = ring_parameters.sq_entries;
+        return true;
+    }
+
+    const char* backend_name() const override { return "io_uring"; }
+
+    bool register_buffers(const std::vector<iovec>& buffers) override {
+        return syscall(__NR_io_uring_register, ring_descriptor, IORING_REGISTER_BUFFERS, buffers.data(),
+                       static_cast<unsigned>(buffers.size())) == 0;
+    }
+
+    void queue(const AsyncIoRequest& request) override {
+        if (unsubmitted_count == submission_capacity) submit();
+        uint32_t tail = *submission_tail;
+        uint32_t entry_index = tail & submission_mask;
+        io_uring_sqe* entry = &submission_entries[entry_index];
+        memset(entry, 0, sizeof(*entry));
+        bool fixed_buffer = request.registered_buffer >= 0;
+        entry->opcode = request.is_write ? (fixed_buffer ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE)
+                                         : (fixed_buffer ? IORING_OP_READ_FIXED : IORING_OP_READ);
+        entry->fd = request.file_descriptor;
+        entry->off = request.file_offset;
+        entry->addr = reinterpret_cast<uint64_t>(request.buffer);
+        entry->len = request.length;
+        entry->user_data = request.request_tag;
+        if (fixed_buffer) entry->buf_index = static_cast<uint16_t>(request.registered_buffer);
+        submission_array[entry_index] = entry_index;
+        __atomic_store_n(submission_tail, tail + 1, __ATOMIC_RELEASE);
+        ++unsubmitted_count;
+    }
+
+    void submit() override { enter(0); }
+
+    size_t reap(std::vector<AsyncIoCompletion>& completions, size_t minimum_count) override {
+        size_t reaped_count = drain_completions(completions);
+        if (reaped_count >= minimum_count) {
+            submit();
+            return reaped_count + drain_completions(completions);
+        }
+        while (reaped_count < minimum_count) {
+            bool entered = enter(static_cast<uint32_t>(minimum_count - reaped_count));
+            size_t drained_count = drain_completions(completions);
+            reaped_count += drained_count;
+            if (!entered && drained_count == 0) break;
+        }
+        return reaped_count;
+    }
+
+private:
+    void* map_ring(size_t length, off_t ring_offset) {
+        void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_descriptor, ring_offset);
+        return mapping == MAP_FAILED ? nullptr : mapping;
+    }
+
+    static uint32_t* ring_field(void* ring, uint32_t field_offset) {
+        return reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(ring) + field_offset);
+    }
+
+    // Отправляет накопленные запросы и ждёт wait_count завершений; false - ошибка io_uring_enter
+    bool enter(uint32_t wait_count) {
+        while (unsubmitted_count > 0 || wait_count > 0) {
+            int submitted = static_cast<int>(syscall(__NR_io_uring_enter, ring_descriptor, unsubmitted_count, wait_count,
+                                                     wait_count ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+            if (submitted < 0) {
+                if (errno == EINTR) continue;
+                // EBUSY/EAGAIN: кольцо завершений заполнено, место освободит reap
+                return errno == EBUSY || errno == EAGAIN;
+            }
+            unsubmitted_count -= static_cast<uint32_t>(submitted);
+            if (unsubmitted_count == 0 || wait_count > 0) return true;
+        }
+        return true;
+    }
+
+    size_t drain_completions(std::vector<AsyncIoCompletion>& completions) {
+        uint32_t head = *completion_head;
+        uint32_t tail = __atomic_load_n(completion_tail, __ATOMIC_ACQUIRE);
+        size_t reaped_count = 0;
+        for (; head != tail; ++head, ++reaped_count) {
+            const io_uring_cqe& entry = completion_entries[head & completion_mask];
+            completions.push_back(AsyncIoCompletion{entry.user_data, entry.res});
+        }
+        __atomic_store_n(completion_head, head, __ATOMIC_RELEASE);
+        return reaped_count;
+    }
+
+    int ring_descriptor = -1;
+    void* submission_ring = nullptr;
+    size_t submission_ring_length = 0;
+    void* completion_ring = nullptr;
+    size_t completion_ring_length = 0;
+    io_uring_sqe* submission_entries = nullptr;
+    size_t submission_entries_length = 0;
+    uint32_t* submission_tail = nullptr;
+    uint32_t submission_mask = 0;
+    uint32_t* submission_array = nullptr;
+    uint32_t submission_capacity = 0;
+    uint32_t unsubmitted_count = 0;
+    uint32_t* completion_head = nullptr;
+    uint32_t* completion_tail = nullptr;
+    uint32_t completion_mask = 0;
+    io_uring_cqe* completion_entries = nullptr;
+};
+#endif
+
+inline std::unique_ptr<AsyncFileIo> AsyncFileIo::create(IoBackend backend, uint32_t queue_depth, std::string& description) {
+    std::string unavailable_reason = "сборка без io_uring";
+#ifdef SHM_HAVE_IO_URING
+    if (backend != IoBackend::Threads) {
+        auto uring_io = std::make_unique<UringFileIo>();
+        if (uring_io->open(queue_depth, unavailable_reason)) {
+            description = "io_uring";
+            return uring_io;
+        }
+    }
+#endif
+    if (backend == IoBackend::Uring) {
+        description = "io_uring недоступен: " + unavailable_reason;
+        return nullptr;
+    }
+    description = backend == IoBackend::Threads ? "потоки ввода-вывода"
+                                                : "потоки ввода-вывода (io_uring недоступен: " + unavailable_reason + ")";
+    return std::make_unique<ThreadFileIo>();
+}
+
+// Буфер, выровненный для O_DIRECT
+struct AlignedBufferDeleter {
+    void operator()(uint8_t* buffer) const { free(buffer); }
+};
+using AlignedBuffer = std::unique_ptr<uint8_t[], AlignedBufferDeleter>;
+
+static inline AlignedBuffer allocate_aligned_buffer(size_t length) {
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, std::max<size_t>(length, 1)) != 0) throw std::bad_alloc();
+    return AlignedBuffer(static_cast<uint8_t*>(buffer));
+}
+
+static inline size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
@@ -0,0 +1,310 @@
+// Кэш блоков по хешу содержимого
+//
+// Producer хеширует каждый несжатый блок (XXH64) и хранит:
+//   - BlockFrameCache: готовые кадры блоков (в памяти по LRU и, если задан каталог, на диске).
+//     Повторный блок не сжимается заново - кадр копируется из кэша. Каталог переживает
+//     запуски, поэтому ротированные логи и слегка изменённые наборы данных не пережимаются.
+//   - SentFrameWindow: какие полные кадры уже переданы по каналу и ещё лежат в окне получателя.
+//     Повторный блок вместо кадра передаётся ссылкой "блок X = кадр N" (см. block_frame.h).
+// Consumer хранит то же окно (ReceivedFrameWindow): принятые полные кадры по порядку.
+// Обе стороны вытесняют кадры одинаково - по порядку передачи, пока сумма длин кадров
+// больше ёмкости окна, - поэтому producer точно знает, какие кадры есть у consumer.
+// Ёмкость окна и номер следующего кадра producer сообщает в описании каждой передачи: если
+// consumer насчитал другой номер (например, прежний producer канала был убит), окно сбрасывается.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "block_frame.h"
+#include "log.h"
+
+constexpr uint64_t MAX_REFERENCE_WINDOW_SIZE = 1ull << 30; // Окно ссылок, которое consumer согласен держать
+
+// XXH64 (Yann Collet): быстрый некриптографический 64-битный хеш
+static inline uint64_t content_hash64(const uint8_t* data, size_t length, uint64_t seed = 0) {
+    constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t PRIME3 = 0x165667B19E3779F9ull;
+    constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+    constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+    auto rotate_left = [](uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); };
+    auto read64 = [](const uint8_t* position) { uint64_t value; memcpy(&value, position, sizeof(value)); return value; };
+    auto read32 = [](const uint8_t* position) { uint32_t value; memcpy(&value, position, sizeof(value)); return value; };
+    auto round = [&](uint64_t accumulator, uint64_t input) {
+        return rotate_left(accumulator + input * PRIME2, 31) * PRIME1;
+    };
+    auto merge = [&](uint64_t accumulator, uint64_t value) {
+        return (accumulator ^ round(0, value)) * PRIME1 + PRIME4;
+    };
+
+    const uint8_t* position = data;
+    const uint8_t* data_end = data + length;
+    uint64_t hash;
+    if (length >= 32) {
+        uint64_t lane1 = seed + PRIME1 + PRIME2, lane2 = seed + PRIME2, lane3 = seed, lane4 = seed - PRIME1;
+        for (; position + 32 <= data_end; position += 32) {
+            lane1 = round(lane1, read64(position));
+            lane2 = round(lane2, read64(position + 8));
+            lane3 = round(lane3, read64(position + 16));
+            lane4 = round(lane4, read64(position + 24));
+        }
+        hash = rotate_left(lane1, 1) + rotate_left(lane2, 7) + rotate_left(lane3, 12) + rotate_left(lane4, 18);
+        hash = merge(hash, lane1);
+        hash = merge(hash, lane2);
+        hash = merge(hash, lane3);
+        hash = merge(hash, lane4);
+    } else {
+        hash = seed + PRIME5;
+    }
+    hash += length;
+    for (; position + 8 <= data_end; position += 8) {
+        hash = rotate_left(hash ^ round(0, read64(position)), 27) * PRIME1 + PRIME4;
+    }
+    if (position + 4 <= data_end) {
+        hash = rotate_left(hash ^ (read32(position) * PRIME1), 23) * PRIME2 + PRIME3;
+        position += 4;
+    }
+    for (; position < data_end; ++position) {
+        hash = rotate_left(hash ^ (*position * PRIME5), 11) * PRIME1;
+    }
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Кадры уже сжатых блоков по хешу содержимого; потокобезопасен (им пользуются потоки сжатия)
+class BlockFrameCache {
+public:
+    // capacity_bytes - объём кадров в памяти; store_directory - каталог на диске (пусто - без него)
+    void configure(size_t capacity_bytes, const std::string& store_directory) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        memory_capacity = capacity_bytes;
+        directory = store_directory;
+        while (!directory.empty() && directory.size() > 1 && directory.back() == '/') directory.pop_back();
+        if (!directory.empty() && mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            SHM_LOG(LogLevel::Warn, "Каталог кэша блоков " << directory << " не создан: " << strerror(errno));
+            directory.clear();
+        }
+    }
+
+    bool enabled() const { return memory_capacity > 0 || !directory.empty(); }
+
+    // Копирует кадр блока с хешем content_hash, длиной block_length и CRC32C block_checksum в output;
+    // 0 - кадра нет или он не помещается в output_capacity. CRC32C сверяется, чтобы
+    // совпадение 64-битных хешей разных блоков не подменило данные.
+    size_t lookup(uint64_t content_hash, size_t block_length, uint32_t block_checksum,
+                  uint8_t* output, size_t output_capacity) {
+        std::shared_ptr<const std::vector<uint8_t>> frame;
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            auto entry = entries_by_hash.find(content_hash);
+            if (entry != entries_by_hash.end()) {
+                recently_used.splice(recently_used.begin(), recently_used, entry->second);
+                frame = entry->second->frame;
+            }
+        }
+        if (!frame && !directory.empty()) {
+            frame = load_from_store(content_hash);
+            if (frame) insert_into_memory(content_hash, frame);
+        }
+        BlockFrameHeader frame_header;
+        std::string frame_error;
+        if (!frame || frame->size() > output_capacity ||
+            !parse_block_frame_header(frame->data(), frame->size(), frame_header, frame_error) ||
+            frame_header.uncompressed_length != block_length || frame_header.checksum != block_checksum) {
+            miss_count.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        memcpy(output, frame->data(), frame->size());
+        hit_count.fetch_add(1, std::memory_order_relaxed);
+        return frame->size();
+    }
+
+    // Запоминает только что сжатый кадр
+    void store(uint64_t content_hash, const uint8_t* frame_data, size_t frame_length) {
+        auto frame = std::make_shared<const std::vector<uint8_t>>(frame_data, frame_data + frame_length);
+        insert_into_memory(content_hash, frame);
+        if (!directory.empty()) save_to_store(content_hash, *frame);
+    }
+
+    uint64_t hits() const { return hit_count.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return miss_count.load(std::memory_order_relaxed); }
+
+private:
+    struct CacheEntry {
+        uint64_t content_hash;
+        std::shared_ptr<const std::vector<uint8_t>> frame;
+    };
+
+    void insert_into_memory(uint64_t content_hash, const std::shared_ptr<const std::vector<uint8_t>>& frame) {
+        if (memory_capacity == 0 || frame->size() > memory_capacity) return;
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (entries_by_hash.count(content_hash)) return;
+        recently_used.push_front(CacheEntry{content_hash, frame});
+        entries_by_hash[content_hash] = recently_used.begin();
+        memory_bytes += frame->size();
+        while (memory_bytes > memory_capacity) {
+            memory_bytes -= recently_used.back().frame->size();
+            entries_by_hash.erase(recently_used.back().content_hash);
+            recently_used.pop_back();
+        }
+    }
+
+    std::string store_path(uint64_t content_hash) const {
+        char file_name[32];
+        snprintf(file_name, sizeof(file_name), "/%016llx.frame", static_cast<unsigned long long>(content_hash));
+        return directory + file_name;
+    }
+
+    std::shared_ptr<const std::vector<uint8_t>> load_from_store(uint64_t content_hash) const {
+        int file_descriptor = ::open(store_path(content_hash).c_str(), O_RDONLY | O_CLOEXEC);
+        if (file_descriptor < 0) return nullptr;
+        std::vector<uint8_t> frame;
+        struct stat file_status;
+        bool loaded = fstat(file_descriptor, &file_status) == 0 && file_status.st_size >= static_cast<off_t>(sizeof(BlockFrameHeader));
+        if (loaded) {
+            frame.resize(static_cast<size_t>(file_status.st_size));
+            loaded = pread(file_descriptor, frame.data(), frame.size(), 0) == static_cast<ssize_t>(frame.size());
+        }
+        close(file_descriptor);
+        if (!loaded) return nullptr;
+        return std::make_shared<const std::vector<uint8_t>>(std::move(frame));
+    }
+
+    // Кадр пишется во временный файл и переименовывается: читатели не видят недописанных кадров
+    void save_to_store(uint64_t content_hash, const std::vector<uint8_t>& frame) const {
+        std::string final_path = store_path(content_hash);
+        if (access(final_path.c_str(), F_OK) == 0) return;
+        std::ostringstream temporary_path;
+        temporary_path << final_path << ".tmp." << getpid() << "." << std::this_thread::get_id();
+        int file_descriptor = ::open(temporary_path.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (file_descriptor < 0) return;
+        bool written = write(file_descriptor, frame.data(), frame.size()) == static_cast<ssize_t>(frame.size());
+        close(file_descriptor);
+        if (!written || rename(temporary_path.str().c_str(), final_path.c_str()) != 0) {
+            unlink(temporary_path.str().c_str());
+        }
+    }
+
+    std::mutex cache_mutex;
+    size_t memory_capacity = 0;
+    size_t memory_bytes = 0;
+    std::string directory;
+    std::list<CacheEntry> recently_used; // Начало - последний использованный кадр
+    std::unordered_map<uint64_t, std::list<CacheEntry>::iterator> entries_by_hash;
+    std::atomic<uint64_t> hit_count{0};
+    std::atomic<uint64_t> miss_count{0};
+};
+
+// Producer: полные кадры, переданные по каналу и ещё лежащие в окне consumer
+class SentFrameWindow {
+public:
+    void configure(uint64_t capacity_bytes) {
+        window_capacity = capacity_bytes;
+        reset();
+    }
+
+    bool enabled() const { return window_capacity > 0; }
+    uint64_t capacity() const { return window_capacity; }
+
+    void reset() {
+        sent_frames.clear();
+        ordinal_by_hash.clear();
+        window_bytes = 0;
+        first_ordinal = 0;
+    }
+
+    // Номер, который получит следующий полный кадр
+    uint64_t next_ordinal() const { return first_ordinal + sent_frames.size(); }
+
+    // Порядковый номер переданного кадра с тем же содержимым (хеш и CRC32C), если он ещё в окне
+    bool find(uint64_t content_hash, uint32_t block_checksum, uint64_t& frame_ordinal) const {
+        auto entry = ordinal_by_hash.find(content_hash);
+        if (entry == ordinal_by_hash.end()) return false;
+        if (sent_frames[static_cast<size_t>(entry->second - first_ordinal)].block_checksum != block_checksum) return false;
+        frame_ordinal = entry->second;
+        return true;
+    }
+
+    // Полный кадр отправлен: он получает следующий порядковый номер
+    void record(uint64_t content_hash, uint32_t block_checksum, size_t frame_length) {
+        ordinal_by_hash[content_hash] = next_ordinal();
+        sent_frames.push_back(SentFrame{content_hash, block_checksum, frame_length});
+        window_bytes += frame_length;
+        while (window_bytes > window_capacity && !sent_frames.empty()) {
+            const SentFrame& evicted_frame = sent_frames.front();
+            auto entry = ordinal_by_hash.find(evicted_frame.content_hash);
+            if (entry != ordinal_by_hash.end() && entry->second == first_ordinal) ordinal_by_hash.erase(entry);
+            window_bytes -= evicted_frame.frame_length;
+            sent_frames.pop_front();
+            ++first_ordinal;
+        }
+    }
+
+private:
+    struct SentFrame {
+        uint64_t content_hash;
+        uint32_t block_checksum;
+        size_t frame_length;
+    };
+
+    uint64_t window_capacity = 0;
+    uint64_t window_bytes = 0;
+    uint64_t first_ordinal = 0; // Номер самого старого кадра в окне
+    std::deque<SentFrame> sent_frames;
+    std::unordered_map<uint64_t, uint64_t> ordinal_by_hash;
+};
+
+// Consumer: копии принятых полных кадров канала с тем же вытеснением, что у SentFrameWindow
+class ReceivedFrameWindow {
+public:
+    bool enabled() const { return window_capacity > 0; }
+    uint64_t capacity() const { return window_capacity; }
+
+    // Номер, который получит следующий принятый полный кадр
+    uint64_t next_ordinal() const { return first_ordinal + received_frames.size(); }
+
+    // Ёмкость и номер следующего кадра сообщает producer; окно начинается с чистого листа
+    void configure(uint64_t capacity_bytes, uint64_t next_frame_ordinal) {
+        reset();
+        window_capacity = capacity_bytes;
+        first_ordinal = next_frame_ordinal;
+    }
+
+    void reset() {
+        received_frames.clear();
+        window_capacity = 0;
+        window_bytes = 0;
+        first_ordinal = 0;
+    }
+
+    void record(const uint8_t* frame_data, size_t frame_length) {
+        if (window_capacity == 0) return;
+        received_frames.emplace_back(frame_data, frame_data + frame_length);
+        window_bytes += frame_length;
+        while (window_bytes > window_capacity && !received_frames.empty()) {
+            window_bytes -= received_frames.front().size();
+            received_frames.pop_front();
+            ++first_ordinal;
+        }
+    }
+
+    // Кадр с порядковым номером frame_ordinal или nullptr, если его нет в окне
+    const std::vector<uint8_t>* find(uint64_t frame_ordinal) const {
+        if (frame_ordinal < first_ordinal || frame_ordinal - first_ordinal >= received_frames.size()) return nullptr;
+        return &received_frames[static_cast<size_t>(frame_ordinal - first_ordinal)];
+    }
+
+private:
+    uint64_t window_capacity = 0;
+    uint64_t window_bytes = 0;
+    uint64_t first_ordinal = 0;
+    std::deque<std::vector<uint8_t>> received_frames;
+};
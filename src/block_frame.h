@@ -0,0 +1,132 @@
+// Кадр сжатого блока: версионированный заголовок перед сжатыми данными
+//
+// Заголовок несёт кодек, длину несжатых и сжатых данных и CRC32C несжатых данных.
+// Consumer по нему выделяет буфер ровно нужного размера, распаковывает блок за один
+// проход и проверяет целостность; любое расхождение - ошибка с номером блока.
+
+#pragma once
+
+#include <bits/stdc++.h>
+
+constexpr uint16_t BLOCK_FRAME_MAGIC = 0xB1F7;
+constexpr uint8_t BLOCK_FRAME_VERSION = 1;
+
+// Кодек, которым сжаты данные кадра
+enum class BlockCodec : uint8_t {
+    Store = 0, // Без сжатия
+    Zlib = 1,  // zlib (compress2/uncompress)
+    Lz4 = 2,   // LZ4 block format
+    Zstd = 3,  // Zstandard
+    Deflate = 4, // Сырой deflate цепочкой блоков передачи (см. DeflateCompressor)
+    Reference = 0x80 // Ссылка на кадр, уже переданный по каналу (см. block_cache.h)
+};
+
+// Кадр-ссылка: заголовок (длина и CRC32C несжатых данных - как у кадра, на который он
+// ссылается) и 8 байт порядкового номера переданного кадра в окне получателя
+constexpr size_t REFERENCE_FRAME_LENGTH = 16 + sizeof(uint64_t);
+
+struct BlockFrameHeader {
+    uint16_t frame_magic;         // BLOCK_FRAME_MAGIC
+    uint8_t  frame_version;       // BLOCK_FRAME_VERSION
+    uint8_t  codec_id;            // BlockCodec
+    uint32_t uncompressed_length; // Длина несжатых данных
+    uint32_t compressed_length;   // Длина данных после заголовка
+    uint32_t checksum;            // CRC32C несжатых данных
+};
+
+static_assert(sizeof(BlockFrameHeader) == 16, "заголовок кадра должен занимать 16 байт");
+
+// Программный CRC32C (полином Castagnoli, отражённый 0x82F63B78)
+static inline uint32_t crc32c_software(uint32_t crc, const uint8_t* data, size_t length) {
+    static const auto lookup_table = []() {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t byte_value = 0; byte_value < 256; ++byte_value) {
+            uint32_t entry = byte_value;
+            for (int bit = 0; bit < 8; ++bit) entry = (entry >> 1) ^ (0x82F63B78u & (0u - (entry & 1u)));
+            table[byte_value] = entry;
+        }
+        return table;
+    }();
+    for (size_t index = 0; index < length; ++index) {
+        crc = lookup_table[(crc ^ data[index]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Аппаратный CRC32C (SSE4.2): 8 байт за инструкцию
+__attribute__((target("sse4.2")))
+static inline uint32_t crc32c_hardware(uint32_t crc, const uint8_t* data, size_t length) {
+    uint64_t crc64 = crc;
+    while (length >= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+        data += sizeof(uint64_t);
+        length -= sizeof(uint64_t);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (length > 0) {
+        crc = __builtin_ia32_crc32qi(crc, *data);
+        ++data;
+        --length;
+    }
+    return crc;
+}
+#endif
+
+// CRC32C с выбором аппаратной реализации при наличии
+static inline uint32_t compute_crc32c(const uint8_t* data, size_t length) {
+#if defined(__x86_64__)
+    static const bool hardware_supported = __builtin_cpu_supports("sse4.2");
+    if (hardware_supported) return ~crc32c_hardware(~0u, data, length);
+#endif
+    return ~crc32c_software(~0u, data, length);
+}
+
+static inline const char* block_codec_name(uint8_t codec_id) {
+    switch (static_cast<BlockCodec>(codec_id)) {
+        case BlockCodec::Store: return "store";
+        case BlockCodec::Zlib: return "zlib";
+        case BlockCodec::Lz4: return "lz4";
+        case BlockCodec::Zstd: return "zstd";
+        case BlockCodec::Deflate: return "deflate";
+        case BlockCodec::Reference: return "reference";
+        default: return "unknown";
+    }
+}
+
+// Читает и проверяет заголовок кадра; при ошибке заполняет error_message
+static inline bool parse_block_frame_header(const uint8_t* frame, size_t frame_length,
+                                            BlockFrameHeader& header, std::string& error_message) {
+    if (frame_length < sizeof(BlockFrameHeader)) {
+        error_message = "кадр короче заголовка (" + std::to_string(frame_length) + " байт)";
+        return false;
+    }
+    memcpy(&header, frame, sizeof(BlockFrameHeader));
+    if (header.frame_magic != BLOCK_FRAME_MAGIC) {
+        error_message = "неверная сигнатура кадра";
+        return false;
+    }
+    if (header.frame_version != BLOCK_FRAME_VERSION) {
+        error_message = "неподдерживаемая версия кадра " + std::to_string(header.frame_version);
+        return false;
+    }
+    if (header.compressed_length != frame_length - sizeof(BlockFrameHeader)) {
+        error_message = "длина сжатых данных " + std::to_string(header.compressed_length) +
+                        " не совпадает с полученной " + std::to_string(frame_length - sizeof(BlockFrameHeader));
+        return false;
+    }
+    return true;
+}
+
+// Записывает кадр-ссылку на полный кадр referenced_frame с порядковым номером frame_ordinal
+static inline size_t encode_reference_frame(const uint8_t* referenced_frame, uint64_t frame_ordinal, uint8_t* output) {
+    BlockFrameHeader header;
+    memcpy(&header, referenced_frame, sizeof(header));
+    header.codec_id = static_cast<uint8_t>(BlockCodec::Reference);
+    header.compressed_length = sizeof(frame_ordinal);
+    memcpy(output, &header, sizeof(header));
+    memcpy(output + sizeof(header), &frame_ordinal, sizeof(frame_ordinal));
+    return REFERENCE_FRAME_LENGTH;
+}
@@ -0,0 +1,464 @@
+// Параметры командной строки, общие для producer и consumer
+
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "async_io.h"
+#include "block_cache.h"
+#include "chunking.h"
+#include "codec.h"
+#include "cpu_placement.h"
+#include "deflate_archive.h"
+#include "input_source.h"
+#include "log.h"
+#include "output_file.h"
+#include "shared_segment.h"
+#include "wait_strategy.h"
+
+// Режим канала передачи
+enum class ChannelMode {
+    Mailbox, // Исходный почтовый ящик с рукопожатием на каждый фрагмент
+    Ring,    // Кольцевой буфер SPSC из нескольких слотов
+    Arena    // Кольцо дескрипторов + общая арена, в которую блоки сжимаются напрямую
+};
+
+constexpr size_t DEFAULT_MAILBOX_SEGMENT_SIZE = 256;          // Заголовок ящика и полезная нагрузка фрагмента
+constexpr size_t DEFAULT_RING_SEGMENT_SIZE = 4 * 1024 * 1024;
+constexpr uint32_t DEFAULT_RING_SLOT_COUNT = 64;
+constexpr size_t DEFAULT_ARENA_RING_SEGMENT_SIZE = 64 * 1024; // В режиме арены слоты несут только дескрипторы
+constexpr size_t DEFAULT_ARENA_SIZE = 32 * 1024 * 1024;
+constexpr size_t DEFAULT_UNCOMPRESSED_BLOCK_SIZE = 64 * 1024;
+constexpr size_t MAX_UNCOMPRESSED_BLOCK_SIZE = 64 * 1024 * 1024;
+constexpr size_t DEFAULT_PACK_THRESHOLD = 64 * 1024;     // Файлы не больше порога отправляются пакетами
+constexpr size_t DEFAULT_PACK_SIZE = 1024 * 1024;        // Размер пакета, после которого он отправляется
+constexpr uint32_t MAX_CHANNEL_COUNT = 64;               // Каналов у одного consumer (не больше FUTEX_WAITV_MAX)
+constexpr size_t MAX_WORKER_THREAD_COUNT = 1024;         // Потоков сжатия/распаковки (--threads)
+constexpr size_t MAX_INFLIGHT_BLOCK_COUNT = 4096;        // Блоков в окне --inflight
+
+struct ChannelOptions {
+    ChannelMode channel_mode = ChannelMode::Ring;
+    size_t ring_segment_size = DEFAULT_RING_SEGMENT_SIZE; // Полный размер сегмента кольца или почтового ящика
+    bool ring_segment_size_specified = false;             // Размер сегмента задан явно
+    uint32_t ring_slot_count = DEFAULT_RING_SLOT_COUNT;   // Количество слотов в кольце
+    WaitStrategy wait_strategy;                           // Как ждать другую сторону
+    size_t worker_thread_count = 0;                       // Потоков сжатия/распаковки (0 - по числу ядер)
+    size_t inflight_block_limit = 0;                      // Блоков в работе впереди отправки (0 - 2 на поток)
+    CpuPlacementOptions cpu_placement;                    // Привязка потоков к процессорам и узел NUMA
+    InputMode input_mode = InputMode::Mmap;               // Как producer читает входной файл
+    OutputMode output_mode = OutputMode::Pwrite;          // Как consumer пишет выходной файл
+    AsyncIoOptions async_io_options;                      // Очередь --input=async и --output=async
+    ArchiveFormat archive_format = ArchiveFormat::None;   // Consumer: сохранить поток deflate как gzip- или zlib-файл
+    size_t arena_size = DEFAULT_ARENA_SIZE;               // Размер арены в режиме arena
+    size_t uncompressed_block_size = DEFAULT_UNCOMPRESSED_BLOCK_SIZE; // Размер несжатого блока
+    bool uncompressed_block_size_specified = false;       // Размер блока задан явно (иначе берётся из кольца)
+    HugePageMode huge_page_mode = HugePageMode::Off;      // Большие страницы для сегмента кольца
+    std::string hugetlbfs_directory = DEFAULT_HUGETLBFS_DIRECTORY; // Каталог hugetlbfs для --huge-pages=hugetlbfs
+    BlockCodec block_codec = BlockCodec::Zlib;            // Кодек producer
+    bool adaptive_codec = false;                          // Выбирать кодек и уровень для каждого блока
+    int compression_level = DEFAULT_COMPRESSION_LEVEL;    // Уровень сжатия выбранного кодека
+    ChunkingMode chunking_mode = ChunkingMode::Fixed;     // Producer: границы блоков файла и сообщения
+    size_t block_cache_size = 0;                          // Producer: байт кадров в кэше блоков в памяти (0 - без кэша)
+    std::string block_cache_directory;                    // Producer: каталог кэша кадров на диске (пусто - без него)
+    size_t reference_window = 0;                          // Producer: байт кадров в окне ссылок consumer (0 - без ссылок)
+    bool delta_transfer = false;                          // Producer: отправлять только блоки, которых нет в старой копии;
+                                                          // consumer: не усекать существующий выходной файл
+    bool resume_transfers = false;                        // Producer и consumer: продолжать прерванную передачу файла
+                                                          // с блоков, которых нет в контрольной точке consumer
+    uint32_t peer_timeout_seconds = 0;                    // Предел молчания другой стороны (0 - проверяется только её процесс)
+    std::string segment_name;                             // Имя сегмента shared memory (пусто - по умолчанию)
+    uint32_t channel_count = 1;                           // Каналов с этим именем: consumer слушает все, producer занимает свободный
+    std::string report_path;                              // Файл машиночитаемого отчёта (пусто - без отчёта)
+    LogLevel log_level = LogLevel::Info;                  // Подробность журнала (parse_channel_options ставит её в log_threshold)
+    bool stats_enabled = true;                            // Публиковать счётчики стадий для shm_stat
+    bool session_mode = false;                            // Сеанс: много файлов через один канал
+    std::string list_path;                                // Producer сеанса: файл со списком входных файлов ("-" - stdin)
+    size_t pack_threshold = DEFAULT_PACK_THRESHOLD;       // Producer сеанса: файлы не больше порога идут пакетами
+    size_t pack_size = DEFAULT_PACK_SIZE;                 // Producer сеанса: размер пакета мелких файлов
+    bool persist = false;                                 // Consumer сеанса: ждать следующих producer после завершения
+    std::vector<std::string> positional_arguments;        // Аргументы без "--"
+};
+
+// Имя сегмента: заданное параметром --segment-name или стандартное для режима канала
+static inline std::string channel_segment_name(const ChannelOptions& options, const char* default_name) {
+    return options.segment_name.empty() ? std::string(default_name) : options.segment_name;
+}
+
+// Имя сегмента канала channel_index: при нескольких каналах к имени добавляется "_<номер>"
+static inline std::string indexed_channel_segment_name(const ChannelOptions& options, const char* default_name,
+                                                       uint32_t channel_index) {
+    std::string segment_name = channel_segment_name(options, default_name);
+    return options.channel_count == 1 ? segment_name : segment_name + "_" + std::to_string(channel_index);
+}
+
+// Разбирает размер с необязательным суффиксом K/M/G
+static inline bool parse_size_argument(const std::string& text, size_t& parsed_value) {
+    if (text.empty()) return false;
+    char* parse_end = nullptr;
+    unsigned long long numeric_value = strtoull(text.c_str(), &parse_end, 10);
+    if (parse_end == text.c_str()) return false;
+    std::string suffix(parse_end);
+    unsigned suffix_shift = 0;
+    if (suffix == "K" || suffix == "k") suffix_shift = 10;
+    else if (suffix == "M" || suffix == "m") suffix_shift = 20;
+    else if (suffix == "G" || suffix == "g") suffix_shift = 30;
+    else if (!suffix.empty()) return false;
+    // Значение с суффиксом не должно переполниться при сдвиге и при приведении к size_t
+    if (numeric_value > (ULLONG_MAX >> suffix_shift)) return false;
+    numeric_value <<= suffix_shift;
+    if (numeric_value > SIZE_MAX) return false;
+    parsed_value = static_cast<size_t>(numeric_value);
+    return true;
+}
+
+static inline void print_channel_options_usage() {
+    std::cerr << "Параметры канала:" << std::endl;
+    std::cerr << "  --channel=ring|arena|mailbox  режим канала (по умолчанию ring)" << std::endl;
+    std::cerr << "  --segment-size=N[K|M|G]  размер сегмента кольца (по умолчанию 4M) или почтового ящика (256)" << std::endl;
+    std::cerr << "  --slots=N                количество слотов кольца (по умолчанию 64)" << std::endl;
+    std::cerr << "  --arena-size=N[K|M|G]    размер арены в режиме arena (по умолчанию 32M)" << std::endl;
+    std::cerr << "  --huge-pages=off|thp|hugetlbfs  большие страницы для сегмента кольца (по умолчанию off)" << std::endl;
+    std::cerr << "  --hugetlbfs-dir=DIR      каталог смонтированной hugetlbfs (по умолчанию /dev/hugepages)" << std::endl;
+    std::cerr << "  --wait=adaptive|spin|block  стратегия ожидания (по умолчанию adaptive)" << std::endl;
+    std::cerr << "  --spin=N                 итераций активного ожидания перед futex (по умолчанию 4096)" << std::endl;
+    std::cerr << "  --threads=N              потоков сжатия/распаковки (по умолчанию по числу ядер)" << std::endl;
+    std::cerr << "  --inflight=N             блоков, сжимаемых впереди отправки (по умолчанию 2 на поток)" << std::endl;
+    std::cerr << "  --pin-transfer=CPUS      привязать поток передачи к процессорам (например 2 или 0-3,8)" << std::endl;
+    std::cerr << "  --pin-workers=CPUS       привязать потоки сжатия/распаковки к процессорам" << std::endl;
+    std::cerr << "  --numa=off|local|N       узел памяти сегмента и буферов: local - узел потока передачи" << std::endl;
+    std::cerr << "  --topology               напечатать топологию процессоров и выбранное размещение" << std::endl;
+    std::cerr << "  --input=mmap|read|async  чтение входного файла producer (по умолчанию mmap)" << std::endl;
+    std::cerr << "  --output=pwrite|mmap|stream|async  запись выходного файла consumer (по умолчанию pwrite)" << std::endl;
+    std::cerr << "  --io-backend=auto|uring|threads  очередь режимов async (по умолчанию io_uring, без него потоки)" << std::endl;
+    std::cerr << "  --io-depth=N             чтений впереди или записей в полёте в режимах async (по умолчанию 8)" << std::endl;
+    std::cerr << "  --direct-io              режимы async: O_DIRECT, данные мимо кэша страниц" << std::endl;
+    std::cerr << "  --archive=gzip|zlib      consumer: сохранить принятый поток --codec=deflate как .gz или zlib-файл" << std::endl;
+    std::cerr << "                           без распаковки" << std::endl;
+    std::cerr << "  --block-size=N[K|M]      размер несжатого блока (по умолчанию из кольца, иначе 64K)" << std::endl;
+    std::cerr << "  --segment-name=/NAME     имя сегмента shared memory вместо стандартного" << std::endl;
+    std::cerr << "  --channels=N             каналов /NAME_0.../NAME_{N-1}: consumer принимает от N producer сразу," << std::endl;
+    std::cerr << "                           producer занимает первый свободный (по умолчанию 1, до 64)" << std::endl;
+    std::cerr << "  --log=error|warn|info|debug|trace  подробность журнала (по умолчанию info)" << std::endl;
+    std::cerr << "  --stats=on|off           счётчики стадий для shm_stat (по умолчанию on)" << std::endl;
+    std::cerr << "  --report=PATH            записать итоговые метрики в файл (ключ=значение)" << std::endl;
+    std::cerr << "  --codec=zlib|deflate|lz4|zstd|store|auto  кодек producer (по умолчанию zlib; deflate - цепочка" << std::endl;
+    std::cerr << "                           блоков со словарём из предыдущего блока)" << std::endl;
+    std::cerr << "  --level=N                уровень сжатия кодека (по умолчанию самый быстрый)" << std::endl;
+    std::cerr << "Повторяющиеся и неизменённые блоки:" << std::endl;
+    std::cerr << "  --chunking=fixed|cdc     producer: границы блоков: фиксированные или по содержимому (по умолчанию fixed)" << std::endl;
+    std::cerr << "  --block-cache=N[K|M|G]   producer: кэш сжатых кадров по хешу блока в памяти (по умолчанию 0 - выключен)" << std::endl;
+    std::cerr << "  --block-cache-dir=DIR    producer: хранить кэш кадров также на диске в DIR (переживает запуски)" << std::endl;
+    std::cerr << "  --reference-window=N[K|M|G]  producer: повторный блок передавать ссылкой на кадр из последних N байт" << std::endl;
+    std::cerr << "                           переданных кадров, которые хранит consumer (по умолчанию 0 - выключено)" << std::endl;
+    std::cerr << "  --delta                  producer и consumer: передать только блоки, отличающиеся от старой копии" << std::endl;
+    std::cerr << "                           выходного файла (consumer пишет их поверх неё)" << std::endl;
+    std::cerr << "Сбои и возобновление:" << std::endl;
+    std::cerr << "  --resume                 producer и consumer: после сбоя передать только блоки, которых нет" << std::endl;
+    std::cerr << "                           в контрольной точке <выходной_файл>.shm-resume" << std::endl;
+    std::cerr << "  --peer-timeout=SECONDS   считать другую сторону пропавшей, если она молчит дольше (по умолчанию 0 -" << std::endl;
+    std::cerr << "                           только если её процесс завершился)" << std::endl;
+    std::cerr << "Сеанс (много файлов через один канал):" << std::endl;
+    std::cerr << "  --session                режим сеанса: producer <файлы...>, consumer <каталог>" << std::endl;
+    std::cerr << "  --list=PATH              producer: читать имена файлов из PATH по строкам (\"-\" - stdin)" << std::endl;
+    std::cerr << "  --pack-threshold=N[K|M]  producer: файлы не больше N отправлять пакетами (по умолчанию 64K, 0 - не паковать)" << std::endl;
+    std::cerr << "  --pack-size=N[K|M]       producer: размер пакета мелких файлов (по умолчанию 1M)" << std::endl;
+    std::cerr << "  --persist                consumer: после завершения producer ждать следующего" << std::endl;
+}
+
+// Разбирает аргументы командной строки; при ошибке печатает сообщение и возвращает false
+static inline bool parse_channel_options(int argc, char** argv, ChannelOptions& options) {
+    for (int argument_index = 1; argument_index < argc; ++argument_index) {
+        std::string argument = argv[argument_index];
+        if (argument.rfind("--", 0) != 0) {
+            options.positional_arguments.push_back(argument);
+            continue;
+        }
+
+        size_t separator_position = argument.find('=');
+        std::string option_name = argument.substr(2, separator_position == std::string::npos ? std::string::npos : separator_position - 2);
+        std::string option_value = separator_position == std::string::npos ? "" : argument.substr(separator_position + 1);
+
+        if (option_name == "channel") {
+            if (option_value == "ring") options.channel_mode = ChannelMode::Ring;
+            else if (option_value == "arena") options.channel_mode = ChannelMode::Arena;
+            else if (option_value == "mailbox") options.channel_mode = ChannelMode::Mailbox;
+            else {
+                std::cerr << "Ошибка: неизвестный режим канала '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "segment-size") {
+            if (!parse_size_argument(option_value, options.ring_segment_size)) {
+                std::cerr << "Ошибка: некорректный размер сегмента '" << option_value << "'" << std::endl;
+                return false;
+            }
+            options.ring_segment_size_specified = true;
+        } else if (option_name == "arena-size") {
+            if (!parse_size_argument(option_value, options.arena_size)) {
+                std::cerr << "Ошибка: некорректный размер арены '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "slots") {
+            size_t slot_count = 0;
+            if (!parse_size_argument(option_value, slot_count) || slot_count == 0 || slot_count > UINT32_MAX) {
+                std::cerr << "Ошибка: некорректное количество слотов '" << option_value << "'" << std::endl;
+                return false;
+            }
+            options.ring_slot_count = static_cast<uint32_t>(slot_count);
+        } else if (option_name == "wait") {
+            if (!parse_wait_mode(option_value, options.wait_strategy.wait_mode)) {
+                std::cerr << "Ошибка: неизвестная стратегия ожидания '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "spin") {
+            size_t spin_iterations = 0;
+            if (!parse_size_argument(option_value, spin_iterations) || spin_iterations > UINT32_MAX) {
+                std::cerr << "Ошибка: некорректное число итераций '" << option_value << "'" << std::endl;
+                return false;
+            }
+            options.wait_strategy.spin_iterations = static_cast<uint32_t>(spin_iterations);
+        } else if (option_name == "threads") {
+            if (!parse_size_argument(option_value, options.worker_thread_count) ||
+                options.worker_thread_count > MAX_WORKER_THREAD_COUNT) {
+                std::cerr << "Ошибка: количество потоков должно быть от 0 до " << MAX_WORKER_THREAD_COUNT
+                          << ", получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "inflight") {
+            if (!parse_size_argument(option_value, options.inflight_block_limit) ||
+                options.inflight_block_limit > MAX_INFLIGHT_BLOCK_COUNT) {
+                std::cerr << "Ошибка: размер окна должен быть от 0 до " << MAX_INFLIGHT_BLOCK_COUNT
+                          << " блоков, получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "pin-transfer" || option_name == "pin-workers") {
+            std::vector<int>& cpus = option_name == "pin-transfer" ? options.cpu_placement.transfer_cpus
+                                                                   : options.cpu_placement.worker_cpus;
+            if (!parse_cpu_list(option_value, cpus)) {
+                std::cerr << "Ошибка: ожидается список процессоров вида 0-3,8, получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "numa") {
+            char* parse_end = nullptr;
+            long numa_node = strtol(option_value.c_str(), &parse_end, 10);
+            if (option_value == "off") {
+                options.cpu_placement.numa_mode = NumaMode::Off;
+            } else if (option_value == "local") {
+                options.cpu_placement.numa_mode = NumaMode::Local;
+            } else if (!option_value.empty() && *parse_end == '\0' && numa_node >= 0 &&
+                       numa_node < static_cast<long>(NUMA_NODE_MASK_BITS)) {
+                options.cpu_placement.numa_mode = NumaMode::Node;
+                options.cpu_placement.numa_node = static_cast<int>(numa_node);
+            } else {
+                std::cerr << "Ошибка: ожидается --numa=off|local|N, получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "input") {
+            if (option_value == "mmap") options.input_mode = InputMode::Mmap;
+            else if (option_value == "read") options.input_mode = InputMode::Read;
+            else if (option_value == "async") options.input_mode = InputMode::Async;
+            else {
+                std::cerr << "Ошибка: неизвестный режим чтения '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "output") {
+            if (option_value == "pwrite") options.output_mode = OutputMode::Pwrite;
+            else if (option_value == "mmap") options.output_mode = OutputMode::Mmap;
+            else if (option_value == "stream") options.output_mode = OutputMode::Stream;
+            else if (option_value == "async") options.output_mode = OutputMode::Async;
+            else {
+                std::cerr << "Ошибка: неизвестный режим записи '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "io-backend") {
+            if (!parse_io_backend(option_value, options.async_io_options.backend)) {
+                std::cerr << "Ошибка: ожидается --io-backend=auto|uring|threads, получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "io-depth") {
+            size_t queue_depth = 0;
+            if (!parse_size_argument(option_value, queue_depth) || queue_depth == 0 || queue_depth > MAX_ASYNC_IO_DEPTH) {
+                std::cerr << "Ошибка: глубина очереди должна быть от 1 до " << MAX_ASYNC_IO_DEPTH
+                          << ", получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+            options.async_io_options.queue_depth = static_cast<uint32_t>(queue_depth);
+        } else if (option_name == "archive") {
+            if (!parse_archive_format(option_value, options.archive_format)) {
+                std::cerr << "Ошибка: ожидается --archive=gzip|zlib, получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "block-size") {
+            if (!parse_size_argument(option_value, options.uncompressed_block_size) ||
+                options.uncompressed_block_size == 0 || options.uncompressed_block_size > MAX_UNCOMPRESSED_BLOCK_SIZE) {
+                std::cerr << "Ошибка: некорректный размер блока '" << option_value << "'" << std::endl;
+                return false;
+            }
+            options.uncompressed_block_size_specified = true;
+        } else if (option_name == "huge-pages") {
+            if (!parse_huge_page_mode(option_value, options.huge_page_mode)) {
+                std::cerr << "Ошибка: ожидается --huge-pages=off|thp|hugetlbfs, получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "hugetlbfs-dir") {
+            if (option_value.empty() || option_value[0] != '/') {
+                std::cerr << "Ошибка: каталог hugetlbfs должен быть абсолютным путём, получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+            options.hugetlbfs_directory = option_value;
+        } else if (option_name == "segment-name") {
+            if (option_value.size() < 2 || option_value[0] != '/' || option_value.find('/', 1) != std::string::npos) {
+                std::cerr << "Ошибка: имя сегмента должно иметь вид /NAME, получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+            options.segment_name = option_value;
+        } else if (option_name == "channels") {
+            size_t channel_count = 0;
+            if (!parse_size_argument(option_value, channel_count) || channel_count == 0 || channel_count > MAX_CHANNEL_COUNT) {
+                std::cerr << "Ошибка: количество каналов должно быть от 1 до " << MAX_CHANNEL_COUNT
+                          << ", получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+            options.channel_count = static_cast<uint32_t>(channel_count);
+        } else if (option_name == "log") {
+            if (!parse_log_level(option_value, options.log_level)) {
+                std::cerr << "Ошибка: неизвестный уровень журнала '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "stats") {
+            if (option_value == "on") options.stats_enabled = true;
+            else if (option_value == "off") options.stats_enabled = false;
+            else {
+                std::cerr << "Ошибка: ожидается --stats=on|off, получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "report") {
+            if (option_value.empty()) {
+                std::cerr << "Ошибка: не задан файл отчёта" << std::endl;
+                return false;
+            }
+            options.report_path = option_value;
+        } else if (option_name == "codec") {
+            if (option_value == "auto") {
+                options.adaptive_codec = true;
+            } else if (!parse_block_codec(option_value, options.block_codec)) {
+                std::cerr << "Ошибка: неизвестный кодек '" << option_value << "'" << std::endl;
+                return false;
+            } else if (!find_block_compressor(options.block_codec)) {
+                std::cerr << "Ошибка: кодек '" << option_value << "' не включён в сборку" << std::endl;
+                return false;
+            } else {
+                options.adaptive_codec = false;
+            }
+        } else if (option_name == "level") {
+            char* parse_end = nullptr;
+            long compression_level = strtol(option_value.c_str(), &parse_end, 10);
+            if (option_value.empty() || *parse_end != '\0' || compression_level < -100 || compression_level > 22) {
+                std::cerr << "Ошибка: некорректный уровень сжатия '" << option_value << "'" << std::endl;
+                return false;
+            }
+            options.compression_level = static_cast<int>(compression_level);
+        } else if (option_name == "chunking") {
+            if (!parse_chunking_mode(option_value, options.chunking_mode)) {
+                std::cerr << "Ошибка: ожидается --chunking=fixed|cdc, получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "block-cache") {
+            if (!parse_size_argument(option_value, options.block_cache_size)) {
+                std::cerr << "Ошибка: некорректный размер кэша блоков '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "block-cache-dir") {
+            if (option_value.empty()) {
+                std::cerr << "Ошибка: не задан каталог кэша блоков" << std::endl;
+                return false;
+            }
+            options.block_cache_directory = option_value;
+        } else if (option_name == "reference-window") {
+            if (!parse_size_argument(option_value, options.reference_window) ||
+                options.reference_window > MAX_REFERENCE_WINDOW_SIZE) {
+                std::cerr << "Ошибка: окно ссылок должно быть не больше " << (MAX_REFERENCE_WINDOW_SIZE >> 20)
+                          << "M, получено '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "session" || option_name == "persist" || option_name == "delta" ||
+                   option_name == "resume" || option_name == "direct-io" || option_name == "topology") {
+            if (!option_value.empty()) {
+                std::cerr << "Ошибка: параметр --" << option_name << " не принимает значения" << std::endl;
+                return false;
+            }
+            if (option_name == "session") options.session_mode = true;
+            else if (option_name == "persist") options.persist = true;
+            else if (option_name == "delta") options.delta_transfer = true;
+            else if (option_name == "direct-io") options.async_io_options.direct_io = true;
+            else if (option_name == "topology") options.cpu_placement.print_topology = true;
+            else options.resume_transfers = true;
+        } else if (option_name == "peer-timeout") {
+            size_t peer_timeout_seconds = 0;
+            if (!parse_size_argument(option_value, peer_timeout_seconds) || peer_timeout_seconds > 86400) {
+                std::cerr << "Ошибка: тайм-аут другой стороны должен быть от 0 до 86400 секунд, получено '"
+                          << option_value << "'" << std::endl;
+                return false;
+            }
+            options.peer_timeout_seconds = static_cast<uint32_t>(peer_timeout_seconds);
+        } else if (option_name == "list") {
+            if (option_value.empty()) {
+                std::cerr << "Ошибка: не задан файл списка" << std::endl;
+                return false;
+            }
+            options.list_path = option_value;
+        } else if (option_name == "pack-threshold") {
+            if (!parse_size_argument(option_value, options.pack_threshold)) {
+                std::cerr << "Ошибка: некорректный порог пакета '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else if (option_name == "pack-size") {
+            if (!parse_size_argument(option_value, options.pack_size) || options.pack_size == 0) {
+                std::cerr << "Ошибка: некорректный размер пакета '" << option_value << "'" << std::endl;
+                return false;
+            }
+        } else {
+            std::cerr << "Ошибка: неизвестный параметр '" << argument << "'" << std::endl;
+            return false;
+        }
+    }
+    if ((!options.list_path.empty() || options.persist) && !options.session_mode) {
+        std::cerr << "Ошибка: --list и --persist работают только вместе с --session" << std::endl;
+        return false;
+    }
+    bool zlib_codec = !options.adaptive_codec &&
+                      (options.block_codec == BlockCodec::Zlib || options.block_codec == BlockCodec::Deflate);
+    if (zlib_codec && options.compression_level != DEFAULT_COMPRESSION_LEVEL &&
+        (options.compression_level < Z_DEFAULT_COMPRESSION || options.compression_level > Z_BEST_COMPRESSION)) {
+        std::cerr << "Ошибка: уровень zlib должен быть от -1 до 9" << std::endl;
+        return false;
+    }
+    // Блок цепочки распаковывается только после предыдущего: пропускать блоки или подменять
+    // их кадрами, сжатыми в другой цепочке, нельзя
+    bool chained_deflate = !options.adaptive_codec && options.block_codec == BlockCodec::Deflate;
+    if ((chained_deflate || options.archive_format != ArchiveFormat::None) &&
+        (options.block_cache_size || !options.block_cache_directory.empty() || options.reference_window ||
+         options.delta_transfer || options.resume_transfers)) {
+        std::cerr << "Ошибка: --codec=deflate и --archive несовместимы с --block-cache, --reference-window, --delta и --resume"
+                  << std::endl;
+        return false;
+    }
+    if (options.archive_format != ArchiveFormat::None && options.session_mode) {
+        std::cerr << "Ошибка: --archive сохраняет одну передачу и не работает с --session" << std::endl;
+        return false;
+    }
+    if (options.async_io_options.direct_io && options.input_mode != InputMode::Async &&
+        options.output_mode != OutputMode::Async) {
+        std::cerr << "Ошибка: --direct-io работает только с --input=async или --output=async" << std::endl;
+        return false;
+    }
+    if (options.channel_mode == ChannelMode::Mailbox && options.huge_page_mode != HugePageMode::Off) {
+        std::cerr << "Ошибка: большие страницы доступны только для кольца и арены" << std::endl;
+        return false;
+    }
+    log_threshold() = options.log_level;
+    if (!options.ring_segment_size_specified) {
+        if (options.channel_mode == ChannelMode::Arena) options.ring_segment_size = DEFAULT_ARENA_RING_SEGMENT_SIZE;
+        else if (options.channel_mode == ChannelMode::Mailbox) options.ring_segment_size = DEFAULT_MAILBOX_SEGMENT_SIZE;
+    }
+    return true;
+}
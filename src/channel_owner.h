@@ -0,0 +1,129 @@
+// Владельцы сторон канала
+//
+// В заголовке сегмента для каждой стороны хранится PID процесса, который её занял.
+// Второй producer (или consumer) на том же канале получает ошибку вместо того, чтобы
+// молча смешать свои фрагменты с чужими. Сторону процесса, который завершился,
+// не освободив её (например, был убит), можно занять заново.
+//
+// Рядом с владельцами лежит ChannelLiveness: метки активности сторон и поколения producer.
+// Ждущая сторона следит за другой через PeerWatch: процесс, который она видела, завершился
+// или сменился, либо (с --peer-timeout) его метка активности устарела - ожидание прерывается.
+// Сторона, занявшая канал за упавшим процессом, восстанавливает состояние канала: если второй
+// стороны нет, сама; если producer пришёл на смену упавшему при живом consumer - просит
+// consumer (recovery_request) и ждёт подтверждения (recovery_acknowledged), потому что
+// только consumer знает, какие области арены ещё распаковываются.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <csignal>
+#include <unistd.h>
+
+#include "wait_strategy.h"
+
+// Жив ли процесс: EPERM означает, что процесс есть, но принадлежит другому пользователю
+static inline bool channel_owner_alive(uint32_t process_id) {
+    return kill(static_cast<pid_t>(process_id), 0) == 0 || errno == EPERM;
+}
+
+// Занимает сторону канала за текущим процессом. Занятой считается сторона живого процесса,
+// в том числе текущего. false - сторона занята, PID владельца в current_owner.
+static inline bool claim_channel_side(uint32_t* owner_word, uint32_t& current_owner) {
+    uint32_t own_process_id = static_cast<uint32_t>(getpid());
+    current_owner = __atomic_load_n(owner_word, __ATOMIC_ACQUIRE);
+    while (true) {
+        if (current_owner != 0 && channel_owner_alive(current_owner)) return false;
+        if (__atomic_compare_exchange_n(owner_word, &current_owner, own_process_id, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+}
+
+// Освобождает сторону, если она всё ещё принадлежит текущему процессу
+static inline void release_channel_side(uint32_t* owner_word) {
+    uint32_t own_process_id = static_cast<uint32_t>(getpid());
+    __atomic_compare_exchange_n(owner_word, &own_process_id, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+// Живость сторон и поколения канала; лежит в заголовке сегмента ящика и кольца
+struct ChannelLiveness {
+    uint64_t producer_heartbeat_ns; // monotonic_time_ns() последней активности producer
+    uint64_t consumer_heartbeat_ns; // То же для consumer
+    uint32_t producer_generation;   // Увеличивается при каждом занятии стороны producer
+    uint32_t recovery_request;      // Поколение producer, который ждёт, пока consumer восстановит канал
+    uint32_t recovery_acknowledged; // Последнее поколение, для которого consumer восстановил канал
+    uint32_t state_stale;           // Состояние канала оставлено упавшим процессом и ещё не сброшено
+};
+
+// Жив ли владелец стороны по слову владельца (0 - сторона свободна)
+static inline bool channel_side_alive(const uint32_t* owner_word) {
+    uint32_t process_id = __atomic_load_n(owner_word, __ATOMIC_ACQUIRE);
+    return process_id != 0 && channel_owner_alive(process_id);
+}
+
+// Наблюдение ждущей стороны за другой. Процесс другой стороны запоминается, когда он впервые
+// замечен занявшим канал; пока его нет, ждать можно сколько угодно.
+struct PeerWatch {
+    const uint32_t* peer_owner_word = nullptr;
+    const uint64_t* peer_heartbeat = nullptr;
+    uint64_t* own_heartbeat = nullptr;
+    uint64_t peer_timeout_ns = 0;     // Предел молчания другой стороны (0 - проверяется только процесс)
+    uint32_t watched_process_id = 0;  // PID другой стороны, замеченный при ожидании
+    uint32_t lost_process_id = 0;     // PID, который перестал отвечать (для сообщения об ошибке)
+    uint32_t stale_process_id = 0;    // PID упавшего процесса, оставшийся в заголовке: не другая сторона
+    uint64_t next_periodic_check_ns = 0;
+
+    void attach(const uint32_t* peer_owner, const uint64_t* peer_beat, uint64_t* own_beat, uint64_t timeout_ns) {
+        *this = PeerWatch{};
+        peer_owner_word = peer_owner;
+        peer_heartbeat = peer_beat;
+        own_heartbeat = own_beat;
+        peer_timeout_ns = timeout_ns;
+        uint32_t owner_process_id = __atomic_load_n(peer_owner, __ATOMIC_ACQUIRE);
+        if (owner_process_id != 0 && !channel_owner_alive(owner_process_id)) stale_process_id = owner_process_id;
+        beat();
+    }
+
+    // Отмечает активность своей стороны
+    void beat() {
+        if (own_heartbeat) __atomic_store_n(own_heartbeat, monotonic_time_ns(), __ATOMIC_RELAXED);
+    }
+
+    // Другая сторона штатно ушла (сигнал завершения) или канал восстановлен: следующую нужно заметить заново
+    void forget() {
+        if (lost_process_id) stale_process_id = lost_process_id;
+        watched_process_id = 0;
+        lost_process_id = 0;
+    }
+
+    // Проверка на каждом блоке, а не только в ожиданиях: сторона, которой не приходится ждать,
+    // тоже замечает смену другой стороны. Сама проверка - не чаще раза в PEER_CHECK_INTERVAL_NS.
+    bool periodic_peer_present() {
+        uint64_t current_time_ns = monotonic_time_ns();
+        if (current_time_ns < next_periodic_check_ns) {
+            if (own_heartbeat) __atomic_store_n(own_heartbeat, current_time_ns, __ATOMIC_RELAXED);
+            return true;
+        }
+        next_periodic_check_ns = current_time_ns + PEER_CHECK_INTERVAL_NS;
+        return peer_present();
+    }
+
+    // false - замеченный процесс завершился, отпустил или уступил сторону, либо молчит дольше предела
+    bool peer_present() {
+        beat();
+        if (!peer_owner_word) return true;
+        uint32_t owner_process_id = __atomic_load_n(peer_owner_word, __ATOMIC_ACQUIRE);
+        if (watched_process_id == 0) {
+            if (owner_process_id != stale_process_id) watched_process_id = owner_process_id;
+            return true;
+        }
+        bool peer_gone = owner_process_id != watched_process_id || !channel_owner_alive(watched_process_id);
+        if (!peer_gone && peer_timeout_ns && peer_heartbeat) {
+            uint64_t peer_beat_ns = __atomic_load_n(peer_heartbeat, __ATOMIC_RELAXED);
+            peer_gone = monotonic_time_ns() > peer_beat_ns + peer_timeout_ns;
+        }
+        if (peer_gone) lost_process_id = watched_process_id;
+        return !peer_gone;
+    }
+};
@@ -0,0 +1,81 @@
+// Разбиение данных на блоки: фиксированное или по содержимому (content-defined chunking)
+//
+// При фиксированном разбиении вставка одного байта в начало файла сдвигает границы всех
+// следующих блоков, и ни один из них больше не совпадает с ранее переданным. Разбиение
+// по содержимому ставит границу там, где скользящий gear-хеш последних байт даёт нули
+// в младших разрядах маски, поэтому после вставки границы быстро возвращаются на прежние
+// места в данных, и блоки за вставкой снова находятся в кэше блоков (см. block_cache.h).
+//
+// Длина блока лежит в [block_size / 4, block_size], в среднем около block_size / 2:
+// верхняя граница не превышает заданный размер блока, поэтому области арены, буферы
+// распаковки и проверки получателя рассчитаны на те же блоки, что и при фиксированном разбиении.
+
+#pragma once
+
+#include <bits/stdc++.h>
+
+enum class ChunkingMode {
+    Fixed,          // Блоки по block_size байт
+    ContentDefined  // Границы по gear-хешу содержимого
+};
+
+static inline const char* chunking_mode_name(ChunkingMode chunking_mode) {
+    return chunking_mode == ChunkingMode::ContentDefined ? "cdc" : "fixed";
+}
+
+static inline bool parse_chunking_mode(const std::string& text, ChunkingMode& chunking_mode) {
+    if (text == "fixed") chunking_mode = ChunkingMode::Fixed;
+    else if (text == "cdc") chunking_mode = ChunkingMode::ContentDefined;
+    else return false;
+    return true;
+}
+
+// Таблица gear-хеша: детерминированные псевдослучайные 64-битные значения (splitmix64)
+static inline const std::array<uint64_t, 256>& gear_table() {
+    static const std::array<uint64_t, 256> table = []() {
+        std::array<uint64_t, 256> values{};
+        uint64_t state = 0x9E3779B97F4A7C15ull;
+        for (auto& value : values) {
+            uint64_t mixed = (state += 0x9E3779B97F4A7C15ull);
+            mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9ull;
+            mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBull;
+            value = mixed ^ (mixed >> 31);
+        }
+        return values;
+    }();
+    return table;
+}
+
+// Границы блоков по содержимому для заданного размера блока
+struct ContentChunker {
+    size_t minimum_length = 0;
+    size_t maximum_length = 0;
+    uint64_t boundary_mask = 0;
+
+    explicit ContentChunker(size_t block_size = 0) {
+        maximum_length = std::max<size_t>(block_size, 1);
+        minimum_length = std::max<size_t>(maximum_length / 4, 1);
+        // После минимальной длины граница встречается в среднем раз в (maximum / 4) байт
+        size_t expected_gap = std::max<size_t>(maximum_length / 4, 1);
+        int mask_bits = 0;
+        while ((size_t(1) << (mask_bits + 1)) <= expected_gap && mask_bits < 48) ++mask_bits;
+        // Старшие разряды хеша зависят от большего числа последних байт
+        boundary_mask = mask_bits == 0 ? 0 : ((uint64_t(1) << mask_bits) - 1) << (64 - mask_bits);
+    }
+
+    // Длина следующего блока в data[0, length); при length <= minimum_length - весь остаток.
+    // end_of_data = false: данные могут продолжаться, и блок короче максимума без найденной
+    // границы возвращается как 0 (нужно дочитать).
+    size_t next_boundary(const uint8_t* data, size_t length, bool end_of_data) const {
+        if (length <= minimum_length) return end_of_data ? length : 0;
+        const auto& gear = gear_table();
+        size_t scan_end = std::min(length, maximum_length);
+        uint64_t rolling_hash = 0;
+        for (size_t position = minimum_length; position < scan_end; ++position) {
+            rolling_hash = (rolling_hash << 1) + gear[data[position]];
+            if ((rolling_hash & boundary_mask) == 0) return position + 1;
+        }
+        if (scan_end == maximum_length || end_of_data) return scan_end;
+        return 0;
+    }
+};
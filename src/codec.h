@@ -0,0 +1,400 @@
+// Подключаемые кодеки блоков: store, zlib, deflate, LZ4, Zstd и адаптивный выбор
+//
+// Producer и consumer работают с кодеками только через интерфейс BlockCompressor.
+// LZ4 и Zstd подключаются при сборке, если найдены их библиотеки (SHM_HAVE_LZ4,
+// SHM_HAVE_ZSTD); кодек каждого блока записан в его кадре, поэтому consumer
+// распаковывает потоки, в которых блоки сжаты разными кодеками.
+//
+// Кодек deflate сжимает блоки цепочкой: словарём блока служит хвост предыдущего блока
+// передачи, поэтому блоки сжимаются параллельно, а распаковываются по порядку.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <zlib.h>
+#ifdef SHM_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef SHM_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "block_frame.h"
+
+constexpr int DEFAULT_COMPRESSION_LEVEL = INT_MIN; // Уровень по умолчанию для выбранного кодека
+constexpr size_t DEFLATE_WINDOW_SIZE = 32 * 1024;  // Окно deflate: столько данных перед блоком служат словарём
+constexpr size_t DEFLATE_BLOCK_PREFIX_LENGTH = 8;  // CRC32 и Adler-32 несжатого блока перед данными deflate
+
+// Интерфейс кодека
+class BlockCompressor {
+public:
+    virtual ~BlockCompressor() = default;
+    virtual BlockCodec codec_id() const = 0;
+    virtual const char* codec_name() const = 0;
+    virtual int default_level() const = 0;
+    virtual size_t compress_bound(size_t input_length) const = 0;
+    // Сжимает данные в буфер; SIZE_MAX при ошибке или нехватке места
+    virtual size_t compress(const uint8_t* input, size_t input_length,
+                            uint8_t* output, size_t output_capacity, int level) const = 0;
+    // Распаковывает ровно output_length байт; при ошибке заполняет error_message
+    virtual bool decompress(const uint8_t* input, size_t input_length,
+                            uint8_t* output, size_t output_length, std::string& error_message) const = 0;
+
+    // То же с предустановленным словарём - данными передачи перед блоком. Кодеки без
+    // словаря его не используют.
+    virtual size_t compress_with_dictionary(const uint8_t* input, size_t input_length, uint8_t* output,
+                                            size_t output_capacity, int level, const uint8_t*, size_t) const {
+        return compress(input, input_length, output, output_capacity, level);
+    }
+    virtual bool decompress_with_dictionary(const uint8_t* input, size_t input_length, uint8_t* output,
+                                            size_t output_length, const uint8_t*, size_t,
+                                            std::string& error_message) const {
+        return decompress(input, input_length, output, output_length, error_message);
+    }
+};
+
+class StoreCompressor final : public BlockCompressor {
+public:
+    BlockCodec codec_id() const override { return BlockCodec::Store; }
+    const char* codec_name() const override { return "store"; }
+    int default_level() const override { return 0; }
+    size_t compress_bound(size_t input_length) const override { return input_length; }
+    size_t compress(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_capacity, int) const override {
+        if (input_length > output_capacity) return SIZE_MAX;
+        memcpy(output, input, input_length);
+        return input_length;
+    }
+    bool decompress(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_length,
+                    std::string& error_message) const override {
+        if (input_length != output_length) {
+            error_message = "длина несжатого блока не совпадает с заголовком";
+            return false;
+        }
+        memcpy(output, input, input_length);
+        return true;
+    }
+};
+
+class ZlibCompressor final : public BlockCompressor {
+public:
+    BlockCodec codec_id() const override { return BlockCodec::Zlib; }
+    const char* codec_name() const override { return "zlib"; }
+    int default_level() const override { return Z_BEST_SPEED; }
+    size_t compress_bound(size_t input_length) const override { return compressBound(input_length); }
+    size_t compress(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_capacity, int level) const override {
+        uLongf final_compressed_size = output_capacity;
+        int compression_result = compress2(output, &final_compressed_size, input, input_length, level);
+        return compression_result == Z_OK ? final_compressed_size : SIZE_MAX;
+    }
+    bool decompress(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_length,
+                    std::string& error_message) const override {
+        uLongf final_decompressed_size = output_length;
+        int decompression_result = uncompress(output, &final_decompressed_size, input, input_length);
+        if (decompression_result != Z_OK || final_decompressed_size != output_length) {
+            error_message = "ошибка распаковки zlib: " + std::to_string(decompression_result);
+            return false;
+        }
+        return true;
+    }
+};
+
+// Сырой deflate для цепочки блоков (--codec=deflate). Блок сжимается со словарём - последними
+// 32 КБ данных передачи перед ним - и заканчивается Z_SYNC_FLUSH на границе байта, поэтому
+// сжатые блоки подряд образуют один поток deflate, а степень сжатия почти как у сжатия файла
+// целиком. Перед данными лежат CRC32 и Adler-32 несжатого блока: из них consumer без
+// распаковки собирает контрольную сумму gzip- или zlib-файла (см. deflate_archive.h).
+// Потоки zlib переиспользуются в пределах потока сжатия или распаковки.
+class DeflateCompressor final : public BlockCompressor {
+public:
+    BlockCodec codec_id() const override { return BlockCodec::Deflate; }
+    const char* codec_name() const override { return "deflate"; }
+    int default_level() const override { return Z_BEST_SPEED; }
+    size_t compress_bound(size_t input_length) const override {
+        // Запас на пустой блок Z_SYNC_FLUSH в конце
+        return DEFLATE_BLOCK_PREFIX_LENGTH + compressBound(input_length) + 8;
+    }
+    size_t compress(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_capacity, int level) const override {
+        return compress_with_dictionary(input, input_length, output, output_capacity, level, nullptr, 0);
+    }
+    bool decompress(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_length,
+                    std::string& error_message) const override {
+        return decompress_with_dictionary(input, input_length, output, output_length, nullptr, 0, error_message);
+    }
+
+    size_t compress_with_dictionary(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_capacity,
+                                    int level, const uint8_t* dictionary, size_t dictionary_length) const override {
+        thread_local DeflateStream deflate_stream;
+        z_stream* stream = deflate_stream.reset(level);
+        if (!stream || output_capacity <= DEFLATE_BLOCK_PREFIX_LENGTH) return SIZE_MAX;
+        if (dictionary_length > 0 &&
+            deflateSetDictionary(stream, dictionary, static_cast<uInt>(dictionary_length)) != Z_OK) {
+            return SIZE_MAX;
+        }
+        stream->next_in = const_cast<Bytef*>(input);
+        stream->avail_in = static_cast<uInt>(input_length);
+        stream->next_out = output + DEFLATE_BLOCK_PREFIX_LENGTH;
+        stream->avail_out = static_cast<uInt>(output_capacity - DEFLATE_BLOCK_PREFIX_LENGTH);
+        // Сброс завершён, только если после него осталось место
+        if (deflate(stream, Z_SYNC_FLUSH) != Z_OK || stream->avail_in != 0 || stream->avail_out == 0) return SIZE_MAX;
+        uint32_t block_checksums[2] = {
+            static_cast<uint32_t>(crc32(0, input, static_cast<uInt>(input_length))),
+            static_cast<uint32_t>(adler32(1, input, static_cast<uInt>(input_length)))};
+        memcpy(output, block_checksums, sizeof(block_checksums));
+        return output_capacity - stream->avail_out;
+    }
+
+    bool decompress_with_dictionary(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_length,
+                                    const uint8_t* dictionary, size_t dictionary_length,
+                                    std::string& error_message) const override {
+        thread_local InflateStream inflate_stream;
+        z_stream* stream = inflate_stream.reset();
+        if (!stream || input_length < DEFLATE_BLOCK_PREFIX_LENGTH) {
+            error_message = "ошибка распаковки deflate: нет потока или заголовка блока";
+            return false;
+        }
+        if (dictionary_length > 0 &&
+            inflateSetDictionary(stream, dictionary, static_cast<uInt>(dictionary_length)) != Z_OK) {
+            error_message = "ошибка распаковки deflate: словарь не принят";
+            return false;
+        }
+        stream->next_in = const_cast<Bytef*>(input + DEFLATE_BLOCK_PREFIX_LENGTH);
+        stream->avail_in = static_cast<uInt>(input_length - DEFLATE_BLOCK_PREFIX_LENGTH);
+        stream->next_out = output;
+        stream->avail_out = static_cast<uInt>(output_length);
+        int inflate_result = inflate(stream, Z_SYNC_FLUSH);
+        if ((inflate_result != Z_OK && inflate_result != Z_BUF_ERROR) || stream->avail_in != 0 || stream->avail_out != 0) {
+            error_message = "ошибка распаковки deflate: " + std::to_string(inflate_result);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    // Поток сжатия сырого deflate; пересоздаётся только при смене уровня
+    struct DeflateStream {
+        z_stream stream{};
+        bool initialized = false;
+        int stream_level = 0;
+
+        ~DeflateStream() { if (initialized) deflateEnd(&stream); }
+
+        z_stream* reset(int level) {
+            if (initialized && level == stream_level) return deflateReset(&stream) == Z_OK ? &stream : nullptr;
+            if (initialized) deflateEnd(&stream);
+            stream = z_stream{};
+            initialized = deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            stream_level = level;
+            return initialized ? &stream : nullptr;
+        }
+    };
+
+    struct InflateStream {
+        z_stream stream{};
+        bool initialized = false;
+
+        ~InflateStream() { if (initialized) inflateEnd(&stream); }
+
+        z_stream* reset() {
+            if (initialized) return inflateReset(&stream) == Z_OK ? &stream : nullptr;
+            initialized = inflateInit2(&stream, -MAX_WBITS) == Z_OK;
+            return initialized ? &stream : nullptr;
+        }
+    };
+};
+
+// Словарь следующего блока цепочки: последние DEFLATE_WINDOW_SIZE байт данных передачи
+// с учётом только что сжатого (или распакованного) блока
+static inline void advance_deflate_dictionary(std::vector<uint8_t>& dictionary, const uint8_t* data, size_t length) {
+    if (length >= DEFLATE_WINDOW_SIZE) {
+        dictionary.assign(data + length - DEFLATE_WINDOW_SIZE, data + length);
+        return;
+    }
+    size_t kept_length = std::min(dictionary.size(), DEFLATE_WINDOW_SIZE - length);
+    dictionary.erase(dictionary.begin(), dictionary.end() - static_cast<std::ptrdiff_t>(kept_length));
+    dictionary.insert(dictionary.end(), data, data + length);
+}
+
+#ifdef SHM_HAVE_LZ4
+// LZ4: уровень >= 1 - обычное сжатие, отрицательный уровень - ускорение LZ4_compress_fast
+class Lz4Compressor final : public BlockCompressor {
+public:
+    BlockCodec codec_id() const override { return BlockCodec::Lz4; }
+    const char* codec_name() const override { return "lz4"; }
+    int default_level() const override { return 1; }
+    size_t compress_bound(size_t input_length) const override {
+        return static_cast<size_t>(LZ4_compressBound(static_cast<int>(input_length)));
+    }
+    size_t compress(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_capacity, int level) const override {
+        int acceleration = level < 0 ? -level : 1;
+        int compressed_size = LZ4_compress_fast(reinterpret_cast<const char*>(input), reinterpret_cast<char*>(output),
+                                                static_cast<int>(input_length), static_cast<int>(output_capacity), acceleration);
+        return compressed_size > 0 ? static_cast<size_t>(compressed_size) : SIZE_MAX;
+    }
+    bool decompress(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_length,
+                    std::string& error_message) const override {
+        int decompressed_size = LZ4_decompress_safe(reinterpret_cast<const char*>(input), reinterpret_cast<char*>(output),
+                                                    static_cast<int>(input_length), static_cast<int>(output_length));
+        if (decompressed_size < 0 || static_cast<size_t>(decompressed_size) != output_length) {
+            error_message = "ошибка распаковки lz4: " + std::to_string(decompressed_size);
+            return false;
+        }
+        return true;
+    }
+};
+#endif
+
+#ifdef SHM_HAVE_ZSTD
+// Zstd: контексты сжатия и распаковки переиспользуются в пределах потока
+class ZstdCompressor final : public BlockCompressor {
+public:
+    BlockCodec codec_id() const override { return BlockCodec::Zstd; }
+    const char* codec_name() const override { return "zstd"; }
+    int default_level() const override { return 1; }
+    size_t compress_bound(size_t input_length) const override { return ZSTD_compressBound(input_length); }
+    size_t compress(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_capacity, int level) const override {
+        thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> compression_context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+        size_t compressed_size = ZSTD_compressCCtx(compression_context.get(), output, output_capacity, input, input_length, level);
+        return ZSTD_isError(compressed_size) ? SIZE_MAX : compressed_size;
+    }
+    bool decompress(const uint8_t* input, size_t input_length, uint8_t* output, size_t output_length,
+                    std::string& error_message) const override {
+        thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> decompression_context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        size_t decompressed_size = ZSTD_decompressDCtx(decompression_context.get(), output, output_length, input, input_length);
+        if (ZSTD_isError(decompressed_size) || decompressed_size != output_length) {
+            error_message = std::string("ошибка распаковки zstd: ") +
+                            (ZSTD_isError(decompressed_size) ? ZSTD_getErrorName(decompressed_size) : "неверная длина");
+            return false;
+        }
+        return true;
+    }
+};
+#endif
+
+// Возвращает кодек по идентификатору или nullptr, если он не входит в сборку
+static inline const BlockCompressor* find_block_compressor(BlockCodec codec) {
+    static const StoreCompressor store_compressor;
+    static const ZlibCompressor zlib_compressor;
+    static const DeflateCompressor deflate_compressor;
+#ifdef SHM_HAVE_LZ4
+    static const Lz4Compressor lz4_compressor;
+#endif
+#ifdef SHM_HAVE_ZSTD
+    static const ZstdCompressor zstd_compressor;
+#endif
+    switch (codec) {
+        case BlockCodec::Store: return &store_compressor;
+        case BlockCodec::Zlib: return &zlib_compressor;
+        case BlockCodec::Deflate: return &deflate_compressor;
+#ifdef SHM_HAVE_LZ4
+        case BlockCodec::Lz4: return &lz4_compressor;
+#endif
+#ifdef SHM_HAVE_ZSTD
+        case BlockCodec::Zstd: return &zstd_compressor;
+#endif
+        default: return nullptr;
+    }
+}
+
+static inline bool parse_block_codec(const std::string& text, BlockCodec& codec) {
+    if (text == "store") codec = BlockCodec::Store;
+    else if (text == "zlib") codec = BlockCodec::Zlib;
+    else if (text == "deflate") codec = BlockCodec::Deflate;
+    else if (text == "lz4") codec = BlockCodec::Lz4;
+    else if (text == "zstd") codec = BlockCodec::Zstd;
+    else return false;
+    return true;
+}
+
+// Кодек и уровень для одного блока
+struct CodecChoice {
+    const BlockCompressor* compressor = nullptr;
+    int level = 0;
+    bool sample_first = false; // Сначала проверить сжимаемость по выборке
+};
+
+// Проверяет сжимаемость блока по трём выборкам (начало, середина, конец).
+// Несжимаемые данные (медиа, архивы) передаются без сжатия и не тратят процессор.
+static inline bool block_looks_compressible(const uint8_t* data, size_t length) {
+    constexpr size_t SAMPLE_LENGTH = 1024;
+    constexpr double INCOMPRESSIBLE_RATIO = 0.95;
+    if (length < 4 * SAMPLE_LENGTH) return true;
+
+    const BlockCompressor* sample_compressor = find_block_compressor(BlockCodec::Lz4);
+    int sample_level = 1;
+    if (!sample_compressor) {
+        sample_compressor = find_block_compressor(BlockCodec::Zlib);
+        sample_level = Z_BEST_SPEED;
+    }
+    uint8_t sample_output[2 * SAMPLE_LENGTH + 256];
+    size_t sampled_input = 0;
+    size_t sampled_output = 0;
+    for (size_t sample_offset : {size_t(0), (length - SAMPLE_LENGTH) / 2, length - SAMPLE_LENGTH}) {
+        size_t compressed_size = sample_compressor->compress(data + sample_offset, SAMPLE_LENGTH,
+                                                             sample_output, sizeof(sample_output), sample_level);
+        sampled_input += SAMPLE_LENGTH;
+        sampled_output += compressed_size == SIZE_MAX ? SAMPLE_LENGTH : compressed_size;
+    }
+    return double(sampled_output) < INCOMPRESSIBLE_RATIO * double(sampled_input);
+}
+
+// Адаптивный выбор кодека.
+// Ступени упорядочены от самой быстрой к самой сильной. Если отправитель ждёт сжатия,
+// выбирается более быстрая ступень; если сжатые блоки ждут освобождения канала -
+// более сильная: лишнее время процессора всё равно уходит на ожидание канала.
+class AdaptiveCodecSelector {
+public:
+    AdaptiveCodecSelector() {
+        auto add_step = [this](BlockCodec codec, int level) {
+            if (const BlockCompressor* compressor = find_block_compressor(codec)) {
+                codec_ladder.push_back(CodecChoice{compressor, level, true});
+            }
+        };
+        add_step(BlockCodec::Lz4, 1);
+        add_step(BlockCodec::Zstd, 1);
+        add_step(BlockCodec::Zstd, 3);
+        if (!find_block_compressor(BlockCodec::Zstd)) {
+            add_step(BlockCodec::Zlib, Z_BEST_SPEED);
+            add_step(BlockCodec::Zlib, 6);
+        } else {
+            add_step(BlockCodec::Zstd, 6);
+        }
+        current_step = codec_ladder.size() > 1 ? 1 : 0;
+    }
+
+    // Ступень для следующего блока
+    CodecChoice current_choice() const { return codec_ladder[current_step]; }
+
+    // Учитывает, кто ждал при отправке очередного блока
+    void record_block(bool sender_waited_for_compression, bool sender_waited_for_channel) {
+        if (sender_waited_for_compression) ++compression_stalls;
+        if (sender_waited_for_channel) ++channel_stalls;
+        if (++observed_blocks < OBSERVATION_WINDOW) return;
+
+        if (compression_stalls * 4 > observed_blocks && current_step > 0) {
+            --current_step;
+        } else if (compression_stalls == 0 && channel_stalls * 2 > observed_blocks &&
+                   current_step + 1 < codec_ladder.size()) {
+            ++current_step;
+        }
+        observed_blocks = compression_stalls = channel_stalls = 0;
+    }
+
+private:
+    static constexpr size_t OBSERVATION_WINDOW = 16;
+    std::vector<CodecChoice> codec_ladder;
+    size_t current_step = 0;
+    size_t observed_blocks = 0;
+    size_t compression_stalls = 0;
+    size_t channel_stalls = 0;
+};
+
+// Размер буфера, в который гарантированно помещается кадр блока любым кодеком
+static inline size_t block_frame_bound(size_t input_length) {
+    size_t payload_bound = input_length;
+    for (BlockCodec codec : {BlockCodec::Zlib, BlockCodec::Deflate, BlockCodec::Lz4, BlockCodec::Zstd}) {
+        if (const BlockCompressor* compressor = find_block_compressor(codec)) {
+            payload_bound = std::max(payload_bound, compressor->compress_bound(input_length));
+        }
+    }
+    return sizeof(BlockFrameHeader) + payload_bound;
+}
@@ -1,243 +1,255 @@
 // Consumer - Потребитель данных
+//
+// Тонкая обёртка над ChannelReceiver из библиотеки shm_channel: разбирает параметры,
+// открывает выходной файл и печатает статистику.
+//
+// В режиме сеанса (--session) передачи сохраняются в каталог под своими именами;
+// с --persist consumer после завершения producer ждёт следующего на том же канале.
+// С --channels=N consumer принимает сеансы N producer одновременно, по каналу на каждого.
+// С --resume недопринятые файлы не удаляются: рядом с ними остаётся контрольная точка,
+// и перезапущенный producer дошлёт только недостающие блоки.
+// С --archive=gzip|zlib поток producer с --codec=deflate сохраняется как .gz без распаковки.
 
 #include <bits/stdc++.h>
-#include <zlib.h>
-#include <fcntl.h>
-#include <sys/mman.h>
+#include <csignal>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <atomic>
-#include <future>
-#include <chrono>
+
+#include "channel_options.h"
+#include "log.h"
+#include "output_file.h"
+#include "run_report.h"
+#include "shm_channel.h"
+
 using namespace std;
 
-constexpr const char* SHARED_MEMORY_SEGMENT_NAME = "/shm_shr_channel_example";
-constexpr size_t SHARED_MEMORY_SIZE = 256;
-constexpr size_t MAX_PAYLOAD_CAPACITY = 200;
-
-// Структура shared memory (должна совпадать с producer)
-struct SharedMemoryHeader {
-    uint32_t synchronization_flag;
-    uint32_t message_available;
-    uint32_t data_block_identifier;
-    uint32_t fragment_sequence_number;
-    uint8_t  is_final_fragment;
-    uint32_t actual_payload_length;
-    uint8_t  data_payload[MAX_PAYLOAD_CAPACITY];
-} __attribute__((packed));
-
-// Функции работы с shared memory (аналогичны producer)
-static inline SharedMemoryHeader* initialize_shared_memory() {
-    int shared_memory_descriptor = shm_open(SHARED_MEMORY_SEGMENT_NAME, O_CREAT | O_RDWR, 0600);
-    if (shared_memory_descriptor < 0) { perror("shm_open"); exit(1); }
-    if (ftruncate(shared_memory_descriptor, SHARED_MEMORY_SIZE) != 0) { perror("ftruncate"); exit(1); }
-    void* memory_region = mmap(nullptr, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shared_memory_descriptor, 0);
-    if (memory_region == MAP_FAILED) { perror("mmap"); exit(1); }
-    close(shared_memory_descriptor);
-    return reinterpret_cast<SharedMemoryHeader*>(memory_region);
+// Сегменты, которые удаляются при завершении по сигналу (режим --persist)
+static vector<string> signal_cleanup_segments;
+
+static void remove_segments_and_exit(int) {
+    for (const auto& segment_path : signal_cleanup_segments) remove_shared_segment(segment_path);
+    _exit(0);
 }
 
-static inline void acquire_shared_memory_lock(SharedMemoryHeader* shared_mem) {
-    uint32_t desired_state = 0;
-    while (!__atomic_compare_exchange_n(&shared_mem->synchronization_flag, &desired_state, 1, false,
-                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
-        desired_state = 0;
-        this_thread::yield();
+// Сохраняет передачи сеанса в каталог: имя передачи становится путём внутри каталога
+class DirectorySessionHandler : public SessionHandler {
+public:
+    // keep_existing: старые копии файлов не усекаются, дельта-передача пишет поверх них;
+    // keep_failed: недопринятые файлы остаются для возобновления передачи
+    DirectorySessionHandler(const string& directory, OutputMode mode, const AsyncIoOptions& async_options, bool keep_existing,
+                            bool keep_failed)
+        : output_directory(directory), output_mode(mode), async_io_options(async_options), keep_existing_files(keep_existing),
+          keep_failed_files(keep_failed) {}
+
+    BlockOutputFile* open_output(const TransferDescription& transfer) override {
+        string output_path = output_directory + "/" + relative_output_path(transfer);
+        if (!create_parent_directories(output_path)) return nullptr;
+        auto output_file = make_unique<BlockOutputFile>();
+        if (!output_file->open(output_path, output_mode, keep_existing_files, async_io_options)) return nullptr;
+        BlockOutputFile* opened_file = output_file.get();
+        open_files[{transfer_key(transfer), output_path}] = move(output_file);
+        return opened_file;
     }
-}
 
-static inline void release_shared_memory_lock(SharedMemoryHeader* shared_mem) {
-    __atomic_store_n(&shared_mem->synchronization_flag, 0, __ATOMIC_RELEASE);
-}
+    void transfer_finished(const TransferDescription& transfer, bool success, const string& error_message) override {
+        string output_path = output_directory + "/" + relative_output_path(transfer);
+        open_files.erase({transfer_key(transfer), output_path});
+        if (success) {
+            ++received_files;
+            SHM_LOG(LogLevel::Info, "Принят файл " << output_path);
+        } else {
+            ++failed_files;
+            cerr << "Ошибка: " << output_path << ": " << error_message << endl;
+            if (!keep_failed_files) unlink(output_path.c_str());
+        }
+    }
+
+    void producer_finished(uint32_t channel_index) override {
+        cout << "Producer завершил сеанс (канал " << channel_index << "): принято файлов " << received_files
+             << ", ошибок " << failed_files << ". Ожидание следующего producer..." << endl;
+    }
+
+    size_t received_files = 0;
+    size_t failed_files = 0;
+
+private:
+    // ID передачи уникален только в пределах канала
+    static uint64_t transfer_key(const TransferDescription& transfer) {
+        return (static_cast<uint64_t>(transfer.channel_index) << 32) | transfer.transfer_id;
+    }
+
+    // Имя от producer превращается в относительный путь без выхода за пределы каталога
+    static string relative_output_path(const TransferDescription& transfer) {
+        string relative_path;
+        size_t component_start = 0;
+        while (component_start <= transfer.name.size()) {
+            size_t component_end = transfer.name.find('/', component_start);
+            if (component_end == string::npos) component_end = transfer.name.size();
+            string component = transfer.name.substr(component_start, component_end - component_start);
+            component_start = component_end + 1;
+            if (component.empty() || component == ".") continue;
+            if (component == "..") component = "__";
+            if (!relative_path.empty()) relative_path += '/';
+            relative_path += component;
+        }
+        if (!relative_path.empty()) return relative_path;
+        return transfer.channel_index == 0
+            ? "transfer_" + to_string(transfer.transfer_id)
+            : "transfer_" + to_string(transfer.channel_index) + "_" + to_string(transfer.transfer_id);
+    }
 
-// Распаковывает сжатые данные с помощью zlib
-vector<uint8_t> inflate_compressed_data(const vector<uint8_t>& compressed_input) {
-    if (compressed_input.empty()) {
-        return {}; // Пустые входные данные
+    static bool create_parent_directories(const string& output_path) {
+        for (size_t separator = output_path.find('/', 1); separator != string::npos; separator = output_path.find('/', separator + 1)) {
+            string directory = output_path.substr(0, separator);
+            if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+                cerr << "Ошибка: не удалось создать каталог '" << directory << "': " << strerror(errno) << endl;
+                return false;
+            }
+        }
+        return true;
     }
-    
-    // Выделяем буфер с запасом
-    size_t output_buffer_capacity = compressed_input.size() * 6 + 1024;
-    vector<uint8_t> decompressed_output(output_buffer_capacity);
-    uLongf final_decompressed_size = output_buffer_capacity;
-
-    // Первая попытка распаковки
-    int decompression_result = uncompress(decompressed_output.data(), &final_decompressed_size, compressed_input.data(), compressed_input.size());
-    
-    // Если буфера не хватило - увеличиваем и пробуем снова
-    if (decompression_result == Z_BUF_ERROR) {
-        output_buffer_capacity *= 2;
-        decompressed_output.resize(output_buffer_capacity);
-        final_decompressed_size = output_buffer_capacity;
-        decompression_result = uncompress(decompressed_output.data(), &final_decompressed_size, compressed_input.data(), compressed_input.size());
+
+    string output_directory;
+    OutputMode output_mode;
+    AsyncIoOptions async_io_options;
+    bool keep_existing_files;
+    bool keep_failed_files;
+    map<pair<uint64_t, string>, unique_ptr<BlockOutputFile>> open_files;
+};
+
+// Сеанс: передачи сохраняются в каталог, пока все producer не закроют свои каналы
+static int run_session(const ChannelOptions& channel_options) {
+    string output_directory = channel_options.positional_arguments[0];
+    if (mkdir(output_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        cerr << "Ошибка: не удалось создать каталог '" << output_directory << "': " << strerror(errno) << endl;
+        return 1;
     }
+    cout << "Выходной каталог: " << output_directory << endl;
 
-    if (decompression_result != Z_OK) {
-        cerr << "Ошибка распаковки: " << decompression_result << endl;
-        return {};
+    ChannelReceiver channel_receiver;
+    if (!channel_receiver.open(channel_options)) {
+        cerr << "Ошибка: " << channel_receiver.error_message() << endl;
+        return 1;
+    }
+    if (channel_options.cpu_placement.print_topology) print_topology_report(cout, channel_receiver.cpu_placement());
+    channel_receiver.set_latency_recording(!channel_options.report_path.empty());
+    if (channel_options.persist) {
+        // Постоянный consumer завершается сигналом: сегменты канала не должны остаться в /dev/shm
+        signal_cleanup_segments = channel_receiver.segment_names();
+        signal(SIGINT, remove_segments_and_exit);
+        signal(SIGTERM, remove_segments_and_exit);
     }
 
-    decompressed_output.resize(final_decompressed_size);
-    return decompressed_output;
+    auto session_start_time = chrono::steady_clock::now();
+    DirectorySessionHandler session_handler(output_directory, channel_options.output_mode, channel_options.async_io_options,
+                                            channel_options.delta_transfer || channel_options.resume_transfers,
+                                            channel_options.resume_transfers);
+    cout << "Consumer запущен. Ожидание данных..." << endl;
+    // С --persist каналы после завершения producer сразу ждут следующего (см. producer_finished)
+    ReceiveStatus receive_status = channel_receiver.receive_session(session_handler);
+    if (receive_status == ReceiveStatus::Error) cerr << "Ошибка: " << channel_receiver.error_message() << endl;
+    bool session_succeeded = receive_status == ReceiveStatus::Closed && session_handler.failed_files == 0;
+
+    double session_time = chrono::duration<double>(chrono::steady_clock::now() - session_start_time).count();
+    const ReceiverStatistics& statistics = channel_receiver.statistics();
+    cout << "Работа consumer завершена " << (session_succeeded ? "успешно" : "с ошибками") << endl;
+    cout << "Общее время: " << session_time << " секунд" << endl;
+    cout << "Файлов принято: " << session_handler.received_files << ", ошибок: " << session_handler.failed_files << endl;
+    cout << "Принято байт: " << statistics.output_bytes << ", блоков: " << statistics.blocks << endl;
+    if (statistics.referenced_blocks > 0) cout << "Блоков принято ссылками: " << statistics.referenced_blocks << endl;
+
+    if (!channel_options.report_path.empty()) {
+        RunReport run_report;
+        run_report.add("role", "consumer");
+        run_report.add("success", session_succeeded ? 1 : 0);
+        run_report.add("seconds", session_time);
+        run_report.add("files", session_handler.received_files);
+        run_report.add("failed_files", session_handler.failed_files);
+        run_report.add("output_bytes", statistics.output_bytes);
+        run_report.add("blocks", statistics.blocks);
+        run_report.add("referenced_blocks", statistics.referenced_blocks);
+        channel_receiver.fragment_latency().add_to_report(run_report);
+        channel_receiver.cpu_placement().add_to_report(run_report);
+        run_report.add_resource_usage();
+        run_report.write(channel_options.report_path);
+    }
+    channel_receiver.close();
+    cout << "Ресурсы освобождены" << endl;
+    return session_succeeded ? 0 : 1;
 }
 
 int main(int argc, char** argv) {
     // Проверка аргументов командной строки
-    if (argc < 2) {
-        cerr << "Использование: consumer <выходной_файл>" << endl;
+    ChannelOptions channel_options;
+    if (!parse_channel_options(argc, argv, channel_options) || channel_options.positional_arguments.empty()) {
+        cerr << "Использование: consumer [параметры] <выходной_файл>" << endl;
+        cerr << "               consumer --session [--persist] [--channels=N] [параметры] <выходной_каталог>" << endl;
         cerr << "Пример: consumer output.bin" << endl;
+        print_channel_options_usage();
         return 1;
     }
-    
-    string output_filename = argv[1];
+    if (channel_options.session_mode) return run_session(channel_options);
+
+    string output_filename = channel_options.positional_arguments[0];
     cout << "Выходной файл: " << output_filename << endl;
-    
+
     // Открываем файл для записи
-    FILE* output_file_stream = fopen(output_filename.c_str(), "wb");
-    if (!output_file_stream) { 
-        perror("Ошибка открытия файла");
-        return 1; 
+    BlockOutputFile output_file;
+    if (!output_file.open(output_filename, channel_options.output_mode,
+                          channel_options.delta_transfer || channel_options.resume_transfers,
+                          channel_options.async_io_options)) {
+        return 1;
     }
+    if (channel_options.output_mode == OutputMode::Async) cout << "Запись: асинхронная (" << output_file.write_method() << ")" << endl;
 
-    // Инициализируем shared memory
-    SharedMemoryHeader* shared_memory_region = initialize_shared_memory();
-
-    // Структуры для управления данными
-    uint32_t next_expected_block_id = 0; // Ожидаемый номер блока
-    unordered_map<uint32_t, vector<uint8_t>> block_assembly_buffer; // Сборка фрагментов
-    map<uint32_t, future<vector<uint8_t>>> decompression_tasks; // Задачи распаковки
+    // Канал: почтовый ящик, кольцевой буфер или кольцо с ареной
+    ChannelReceiver channel_receiver;
+    if (!channel_receiver.open(channel_options)) {
+        cerr << "Ошибка: " << channel_receiver.error_message() << endl;
+        return 1;
+    }
+    if (channel_options.cpu_placement.print_topology) print_topology_report(cout, channel_receiver.cpu_placement());
+    channel_receiver.set_latency_recording(!channel_options.report_path.empty());
 
     auto program_start_time = chrono::steady_clock::now();
-    bool termination_signal_received = false; // Флаг завершения работы
-    bool empty_file_detected = false; // Флаг пустого файла
-
     cout << "Consumer запущен. Ожидание данных..." << endl;
 
-    // Главный цикл обработки данных
-    while (!termination_signal_received) {
-        // Ожидаем новых данных от producer
-        while (true) {
-            acquire_shared_memory_lock(shared_memory_region);
-            if (shared_memory_region->message_available == 1) break;
-            release_shared_memory_lock(shared_memory_region);
-            this_thread::sleep_for(chrono::milliseconds(1));
-        }
-
-        // Читаем данные из shared memory
-        uint32_t current_block_id = shared_memory_region->data_block_identifier;
-        uint8_t is_last_fragment = shared_memory_region->is_final_fragment;
-        uint32_t payload_size = shared_memory_region->actual_payload_length;
-        
-        vector<uint8_t> received_payload(payload_size);
-        if (payload_size > 0) {
-            memcpy(received_payload.data(), shared_memory_region->data_payload, payload_size);
-        }
-
-        // Освобождаем shared memory для следующего сообщения
-        shared_memory_region->message_available = 0;
-        release_shared_memory_lock(shared_memory_region);
-
-        cout << "Получено: block_id=" << current_block_id << ", last_chunk=" << (int)is_last_fragment 
-             << ", размер данных=" << payload_size << " байт" << endl;
-
-        // Проверяем сигнал завершения
-        if (current_block_id == UINT32_MAX) {
-            termination_signal_received = true;
-            cout << "Получен сигнал завершения" << endl;
-            break;
-        }
-
-        // Проверяем маркер пустого файла
-        if (current_block_id == 0 && is_last_fragment == 1 && payload_size == 0) {
-            cout << "Получен маркер пустого файла" << endl;
-            empty_file_detected = true;
-            block_assembly_buffer[current_block_id] = {}; // Создаем пустой блок
-        } else {
-            // Добавляем фрагмент к соответствующему блоку
-            auto &assembly_buffer = block_assembly_buffer[current_block_id];
-            assembly_buffer.insert(assembly_buffer.end(), received_payload.begin(), received_payload.end());
-        }
-
-        // Если блок собран полностью
-        if (is_last_fragment) {
-            auto compressed_data = block_assembly_buffer[current_block_id];
-            cout << "Блок " << current_block_id << " собран, размер: " << compressed_data.size() << " байт" << endl;
-            
-            // Запускаем распаковку в отдельном потоке
-            if (compressed_data.empty()) {
-                // Для пустого блока создаем пустой результат
-                decompression_tasks[current_block_id] = async(launch::async, []() {
-                    return vector<uint8_t>{};
-                });
-            } else {
-                // Запускаем распаковку сжатых данных
-                decompression_tasks[current_block_id] = async(launch::async, [compressed_data]() {
-                    return inflate_compressed_data(compressed_data);
-                });
-            }
-            block_assembly_buffer.erase(current_block_id);
-        }
-
-        // Записываем готовые блоки в правильном порядке
-        while (true) {
-            auto task_iterator = decompression_tasks.find(next_expected_block_id);
-            if (task_iterator == decompression_tasks.end()) break;
-            
-            // Проверяем, завершилась ли распаковка
-            if (task_iterator->second.wait_for(chrono::milliseconds(0)) != future_status::ready) {
-                break;
-            }
-            
-            // Получаем распакованные данные
-            vector<uint8_t> decompressed_data = task_iterator->second.get();
-            
-            // Записываем в файл
-            if (!decompressed_data.empty() || empty_file_detected) {
-                size_t bytes_written = fwrite(decompressed_data.data(), 1, decompressed_data.size(), output_file_stream);
-                fflush(output_file_stream);
-                cout << "Блок " << next_expected_block_id << " записан в файл: " 
-                     << bytes_written << " байт" << endl;
-            } else {
-                cout << "Блок " << next_expected_block_id << " пропущен (пустой или ошибка распаковки)" << endl;
-            }
-            
-            // Переходим к следующему блоку
-            decompression_tasks.erase(task_iterator);
-            ++next_expected_block_id;
-        }
-    }
-
-    // Обрабатываем оставшиеся блоки
-    cout << "Обработка оставшихся блоков: " << decompression_tasks.size() << endl;
-    
-    for (auto &decompression_task : decompression_tasks) {
-        vector<uint8_t> decompressed_data = decompression_task.second.get();
-        if (!decompressed_data.empty()) {
-            size_t bytes_written = fwrite(decompressed_data.data(), 1, decompressed_data.size(), output_file_stream);
-            cout << "Поздний блок " << decompression_task.first << " записан: " << bytes_written << " байт" << endl;
-        } else {
-            cout << "Поздний блок " << decompression_task.first << " пропущен (пустой)" << endl;
-        }
+    // Один файл - одно сообщение канала
+    ReceiveStatus receive_status = channel_receiver.recv_file(output_file);
+    bool transfer_succeeded = receive_status == ReceiveStatus::Message;
+    if (!transfer_succeeded) {
+        cerr << "Ошибка: " << channel_receiver.error_message() << endl;
+        // Отклонённый или недописанный архив ничего не содержит: не оставляем его на диске
+        if (channel_options.archive_format != ArchiveFormat::None) unlink(output_filename.c_str());
     }
 
     // Выводим статистику
     auto program_end_time = chrono::steady_clock::now();
     double total_execution_time = chrono::duration<double>(program_end_time - program_start_time).count();
-    
-    cout << "Работа consumer завершена успешно" << endl;
+    const ReceiverStatistics& statistics = channel_receiver.statistics();
+
+    cout << "Работа consumer завершена " << (transfer_succeeded ? "успешно" : "с ошибками") << endl;
     cout << "Общее время: " << total_execution_time << " секунд" << endl;
-    cout << "Обработано блоков: " << next_expected_block_id << endl;
-    
-    // Определяем размер выходного файла
-    fseek(output_file_stream, 0, SEEK_END);
-    long final_output_size = ftell(output_file_stream);
-    cout << "Размер выходного файла: " << final_output_size << " байт" << endl;
+    cout << "Обработано блоков: " << statistics.blocks << endl;
+    if (statistics.referenced_blocks > 0) cout << "Блоков принято ссылками: " << statistics.referenced_blocks << endl;
+    cout << "Размер выходного файла: " << output_file.file_size() << " байт" << endl;
+
+    if (!channel_options.report_path.empty()) {
+        RunReport run_report;
+        run_report.add("role", "consumer");
+        run_report.add("success", transfer_succeeded ? 1 : 0);
+        run_report.add("seconds", total_execution_time);
+        run_report.add("output_bytes", output_file.file_size());
+        run_report.add("blocks", statistics.blocks);
+        run_report.add("referenced_blocks", statistics.referenced_blocks);
+        channel_receiver.fragment_latency().add_to_report(run_report);
+        channel_receiver.cpu_placement().add_to_report(run_report);
+        run_report.add_resource_usage();
+        run_report.write(channel_options.report_path);
+    }
 
     // Освобождаем ресурсы
-    fclose(output_file_stream);
-    munmap(reinterpret_cast<void*>(shared_memory_region), SHARED_MEMORY_SIZE);
-    shm_unlink(SHARED_MEMORY_SEGMENT_NAME);
-    
+    channel_receiver.close();
     cout << "Ресурсы освобождены" << endl;
-    return 0;
-}
\ No newline at end of file
+    return transfer_succeeded ? 0 : 1;
+}
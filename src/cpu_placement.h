@@ -0,0 +1,290 @@
+// Размещение потоков и памяти канала по процессорам и узлам NUMA
+//
+// Поток передачи (отправитель producer, приёмник consumer) и потоки сжатия/распаковки
+// по умолчанию переходят между ядрами свободно, а страницы сегмента оказываются на узле,
+// который первым их коснулся. На многосокетных машинах это даёт перебрасывание строк
+// кэша с флагами и индексами кольца между сокетами и копирование через удалённую память.
+//
+// --pin-transfer=CPUS привязывает поток, открывающий канал, к заданным процессорам
+// (например, producer и consumer - к двум ядрам с общим L2 или L3, см. --topology).
+// --pin-workers=CPUS привязывает пул сжатия/распаковки к своему набору процессоров.
+// --numa=local|N выбирает узел памяти: local - узел процессора потока передачи. Сегменты
+// канала получают политику MPOL_PREFERRED через mbind до первого касания страниц, буферы
+// блоков - через политику потоков (set_mempolicy наследуют потоки пулов), а потоки без явной
+// привязки ограничиваются процессорами узла, и выделенная ими память остаётся локальной.
+// Системные вызовы NUMA вызываются напрямую: libnuma не нужна.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "run_report.h"
+
+constexpr int NUMA_NODE_NONE = -1;
+constexpr size_t NUMA_NODE_MASK_BITS = 1024;
+constexpr int NUMA_POLICY_PREFERRED = 1;           // MPOL_PREFERRED
+constexpr unsigned long NUMA_GET_NODE_OF_ADDRESS = 3; // MPOL_F_NODE | MPOL_F_ADDR
+constexpr const char* CPU_SYSFS_DIRECTORY = "/sys/devices/system/cpu";
+constexpr const char* NODE_SYSFS_DIRECTORY = "/sys/devices/system/node";
+
+enum class NumaMode {
+    Off,   // Память там, где её коснулись первой
+    Local, // Узел процессора потока передачи
+    Node   // Заданный узел
+};
+
+// Параметры размещения из командной строки
+struct CpuPlacementOptions {
+    std::vector<int> transfer_cpus; // --pin-transfer: процессоры потока передачи
+    std::vector<int> worker_cpus;   // --pin-workers: процессоры потоков сжатия/распаковки
+    NumaMode numa_mode = NumaMode::Off;
+    int numa_node = NUMA_NODE_NONE; // --numa=N
+    bool print_topology = false;    // --topology: напечатать топологию и выбранное размещение
+};
+
+// Список процессоров вида "0-3,8,10-11"
+static inline bool parse_cpu_list(const std::string& text, std::vector<int>& cpus) {
+    cpus.clear();
+    std::stringstream list_stream(text);
+    std::string list_item;
+    while (std::getline(list_stream, list_item, ',')) {
+        if (list_item.empty()) continue;
+        size_t dash_position = list_item.find('-');
+        char* parse_end = nullptr;
+        long range_first = strtol(list_item.c_str(), &parse_end, 10);
+        long range_last = range_first;
+        if (parse_end == list_item.c_str()) return false;
+        if (dash_position != std::string::npos) {
+            const char* last_text = list_item.c_str() + dash_position + 1;
+            range_last = strtol(last_text, &parse_end, 10);
+            if (parse_end == last_text) return false;
+        }
+        if (*parse_end != '\0' || range_first < 0 || range_last < range_first || range_last >= CPU_SETSIZE) return false;
+        for (long cpu = range_first; cpu <= range_last; ++cpu) cpus.push_back(static_cast<int>(cpu));
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return !cpus.empty();
+}
+
+// Обратное преобразование со свёрткой диапазонов
+static inline std::string format_cpu_list(const std::vector<int>& cpus) {
+    std::string text;
+    for (size_t range_begin = 0; range_begin < cpus.size();) {
+        size_t range_end = range_begin;
+        while (range_end + 1 < cpus.size() && cpus[range_end + 1] == cpus[range_end] + 1) ++range_end;
+        if (!text.empty()) text += ",";
+        text += std::to_string(cpus[range_begin]);
+        if (range_end > range_begin) text += "-" + std::to_string(cpus[range_end]);
+        range_begin = range_end + 1;
+    }
+    return text;
+}
+
+static inline std::vector<int> read_cpu_list_file(const std::string& path) {
+    std::ifstream list_file(path);
+    std::string list_text;
+    std::vector<int> cpus;
+    if (std::getline(list_file, list_text)) parse_cpu_list(list_text, cpus);
+    return cpus;
+}
+
+// Топология машины по sysfs: узлы NUMA и группы процессоров с общим кэшем L2 и L3
+struct CpuTopology {
+    std::vector<int> online_cpus;
+    std::map<int, std::vector<int>> node_cpus;
+    std::vector<std::vector<int>> l2_groups;
+    std::vector<std::vector<int>> l3_groups;
+
+    static CpuTopology read() {
+        CpuTopology topology;
+        topology.online_cpus = read_cpu_list_file(std::string(CPU_SYSFS_DIRECTORY) + "/online");
+        if (topology.online_cpus.empty()) {
+            for (int cpu = 0; cpu < static_cast<int>(std::max(1u, std::thread::hardware_concurrency())); ++cpu) {
+                topology.online_cpus.push_back(cpu);
+            }
+        }
+        for (int node : read_cpu_list_file(std::string(NODE_SYSFS_DIRECTORY) + "/online")) {
+            topology.node_cpus[node] = read_cpu_list_file(std::string(NODE_SYSFS_DIRECTORY) + "/node" + std::to_string(node) + "/cpulist");
+        }
+        // Без sysfs узлов (ядро без NUMA) вся машина - узел 0
+        if (topology.node_cpus.empty()) topology.node_cpus[0] = topology.online_cpus;
+
+        std::set<std::vector<int>> l2_sets, l3_sets;
+        for (int cpu : topology.online_cpus) {
+            std::string cache_directory = std::string(CPU_SYSFS_DIRECTORY) + "/cpu" + std::to_string(cpu) + "/cache";
+            for (int cache_index = 0;; ++cache_index) {
+                std::string index_directory = cache_directory + "/index" + std::to_string(cache_index);
+                std::ifstream level_file(index_directory + "/level");
+                int cache_level = 0;
+                if (!(level_file >> cache_level)) break;
+                std::ifstream type_file(index_directory + "/type");
+                std::string cache_type;
+                type_file >> cache_type;
+                if (cache_type == "Instruction") continue;
+                std::vector<int> shared_cpus = read_cpu_list_file(index_directory + "/shared_cpu_list");
+                if (cache_level == 2 && !shared_cpus.empty()) l2_sets.insert(shared_cpus);
+                if (cache_level == 3 && !shared_cpus.empty()) l3_sets.insert(shared_cpus);
+            }
+        }
+        topology.l2_groups.assign(l2_sets.begin(), l2_sets.end());
+        topology.l3_groups.assign(l3_sets.begin(), l3_sets.end());
+        return topology;
+    }
+
+    int node_of_cpu(int cpu) const {
+        for (const auto& [node, cpus] : node_cpus) {
+            if (std::binary_search(cpus.begin(), cpus.end(), cpu)) return node;
+        }
+        return NUMA_NODE_NONE;
+    }
+
+    bool cpu_online(int cpu) const { return std::binary_search(online_cpus.begin(), online_cpus.end(), cpu); }
+};
+
+// Привязывает вызывающий поток к процессорам; пустой список ничего не меняет
+static inline bool pin_current_thread(const std::vector<int>& cpus) {
+    if (cpus.empty()) return true;
+    cpu_set_t cpu_mask;
+    CPU_ZERO(&cpu_mask);
+    for (int cpu : cpus) CPU_SET(cpu, &cpu_mask);
+    return sched_setaffinity(0, sizeof(cpu_mask), &cpu_mask) == 0;
+}
+
+static inline std::vector<int> current_thread_cpus() {
+    cpu_set_t cpu_mask;
+    CPU_ZERO(&cpu_mask);
+    std::vector<int> cpus;
+    if (sched_getaffinity(0, sizeof(cpu_mask), &cpu_mask) != 0) return cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &cpu_mask)) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// Маска узлов для mbind и set_mempolicy: ядро читает maxnode - 1 бит
+struct NumaNodeMask {
+    unsigned long words[NUMA_NODE_MASK_BITS / (8 * sizeof(unsigned long))] = {};
+    explicit NumaNodeMask(int node) { words[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long))); }
+    static constexpr unsigned long max_node() { return NUMA_NODE_MASK_BITS + 1; }
+};
+
+// Узел для страниц сегментов, отображаемых этой единицей трансляции (см. map_shared_segment)
+static inline int& segment_numa_node() {
+    static int numa_node = NUMA_NODE_NONE;
+    return numa_node;
+}
+
+// Ещё не выделенные страницы диапазона предпочтительно размещаются на узле
+static inline bool bind_memory_to_node(void* address, size_t length, int node) {
+    if (node < 0 || static_cast<size_t>(node) >= NUMA_NODE_MASK_BITS) return false;
+    NumaNodeMask node_mask(node);
+    return syscall(SYS_mbind, address, length, NUMA_POLICY_PREFERRED, node_mask.words, NumaNodeMask::max_node(), 0) == 0;
+}
+
+// Политика памяти вызывающего потока; потоки, созданные им позже, наследуют её
+static inline bool prefer_numa_node(int node) {
+    if (node < 0 || static_cast<size_t>(node) >= NUMA_NODE_MASK_BITS) return false;
+    NumaNodeMask node_mask(node);
+    return syscall(SYS_set_mempolicy, NUMA_POLICY_PREFERRED, node_mask.words, NumaNodeMask::max_node()) == 0;
+}
+
+// Узел, на котором лежит (уже выделенная) страница address
+static inline int memory_node_of(const void* address) {
+    int node = NUMA_NODE_NONE;
+    if (syscall(SYS_get_mempolicy, &node, nullptr, 0, address, NUMA_GET_NODE_OF_ADDRESS) != 0) return NUMA_NODE_NONE;
+    return node;
+}
+
+// Применённое размещение
+struct CpuPlacement {
+    std::vector<int> transfer_cpus;    // Маска потока передачи (пусто - не менялась)
+    std::vector<int> worker_cpus;      // Маска потоков пула (пусто - наследуют маску потока передачи)
+    int numa_node = NUMA_NODE_NONE;    // Узел памяти (NUMA_NODE_NONE - первое касание)
+    int segment_node = NUMA_NODE_NONE; // Где фактически лежит первая страница сегмента канала
+
+    void add_to_report(RunReport& report) const {
+        report.add("transfer_cpus", transfer_cpus.empty() ? std::string("any") : format_cpu_list(transfer_cpus));
+        report.add("worker_cpus", worker_cpus.empty() ? std::string("any") : format_cpu_list(worker_cpus));
+        report.add("numa_node", numa_node);
+        report.add("segment_numa_node", segment_node);
+    }
+};
+
+// Применяет размещение к вызывающему потоку (потоку передачи) и возвращает маску для пулов
+static inline bool apply_cpu_placement(const CpuPlacementOptions& options, CpuPlacement& placement,
+                                       std::string& error_message) {
+    placement = CpuPlacement{};
+    if (options.transfer_cpus.empty() && options.worker_cpus.empty() && options.numa_mode == NumaMode::Off) return true;
+    CpuTopology topology = CpuTopology::read();
+    for (const std::vector<int>* cpus : {&options.transfer_cpus, &options.worker_cpus}) {
+        for (int cpu : *cpus) {
+            if (!topology.cpu_online(cpu)) {
+                error_message = "процессор " + std::to_string(cpu) + " не в сети (доступны " +
+                                format_cpu_list(topology.online_cpus) + ")";
+                return false;
+            }
+        }
+    }
+
+    if (options.numa_mode == NumaMode::Node) {
+        if (!topology.node_cpus.count(options.numa_node)) {
+            error_message = "узла NUMA " + std::to_string(options.numa_node) + " нет";
+            return false;
+        }
+        placement.numa_node = options.numa_node;
+    } else if (options.numa_mode == NumaMode::Local) {
+        int transfer_cpu = options.transfer_cpus.empty() ? sched_getcpu() : options.transfer_cpus.front();
+        placement.numa_node = topology.node_of_cpu(transfer_cpu);
+    }
+    // Потоки без явной привязки остаются на процессорах выбранного узла
+    std::vector<int> node_cpus = placement.numa_node != NUMA_NODE_NONE ? topology.node_cpus[placement.numa_node] : std::vector<int>();
+    std::vector<int> original_cpus = current_thread_cpus();
+    placement.transfer_cpus = options.transfer_cpus.empty() ? node_cpus : options.transfer_cpus;
+    placement.worker_cpus = !options.worker_cpus.empty() ? options.worker_cpus
+                          : !node_cpus.empty()           ? node_cpus
+                          : !placement.transfer_cpus.empty() ? original_cpus // Пул не должен унаследовать маску передачи
+                                                             : std::vector<int>();
+    if (!pin_current_thread(placement.transfer_cpus)) {
+        error_message = "привязка потока передачи к " + format_cpu_list(placement.transfer_cpus) + ": " + strerror(errno);
+        return false;
+    }
+    if (placement.numa_node != NUMA_NODE_NONE && !prefer_numa_node(placement.numa_node)) {
+        error_message = "политика памяти узла " + std::to_string(placement.numa_node) + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+static inline std::string format_cpu_groups(const std::vector<std::vector<int>>& groups) {
+    constexpr size_t PRINTED_GROUP_LIMIT = 16;
+    std::string text;
+    for (size_t group_index = 0; group_index < groups.size() && group_index < PRINTED_GROUP_LIMIT; ++group_index) {
+        text += (group_index ? "; " : "") + format_cpu_list(groups[group_index]);
+    }
+    if (groups.size() > PRINTED_GROUP_LIMIT) text += "; ... (всего " + std::to_string(groups.size()) + ")";
+    return text.empty() ? "нет данных" : text;
+}
+
+// Топология и размещение в виде, пригодном для сравнения запусков
+static inline void print_topology_report(std::ostream& output, const CpuPlacement& placement) {
+    CpuTopology topology = CpuTopology::read();
+    output << "Топология: процессоров в сети " << topology.online_cpus.size() << " (" << format_cpu_list(topology.online_cpus)
+           << "), узлов NUMA " << topology.node_cpus.size() << std::endl;
+    for (const auto& [node, cpus] : topology.node_cpus) {
+        output << "  узел " << node << ": процессоры " << format_cpu_list(cpus) << std::endl;
+    }
+    output << "  общий L2: " << format_cpu_groups(topology.l2_groups) << std::endl;
+    output << "  общий L3: " << format_cpu_groups(topology.l3_groups) << std::endl;
+    auto describe_cpus = [](const std::vector<int>& cpus) { return cpus.empty() ? std::string("любые") : format_cpu_list(cpus); };
+    output << "Размещение: поток передачи - " << describe_cpus(placement.transfer_cpus)
+           << " (сейчас на " << sched_getcpu() << "), потоки пула - " << describe_cpus(placement.worker_cpus)
+           << ", память - " << (placement.numa_node == NUMA_NODE_NONE ? std::string("первое касание")
+                                                                      : "узел " + std::to_string(placement.numa_node))
+           << ", сегмент канала - "
+           << (placement.segment_node == NUMA_NODE_NONE ? std::string("неизвестно") : "узел " + std::to_string(placement.segment_node))
+           << std::endl;
+}
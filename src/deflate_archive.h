@@ -0,0 +1,92 @@
+// Архив принятого потока deflate: gzip- или zlib-файл без распаковки
+//
+// Блоки кодека deflate (см. DeflateCompressor) заканчиваются Z_SYNC_FLUSH на границе байта,
+// поэтому данные блоков цепочки, записанные подряд, образуют один поток deflate. Consumer
+// с --archive дописывает к нему заголовок и концевик контейнера: последний пустой блок deflate
+// и контрольную сумму всего потока. Её не нужно считать заново: CRC32 и Adler-32 каждого блока
+// посчитаны потоками сжатия producer и объединяются через crc32_combine и adler32_combine.
+// Блок, переданный без сжатия (store), записывается несжатыми блоками deflate.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <zlib.h>
+
+enum class ArchiveFormat {
+    None, // Поток распаковывается в выходной файл
+    Gzip, // RFC 1952: заголовок, deflate, CRC32 и длина
+    Zlib  // RFC 1950: заголовок, deflate, Adler-32
+};
+
+static inline bool parse_archive_format(const std::string& text, ArchiveFormat& format) {
+    if (text == "gzip") format = ArchiveFormat::Gzip;
+    else if (text == "zlib") format = ArchiveFormat::Zlib;
+    else return false;
+    return true;
+}
+
+// Несжатые блоки deflate (BTYPE=00) по 65535 байт; поток перед ними выровнен на байт
+static inline void encode_stored_deflate_blocks(const uint8_t* data, size_t length, std::vector<uint8_t>& output) {
+    constexpr size_t MAX_STORED_BLOCK_LENGTH = 65535;
+    do {
+        uint16_t block_length = static_cast<uint16_t>(std::min(length, MAX_STORED_BLOCK_LENGTH));
+        uint16_t complement_length = static_cast<uint16_t>(~block_length);
+        uint8_t block_header[5] = {0x00, static_cast<uint8_t>(block_length), static_cast<uint8_t>(block_length >> 8),
+                                   static_cast<uint8_t>(complement_length), static_cast<uint8_t>(complement_length >> 8)};
+        output.insert(output.end(), block_header, block_header + sizeof(block_header));
+        output.insert(output.end(), data, data + block_length);
+        data += block_length;
+        length -= block_length;
+    } while (length > 0);
+}
+
+// Заголовок, контрольная сумма и концевик контейнера
+class DeflateArchive {
+public:
+    explicit DeflateArchive(ArchiveFormat format = ArchiveFormat::Gzip) : archive_format(format) {}
+
+    void reset() {
+        stream_crc32 = 0;
+        stream_adler32 = 1;
+        stream_length = 0;
+    }
+
+    void append_header(std::vector<uint8_t>& output) const {
+        if (archive_format == ArchiveFormat::Gzip) {
+            // ID1 ID2, CM=deflate, без флагов и времени изменения, XFL=0, OS=Unix
+            static const uint8_t gzip_header[10] = {0x1F, 0x8B, 0x08, 0x00, 0, 0, 0, 0, 0x00, 0x03};
+            output.insert(output.end(), gzip_header, gzip_header + sizeof(gzip_header));
+        } else {
+            // CMF: deflate с окном 32 КБ, FLG: без словаря, проверка (CMF * 256 + FLG) % 31 == 0
+            static const uint8_t zlib_header[2] = {0x78, 0x01};
+            output.insert(output.end(), zlib_header, zlib_header + sizeof(zlib_header));
+        }
+    }
+
+    // Учитывает контрольные суммы очередного блока потока
+    void add_block(uint32_t block_crc32, uint32_t block_adler32, size_t block_length) {
+        stream_crc32 = static_cast<uint32_t>(crc32_combine(stream_crc32, block_crc32, static_cast<z_off_t>(block_length)));
+        stream_adler32 = static_cast<uint32_t>(adler32_combine(stream_adler32, block_adler32, static_cast<z_off_t>(block_length)));
+        stream_length += block_length;
+    }
+
+    // Последний (пустой, фиксированный Хаффман) блок deflate и концевик контейнера
+    void append_trailer(std::vector<uint8_t>& output) const {
+        output.push_back(0x03);
+        output.push_back(0x00);
+        if (archive_format == ArchiveFormat::Gzip) {
+            uint32_t trailer_words[2] = {stream_crc32, static_cast<uint32_t>(stream_length)};
+            for (uint32_t word : trailer_words) {
+                for (int shift = 0; shift < 32; shift += 8) output.push_back(static_cast<uint8_t>(word >> shift));
+            }
+        } else {
+            for (int shift = 24; shift >= 0; shift -= 8) output.push_back(static_cast<uint8_t>(stream_adler32 >> shift));
+        }
+    }
+
+private:
+    ArchiveFormat archive_format;
+    uint32_t stream_crc32 = 0;
+    uint32_t stream_adler32 = 1;
+    uint64_t stream_length = 0;
+};
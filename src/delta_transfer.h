@@ -0,0 +1,206 @@
+// Дельта-передача: producer отправляет только блоки, которых нет в старой копии у consumer
+//
+// Producer с --delta помечает передачу файла известного размера флагом TRANSFER_FLAG_DELTA
+// и после описания передачи ждёт сигнатуру по обратному каналу. Consumer хеширует блоки
+// уже лежащего на месте выходного файла (XXH64 и CRC32C каждого блока размера block_size)
+// и возвращает сигнатуру; если старой копии нет или приёмник пишет по порядку, сигнатура
+// пустая. Producer хеширует свои блоки в потоках сжатия и не отправляет совпавшие, а consumer
+// пишет пришедшие блоки поверх старой копии на их места и обрезает файл до нового размера.
+//
+// Возобновляемая передача (TRANSFER_FLAG_RESUMABLE) спрашивает по тому же обратному каналу:
+// consumer добавляет к сигнатуре битовую карту блоков, уже записанных прошлой попыткой
+// (см. transfer_checkpoint.h), и producer не читает, не сжимает и не отправляет их.
+//
+// Producer, которому нужен итог передачи (TRANSFER_END_FLAG_CONFIRM в конце передачи), ждёт
+// по обратному каналу сообщение TRANSFER_OUTCOME_BLOCK_ID: consumer отправляет его, когда
+// передача записана или отклонена (например, приёмник --archive не принимает её формат).
+//
+// Обратный канал - отдельный сегмент почтового ящика "<имя канала>_reverse" с той же
+// раскладкой SharedMemoryHeader, но писателем в нём выступает consumer. Обе стороны ждут
+// друг друга так же, как в основном канале: с проверкой процесса и меток активности другой
+// стороны (PeerWatch, --peer-timeout). Умерший или замолчавший процесс не оставит второго
+// ждать вечно.
+
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "block_cache.h"
+#include "block_frame.h"
+#include "channel_owner.h"
+#include "shm_mailbox.h"
+
+constexpr size_t REVERSE_SEGMENT_SIZE = 64 * 1024;              // Заголовок и фрагмент сигнатуры
+constexpr uint32_t DELTA_SIGNATURE_BLOCK_ID = UINT32_MAX - 3;   // Сообщение сигнатуры в обратном канале
+constexpr uint32_t TRANSFER_OUTCOME_BLOCK_ID = UINT32_MAX - 4;  // Итог передачи в обратном канале (TRANSFER_END_FLAG_CONFIRM)
+constexpr uint32_t DELTA_SIGNATURE_FLAG_AVAILABLE = 1u << 0;    // Старая копия есть, блоки захешированы
+constexpr uint32_t DELTA_SIGNATURE_FLAG_RECEIVED = 1u << 1;     // Есть карта блоков, записанных прошлой попыткой
+
+static inline std::string reverse_segment_name(const std::string& channel_segment) {
+    return channel_segment + "_reverse";
+}
+
+// Заголовок сигнатуры; за ним content_hashes[block_count], checksums[block_count]
+// и битовая карта записанных блоков (received_block_count бит, по байтам от младшего бита)
+struct DeltaSignatureHeader {
+    uint64_t existing_size;       // Размер старой копии у consumer
+    uint32_t block_size;          // Размер блока, которым она захеширована
+    uint32_t block_count;         // Захешировано блоков (покрывают [0, min(старый, новый размер)))
+    uint32_t signature_flags;     // DELTA_SIGNATURE_FLAG_*
+    uint32_t received_block_count; // Бит в карте записанных блоков (блоков передачи)
+};
+
+static inline size_t block_bitmap_bytes(uint64_t block_count) {
+    return static_cast<size_t>((block_count + 7) / 8);
+}
+
+// Сигнатура старой копии: блок N - байты [N * block_size, min((N + 1) * block_size, existing_size))
+struct DeltaSignature {
+    uint64_t existing_size = 0;
+    size_t block_size = 0;
+    bool available = false;
+    std::vector<uint64_t> content_hashes;
+    std::vector<uint32_t> checksums;
+    uint64_t received_block_count = 0;    // Бит в received_blocks (0 - карты нет)
+    std::vector<uint8_t> received_blocks; // Блоки, записанные прошлой попыткой передачи
+
+    bool block_received(uint64_t block_index) const {
+        return block_index < received_block_count && (received_blocks[block_index / 8] >> (block_index % 8)) & 1;
+    }
+
+    // Совпадает ли блок block_index нового файла со старой копией
+    bool block_unchanged(uint64_t block_index, const uint8_t* data, size_t length) const {
+        if (!available || block_index >= content_hashes.size()) return false;
+        uint64_t block_offset = block_index * block_size;
+        if (std::min<uint64_t>(block_size, existing_size - block_offset) != length) return false;
+        return content_hashes[block_index] == content_hash64(data, length) &&
+               checksums[block_index] == compute_crc32c(data, length);
+    }
+};
+
+static inline void encode_delta_signature(const DeltaSignature& signature, std::vector<uint8_t>& payload) {
+    DeltaSignatureHeader header{};
+    header.existing_size = signature.existing_size;
+    header.block_size = static_cast<uint32_t>(signature.block_size);
+    header.block_count = static_cast<uint32_t>(signature.content_hashes.size());
+    header.signature_flags = (signature.available ? DELTA_SIGNATURE_FLAG_AVAILABLE : 0) |
+                             (signature.received_block_count ? DELTA_SIGNATURE_FLAG_RECEIVED : 0);
+    header.received_block_count = static_cast<uint32_t>(signature.received_block_count);
+    size_t hashes_length = signature.content_hashes.size() * sizeof(uint64_t);
+    size_t checksums_length = signature.checksums.size() * sizeof(uint32_t);
+    size_t bitmap_length = block_bitmap_bytes(signature.received_block_count);
+    payload.resize(sizeof(header) + hashes_length + checksums_length + bitmap_length);
+    uint8_t* write_position = payload.data();
+    memcpy(write_position, &header, sizeof(header));
+    write_position += sizeof(header);
+    if (hashes_length) memcpy(write_position, signature.content_hashes.data(), hashes_length);
+    write_position += hashes_length;
+    if (checksums_length) memcpy(write_position, signature.checksums.data(), checksums_length);
+    write_position += checksums_length;
+    if (bitmap_length) memcpy(write_position, signature.received_blocks.data(), bitmap_length);
+}
+
+// Разбирает сигнатуру; block_size - размер блока передачи, с которым она должна совпадать
+static inline bool decode_delta_signature(const std::vector<uint8_t>& payload, size_t block_size,
+                                          DeltaSignature& signature, std::string& error_message) {
+    DeltaSignatureHeader header;
+    if (payload.size() < sizeof(header)) {
+        error_message = "сигнатура короче заголовка";
+        return false;
+    }
+    memcpy(&header, payload.data(), sizeof(header));
+    size_t block_count = header.block_count;
+    size_t hashes_end = sizeof(header) + block_count * (sizeof(uint64_t) + sizeof(uint32_t));
+    uint64_t received_block_count = (header.signature_flags & DELTA_SIGNATURE_FLAG_RECEIVED) ? header.received_block_count : 0;
+    if (payload.size() != hashes_end + block_bitmap_bytes(received_block_count)) {
+        error_message = "длина сигнатуры не совпадает с числом блоков";
+        return false;
+    }
+    signature = DeltaSignature{};
+    if (received_block_count) {
+        signature.received_block_count = received_block_count;
+        signature.received_blocks.assign(payload.begin() + hashes_end, payload.end());
+    }
+    if (!(header.signature_flags & DELTA_SIGNATURE_FLAG_AVAILABLE)) return true;
+    if (header.block_size != block_size || block_count == 0 ||
+        (block_count - 1) * uint64_t(block_size) >= header.existing_size) {
+        error_message = "сигнатура не соответствует размеру блока передачи";
+        return false;
+    }
+    signature.available = true;
+    signature.existing_size = header.existing_size;
+    signature.block_size = block_size;
+    signature.content_hashes.resize(block_count);
+    signature.checksums.resize(block_count);
+    memcpy(signature.content_hashes.data(), payload.data() + sizeof(header), block_count * sizeof(uint64_t));
+    memcpy(signature.checksums.data(), payload.data() + sizeof(header) + block_count * sizeof(uint64_t),
+           block_count * sizeof(uint32_t));
+    return true;
+}
+
+// Итог передачи: байт 1 - принята, 0 - отклонена; за ним текст ошибки consumer
+static inline void encode_transfer_outcome(bool transfer_succeeded, const std::string& error_message,
+                                           std::vector<uint8_t>& payload) {
+    payload.assign(1, transfer_succeeded ? 1 : 0);
+    if (!transfer_succeeded) payload.insert(payload.end(), error_message.begin(), error_message.end());
+}
+
+static inline bool decode_transfer_outcome(const std::vector<uint8_t>& payload, std::string& error_message) {
+    if (payload.empty()) {
+        error_message = "пустой итог передачи";
+        return false;
+    }
+    if (payload[0] == 1) return true;
+    error_message.assign(payload.begin() + 1, payload.end());
+    return false;
+}
+
+// Ждёт, пока флаг сообщения станет desired_value; false - peer_check сообщил, что другая сторона пропала.
+// Спит на futex интервалами, между которыми проверяет другую сторону.
+static inline bool reverse_wait_for_flag(SharedMemoryHeader* reverse_region, uint32_t desired_value, const PeerCheck* peer_check) {
+    static const WaitStrategy reverse_wait_strategy{WaitMode::Block, 0};
+    return mailbox_wait_for_flag(reverse_region, desired_value, reverse_wait_strategy, peer_check);
+}
+
+// Consumer: отправляет сообщение обратного канала фрагментами (каждый ждёт, пока producer заберёт
+// предыдущий); false - producer пропал
+static inline bool reverse_send_message(SharedMemoryHeader* reverse_region, uint32_t transfer_id, uint32_t block_id,
+                                        const std::vector<uint8_t>& payload, const PeerCheck* producer_check) {
+    size_t current_offset = 0;
+    uint32_t fragment_counter = 0;
+    do {
+        if (!reverse_wait_for_flag(reverse_region, 0, producer_check)) return false;
+        size_t fragment_size = std::min<size_t>(reverse_region->payload_capacity, payload.size() - current_offset);
+        reverse_region->transfer_identifier = transfer_id;
+        reverse_region->data_block_identifier = block_id;
+        reverse_region->fragment_sequence_number = fragment_counter++;
+        reverse_region->actual_payload_length = static_cast<uint32_t>(fragment_size);
+        reverse_region->is_final_fragment = current_offset + fragment_size >= payload.size() ? 1 : 0;
+        if (fragment_size > 0) memcpy(mailbox_payload(reverse_region), payload.data() + current_offset, fragment_size);
+        __atomic_store_n(mailbox_message_flag(reverse_region), 1, __ATOMIC_RELEASE);
+        mailbox_wake_peer(reverse_region);
+        current_offset += fragment_size;
+    } while (current_offset < payload.size());
+    return true;
+}
+
+// Producer: принимает сообщение обратного канала для передачи transfer_id; сообщения других
+// передач (оставшиеся от прежнего producer) пропускаются. false - consumer пропал.
+static inline bool reverse_receive_message(SharedMemoryHeader* reverse_region, uint32_t transfer_id, uint32_t block_id,
+                                           std::vector<uint8_t>& payload, const PeerCheck* consumer_check) {
+    payload.clear();
+    while (true) {
+        if (!reverse_wait_for_flag(reverse_region, 1, consumer_check)) return false;
+        bool own_message = reverse_region->transfer_identifier == transfer_id &&
+                           reverse_region->data_block_identifier == block_id;
+        bool is_final = reverse_region->is_final_fragment != 0;
+        if (own_message) {
+            if (reverse_region->fragment_sequence_number == 0) payload.clear();
+            size_t fragment_size = std::min(reverse_region->actual_payload_length, reverse_region->payload_capacity);
+            payload.insert(payload.end(), mailbox_payload(reverse_region), mailbox_payload(reverse_region) + fragment_size);
+        }
+        __atomic_store_n(mailbox_message_flag(reverse_region), 0, __ATOMIC_RELEASE);
+        mailbox_wake_peer(reverse_region);
+        if (own_message && is_final) return true;
+    }
+}
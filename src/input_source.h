@@ -0,0 +1,469 @@
+// Потоковый источник входных блоков для producer
+//
+// Файл не читается в память целиком. В режиме mmap блок - это окно в отображении файла,
+// которое потоки сжатия читают напрямую; после отправки страницы блока отдаются ядру,
+// поэтому резидентная память ограничена окном блоков в работе. Если отображение
+// невозможно (канал, stdin) или задан режим read, блоки читаются по одному в
+// собственные буферы, которые живут, пока блок не сжат и не отправлен.
+// С разбиением по содержимому (ChunkingMode::ContentDefined) длина блока переменная,
+// не больше block_size; в режиме read недочитанный хвост переносится в следующий блок.
+// Версия содержимого (устройство, inode, размер, время изменения) позволяет consumer понять,
+// что контрольная точка прерванной передачи относится к тому же неизменённому файлу.
+//
+// В режиме async (см. async_io.h) несколько следующих блоков обычного файла читаются заранее
+// через io_uring или потоки ввода-вывода, пока потоки сжатия работают с текущими. Буферы
+// берутся из пула и возвращаются в него, когда отправленный блок отпускается. С O_DIRECT
+// чтение идёт мимо кэша страниц; для этого размер блока должен быть кратен 4 КБ.
+// Разбиение по содержимому и неизвестный размер (канал, stdin) читаются в режиме read.
+//
+// Возобновляемая передача сообщает источнику блоки, уже записанные прошлой попыткой
+// (skip_blocks): в режимах read и async они не читаются с диска, а выдаются без данных.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "async_io.h"
+#include "chunking.h"
+
+enum class InputMode {
+    Mmap, // Отображение файла в память (с откатом на Read)
+    Read, // Последовательное чтение блоками
+    Async // Чтение нескольких блоков впереди через io_uring или потоки (с откатом на Read)
+};
+
+// Блок входных данных: указатель на данные и владелец буфера (режимы Read и Async)
+struct InputBlock {
+    uint64_t block_index = 0;
+    uint64_t file_offset = 0;
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    std::shared_ptr<const void> storage;
+    bool not_read = false; // Источник пропустил блок (см. skip_blocks): данных нет
+};
+
+// Буферы чтения впереди. Первые buffer_count выделены одним куском и могут быть
+// зарегистрированы в очереди io_uring; если блоки задержались в окне сжатия и их
+// не хватило, выделяются дополнительные. Отпущенный блок возвращает буфер в пул.
+class ReadBufferPool {
+public:
+    struct Buffer {
+        uint8_t* data = nullptr;
+        int registered_index = -1; // Номер в зарегистрированном наборе (-1 - дополнительный)
+    };
+
+    ReadBufferPool(size_t buffer_length, size_t buffer_count)
+        : buffer_capacity(align_up(buffer_length, DIRECT_IO_ALIGNMENT)),
+          fixed_buffers(allocate_aligned_buffer(buffer_capacity * buffer_count)) {
+        for (size_t buffer_index = buffer_count; buffer_index-- > 0;) {
+            free_buffers.push_back(Buffer{fixed_buffers.get() + buffer_index * buffer_capacity, static_cast<int>(buffer_index)});
+        }
+        fixed_count = buffer_count;
+    }
+
+    size_t capacity() const { return buffer_capacity; }
+
+    // Описание набора для AsyncFileIo::register_buffers
+    std::vector<iovec> fixed_buffer_list() const {
+        std::vector<iovec> buffer_list(fixed_count);
+        for (size_t buffer_index = 0; buffer_index < fixed_count; ++buffer_index) {
+            buffer_list[buffer_index].iov_base = fixed_buffers.get() + buffer_index * buffer_capacity;
+            buffer_list[buffer_index].iov_len = buffer_capacity;
+        }
+        return buffer_list;
+    }
+
+    Buffer acquire() {
+        std::lock_guard<std::mutex> pool_guard(pool_mutex);
+        if (free_buffers.empty()) {
+            extra_buffers.push_back(allocate_aligned_buffer(buffer_capacity));
+            return Buffer{extra_buffers.back().get(), -1};
+        }
+        Buffer buffer = free_buffers.back();
+        free_buffers.pop_back();
+        return buffer;
+    }
+
+    // Потокобезопасно: блок может отпустить любой поток
+    void release(const Buffer& buffer) {
+        std::lock_guard<std::mutex> pool_guard(pool_mutex);
+        free_buffers.push_back(buffer);
+    }
+
+private:
+    size_t buffer_capacity;
+    size_t fixed_count = 0;
+    AlignedBuffer fixed_buffers;
+    std::vector<AlignedBuffer> extra_buffers;
+    std::mutex pool_mutex;
+    std::vector<Buffer> free_buffers;
+};
+
+class BlockInputSource {
+public:
+    BlockInputSource() = default;
+    BlockInputSource(const BlockInputSource&) = delete;
+    BlockInputSource& operator=(const BlockInputSource&) = delete;
+
+    ~BlockInputSource() {
+        // Ядро или потоки ввода-вывода не должны писать в буферы после их освобождения
+        while (reads_in_flight > 0) {
+            read_completions.clear();
+            size_t reaped_count = async_io->reap(read_completions, reads_in_flight);
+            if (reaped_count == 0) break;
+            reads_in_flight -= reaped_count;
+        }
+        async_io.reset();
+        if (mapped_data) munmap(mapped_data, mapped_length);
+        if (direct_descriptor >= 0) close(direct_descriptor);
+        if (file_descriptor > STDIN_FILENO) close(file_descriptor);
+    }
+
+    // Открывает файл ("-" - стандартный ввод); при ошибке печатает сообщение
+    bool open(const std::string& path, InputMode input_mode, size_t block_size,
+              ChunkingMode chunking = ChunkingMode::Fixed, const AsyncIoOptions& async_options = AsyncIoOptions()) {
+        uncompressed_block_size = block_size;
+        chunking_mode = chunking;
+        content_chunker = ContentChunker(block_size);
+        file_descriptor = path == "-" ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file_descriptor < 0) {
+            std::cerr << "Ошибка: Не удалось открыть файл '" << path << "': " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        struct stat file_status;
+        if (fstat(file_descriptor, &file_status) == 0 && S_ISREG(file_status.st_mode)) {
+            known_total_size = true;
+            total_size = static_cast<uint64_t>(file_status.st_size);
+            file_version = file_content_version(file_status);
+            posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+
+        if (input_mode == InputMode::Mmap && known_total_size && total_size > 0) {
+            void* mapping = mmap(nullptr, total_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+            if (mapping != MAP_FAILED) {
+                mapped_data = static_cast<uint8_t*>(mapping);
+                mapped_length = total_size;
+                madvise(mapped_data, mapped_length, MADV_SEQUENTIAL);
+            }
+        }
+
+        if (input_mode == InputMode::Async) {
+            if (!known_total_size || chunking == ChunkingMode::ContentDefined) {
+                std::cerr << "Асинхронное чтение только для обычного файла с --chunking=fixed, чтение через read"
+                          << std::endl;
+                return true;
+            }
+            std::string backend_description;
+            async_io = AsyncFileIo::create(async_options.backend, async_options.queue_depth, backend_description);
+            if (!async_io) {
+                std::cerr << "Ошибка: " << backend_description << std::endl;
+                return false;
+            }
+            read_ahead_depth = async_options.queue_depth;
+            read_method_description = "асинхронное (" + backend_description + ", " + std::to_string(read_ahead_depth) +
+                                      " блоков впереди";
+            if (async_options.direct_io) {
+                direct_descriptor = ::open(path.c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+                if (direct_descriptor < 0) {
+                    std::cerr << "Предупреждение: O_DIRECT для '" << path << "': " << strerror(errno)
+                              << ", чтение через кэш страниц" << std::endl;
+                } else {
+                    read_method_description += ", O_DIRECT";
+                }
+            }
+            read_method_description += ")";
+        }
+        return true;
+    }
+
+    bool is_memory_mapped() const { return mapped_data != nullptr; }
+    bool is_async() const { return async_io != nullptr; }
+
+    // Как читается файл: для сообщения producer
+    std::string read_method() const {
+        if (mapped_data) return "mmap";
+        return async_io ? read_method_description : "последовательное";
+    }
+
+    bool size_known() const { return known_total_size; }
+    uint64_t file_size() const { return total_size; }
+    uint64_t content_version() const { return file_version; } // 0 - не обычный файл, версии нет
+    size_t block_size() const { return uncompressed_block_size; }
+
+    ChunkingMode chunking() const { return chunking_mode; }
+
+    // Меняет размер блока; допустимо только до первого next_block
+    void set_block_size(size_t block_size) {
+        uncompressed_block_size = block_size;
+        content_chunker = ContentChunker(block_size);
+    }
+    bool failed() const { return read_failed; }
+
+    // Блоки, которые не нужно читать (пустая функция - читать все). Учитывается только для
+    // обычного файла с фиксированными блоками; отображению чтение не нужно и так
+    void skip_blocks(std::function<bool(uint64_t)> block_skipped) {
+        skipped_block = known_total_size && chunking_mode == ChunkingMode::Fixed ? std::move(block_skipped) : nullptr;
+    }
+
+    // Выдаёт следующий блок; false - конец данных или ошибка чтения (см. failed)
+    bool next_block(InputBlock& block) {
+        if (mapped_data) {
+            if (next_offset >= mapped_length) return false;
+            block.block_index = next_block_index++;
+            block.file_offset = next_offset;
+            block.data = mapped_data + next_offset;
+            block.length = static_cast<size_t>(std::min<uint64_t>(uncompressed_block_size, mapped_length - next_offset));
+            if (chunking_mode == ChunkingMode::ContentDefined) {
+                block.length = content_chunker.next_boundary(block.data, static_cast<size_t>(mapped_length - next_offset), true);
+            }
+            block.storage.reset();
+            next_offset += block.length;
+            return true;
+        }
+        if (async_io) return next_async_block(block);
+
+        if (skipped_block && next_offset < total_size && skipped_block(next_block_index)) {
+            size_t block_length = static_cast<size_t>(std::min<uint64_t>(uncompressed_block_size, total_size - next_offset));
+            if (lseek(file_descriptor, static_cast<off_t>(block_length), SEEK_CUR) >= 0) {
+                fill_skipped_block(block, next_block_index++, next_offset, block_length);
+                next_offset += block_length;
+                return true;
+            }
+        }
+
+        auto buffer = std::make_shared<std::vector<uint8_t>>(uncompressed_block_size);
+        size_t filled = carried_bytes.size();
+        std::copy(carried_bytes.begin(), carried_bytes.end(), buffer->begin());
+        carried_bytes.clear();
+        while (filled < uncompressed_block_size) {
+            ssize_t bytes_read = read(file_descriptor, buffer->data() + filled, uncompressed_block_size - filled);
+            if (bytes_read < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "Ошибка чтения файла: " << strerror(errno) << std::endl;
+                read_failed = true;
+                return false;
+            }
+            if (bytes_read == 0) break;
+            filled += static_cast<size_t>(bytes_read);
+        }
+        if (filled == 0) return false;
+
+        if (chunking_mode == ChunkingMode::ContentDefined) {
+            // Буфер полон или файл кончился: граница найдётся в любом случае
+            size_t block_length = content_chunker.next_boundary(buffer->data(), filled, true);
+            carried_bytes.assign(buffer->begin() + block_length, buffer->begin() + filled);
+            filled = block_length;
+        }
+        buffer->resize(filled);
+        block.block_index = next_block_index++;
+        block.file_offset = next_offset;
+        block.data = buffer->data();
+        block.length = filled;
+        block.storage = std::move(buffer);
+        next_offset += filled;
+        return true;
+    }
+
+    // Сообщает, что блок отправлен: страницы отображения больше не нужны в памяти процесса
+    void release_block(InputBlock& block) {
+        if (mapped_data && block.length > 0) {
+            static const uint64_t page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+            uint64_t range_begin = (block.file_offset + page_size - 1) / page_size * page_size;
+            uint64_t range_end = (block.file_offset + block.length) / page_size * page_size;
+            if (block.file_offset + block.length == mapped_length) range_end = mapped_length;
+            if (range_end > range_begin) {
+                madvise(mapped_data + range_begin, range_end - range_begin, MADV_DONTNEED);
+            }
+        }
+        block.storage.reset();
+        block.data = nullptr;
+    }
+
+private:
+    // Блок, читаемый впереди; tag запроса - номер блока
+    struct ReadAheadBlock {
+        uint64_t file_offset = 0;
+        size_t length = 0;
+        size_t filled = 0;
+        ReadBufferPool::Buffer buffer;
+        bool complete = false;
+        bool not_read = false; // Пропущен: чтение не ставилось, буфера нет
+        int error_code = 0;
+    };
+
+    static void fill_skipped_block(InputBlock& block, uint64_t block_index, uint64_t file_offset, size_t length) {
+        block.block_index = block_index;
+        block.file_offset = file_offset;
+        block.data = nullptr;
+        block.length = length;
+        block.storage.reset();
+        block.not_read = true;
+    }
+
+    bool next_async_block(InputBlock& block) {
+        if (!read_buffer_pool) start_async_reads();
+        fill_read_ahead();
+        if (read_ahead_blocks.empty()) return false;
+        while (!read_ahead_blocks.front().complete) {
+            if (!wait_read_completions()) {
+                std::cerr << "Ошибка асинхронного чтения: очередь ввода-вывода не отвечает" << std::endl;
+                read_failed = true;
+                return false;
+            }
+        }
+        ReadAheadBlock front_block = read_ahead_blocks.front();
+        read_ahead_blocks.pop_front();
+        uint64_t block_index = next_block_index++;
+        if (front_block.not_read) {
+            fill_skipped_block(block, block_index, front_block.file_offset, front_block.length);
+            next_offset = front_block.file_offset + front_block.length;
+            fill_read_ahead();
+            return true;
+        }
+        std::shared_ptr<ReadBufferPool> buffer_pool = read_buffer_pool;
+        ReadBufferPool::Buffer buffer = front_block.buffer;
+        block.storage = std::shared_ptr<const void>(buffer.data, [buffer_pool, buffer](const void*) { buffer_pool->release(buffer); });
+        if (front_block.error_code != 0) {
+            std::cerr << "Ошибка чтения файла: "
+                      << (front_block.error_code > 0 ? strerror(front_block.error_code) : "файл укоротился во время чтения")
+                      << std::endl;
+            read_failed = true;
+            block.storage.reset();
+            return false;
+        }
+        block.block_index = block_index;
+        block.file_offset = front_block.file_offset;
+        block.data = buffer.data;
+        block.length = front_block.length;
+        next_offset = front_block.file_offset + front_block.length;
+        // Освободившееся место в очереди сразу занимает следующее чтение
+        fill_read_ahead();
+        return true;
+    }
+
+    // Пул буферов по размеру блока, известному только к первому блоку (см. set_block_size)
+    void start_async_reads() {
+        if (direct_descriptor >= 0 && uncompressed_block_size % DIRECT_IO_ALIGNMENT != 0) {
+            std::cerr << "Предупреждение: размер блока не кратен " << DIRECT_IO_ALIGNMENT
+                      << " байт, O_DIRECT не используется" << std::endl;
+            close(direct_descriptor);
+            direct_descriptor = -1;
+        }
+        read_buffer_pool = std::make_shared<ReadBufferPool>(uncompressed_block_size, 2 * read_ahead_depth);
+        // Регистрация может упереться в RLIMIT_MEMLOCK: тогда буферы передаются как обычные
+        buffers_registered = async_io->register_buffers(read_buffer_pool->fixed_buffer_list());
+        next_read_offset = next_offset;
+        next_read_block_index = next_block_index;
+    }
+
+    void fill_read_ahead() {
+        while (read_ahead_blocks.size() < read_ahead_depth && next_read_offset < total_size) {
+            ReadAheadBlock read_block;
+            read_block.file_offset = next_read_offset;
+            read_block.length = static_cast<size_t>(std::min<uint64_t>(uncompressed_block_size, total_size - next_read_offset));
+            next_read_offset += read_block.length;
+            if (skipped_block && skipped_block(next_read_block_index)) {
+                // Место в очереди занимается, чтобы номер блока оставался индексом в ней
+                read_block.complete = true;
+                read_block.not_read = true;
+                read_ahead_blocks.push_back(read_block);
+                ++next_read_block_index;
+                continue;
+            }
+            read_block.buffer = read_buffer_pool->acquire();
+            read_ahead_blocks.push_back(read_block);
+            queue_read(read_ahead_blocks.back(), next_read_block_index++);
+        }
+        async_io->submit();
+    }
+
+    // Запрос на недочитанную часть блока. O_DIRECT - только при выровненном смещении;
+    // длина округляется вверх, и у хвоста файла чтение просто вернёт меньше
+    void queue_read(ReadAheadBlock& read_block, uint64_t block_index) {
+        uint64_t read_offset = read_block.file_offset + read_block.filled;
+        size_t read_length = read_block.length - read_block.filled;
+        bool direct = direct_descriptor >= 0 && read_offset % DIRECT_IO_ALIGNMENT == 0;
+        if (direct) read_length = align_up(read_length, DIRECT_IO_ALIGNMENT);
+        AsyncIoRequest request;
+        request.file_descriptor = direct ? direct_descriptor : file_descriptor;
+        request.buffer = read_block.buffer.data + read_block.filled;
+        request.length = static_cast<uint32_t>(read_length);
+        request.file_offset = read_offset;
+        request.request_tag = block_index;
+        request.registered_buffer = buffers_registered ? read_block.buffer.registered_index : -1;
+        async_io->queue(request);
+        ++reads_in_flight;
+    }
+
+    // Забирает завершённые чтения; false - очередь ввода-вывода отказала
+    bool wait_read_completions() {
+        read_completions.clear();
+        if (async_io->reap(read_completions, 1) == 0) return false;
+        reads_in_flight -= read_completions.size();
+        for (const AsyncIoCompletion& completion : read_completions) {
+            ReadAheadBlock& read_block = read_ahead_blocks[completion.request_tag - next_block_index];
+            if (completion.result < 0) {
+                read_block.error_code = -completion.result;
+                read_block.complete = true;
+                continue;
+            }
+            read_block.filled = std::min(read_block.length, read_block.filled + static_cast<size_t>(completion.result));
+            if (read_block.filled == read_block.length) {
+                read_block.complete = true;
+            } else if (completion.result == 0) {
+                read_block.error_code = -1;
+                read_block.complete = true;
+            } else {
+                queue_read(read_block, completion.request_tag);
+            }
+        }
+        return true;
+    }
+
+    // Смешивает поля, меняющиеся при замене или изменении файла; результат не равен 0
+    static uint64_t file_content_version(const struct stat& file_status) {
+        uint64_t version_fields[] = {static_cast<uint64_t>(file_status.st_dev), static_cast<uint64_t>(file_status.st_ino),
+                                     static_cast<uint64_t>(file_status.st_size),
+                                     static_cast<uint64_t>(file_status.st_mtim.tv_sec),
+                                     static_cast<uint64_t>(file_status.st_mtim.tv_nsec)};
+        uint64_t version = 0x9E3779B97F4A7C15ull;
+        for (uint64_t field : version_fields) {
+            version ^= field + 0x9E3779B97F4A7C15ull + (version << 6) + (version >> 2);
+            version *= 0xBF58476D1CE4E5B9ull;
+        }
+        return version | 1;
+    }
+
+    int file_descriptor = -1;
+    size_t uncompressed_block_size = 0;
+    ChunkingMode chunking_mode = ChunkingMode::Fixed;
+    ContentChunker content_chunker;
+    std::vector<uint8_t> carried_bytes; // Режим read с cdc: прочитано после границы блока
+    bool known_total_size = false;
+    uint64_t total_size = 0;
+    uint64_t file_version = 0;
+    uint8_t* mapped_data = nullptr;
+    uint64_t mapped_length = 0;
+    uint64_t next_offset = 0;
+    uint64_t next_block_index = 0;
+    bool read_failed = false;
+    std::function<bool(uint64_t)> skipped_block; // Блоки, записанные прошлой попыткой (skip_blocks)
+
+    // Режим async
+    std::unique_ptr<AsyncFileIo> async_io;
+    std::string read_method_description;
+    int direct_descriptor = -1;
+    uint32_t read_ahead_depth = 0;
+    std::shared_ptr<ReadBufferPool> read_buffer_pool;
+    bool buffers_registered = false;
+    std::deque<ReadAheadBlock> read_ahead_blocks; // По порядку блоков, первый - next_block_index
+    std::vector<AsyncIoCompletion> read_completions;
+    size_t reads_in_flight = 0;
+    uint64_t next_read_offset = 0;
+    uint64_t next_read_block_index = 0;
+};
@@ -0,0 +1,56 @@
+// Журнал с уровнями важности
+//
+// Сообщение формируется только если его уровень включён, поэтому отключённые строки
+// на горячем пути (по фрагменту или блоку) стоят одного сравнения. Строки не сбрасываются
+// после каждой записи: ошибки и предупреждения идут в небуферизованный stderr, остальное -
+// в буферизованный stdout.
+
+#pragma once
+
+#include <bits/stdc++.h>
+
+enum class LogLevel {
+    Error,
+    Warn,
+    Info,  // По умолчанию: ход передачи и итоговая статистика
+    Debug, // Каждый блок
+    Trace  // Каждый фрагмент
+};
+
+// Один порог на весь процесс: inline-функция без static общая для всех единиц трансляции
+inline LogLevel& log_threshold() {
+    static LogLevel threshold = LogLevel::Info;
+    return threshold;
+}
+
+static inline bool log_enabled(LogLevel level) {
+    return level <= log_threshold();
+}
+
+static inline bool parse_log_level(const std::string& text, LogLevel& level) {
+    if (text == "error") level = LogLevel::Error;
+    else if (text == "warn") level = LogLevel::Warn;
+    else if (text == "info") level = LogLevel::Info;
+    else if (text == "debug") level = LogLevel::Debug;
+    else if (text == "trace") level = LogLevel::Trace;
+    else return false;
+    return true;
+}
+
+static inline void log_write(LogLevel level, const std::string& message) {
+    if (level <= LogLevel::Warn) {
+        std::cerr << message << '\n';
+    } else {
+        std::cout << message << '\n';
+    }
+}
+
+// SHM_LOG(LogLevel::Debug, "Блок " << block_id << " записан");
+#define SHM_LOG(level, message_expression)                  \
+    do {                                                    \
+        if (log_enabled(level)) {                           \
+            std::ostringstream log_message_stream;          \
+            log_message_stream << message_expression;       \
+            log_write(level, log_message_stream.str());     \
+        }                                                   \
+    } while (0)
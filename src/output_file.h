@@ -0,0 +1,364 @@
+// Выходной файл consumer: последовательная запись или позиционная запись блоков
+//
+// В режиме stream блоки дописываются по порядку из потока приёма (исходное поведение).
+// В режимах pwrite и mmap смещение каждого блока известно заранее (block_id * block_size),
+// поэтому потоки распаковки пишут блоки сами, в любом порядке: через pwrite или прямо
+// в отображение файла. Файл заранее резервируется через fallocate, а надёжность
+// обеспечивается одним fsync в конце.
+//
+// С keep_existing файл открывается без усечения: дельта-передача пишет только изменившиеся
+// блоки поверх старой копии, а finish обрезает файл до нового размера; так же файл открывается
+// для возобновления прерванной передачи (см. transfer_checkpoint.h).
+//
+// В режиме async (см. async_io.h) write_at копирует блок в буфер очереди записи и сразу
+// возвращается: записи копятся и уходят io_uring или потокам ввода-вывода пачками,
+// а поток распаковки берётся за следующий блок. Ошибка записи запоминается и возвращается
+// следующим write_at или finish. Действия, которые можно выполнить только после записи
+// (отметка блока в контрольной точке), откладываются через after_writes. С O_DIRECT
+// выровненные блоки пишутся мимо кэша страниц, остальные (хвост файла) - обычным
+// дескриптором.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "async_io.h"
+
+enum class OutputMode {
+    Stream, // Упорядоченная запись из потока приёма
+    Pwrite, // Позиционная запись из потоков распаковки
+    Mmap,   // Распаковка прямо в отображение файла (нужен известный размер)
+    Async   // Позиционная запись пачками через io_uring или потоки ввода-вывода
+};
+
+constexpr size_t ASYNC_WRITE_BATCH = 4;                     // Записей, отправляемых одним вызовом
+constexpr size_t MAX_ASYNC_WRITE_LENGTH = 64 * 1024 * 1024; // Длиннее пишется несколькими запросами
+
+class BlockOutputFile {
+public:
+    BlockOutputFile() = default;
+    BlockOutputFile(const BlockOutputFile&) = delete;
+    BlockOutputFile& operator=(const BlockOutputFile&) = delete;
+
+    ~BlockOutputFile() {
+        if (async_io) {
+            // Владельцы отложенных действий могли уже исчезнуть: только дожидаемся записей
+            std::lock_guard<std::mutex> write_guard(write_mutex);
+            deferred_actions.clear();
+            drain_writes();
+        }
+        if (mapped_data) munmap(mapped_data, mapped_length);
+        if (direct_descriptor >= 0) close(direct_descriptor);
+        if (file_descriptor >= 0) close(file_descriptor);
+    }
+
+    bool open(const std::string& path, OutputMode mode, bool keep_existing = false,
+              const AsyncIoOptions& async_options = AsyncIoOptions()) {
+        output_mode = mode;
+        output_path = path;
+        file_descriptor = ::open(path.c_str(), O_RDWR | O_CREAT | (keep_existing ? 0 : O_TRUNC) | O_CLOEXEC, 0644);
+        if (file_descriptor < 0) {
+            perror("Ошибка открытия файла");
+            return false;
+        }
+        existing_length = keep_existing ? file_size() : 0;
+        if (mode == OutputMode::Async) {
+            std::string backend_description;
+            async_io = AsyncFileIo::create(async_options.backend, async_options.queue_depth, backend_description);
+            if (!async_io) {
+                std::cerr << "Ошибка: " << backend_description << std::endl;
+                return false;
+            }
+            write_queue_depth = async_options.queue_depth;
+            write_method_description = backend_description;
+            if (async_options.direct_io) {
+                direct_descriptor = ::open(path.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+                if (direct_descriptor < 0) {
+                    std::cerr << "Предупреждение: O_DIRECT для '" << path << "': " << strerror(errno)
+                              << ", запись через кэш страниц" << std::endl;
+                } else {
+                    write_method_description += ", O_DIRECT";
+                }
+            }
+        }
+        return true;
+    }
+
+    // Чем пишутся блоки в режиме async: для сообщения consumer
+    const std::string& write_method() const { return write_method_description; }
+
+    // Размер старой копии, сохранённой при открытии с keep_existing
+    uint64_t existing_size() const { return existing_length; }
+
+    // Чтение старой копии (до prepare: он может изменить размер файла); потокобезопасно
+    bool read_at(uint64_t offset, uint8_t* data, size_t length) const {
+        while (length > 0) {
+            ssize_t bytes_read = pread(file_descriptor, data, length, static_cast<off_t>(offset));
+            if (bytes_read < 0 && errno == EINTR) continue;
+            if (bytes_read <= 0) return false;
+            data += bytes_read;
+            offset += static_cast<uint64_t>(bytes_read);
+            length -= static_cast<size_t>(bytes_read);
+        }
+        return true;
+    }
+
+    const std::string& path() const { return output_path; }
+    OutputMode mode() const { return output_mode; }
+    bool positional() const { return output_mode != OutputMode::Stream; }
+    bool is_memory_mapped() const { return mapped_data != nullptr; }
+
+    // Резервирует место под файл известного размера; в режиме mmap отображает его
+    void prepare(uint64_t total_size) {
+        if (total_size == 0) return;
+        if (output_mode != OutputMode::Stream) {
+            int allocation_result = posix_fallocate(file_descriptor, 0, static_cast<off_t>(total_size));
+            if (allocation_result != 0 && allocation_result != EOPNOTSUPP && allocation_result != EINVAL) {
+                std::cerr << "Предупреждение: fallocate: " << strerror(allocation_result) << std::endl;
+            }
+            if (ftruncate(file_descriptor, static_cast<off_t>(total_size)) != 0) {
+                perror("ftruncate");
+            }
+        }
+        if (output_mode == OutputMode::Mmap) {
+            void* mapping = mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+            if (mapping == MAP_FAILED) {
+                perror("mmap выходного файла, переход на pwrite");
+                output_mode = OutputMode::Pwrite;
+                return;
+            }
+            mapped_data = static_cast<uint8_t*>(mapping);
+            mapped_length = total_size;
+        }
+    }
+
+    // Режим mmap без известного размера невозможен: отображать нечего
+    void size_unknown() {
+        if (output_mode == OutputMode::Mmap) {
+            std::cerr << "Размер данных неизвестен, запись через pwrite вместо mmap" << std::endl;
+            output_mode = OutputMode::Pwrite;
+        }
+    }
+
+    // Область отображения под блок или nullptr, если блок в неё не попадает
+    uint8_t* mapped_destination(uint64_t offset, size_t length) const {
+        if (!mapped_data || offset + length > mapped_length) return nullptr;
+        return mapped_data + offset;
+    }
+
+    // Позиционная запись блока; потокобезопасна. В режиме async только ставит запись в очередь
+    bool write_at(uint64_t offset, const uint8_t* data, size_t length) {
+        if (async_io) return queue_write(offset, data, length);
+        while (length > 0) {
+            ssize_t bytes_written = pwrite(file_descriptor, data, length, static_cast<off_t>(offset));
+            if (bytes_written < 0) {
+                if (errno == EINTR) continue;
+                perror("pwrite");
+                return false;
+            }
+            data += bytes_written;
+            offset += static_cast<uint64_t>(bytes_written);
+            length -= static_cast<size_t>(bytes_written);
+        }
+        return true;
+    }
+
+    // Последовательная запись (режим stream)
+    bool append(const uint8_t* data, size_t length) {
+        if (!write_at(append_offset, data, length)) return false;
+        append_offset += length;
+        return true;
+    }
+
+    // Выполняет action, когда завершатся все записи, поставленные до этого вызова;
+    // вне режима async - сразу. Действие может выполниться в любом пишущем потоке.
+    void after_writes(std::function<void()> action) {
+        if (!async_io) {
+            action();
+            return;
+        }
+        std::lock_guard<std::mutex> write_guard(write_mutex);
+        if (completed_write_prefix == next_write_ticket) {
+            action();
+            return;
+        }
+        deferred_actions.emplace_back(next_write_ticket, std::move(action));
+    }
+
+    // Дожидается поставленных записей и выполняет отложенные действия
+    void wait_writes() {
+        if (!async_io) return;
+        std::lock_guard<std::mutex> write_guard(write_mutex);
+        drain_writes();
+    }
+
+    // Фиксирует итоговый размер и один раз сбрасывает данные на диск
+    bool finish(uint64_t final_size) {
+        bool success = true;
+        if (async_io) {
+            std::lock_guard<std::mutex> write_guard(write_mutex);
+            drain_writes();
+            if (write_error != 0) {
+                std::cerr << "Ошибка асинхронной записи: " << strerror(write_error) << std::endl;
+                success = false;
+            }
+        }
+        if (mapped_data) {
+            // Грязные страницы отображения принадлежат кэшу файла, их сбросит fsync ниже
+            munmap(mapped_data, mapped_length);
+            mapped_data = nullptr;
+        }
+        if (ftruncate(file_descriptor, static_cast<off_t>(final_size)) != 0) { perror("ftruncate"); success = false; }
+        if (fsync(file_descriptor) != 0) { perror("fsync"); success = false; }
+        return success;
+    }
+
+    uint64_t file_size() const {
+        struct stat file_status;
+        if (fstat(file_descriptor, &file_status) != 0) return 0;
+        return static_cast<uint64_t>(file_status.st_size);
+    }
+
+private:
+    // Запись в очереди; tag запроса - номер записи (ticket)
+    struct PendingWrite {
+        uint64_t file_offset = 0;
+        size_t length = 0;   // Байт данных (без выравнивания O_DIRECT)
+        size_t written = 0;
+        size_t slot_index = 0;
+        bool direct = false;
+    };
+
+    // Буфер записи; выровнен для O_DIRECT
+    struct WriteSlot {
+        AlignedBuffer buffer;
+        size_t capacity = 0;
+    };
+
+    bool queue_write(uint64_t offset, const uint8_t* data, size_t length) {
+        std::lock_guard<std::mutex> write_guard(write_mutex);
+        while (length > 0) {
+            if (write_error != 0) return false;
+            size_t part_length = std::min(length, MAX_ASYNC_WRITE_LENGTH);
+            // Все буферы в полёте: ждём, пока освободится хотя бы один
+            while (free_write_slots.empty() && write_slots.size() >= write_queue_depth) {
+                if (!reap_writes(1)) return false;
+            }
+            if (free_write_slots.empty()) {
+                write_slots.emplace_back();
+                free_write_slots.push_back(write_slots.size() - 1);
+            }
+            size_t slot_index = free_write_slots.back();
+            free_write_slots.pop_back();
+            WriteSlot& slot = write_slots[slot_index];
+            bool direct = direct_descriptor >= 0 && offset % DIRECT_IO_ALIGNMENT == 0 &&
+                          part_length % DIRECT_IO_ALIGNMENT == 0;
+            if (slot.capacity < part_length) {
+                slot.capacity = align_up(part_length, DIRECT_IO_ALIGNMENT);
+                slot.buffer = allocate_aligned_buffer(slot.capacity);
+            }
+            memcpy(slot.buffer.get(), data, part_length);
+
+            uint64_t write_ticket = next_write_ticket++;
+            PendingWrite& pending_write = pending_writes[write_ticket];
+            pending_write.file_offset = offset;
+            pending_write.length = part_length;
+            pending_write.slot_index = slot_index;
+            pending_write.direct = direct;
+            queue_write_request(write_ticket, pending_write);
+            if (++unsubmitted_writes >= ASYNC_WRITE_BATCH) {
+                async_io->submit();
+                unsubmitted_writes = 0;
+            }
+            data += part_length;
+            offset += part_length;
+            length -= part_length;
+        }
+        // Завершённые к этому моменту записи освобождают буферы без ожидания
+        if (writes_in_flight > write_queue_depth / 2) reap_writes(0);
+        return write_error == 0;
+    }
+
+    void queue_write_request(uint64_t write_ticket, const PendingWrite& pending_write) {
+        AsyncIoRequest request;
+        request.is_write = true;
+        request.file_descriptor = pending_write.direct ? direct_descriptor : file_descriptor;
+        request.buffer = write_slots[pending_write.slot_index].buffer.get() + pending_write.written;
+        request.length = static_cast<uint32_t>(pending_write.length - pending_write.written);
+        request.file_offset = pending_write.file_offset + pending_write.written;
+        request.request_tag = write_ticket;
+        async_io->queue(request);
+        ++writes_in_flight;
+    }
+
+    // Забирает завершения (ждёт не меньше minimum_count); false - очередь отказала
+    bool reap_writes(size_t minimum_count) {
+        write_completions.clear();
+        size_t reaped_count = async_io->reap(write_completions, minimum_count);
+        unsubmitted_writes = 0;
+        if (reaped_count < minimum_count) {
+            if (write_error == 0) write_error = EIO;
+            return false;
+        }
+        writes_in_flight -= reaped_count;
+        for (const AsyncIoCompletion& completion : write_completions) {
+            auto pending_entry = pending_writes.find(completion.request_tag);
+            PendingWrite& pending_write = pending_entry->second;
+            if (completion.result < 0 && write_error == 0) write_error = -completion.result;
+            if (completion.result > 0) pending_write.written += static_cast<size_t>(completion.result);
+            // Короткая запись: остаток уходит ещё одним запросом (с O_DIRECT - обычным дескриптором)
+            if (completion.result > 0 && pending_write.written < pending_write.length) {
+                pending_write.direct = pending_write.direct && pending_write.written % DIRECT_IO_ALIGNMENT == 0;
+                queue_write_request(completion.request_tag, pending_write);
+                continue;
+            }
+            if (completion.result == 0 && pending_write.written < pending_write.length && write_error == 0) write_error = EIO;
+            free_write_slots.push_back(pending_write.slot_index);
+            pending_writes.erase(pending_entry);
+        }
+        // Записи завершаются в любом порядке: отложенные действия ждут, пока завершатся
+        // все записи до их отметки
+        completed_write_prefix = pending_writes.empty() ? next_write_ticket : pending_writes.begin()->first;
+        while (!deferred_actions.empty() && deferred_actions.front().first <= completed_write_prefix) {
+            if (write_error == 0) deferred_actions.front().second();
+            deferred_actions.pop_front();
+        }
+        return true;
+    }
+
+    // Дожидается всех записей в полёте
+    void drain_writes() {
+        while (writes_in_flight > 0) {
+            if (!reap_writes(1)) break;
+        }
+    }
+
+    std::string output_path;
+    int file_descriptor = -1;
+    OutputMode output_mode = OutputMode::Pwrite;
+    uint64_t append_offset = 0;
+    uint64_t existing_length = 0;
+    uint8_t* mapped_data = nullptr;
+    uint64_t mapped_length = 0;
+
+    // Режим async
+    std::unique_ptr<AsyncFileIo> async_io;
+    std::string write_method_description;
+    int direct_descriptor = -1;
+    uint32_t write_queue_depth = 0;
+    std::mutex write_mutex;
+    std::vector<WriteSlot> write_slots;
+    std::vector<size_t> free_write_slots;
+    std::map<uint64_t, PendingWrite> pending_writes; // По номеру записи
+    std::vector<AsyncIoCompletion> write_completions;
+    uint64_t next_write_ticket = 0;
+    uint64_t completed_write_prefix = 0; // Все записи с меньшими номерами завершены
+    size_t writes_in_flight = 0;
+    size_t unsubmitted_writes = 0;
+    int write_error = 0;
+    std::deque<std::pair<uint64_t, std::function<void()>>> deferred_actions;
+};
@@ -1,264 +1,459 @@
 // Producer - Производитель данных
+//
+// Тонкая обёртка над ChannelSender из библиотеки shm_channel: разбирает параметры,
+// открывает входной файл и печатает статистику.
+//
+// В режиме сеанса (--session) один канал обслуживает много передач: файлы из аргументов
+// и из списка --list отправляются по мере появления, мелкие файлы собираются в пакеты,
+// а каналы и stdin читаются одновременно и передаются вперемешку.
 
 #include <bits/stdc++.h>
-#include <zlib.h>
 #include <fcntl.h>
-#include <sys/mman.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <atomic>
-#include <future>
-#include <chrono>
+
+#include "channel_options.h"
+#include "input_source.h"
+#include "log.h"
+#include "run_report.h"
+#include "shm_channel.h"
+#include "transfer_protocol.h"
 
 using namespace std;
 
-constexpr const char* SHARED_MEMORY_SEGMENT_NAME = "/shm_shr_channel_example";
-constexpr size_t SHARED_MEMORY_SIZE = 256;
-constexpr size_t MAX_PAYLOAD_CAPACITY = 200;
-
-// Структура для обмена данными через shared memory
-struct SharedMemoryHeader {
-    uint32_t synchronization_flag;    // Spinlock для синхронизации
-    uint32_t message_available;       // Флаг готовности сообщения
-    uint32_t data_block_identifier;   // ID блока данных
-    uint32_t fragment_sequence_number;// Порядковый номер фрагмента в блоке
-    uint8_t  is_final_fragment;       // Флаг последнего фрагмента в блоке
-    uint32_t actual_payload_length;   // Длина полезных данных
-    uint8_t  data_payload[MAX_PAYLOAD_CAPACITY]; // Полезная нагрузка
-} __attribute__((packed));
-
-// Открывает и настраивает shared memory сегмент
-static inline SharedMemoryHeader* initialize_shared_memory() {
-    int shared_memory_descriptor = shm_open(SHARED_MEMORY_SEGMENT_NAME, O_CREAT | O_RDWR, 0600);
-    if (shared_memory_descriptor < 0) { perror("shm_open"); exit(1); }
-    if (ftruncate(shared_memory_descriptor, SHARED_MEMORY_SIZE) != 0) { perror("ftruncate"); exit(1); }
-    void* memory_region = mmap(nullptr, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shared_memory_descriptor, 0);
-    if (memory_region == MAP_FAILED) { perror("mmap"); exit(1); }
-    close(shared_memory_descriptor);
-    return reinterpret_cast<SharedMemoryHeader*>(memory_region);
-}
+// Сеанс producer: очередь входных путей, пакет мелких файлов и открытые потоки
+class SessionProducer {
+public:
+    SessionProducer(const ChannelOptions& options, ChannelSender& sender)
+        : channel_options(options), channel_sender(sender) {}
+
+    // Отправляет все входные файлы; false - хотя бы одна передача не удалась
+    bool run() {
+        for (const auto& input_path : channel_options.positional_arguments) pending_paths.push_back(input_path);
+        if (!channel_options.list_path.empty()) {
+            list_descriptor = channel_options.list_path == "-" ? STDIN_FILENO
+                                                               : open(channel_options.list_path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (list_descriptor < 0) {
+                cerr << "Ошибка: Не удалось открыть список '" << channel_options.list_path << "': " << strerror(errno) << endl;
+                return false;
+            }
+        }
 
-// Блокирует shared memory с помощью spinlock
-static inline void acquire_shared_memory_lock(SharedMemoryHeader* shared_mem) {
-    uint32_t desired_state = 0;
-    while (!__atomic_compare_exchange_n(&shared_mem->synchronization_flag, &desired_state, 1, false,
-                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
-        desired_state = 0;
-        this_thread::yield();
+        while (true) {
+            while (!pending_paths.empty()) {
+                string input_path = move(pending_paths.front());
+                pending_paths.pop_front();
+                start_input(input_path);
+            }
+            if (list_descriptor < 0 && open_streams.empty()) break;
+            wait_for_input();
+        }
+        flush_pack();
+        if (list_descriptor > STDIN_FILENO) close(list_descriptor);
+        return failed_inputs == 0;
     }
-}
 
-// Разблокирует shared memory
-static inline void release_shared_memory_lock(SharedMemoryHeader* shared_mem) {
-    __atomic_store_n(&shared_mem->synchronization_flag, 0, __ATOMIC_RELEASE);
-}
+    size_t sent_files = 0;
+    size_t failed_inputs = 0;
+    size_t sent_packs = 0;
+
+private:
+    // Поток неизвестной длины (канал, stdin): читается по готовности через poll
+    struct OpenStream {
+        int file_descriptor = -1;
+        string name;
+        unique_ptr<ChannelStreamWriter> stream_writer;
+        uint64_t bytes_sent = 0;
+    };
 
-// Сжимает блок данных с помощью zlib
-vector<uint8_t> deflate_data_block(const vector<uint8_t>& input_data, int compression_level = Z_BEST_SPEED) {
-    if (input_data.empty()) {
-        return {}; // Для пустых данных возвращаем пустой вектор
+    void report_failure(const string& input_path, const string& failure_reason) {
+        cerr << "Ошибка: " << input_path << ": " << failure_reason << endl;
+        ++failed_inputs;
     }
-    
-    uLong source_data_length = input_data.size();
-    uLong maximum_compressed_size = compressBound(source_data_length);
-    vector<uint8_t> compressed_output(maximum_compressed_size);
-    uLongf final_compressed_size = maximum_compressed_size;
-    int compression_result = compress2(compressed_output.data(), &final_compressed_size, input_data.data(), source_data_length, compression_level);
-    if (compression_result != Z_OK) {
-        cerr << "Ошибка сжатия: " << compression_result << endl;
-        return input_data; // При ошибке возвращаем исходные данные
+
+    void start_input(const string& input_path) {
+        if (input_path.empty()) return;
+        if (input_path == "-") {
+            if (list_descriptor == STDIN_FILENO) {
+                report_failure(input_path, "stdin уже занят списком файлов");
+                return;
+            }
+            start_stream(STDIN_FILENO, "stdin");
+            return;
+        }
+        int file_descriptor = open(input_path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+        struct stat file_status;
+        if (file_descriptor < 0 || fstat(file_descriptor, &file_status) != 0) {
+            report_failure(input_path, strerror(errno));
+            if (file_descriptor >= 0) close(file_descriptor);
+            return;
+        }
+        if (!S_ISREG(file_status.st_mode)) {
+            start_stream(file_descriptor, input_path);
+            return;
+        }
+        uint64_t file_size = static_cast<uint64_t>(file_status.st_size);
+        if (channel_options.pack_threshold > 0 && file_size <= channel_options.pack_threshold) {
+            add_to_pack(file_descriptor, input_path, file_size);
+            close(file_descriptor);
+            return;
+        }
+        close(file_descriptor);
+        send_whole_file(input_path);
     }
-    compressed_output.resize(final_compressed_size);
-    return compressed_output;
+
+    // Крупный файл - отдельная передача через конвейер блоков
+    void send_whole_file(const string& input_path) {
+        BlockInputSource input_source;
+        if (!input_source.open(input_path, channel_options.input_mode, channel_sender.block_size(), channel_options.chunking_mode,
+                               channel_options.async_io_options)) {
+            ++failed_inputs;
+            return;
+        }
+        if (!channel_sender.send_file(input_source, input_path)) {
+            report_failure(input_path, channel_sender.error_message());
+            return;
+        }
+        ++sent_files;
+        SHM_LOG(LogLevel::Info, "Отправлен файл " << input_path << " (" << input_source.file_size() << " байт)");
+    }
+
+    // Мелкий файл читается целиком и дописывается в пакет
+    void add_to_pack(int file_descriptor, const string& input_path, uint64_t file_size) {
+        if (pack_data.size() + file_size > channel_options.pack_size || pack_entries.size() >= MAX_TRANSFER_ENTRY_COUNT) {
+            flush_pack();
+        }
+        size_t entry_start = pack_data.size();
+        pack_data.resize(entry_start + file_size);
+        size_t bytes_read = 0;
+        while (bytes_read < file_size) {
+            ssize_t read_result = read(file_descriptor, pack_data.data() + entry_start + bytes_read, file_size - bytes_read);
+            if (read_result < 0 && errno == EINTR) continue;
+            if (read_result <= 0) {
+                report_failure(input_path, read_result < 0 ? strerror(errno) : "файл укоротился во время чтения");
+                pack_data.resize(entry_start);
+                return;
+            }
+            bytes_read += static_cast<size_t>(read_result);
+        }
+        pack_entries.push_back({input_path, file_size});
+        last_pack_addition = chrono::steady_clock::now();
+    }
+
+    // Отправляет накопленный пакет; единственный файл уходит обычной передачей
+    void flush_pack() {
+        if (pack_entries.empty()) return;
+        bool pack_sent = false;
+        if (pack_entries.size() == 1) {
+            pack_sent = channel_sender.send(ConstByteSpan(pack_data), pack_entries.front().first);
+        } else {
+            packed_files.clear();
+            size_t entry_start = 0;
+            for (const auto& [entry_name, entry_size] : pack_entries) {
+                packed_files.push_back(PackedFile{entry_name, ConstByteSpan(pack_data.data() + entry_start, entry_size)});
+                entry_start += entry_size;
+            }
+            pack_sent = channel_sender.send_packed(packed_files);
+            if (pack_sent) ++sent_packs;
+        }
+        if (pack_sent) {
+            sent_files += pack_entries.size();
+            SHM_LOG(LogLevel::Info, "Отправлен пакет: " << pack_entries.size() << " файлов, " << pack_data.size() << " байт");
+        } else {
+            for (const auto& pack_entry : pack_entries) report_failure(pack_entry.first, channel_sender.error_message());
+        }
+        pack_entries.clear();
+        pack_data.clear();
+    }
+
+    void start_stream(int file_descriptor, const string& name) {
+        OpenStream open_stream;
+        open_stream.file_descriptor = file_descriptor;
+        open_stream.name = name;
+        open_stream.stream_writer = make_unique<ChannelStreamWriter>(channel_sender, name);
+        open_streams.push_back(move(open_stream));
+        SHM_LOG(LogLevel::Info, "Открыт поток " << name);
+    }
+
+    // Читает готовую часть потока; false - поток закончился
+    bool service_stream(OpenStream& open_stream) {
+        ssize_t read_result = read(open_stream.file_descriptor, read_buffer.data(), read_buffer.size());
+        if (read_result < 0 && (errno == EINTR || errno == EAGAIN)) return true;
+        if (read_result > 0) {
+            open_stream.bytes_sent += static_cast<uint64_t>(read_result);
+            if (open_stream.stream_writer->write(ConstByteSpan(read_buffer.data(), static_cast<size_t>(read_result)))) return true;
+            report_failure(open_stream.name, channel_sender.error_message());
+            open_stream.stream_writer->abort();
+        } else if (read_result < 0) {
+            report_failure(open_stream.name, strerror(errno));
+            open_stream.stream_writer->abort();
+        } else if (open_stream.stream_writer->finish()) {
+            ++sent_files;
+            SHM_LOG(LogLevel::Info, "Отправлен поток " << open_stream.name << " (" << open_stream.bytes_sent << " байт)");
+        } else {
+            report_failure(open_stream.name, channel_sender.error_message());
+        }
+        if (open_stream.file_descriptor > STDIN_FILENO) close(open_stream.file_descriptor);
+        return false;
+    }
+
+    // Дописывает в очередь пути из прочитанной части списка
+    void read_list() {
+        ssize_t read_result = read(list_descriptor, read_buffer.data(), read_buffer.size());
+        if (read_result < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        if (read_result <= 0) {
+            if (!list_line.empty()) pending_paths.push_back(move(list_line));
+            list_line.clear();
+            if (list_descriptor > STDIN_FILENO) close(list_descriptor);
+            list_descriptor = -1;
+            return;
+        }
+        for (ssize_t byte_index = 0; byte_index < read_result; ++byte_index) {
+            char list_character = static_cast<char>(read_buffer[byte_index]);
+            if (list_character == '\n') {
+                pending_paths.push_back(move(list_line));
+                list_line.clear();
+            } else {
+                list_line.push_back(list_character);
+            }
+        }
+    }
+
+    // Ждёт данных в списке или потоках; пакет отправляется, если новые файлы перестали приходить
+    void wait_for_input() {
+        poll_descriptors.clear();
+        if (list_descriptor >= 0) poll_descriptors.push_back(pollfd{list_descriptor, POLLIN, 0});
+        for (const auto& open_stream : open_streams) poll_descriptors.push_back(pollfd{open_stream.file_descriptor, POLLIN, 0});
+        int poll_timeout = -1;
+        if (!pack_entries.empty()) {
+            auto idle_time = chrono::steady_clock::now() - last_pack_addition;
+            poll_timeout = max<int>(0, static_cast<int>(PACK_IDLE_FLUSH_MS - chrono::duration_cast<chrono::milliseconds>(idle_time).count()));
+        }
+        int ready_count = poll(poll_descriptors.data(), poll_descriptors.size(), poll_timeout);
+        if (ready_count < 0 && errno != EINTR) {
+            cerr << "Ошибка: poll: " << strerror(errno) << endl;
+            exit(1);
+        }
+        if (ready_count == 0) {
+            flush_pack();
+            return;
+        }
+        size_t descriptor_index = 0;
+        if (list_descriptor >= 0) {
+            if (poll_descriptors[descriptor_index++].revents) read_list();
+        }
+        for (size_t stream_index = 0; stream_index < open_streams.size(); ++descriptor_index) {
+            if (poll_descriptors[descriptor_index].revents && !service_stream(open_streams[stream_index])) {
+                open_streams.erase(open_streams.begin() + static_cast<ptrdiff_t>(stream_index));
+            } else {
+                ++stream_index;
+            }
+        }
+    }
+
+    static constexpr int PACK_IDLE_FLUSH_MS = 100;
+
+    const ChannelOptions& channel_options;
+    ChannelSender& channel_sender;
+    deque<string> pending_paths;
+    int list_descriptor = -1;
+    string list_line;
+    vector<OpenStream> open_streams;
+    vector<pollfd> poll_descriptors;
+    vector<uint8_t> read_buffer = vector<uint8_t>(64 * 1024);
+
+    vector<uint8_t> pack_data;                    // Содержимое файлов пакета подряд
+    vector<pair<string, uint64_t>> pack_entries;  // Имена и размеры файлов пакета
+    vector<PackedFile> packed_files;
+    chrono::steady_clock::time_point last_pack_addition;
+};
+
+// Сеанс: все входные файлы через один канал, затем один сигнал завершения
+static int run_session(const ChannelOptions& channel_options) {
+    ChannelSender channel_sender;
+    if (!channel_sender.open(channel_options)) {
+        cerr << "Ошибка: " << channel_sender.error_message() << endl;
+        return 1;
+    }
+    if (channel_options.cpu_placement.print_topology) print_topology_report(cout, channel_sender.cpu_placement());
+    cout << "Канал: " << channel_sender.channel_description() << endl;
+    cout << "Сеанс: пакеты до " << channel_options.pack_size << " байт из файлов не больше "
+         << channel_options.pack_threshold << " байт" << endl;
+
+    auto session_start_time = chrono::steady_clock::now();
+    SessionProducer session_producer(channel_options, channel_sender);
+    bool session_succeeded = session_producer.run();
+    double session_time = chrono::duration<double>(chrono::steady_clock::now() - session_start_time).count();
+    channel_sender.close();
+
+    const SenderStatistics& statistics = channel_sender.statistics();
+    cout << "Сеанс завершён " << (session_succeeded ? "успешно" : "с ошибками") << endl;
+    cout << "Время выполнения: " << session_time << " секунд" << endl;
+    cout << "Файлов отправлено: " << session_producer.sent_files << " (пакетов: " << session_producer.sent_packs
+         << "), ошибок: " << session_producer.failed_inputs << endl;
+    cout << "  Исходный размер: " << statistics.input_bytes << " байт" << endl;
+    cout << "  Сжатый размер: " << statistics.compressed_bytes << " байт" << endl;
+    if (statistics.cached_blocks > 0 || statistics.referenced_blocks > 0) {
+        cout << "  Блоков из кэша кадров: " << statistics.cached_blocks << ", ссылками: " << statistics.referenced_blocks << endl;
+    }
+    if (statistics.unchanged_blocks > 0) {
+        cout << "  Блоков не отправлено (совпали со старой копией): " << statistics.unchanged_blocks << endl;
+    }
+    if (statistics.resumed_blocks > 0) {
+        cout << "  Блоков не отправлено (записаны прошлой попыткой): " << statistics.resumed_blocks << endl;
+    }
+
+    if (!channel_options.report_path.empty()) {
+        RunReport run_report;
+        run_report.add("role", "producer");
+        run_report.add("seconds", session_time);
+        run_report.add("files", session_producer.sent_files);
+        run_report.add("packs", session_producer.sent_packs);
+        run_report.add("messages", statistics.messages);
+        run_report.add("input_bytes", statistics.input_bytes);
+        run_report.add("compressed_bytes", statistics.compressed_bytes);
+        run_report.add("blocks", statistics.blocks);
+        run_report.add("cached_blocks", statistics.cached_blocks);
+        run_report.add("referenced_blocks", statistics.referenced_blocks);
+        run_report.add("unchanged_blocks", statistics.unchanged_blocks);
+        run_report.add("resumed_blocks", statistics.resumed_blocks);
+        run_report.add("success", session_succeeded ? 1 : 0);
+        channel_sender.cpu_placement().add_to_report(run_report);
+        run_report.add_resource_usage();
+        run_report.write(channel_options.report_path);
+    }
+    return session_succeeded ? 0 : 1;
 }
 
 int main(int argc, char** argv){
     ios::sync_with_stdio(false);
-    
+
     // Проверка аргументов командной строки
-    if (argc < 2) {
-        cerr << "Использование: producer <входной_файл>" << endl;
+    ChannelOptions channel_options;
+    bool options_valid = parse_channel_options(argc, argv, channel_options);
+    if (!options_valid || (channel_options.positional_arguments.empty() && channel_options.list_path.empty())) {
+        cerr << "Использование: producer [параметры] <входной_файл>" << endl;
+        cerr << "               producer --session [параметры] [--list=PATH] <файл>..." << endl;
         cerr << "Пример: producer source_data.bin" << endl;
+        print_channel_options_usage();
         return 1;
     }
+    if (channel_options.session_mode) return run_session(channel_options);
+
+    string input_filename = channel_options.positional_arguments[0];
 
-    string input_filename = argv[1];
-    
-    // Проверка существования и доступности файла
-    ifstream input_file_stream(input_filename, ios::binary);
-    if (!input_file_stream) { 
-        cerr << "Ошибка: Не удалось открыть файл '" << input_filename << "'" << endl;
-        return 1; 
+    // Открываем входной файл; данные читаются по мере отправки, а не целиком
+    BlockInputSource input_source;
+    if (!input_source.open(input_filename, channel_options.input_mode, channel_options.uncompressed_block_size,
+                           channel_options.chunking_mode, channel_options.async_io_options)) {
+        return 1;
     }
-    
-    // Определяем размер файла
-    input_file_stream.seekg(0, ios::end);
-    size_t total_file_size = input_file_stream.tellg();
-    input_file_stream.seekg(0, ios::beg);
-    
-    cout << "Входной файл: " << input_filename << endl;
-    cout << "Размер файла: " << total_file_size << " байт" << endl;
-    
-    if (total_file_size == 0) {
-        cout << "Предупреждение: Файл пустой" << endl;
+
+    // Канал: почтовый ящик, кольцевой буфер или кольцо с ареной. Размер блока может прийти
+    // из заголовка кольца, размеченного consumer
+    ChannelSender channel_sender;
+    if (!channel_sender.open(channel_options)) {
+        cerr << "Ошибка: " << channel_sender.error_message() << endl;
+        return 1;
     }
+    if (channel_options.cpu_placement.print_topology) print_topology_report(cout, channel_sender.cpu_placement());
+    const size_t UNCOMPRESSED_BLOCK_SIZE = channel_sender.block_size();
+    input_source.set_block_size(UNCOMPRESSED_BLOCK_SIZE);
 
-    // Читаем содержимое файла
-    vector<uint8_t> file_content(total_file_size);
-    if (total_file_size > 0) {
-        input_file_stream.read(reinterpret_cast<char*>(file_content.data()), total_file_size);
-        if (!input_file_stream) {
-            cerr << "Ошибка чтения файла" << endl;
-            return 1;
+    cout << "Входной файл: " << input_filename << endl;
+    size_t total_blocks_count = 0;
+    if (input_source.size_known()) {
+        total_blocks_count = (input_source.file_size() + UNCOMPRESSED_BLOCK_SIZE - 1) / UNCOMPRESSED_BLOCK_SIZE;
+        cout << "Размер файла: " << input_source.file_size() << " байт" << endl;
+        if (input_source.file_size() == 0) {
+            cout << "Предупреждение: Файл пустой" << endl;
         }
+    } else {
+        cout << "Размер файла: неизвестен (потоковый ввод)" << endl;
     }
-    input_file_stream.close();
-
-    // Разбиваем файл на блоки по 64 КБ
-    const size_t UNCOMPRESSED_BLOCK_SIZE = 64 * 1024;
-    size_t total_blocks_count = (total_file_size + UNCOMPRESSED_BLOCK_SIZE - 1) / UNCOMPRESSED_BLOCK_SIZE;
-    
+    cout << "Чтение: " << input_source.read_method() << endl;
     cout << "Размер блока: " << UNCOMPRESSED_BLOCK_SIZE << " байт" << endl;
-    cout << "Количество блоков: " << total_blocks_count << endl;
+    if (input_source.size_known()) {
+        cout << "Количество блоков: " << total_blocks_count << endl;
+    }
 
-    // Инициализируем shared memory
-    SharedMemoryHeader* shared_memory_region = initialize_shared_memory();
-    memset(shared_memory_region, 0, sizeof(SharedMemoryHeader));
+    cout << "Канал: " << channel_sender.channel_description() << endl;
 
-    // Обработка пустого файла
-    if (total_blocks_count == 0) {
-        cout << "Отправка маркера пустого файла..." << endl;
-        
-        // Ждем освобождения канала
-        while (true) {
-            acquire_shared_memory_lock(shared_memory_region);
-            if (shared_memory_region->message_available == 0) break;
-            release_shared_memory_lock(shared_memory_region);
-            this_thread::yield();
-        }
-        
-        // Отправляем маркер пустого файла
-        shared_memory_region->data_block_identifier = 0;
-        shared_memory_region->fragment_sequence_number = 0;
-        shared_memory_region->is_final_fragment = 1;
-        shared_memory_region->actual_payload_length = 0;
-        shared_memory_region->message_available = 1;
-        release_shared_memory_lock(shared_memory_region);
-        
-        // Ждем подтверждения приема
-        while (true) {
-            acquire_shared_memory_lock(shared_memory_region);
-            bool message_still_available = (shared_memory_region->message_available != 0);
-            release_shared_memory_lock(shared_memory_region);
-            if (!message_still_available) break;
-            this_thread::yield();
-        }
-        
-        cout << "Маркер пустого файла отправлен" << endl;
-    } else {
-        // Многопоточное сжатие блоков
-        vector<future<vector<uint8_t>>> compression_tasks;
-        compression_tasks.reserve(total_blocks_count);
-        
-        cout << "Запуск параллельного сжатия..." << endl;
-        
-        // Запускаем сжатие каждого блока в отдельном потоке
-        for (size_t block_index = 0; block_index < total_blocks_count; ++block_index) {
-            size_t data_offset = block_index * UNCOMPRESSED_BLOCK_SIZE;
-            size_t block_length = min(UNCOMPRESSED_BLOCK_SIZE, total_file_size - data_offset);
-            vector<uint8_t> data_block(file_content.begin() + data_offset, file_content.begin() + data_offset + block_length);
-            
-            compression_tasks.push_back(async(launch::async, [data_block]() {
-                return deflate_data_block(data_block, Z_BEST_SPEED);
-            }));
-        }
+    // Успех - только если consumer подтвердил, что записал файл (а не отклонил передачу)
+    channel_sender.set_delivery_confirmation(true);
 
-        auto compression_start_time = chrono::steady_clock::now();
-        size_t total_compressed_size = 0;
-
-        // Передача сжатых данных через shared memory
-        for (size_t current_block_id = 0; current_block_id < total_blocks_count; ++current_block_id) {
-            // Получаем сжатый блок
-            vector<uint8_t> compressed_block = compression_tasks[current_block_id].get();
-            total_compressed_size += compressed_block.size();
-
-            // Разбиваем на фрагменты и передаем
-            size_t current_offset = 0;
-            uint32_t fragment_counter = 0;
-            
-            while (current_offset < compressed_block.size()) {
-                size_t fragment_size = min(MAX_PAYLOAD_CAPACITY, compressed_block.size() - current_offset);
-
-                // Ожидаем освобождения канала
-                while (true) {
-                    acquire_shared_memory_lock(shared_memory_region);
-                    if (shared_memory_region->message_available == 0) break;
-                    release_shared_memory_lock(shared_memory_region);
-                    this_thread::yield();
-                }
-
-                // Записываем данные в shared memory
-                shared_memory_region->data_block_identifier = (uint32_t)current_block_id;
-                shared_memory_region->fragment_sequence_number = fragment_counter;
-                shared_memory_region->is_final_fragment = (current_offset + fragment_size >= compressed_block.size()) ? 1 : 0;
-                shared_memory_region->actual_payload_length = static_cast<uint32_t>(fragment_size);
-                memcpy(shared_memory_region->data_payload, compressed_block.data() + current_offset, fragment_size);
-                shared_memory_region->message_available = 1;
-                release_shared_memory_lock(shared_memory_region);
-
-                // Ожидаем подтверждения приема
-                while (true) {
-                    acquire_shared_memory_lock(shared_memory_region);
-                    bool message_still_available = (shared_memory_region->message_available != 0);
-                    release_shared_memory_lock(shared_memory_region);
-                    if (!message_still_available) break;
-                    this_thread::yield();
-                }
-
-                current_offset += fragment_size;
-                ++fragment_counter;
-            }
-            
-            // Вывод прогресса
-            if ((current_block_id + 1) % 10 == 0 || current_block_id + 1 == total_blocks_count) {
-                cout << "Прогресс: " << (current_block_id + 1) << "/" << total_blocks_count << " блоков отправлено" << endl;
-            }
+    // Вывод прогресса
+    channel_sender.set_progress_callback([&](const SenderStatistics& statistics) {
+        // Пропущенные блоки (дельта, возобновление) тоже двигают прогресс
+        if (statistics.processed_blocks % 10 == 0 ||
+            (input_source.size_known() && statistics.processed_blocks == total_blocks_count)) {
+            SHM_LOG(LogLevel::Info, "Прогресс: " << statistics.processed_blocks
+                    << (input_source.size_known() ? "/" + to_string(total_blocks_count) : string())
+                    << " блоков обработано (отправлено " << statistics.blocks << ")");
         }
+    });
 
-        auto compression_end_time = chrono::steady_clock::now();
-        double total_compression_time = chrono::duration<double>(compression_end_time - compression_start_time).count();
-        cout << "Все блоки данных успешно отправлены" << endl;
-        cout << "Время выполнения: " << total_compression_time << " секунд" << endl;
-        cout << "Статистика сжатия:" << endl;
-        cout << "  Исходный размер: " << total_file_size << " байт" << endl;
-        cout << "  Сжатый размер: " << total_compressed_size << " байт" << endl;
-        if (total_file_size > 0) {
-            double compression_ratio = 100.0 * (1.0 - double(total_compressed_size) / double(total_file_size));
-            cout << "  Степень сжатия: " << fixed << setprecision(2) << compression_ratio << " %" << endl;
-        }
+    cout << "Запуск параллельного сжатия: " << channel_sender.worker_count() << " потоков, окно "
+         << channel_sender.inflight_block_limit() << " блоков, кодек "
+         << (channel_options.adaptive_codec ? "auto" : block_codec_name(static_cast<uint8_t>(channel_options.block_codec)))
+         << endl;
+
+    auto compression_start_time = chrono::steady_clock::now();
+    bool transfer_succeeded = channel_sender.send_file(input_source);
+    if (!transfer_succeeded) {
+        cerr << "Ошибка: " << channel_sender.error_message() << endl;
     }
+    auto compression_end_time = chrono::steady_clock::now();
+    double total_compression_time = chrono::duration<double>(compression_end_time - compression_start_time).count();
 
-    // Отправка сигнала завершения
-    cout << "Отправка сигнала завершения..." << endl;
-    
-    while (true) {
-        acquire_shared_memory_lock(shared_memory_region);
-        if (shared_memory_region->message_available == 0) break;
-        release_shared_memory_lock(shared_memory_region);
-        this_thread::yield();
+    const SenderStatistics& statistics = channel_sender.statistics();
+    if (transfer_succeeded) cout << "Все блоки данных успешно отправлены" << endl;
+    cout << "Время выполнения: " << total_compression_time << " секунд" << endl;
+    cout << "Статистика сжатия:" << endl;
+    cout << "  Исходный размер: " << statistics.input_bytes << " байт" << endl;
+    cout << "  Сжатый размер: " << statistics.compressed_bytes << " байт" << endl;
+    if (statistics.input_bytes > 0) {
+        double compression_ratio = 100.0 * (1.0 - double(statistics.compressed_bytes) / double(statistics.input_bytes));
+        cout << "  Степень сжатия: " << fixed << setprecision(2) << compression_ratio << " %" << endl;
+    }
+    cout << "  Блоков по кодекам:";
+    for (const auto& [codec_name, block_count] : statistics.blocks_per_codec) cout << " " << codec_name << "=" << block_count;
+    cout << endl;
+    if (statistics.cached_blocks > 0 || statistics.referenced_blocks > 0) {
+        cout << "  Блоков из кэша кадров: " << statistics.cached_blocks << ", ссылками: " << statistics.referenced_blocks << endl;
+    }
+    if (statistics.unchanged_blocks > 0) {
+        cout << "  Блоков не отправлено (совпали со старой копией): " << statistics.unchanged_blocks << endl;
+    }
+    if (statistics.resumed_blocks > 0) {
+        cout << "  Блоков не отправлено (записаны прошлой попыткой): " << statistics.resumed_blocks << endl;
     }
-    
-    shared_memory_region->data_block_identifier = UINT32_MAX;
-    shared_memory_region->fragment_sequence_number = 0;
-    shared_memory_region->is_final_fragment = 1;
-    shared_memory_region->actual_payload_length = 0;
-    shared_memory_region->message_available = 1;
-    release_shared_memory_lock(shared_memory_region);
 
+    // Отправка сигнала завершения и освобождение ресурсов
+    channel_sender.close();
     cout << "Сигнал завершения отправлен" << endl;
 
-    // Освобождение ресурсов
-    munmap(reinterpret_cast<void*>(shared_memory_region), SHARED_MEMORY_SIZE);
+    if (!channel_options.report_path.empty()) {
+        RunReport run_report;
+        run_report.add("role", "producer");
+        run_report.add("seconds", total_compression_time);
+        run_report.add("input_bytes", statistics.input_bytes);
+        run_report.add("compressed_bytes", statistics.compressed_bytes);
+        run_report.add("blocks", statistics.blocks);
+        run_report.add("cached_blocks", statistics.cached_blocks);
+        run_report.add("referenced_blocks", statistics.referenced_blocks);
+        run_report.add("unchanged_blocks", statistics.unchanged_blocks);
+        run_report.add("resumed_blocks", statistics.resumed_blocks);
+        for (const auto& [codec_name, block_count] : statistics.blocks_per_codec) run_report.add("codec_blocks_" + codec_name, block_count);
+        run_report.add("success", transfer_succeeded ? 1 : 0);
+        channel_sender.cpu_placement().add_to_report(run_report);
+        run_report.add_resource_usage();
+        run_report.write(channel_options.report_path);
+    }
+    if (!transfer_succeeded) {
+        return 1;
+    }
     cout << "Работа producer завершена успешно" << endl;
     return 0;
-}
\ No newline at end of file
+}
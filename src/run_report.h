@@ -0,0 +1,65 @@
+// Машиночитаемый отчёт о запуске (--report=PATH)
+//
+// Одна строка "ключ=значение" на метрику; формат рассчитан на разбор скриптами и shm_bench.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <sys/resource.h>
+
+class RunReport {
+public:
+    template <typename Value>
+    void add(const std::string& key, const Value& value) {
+        std::ostringstream formatted_value;
+        formatted_value << std::setprecision(9) << value;
+        report_entries.emplace_back(key, formatted_value.str());
+    }
+
+    // Процессорное время и пиковая резидентная память текущего процесса
+    void add_resource_usage() {
+        struct rusage resource_usage;
+        if (getrusage(RUSAGE_SELF, &resource_usage) != 0) return;
+        add("cpu_user_seconds", resource_usage.ru_utime.tv_sec + resource_usage.ru_utime.tv_usec / 1e6);
+        add("cpu_system_seconds", resource_usage.ru_stime.tv_sec + resource_usage.ru_stime.tv_usec / 1e6);
+        add("max_rss_kb", resource_usage.ru_maxrss);
+    }
+
+    bool write(const std::string& path) const {
+        std::ofstream report_file(path, std::ios::trunc);
+        for (const auto& [key, value] : report_entries) report_file << key << "=" << value << "\n";
+        report_file.flush();
+        if (!report_file) {
+            std::cerr << "Ошибка записи отчёта '" << path << "'" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<std::pair<std::string, std::string>> report_entries;
+};
+
+// Накопитель задержек фрагментов: от публикации слота producer до его получения consumer
+class LatencyRecorder {
+public:
+    void record(uint64_t latency_ns) { latency_samples.push_back(latency_ns); }
+
+    void add_to_report(RunReport& report) {
+        report.add("latency_samples", latency_samples.size());
+        if (latency_samples.empty()) return;
+        std::sort(latency_samples.begin(), latency_samples.end());
+        auto percentile = [&](double fraction) {
+            size_t sample_index = static_cast<size_t>(fraction * double(latency_samples.size() - 1) + 0.5);
+            return latency_samples[sample_index];
+        };
+        report.add("latency_p50_ns", percentile(0.50));
+        report.add("latency_p90_ns", percentile(0.90));
+        report.add("latency_p99_ns", percentile(0.99));
+        report.add("latency_p999_ns", percentile(0.999));
+        report.add("latency_max_ns", latency_samples.back());
+    }
+
+private:
+    std::vector<uint64_t> latency_samples;
+};
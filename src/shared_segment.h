@@ -0,0 +1,145 @@
+// Сегменты каналов: POSIX shared memory или файл в hugetlbfs
+//
+// Путь сегмента - либо имя POSIX shm ("/NAME", лежит в /dev/shm), либо путь к файлу
+// в смонтированной hugetlbfs ("/dev/hugepages/NAME"): такой файл всегда состоит из больших
+// страниц, и обращения к кольцу и арене дают меньше промахов TLB. Режим thp оставляет
+// сегмент в /dev/shm и просит ядро отобразить его прозрачными большими страницами.
+//
+// Размер сегмента задаёт сторона, создавшая его; вторая сторона отображает файл целиком
+// и берёт геометрию из управляющего заголовка.
+//
+// С --numa (см. cpu_placement.h) ещё не выделенные страницы сегмента получают политику узла
+// сразу после отображения, до разметки: их размещает первая сторона, запросившая узел.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include "cpu_placement.h"
+
+// Большие страницы для сегмента кольца
+enum class HugePageMode {
+    Off,        // Обычные страницы /dev/shm
+    Transparent,// madvise(MADV_HUGEPAGE) для сегмента в /dev/shm (если ядро разрешает THP для shmem)
+    Hugetlbfs   // Файл в смонтированной hugetlbfs
+};
+
+constexpr const char* DEFAULT_HUGETLBFS_DIRECTORY = "/dev/hugepages";
+constexpr long HUGETLBFS_FILESYSTEM_MAGIC = 0x958458f6;
+constexpr size_t TRANSPARENT_HUGE_PAGE_SIZE = 2 * 1024 * 1024; // Размер страницы PMD на x86-64 и arm64
+
+static inline const char* huge_page_mode_name(HugePageMode huge_page_mode) {
+    switch (huge_page_mode) {
+        case HugePageMode::Transparent: return "thp";
+        case HugePageMode::Hugetlbfs: return "hugetlbfs";
+        default: return "off";
+    }
+}
+
+static inline bool parse_huge_page_mode(const std::string& text, HugePageMode& huge_page_mode) {
+    if (text == "off") huge_page_mode = HugePageMode::Off;
+    else if (text == "thp") huge_page_mode = HugePageMode::Transparent;
+    else if (text == "hugetlbfs") huge_page_mode = HugePageMode::Hugetlbfs;
+    else return false;
+    return true;
+}
+
+// Путь сегмента segment_name ("/NAME"): имя POSIX shm или файл в каталоге hugetlbfs
+static inline std::string shared_segment_path(HugePageMode huge_page_mode, const std::string& hugetlbfs_directory,
+                                              const std::string& segment_name) {
+    if (huge_page_mode != HugePageMode::Hugetlbfs) return segment_name;
+    std::string directory = hugetlbfs_directory;
+    while (directory.size() > 1 && directory.back() == '/') directory.pop_back();
+    return directory + segment_name;
+}
+
+// Имя POSIX shm содержит единственный "/" в начале, у файла в hugetlbfs их больше
+static inline bool is_posix_shared_memory_path(const std::string& segment_path) {
+    return segment_path.find('/', 1) == std::string::npos;
+}
+
+// Удаляет сегмент; безопасно вызывать из обработчика сигнала
+static inline int remove_shared_segment(const std::string& segment_path) {
+    return is_posix_shared_memory_path(segment_path) ? shm_unlink(segment_path.c_str()) : unlink(segment_path.c_str());
+}
+
+// Размер большой страницы каталога hugetlbfs; 0 - каталог не является hugetlbfs
+static inline size_t hugetlbfs_page_size(const std::string& hugetlbfs_directory) {
+    struct statfs filesystem_status;
+    if (statfs(hugetlbfs_directory.c_str(), &filesystem_status) != 0) return 0;
+    if (static_cast<long>(filesystem_status.f_type) != HUGETLBFS_FILESYSTEM_MAGIC) return 0;
+    return static_cast<size_t>(filesystem_status.f_bsize);
+}
+
+// Открывает сегмент и отображает его целиком. Пустой (только что созданный) сегмент получает
+// размер requested_size; размер существующего берётся из файла - его выбрала первая сторона.
+// mapping_alignment больше страницы выравнивает адрес отображения (THP отображает большими
+// страницами только выровненные диапазоны). nullptr и текст ошибки при неудаче.
+static inline void* map_shared_segment(const std::string& segment_path, size_t requested_size, size_t mapping_alignment,
+                                       size_t& mapped_size, std::string& error_message) {
+    int segment_descriptor = is_posix_shared_memory_path(segment_path)
+        ? shm_open(segment_path.c_str(), O_CREAT | O_RDWR, 0600)
+        : open(segment_path.c_str(), O_CREAT | O_RDWR, 0600);
+    if (segment_descriptor < 0) {
+        error_message = "открытие сегмента " + segment_path + ": " + strerror(errno);
+        return nullptr;
+    }
+    struct stat segment_status;
+    if (fstat(segment_descriptor, &segment_status) != 0) {
+        error_message = std::string("fstat: ") + strerror(errno);
+        close(segment_descriptor);
+        return nullptr;
+    }
+    if (segment_status.st_size == 0) {
+        // Одновременный ftruncate обеих сторон безопасен: выигрывает один размер, его и отобразим
+        if (ftruncate(segment_descriptor, static_cast<off_t>(requested_size)) != 0 ||
+            fstat(segment_descriptor, &segment_status) != 0) {
+            error_message = "ftruncate " + segment_path + ": " + strerror(errno);
+            close(segment_descriptor);
+            return nullptr;
+        }
+    }
+    mapped_size = static_cast<size_t>(segment_status.st_size);
+
+    // Резервируем диапазон с запасом на выравнивание и отображаем сегмент поверх него
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    void* mapping_hint = nullptr;
+    size_t reserved_length = 0;
+    uint8_t* reserved_region = nullptr;
+    if (mapping_alignment > page_size) {
+        reserved_length = mapped_size + mapping_alignment;
+        void* reservation = mmap(nullptr, reserved_length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reservation != MAP_FAILED) {
+            reserved_region = static_cast<uint8_t*>(reservation);
+            uintptr_t aligned_address = (reinterpret_cast<uintptr_t>(reserved_region) + mapping_alignment - 1) /
+                                        mapping_alignment * mapping_alignment;
+            mapping_hint = reinterpret_cast<void*>(aligned_address);
+        }
+    }
+    void* memory_region = mmap(mapping_hint, mapped_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | (mapping_hint ? MAP_FIXED : 0), segment_descriptor, 0);
+    close(segment_descriptor);
+    if (reserved_region) {
+        // Возвращаем неиспользованные края резерва (или весь резерв, если отображение не удалось)
+        uint8_t* aligned_region = static_cast<uint8_t*>(mapping_hint);
+        if (memory_region == MAP_FAILED) {
+            munmap(reserved_region, reserved_length);
+        } else {
+            size_t head_length = static_cast<size_t>(aligned_region - reserved_region);
+            size_t mapped_end = head_length + (mapped_size + page_size - 1) / page_size * page_size;
+            if (head_length > 0) munmap(reserved_region, head_length);
+            if (mapped_end < reserved_length) munmap(reserved_region + mapped_end, reserved_length - mapped_end);
+        }
+    }
+    if (memory_region == MAP_FAILED) {
+        error_message = "mmap " + segment_path + ": " + strerror(errno);
+        return nullptr;
+    }
+    if (segment_numa_node() != NUMA_NODE_NONE) bind_memory_to_node(memory_region, mapped_size, segment_numa_node());
+    return memory_region;
+}
@@ -0,0 +1,670 @@
+// shm_bench - набор замеров производительности producer/consumer
+//
+// Для каждой комбинации параметров запускает producer и consumer отдельными процессами
+// на приватном сегменте shared memory, проверяет, что файл передан без искажений, и
+// печатает строку метрик: пропускная способность, процентили задержки фрагментов,
+// процессорное время и пиковая память обеих сторон. Вывод - CSV или JSON Lines.
+// При нескольких producer (--producers) они передают копии корпуса одновременно в сеансе
+// одного consumer с --channels=N, а пропускная способность считается суммарной.
+// Раскладки (--layouts) привязывают потоки передачи producer и consumer к паре процессоров,
+// выбранной по топологии машины: с общим L2, с общим L3, в разных L3 или на разных узлах NUMA.
+
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "channel_options.h"
+#include "shm_mailbox.h"
+#include "shm_ring.h"
+
+using namespace std;
+
+// Параметры прогона: каждый список перебирается полностью
+struct BenchOptions {
+    vector<size_t> file_sizes = {1 << 20, 16 << 20};
+    vector<size_t> block_sizes = {DEFAULT_UNCOMPRESSED_BLOCK_SIZE};
+    vector<size_t> segment_sizes = {DEFAULT_RING_SEGMENT_SIZE};
+    bool segment_sizes_specified = false;
+    vector<size_t> slot_counts = {DEFAULT_RING_SLOT_COUNT};
+    vector<string> codecs = {"zlib"};
+    vector<string> levels = {"default"};
+    vector<size_t> thread_counts = {0};
+    vector<size_t> producer_counts = {1};
+    vector<string> huge_page_modes = {"off"};
+    vector<string> layouts = {"free"};
+    vector<string> corpora = {"zeros", "random", "text", "mixed"};
+    string channel_mode = "ring";
+    size_t repeat_count = 1;
+    bool json_output = false;
+    string output_path;               // Пусто - стандартный вывод
+    string binary_directory;          // Где лежат producer и consumer (по умолчанию рядом с shm_bench)
+    string work_directory = "/tmp";   // Где создаются корпуса и выходные файлы
+    unsigned timeout_seconds = 300;   // Сколько ждать одну передачу
+    bool verbose = false;             // Не скрывать вывод producer и consumer
+};
+
+static void print_bench_usage() {
+    cerr << "Использование: shm_bench [параметры]" << endl;
+    cerr << "Списки задаются через запятую, перебираются все комбинации:" << endl;
+    cerr << "  --sizes=1M,16M            размеры входного файла" << endl;
+    cerr << "  --block-sizes=64K         размеры несжатого блока" << endl;
+    cerr << "  --segment-sizes=4M        размеры сегмента кольца (слот = сегмент / слоты) или почтового ящика (256)" << endl;
+    cerr << "  --slots=64                количество слотов кольца" << endl;
+    cerr << "  --codecs=zlib             кодеки (zlib, deflate, lz4, zstd, store, auto)" << endl;
+    cerr << "  --levels=default          уровни сжатия (default - уровень кодека по умолчанию)" << endl;
+    cerr << "  --threads=0               потоков сжатия/распаковки (0 - по числу ядер)" << endl;
+    cerr << "  --corpora=zeros,random,text,mixed  виды входных данных" << endl;
+    cerr << "  --producers=1             одновременных producer (больше 1 - сеанс consumer с --channels=N)" << endl;
+    cerr << "  --huge-pages=off          большие страницы сегмента кольца (off, thp, hugetlbfs)" << endl;
+    cerr << "  --layouts=free            размещение потоков передачи (free, shared-l2, shared-l3, cross-l3, cross-node)" << endl;
+    cerr << "Прочие параметры:" << endl;
+    cerr << "  --channel=ring|arena|mailbox  режим канала (по умолчанию ring)" << endl;
+    cerr << "  --repeat=N                повторов каждой комбинации (по умолчанию 1)" << endl;
+    cerr << "  --format=csv|json         формат вывода (по умолчанию csv; json - по объекту на строку)" << endl;
+    cerr << "  --out=PATH                файл результатов вместо стандартного вывода" << endl;
+    cerr << "  --bin-dir=DIR             каталог с producer и consumer" << endl;
+    cerr << "  --work-dir=DIR            каталог временных файлов (по умолчанию /tmp)" << endl;
+    cerr << "  --timeout=SECONDS         предел времени одной передачи (по умолчанию 300)" << endl;
+    cerr << "  --verbose                 показывать вывод producer и consumer" << endl;
+}
+
+static vector<string> split_list(const string& text) {
+    vector<string> list_items;
+    stringstream list_stream(text);
+    string list_item;
+    while (getline(list_stream, list_item, ',')) {
+        if (!list_item.empty()) list_items.push_back(list_item);
+    }
+    return list_items;
+}
+
+static bool parse_size_list(const string& text, vector<size_t>& parsed_values) {
+    parsed_values.clear();
+    for (const string& list_item : split_list(text)) {
+        size_t parsed_value = 0;
+        if (!parse_size_argument(list_item, parsed_value)) return false;
+        parsed_values.push_back(parsed_value);
+    }
+    return !parsed_values.empty();
+}
+
+static bool parse_bench_options(int argc, char** argv, BenchOptions& options) {
+    for (int argument_index = 1; argument_index < argc; ++argument_index) {
+        string argument = argv[argument_index];
+        size_t separator_position = argument.find('=');
+        if (argument.rfind("--", 0) != 0) {
+            cerr << "Ошибка: неожиданный аргумент '" << argument << "'" << endl;
+            return false;
+        }
+        string option_name = argument.substr(2, separator_position == string::npos ? string::npos : separator_position - 2);
+        string option_value = separator_position == string::npos ? "" : argument.substr(separator_position + 1);
+
+        bool parsed = true;
+        if (option_name == "sizes") parsed = parse_size_list(option_value, options.file_sizes);
+        else if (option_name == "block-sizes") parsed = parse_size_list(option_value, options.block_sizes);
+        else if (option_name == "segment-sizes") {
+            parsed = parse_size_list(option_value, options.segment_sizes);
+            options.segment_sizes_specified = true;
+        }
+        else if (option_name == "slots") parsed = parse_size_list(option_value, options.slot_counts);
+        else if (option_name == "threads") parsed = parse_size_list(option_value, options.thread_counts);
+        else if (option_name == "producers") {
+            parsed = parse_size_list(option_value, options.producer_counts);
+            for (size_t producer_count : options.producer_counts) {
+                if (producer_count == 0 || producer_count > MAX_CHANNEL_COUNT) parsed = false;
+            }
+        }
+        else if (option_name == "huge-pages") {
+            options.huge_page_modes = split_list(option_value);
+            parsed = !options.huge_page_modes.empty();
+            for (const string& huge_pages : options.huge_page_modes) {
+                HugePageMode huge_page_mode;
+                if (!parse_huge_page_mode(huge_pages, huge_page_mode)) parsed = false;
+            }
+        }
+        else if (option_name == "layouts") {
+            options.layouts = split_list(option_value);
+            parsed = !options.layouts.empty();
+            for (const string& layout : options.layouts) {
+                if (layout != "free" && layout != "shared-l2" && layout != "shared-l3" && layout != "cross-l3" &&
+                    layout != "cross-node") {
+                    parsed = false;
+                }
+            }
+        }
+        else if (option_name == "codecs") parsed = !(options.codecs = split_list(option_value)).empty();
+        else if (option_name == "levels") parsed = !(options.levels = split_list(option_value)).empty();
+        else if (option_name == "corpora") {
+            options.corpora = split_list(option_value);
+            parsed = !options.corpora.empty();
+            for (const string& corpus_name : options.corpora) {
+                if (corpus_name != "zeros" && corpus_name != "random" && corpus_name != "text" && corpus_name != "mixed") {
+                    parsed = false;
+                }
+            }
+        }
+        else if (option_name == "channel") {
+            options.channel_mode = option_value;
+            parsed = option_value == "ring" || option_value == "arena" || option_value == "mailbox";
+        }
+        else if (option_name == "repeat") parsed = parse_size_argument(option_value, options.repeat_count) && options.repeat_count > 0;
+        else if (option_name == "format") {
+            options.json_output = option_value == "json";
+            parsed = option_value == "json" || option_value == "csv";
+        }
+        else if (option_name == "out") options.output_path = option_value;
+        else if (option_name == "bin-dir") options.binary_directory = option_value;
+        else if (option_name == "work-dir") options.work_directory = option_value;
+        else if (option_name == "timeout") {
+            size_t timeout_seconds = 0;
+            parsed = parse_size_argument(option_value, timeout_seconds) && timeout_seconds > 0;
+            options.timeout_seconds = static_cast<unsigned>(timeout_seconds);
+        }
+        else if (option_name == "verbose") options.verbose = true;
+        else if (option_name == "help") return false;
+        else {
+            cerr << "Ошибка: неизвестный параметр '" << argument << "'" << endl;
+            return false;
+        }
+        if (!parsed) {
+            cerr << "Ошибка: некорректное значение '" << argument << "'" << endl;
+            return false;
+        }
+    }
+    if (options.channel_mode == "mailbox") {
+        if (options.huge_page_modes != vector<string>{"off"}) {
+            cerr << "Ошибка: большие страницы доступны только для кольца и арены" << endl;
+            return false;
+        }
+        if (!options.segment_sizes_specified) options.segment_sizes = {DEFAULT_MAILBOX_SEGMENT_SIZE};
+    } else if (options.channel_mode == "arena" && !options.segment_sizes_specified) {
+        options.segment_sizes = {DEFAULT_ARENA_RING_SEGMENT_SIZE};
+    }
+    return true;
+}
+
+// Создаёт детерминированный корпус заданного вида
+static bool generate_corpus(const string& corpus_name, size_t file_size, const string& path) {
+    constexpr size_t WRITE_CHUNK_SIZE = 1 << 20;
+    constexpr size_t MIXED_SEGMENT_SIZE = 256 * 1024;
+    static const vector<string> text_vocabulary = {
+        "INFO ", "WARN ", "ERROR ", "request ", "response ", "latency=", "user_id=", "session ", "ok ",
+        "timeout ", "GET /api/v1/items ", "POST /api/v1/orders ", "200 ", "404 ", "500 ", "\n"};
+
+    ofstream corpus_file(path, ios::binary | ios::trunc);
+    if (!corpus_file) return false;
+    mt19937_64 random_generator(0x5348'4D42'454E'4348ull); // Одинаковые данные от запуска к запуску
+    vector<uint8_t> chunk;
+    chunk.reserve(WRITE_CHUNK_SIZE);
+    size_t generated = 0;
+
+    auto append_random = [&](size_t length) {
+        for (size_t index = 0; index < length; ++index) chunk.push_back(static_cast<uint8_t>(random_generator()));
+    };
+    auto append_text = [&](size_t length) {
+        size_t chunk_end = chunk.size() + length;
+        while (chunk.size() < chunk_end) {
+            const string& word = text_vocabulary[random_generator() % text_vocabulary.size()];
+            size_t copy_length = min(word.size(), chunk_end - chunk.size());
+            chunk.insert(chunk.end(), word.begin(), word.begin() + copy_length);
+            if (word == "latency=" && chunk.size() < chunk_end) {
+                string number = to_string(random_generator() % 100000) + " ";
+                copy_length = min(number.size(), chunk_end - chunk.size());
+                chunk.insert(chunk.end(), number.begin(), number.begin() + copy_length);
+            }
+        }
+    };
+
+    while (generated < file_size) {
+        chunk.clear();
+        size_t chunk_length = min(WRITE_CHUNK_SIZE, file_size - generated);
+        if (corpus_name == "zeros") {
+            chunk.assign(chunk_length, 0);
+        } else if (corpus_name == "random") {
+            append_random(chunk_length);
+        } else if (corpus_name == "text") {
+            append_text(chunk_length);
+        } else {
+            // mixed: чередование текста, случайных данных и нулей по 256 КБ
+            for (size_t chunk_offset = 0; chunk_offset < chunk_length;) {
+                size_t absolute_offset = generated + chunk_offset;
+                size_t segment_remaining = MIXED_SEGMENT_SIZE - absolute_offset % MIXED_SEGMENT_SIZE;
+                size_t piece_length = min(segment_remaining, chunk_length - chunk_offset);
+                switch ((absolute_offset / MIXED_SEGMENT_SIZE) % 3) {
+                    case 0: append_text(piece_length); break;
+                    case 1: append_random(piece_length); break;
+                    default: chunk.insert(chunk.end(), piece_length, 0); break;
+                }
+                chunk_offset += piece_length;
+            }
+        }
+        corpus_file.write(reinterpret_cast<const char*>(chunk.data()), static_cast<streamsize>(chunk.size()));
+        generated += chunk_length;
+    }
+    return static_cast<bool>(corpus_file.flush());
+}
+
+// Процессоры потоков передачи producer и consumer для раскладки; false - на этой машине её нет
+static bool layout_cpu_pair(const CpuTopology& topology, const string& layout, int& producer_cpu, int& consumer_cpu) {
+    auto pair_within = [&](const vector<vector<int>>& groups, bool avoid_shared_l2) {
+        for (const vector<int>& group : groups) {
+            if (group.size() < 2) continue;
+            producer_cpu = group[0];
+            consumer_cpu = group[1];
+            // Внутри общего L3 берём ядро без общего с первым L2, если такое есть
+            if (avoid_shared_l2) {
+                for (int cpu : group) {
+                    bool shares_l2 = any_of(topology.l2_groups.begin(), topology.l2_groups.end(), [&](const vector<int>& l2_group) {
+                        return binary_search(l2_group.begin(), l2_group.end(), producer_cpu) &&
+                               binary_search(l2_group.begin(), l2_group.end(), cpu);
+                    });
+                    if (!shares_l2) {
+                        consumer_cpu = cpu;
+                        break;
+                    }
+                }
+            }
+            return true;
+        }
+        return false;
+    };
+    auto pair_across = [&](const vector<vector<int>>& groups) {
+        if (groups.size() < 2 || groups[0].empty() || groups[1].empty()) return false;
+        producer_cpu = groups[0].front();
+        consumer_cpu = groups[1].front();
+        return true;
+    };
+    if (layout == "shared-l2") return pair_within(topology.l2_groups, false);
+    if (layout == "shared-l3") return pair_within(topology.l3_groups, true);
+    if (layout == "cross-l3") return pair_across(topology.l3_groups);
+    if (layout == "cross-node") {
+        vector<vector<int>> node_groups;
+        for (const auto& [node, cpus] : topology.node_cpus) {
+            if (!cpus.empty()) node_groups.push_back(cpus);
+        }
+        return pair_across(node_groups);
+    }
+    return true; // free: без привязки
+}
+
+// Сравнивает два файла побайтно
+static bool files_identical(const string& expected_path, const string& actual_path) {
+    ifstream expected_file(expected_path, ios::binary);
+    ifstream actual_file(actual_path, ios::binary);
+    if (!expected_file || !actual_file) return false;
+    vector<char> expected_chunk(1 << 20);
+    vector<char> actual_chunk(1 << 20);
+    while (true) {
+        expected_file.read(expected_chunk.data(), static_cast<streamsize>(expected_chunk.size()));
+        actual_file.read(actual_chunk.data(), static_cast<streamsize>(actual_chunk.size()));
+        streamsize expected_read = expected_file.gcount();
+        if (expected_read != actual_file.gcount()) return false;
+        if (expected_read == 0) return true;
+        if (memcmp(expected_chunk.data(), actual_chunk.data(), static_cast<size_t>(expected_read)) != 0) return false;
+    }
+}
+
+static map<string, string> read_report(const string& path) {
+    map<string, string> report_values;
+    ifstream report_file(path);
+    string report_line;
+    while (getline(report_file, report_line)) {
+        size_t separator_position = report_line.find('=');
+        if (separator_position != string::npos) {
+            report_values[report_line.substr(0, separator_position)] = report_line.substr(separator_position + 1);
+        }
+    }
+    return report_values;
+}
+
+// Дочерний процесс: producer или consumer с заданными аргументами
+static pid_t spawn_process(const string& executable_path, const vector<string>& arguments, bool verbose) {
+    pid_t child_pid = fork();
+    if (child_pid != 0) return child_pid;
+
+    if (!verbose) {
+        int null_descriptor = open("/dev/null", O_WRONLY);
+        if (null_descriptor >= 0) {
+            dup2(null_descriptor, STDOUT_FILENO);
+            dup2(null_descriptor, STDERR_FILENO);
+            close(null_descriptor);
+        }
+    }
+    vector<char*> argument_pointers;
+    argument_pointers.push_back(const_cast<char*>(executable_path.c_str()));
+    for (const string& argument : arguments) argument_pointers.push_back(const_cast<char*>(argument.c_str()));
+    argument_pointers.push_back(nullptr);
+    execv(executable_path.c_str(), argument_pointers.data());
+    _exit(127);
+}
+
+// Результат ожидания дочернего процесса
+struct ChildResult {
+    int exit_code = -1;
+    double cpu_seconds = 0;
+    long max_rss_kb = 0;
+};
+
+// Ждёт завершения всех producer и consumer; по истечении времени завершает их принудительно
+static bool wait_for_children(const vector<pid_t>& producer_pids, pid_t consumer_pid, unsigned timeout_seconds,
+                              vector<ChildResult>& producer_results, ChildResult& consumer_result) {
+    mutex watchdog_mutex;
+    condition_variable watchdog_condition;
+    bool children_finished = false;
+    bool timed_out = false;
+    thread watchdog_thread([&]() {
+        unique_lock<mutex> watchdog_lock(watchdog_mutex);
+        if (!watchdog_condition.wait_for(watchdog_lock, chrono::seconds(timeout_seconds), [&]() { return children_finished; })) {
+            timed_out = true;
+            for (pid_t producer_pid : producer_pids) kill(producer_pid, SIGKILL);
+            kill(consumer_pid, SIGKILL);
+        }
+    });
+
+    producer_results.assign(producer_pids.size(), ChildResult{});
+    for (size_t remaining_children = producer_pids.size() + 1; remaining_children > 0;) {
+        int wait_status = 0;
+        struct rusage child_usage;
+        pid_t finished_pid = wait4(-1, &wait_status, 0, &child_usage);
+        if (finished_pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        auto producer_iterator = find(producer_pids.begin(), producer_pids.end(), finished_pid);
+        ChildResult* result = producer_iterator != producer_pids.end()
+                            ? &producer_results[producer_iterator - producer_pids.begin()]
+                            : finished_pid == consumer_pid ? &consumer_result : nullptr;
+        if (!result) continue;
+        result->exit_code = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 128 + WTERMSIG(wait_status);
+        result->cpu_seconds = child_usage.ru_utime.tv_sec + child_usage.ru_utime.tv_usec / 1e6 +
+                              child_usage.ru_stime.tv_sec + child_usage.ru_stime.tv_usec / 1e6;
+        result->max_rss_kb = child_usage.ru_maxrss;
+        --remaining_children;
+    }
+
+    {
+        lock_guard<mutex> watchdog_lock(watchdog_mutex);
+        children_finished = true;
+    }
+    watchdog_condition.notify_one();
+    watchdog_thread.join();
+    return !timed_out;
+}
+
+// Каталог исполняемого файла shm_bench
+static string executable_directory() {
+    char executable_path[PATH_MAX];
+    ssize_t path_length = readlink("/proc/self/exe", executable_path, sizeof(executable_path) - 1);
+    if (path_length <= 0) return ".";
+    string path(executable_path, static_cast<size_t>(path_length));
+    size_t separator_position = path.rfind('/');
+    return separator_position == string::npos ? "." : path.substr(0, separator_position);
+}
+
+// Удаляет выходной каталог сеанса вместе с содержимым
+static void remove_directory_tree(const string& directory) {
+    nftw(directory.c_str(), [](const char* path, const struct stat*, int, struct FTW*) { return remove(path); },
+         16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Колонки результата в порядке вывода
+static const vector<string> RESULT_COLUMNS = {
+    "corpus", "file_bytes", "block_bytes", "segment_bytes", "slots", "fragment_bytes", "codec", "level", "threads",
+    "channel", "producers", "huge_pages", "layout", "producer_cpu", "consumer_cpu", "segment_numa_node", "repeat", "status", "wall_seconds", "throughput_mb_s", "compressed_bytes", "compression_ratio",
+    "latency_samples", "latency_p50_ns", "latency_p90_ns", "latency_p99_ns", "latency_p999_ns", "latency_max_ns",
+    "producer_cpu_seconds", "consumer_cpu_seconds", "producer_max_rss_kb", "consumer_max_rss_kb"};
+
+static void print_result_row(ostream& output, const map<string, string>& row, bool json_output) {
+    if (json_output) {
+        output << "{";
+        for (size_t column_index = 0; column_index < RESULT_COLUMNS.size(); ++column_index) {
+            const string& column = RESULT_COLUMNS[column_index];
+            auto value_iterator = row.find(column);
+            string value = value_iterator == row.end() ? "" : value_iterator->second;
+            bool numeric = !value.empty() && value.find_first_not_of("0123456789.-e+") == string::npos;
+            output << (column_index ? "," : "") << "\"" << column << "\":";
+            if (numeric) output << value;
+            else if (value.empty()) output << "null";
+            else output << "\"" << value << "\"";
+        }
+        output << "}" << endl;
+    } else {
+        for (size_t column_index = 0; column_index < RESULT_COLUMNS.size(); ++column_index) {
+            auto value_iterator = row.find(RESULT_COLUMNS[column_index]);
+            output << (column_index ? "," : "") << (value_iterator == row.end() ? "" : value_iterator->second);
+        }
+        output << endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchOptions bench_options;
+    if (!parse_bench_options(argc, argv, bench_options)) {
+        print_bench_usage();
+        return 1;
+    }
+    if (bench_options.binary_directory.empty()) bench_options.binary_directory = executable_directory();
+    string producer_path = bench_options.binary_directory + "/producer";
+    string consumer_path = bench_options.binary_directory + "/consumer";
+    if (access(producer_path.c_str(), X_OK) != 0 || access(consumer_path.c_str(), X_OK) != 0) {
+        cerr << "Ошибка: producer и consumer не найдены в '" << bench_options.binary_directory << "'" << endl;
+        return 1;
+    }
+
+    ofstream output_file;
+    if (!bench_options.output_path.empty()) {
+        output_file.open(bench_options.output_path, ios::trunc);
+        if (!output_file) {
+            cerr << "Ошибка: не удалось открыть '" << bench_options.output_path << "'" << endl;
+            return 1;
+        }
+    }
+    ostream& output = bench_options.output_path.empty() ? cout : output_file;
+    // Сеанс сохраняет файл по его пути без "/" в начале, поэтому путь к корпусу должен быть каноническим
+    char resolved_work_directory[PATH_MAX];
+    if (realpath(bench_options.work_directory.c_str(), resolved_work_directory)) {
+        bench_options.work_directory = resolved_work_directory;
+    }
+    if (!bench_options.json_output) {
+        for (size_t column_index = 0; column_index < RESULT_COLUMNS.size(); ++column_index) {
+            output << (column_index ? "," : "") << RESULT_COLUMNS[column_index];
+        }
+        output << endl;
+    }
+
+    // Все файлы и сегменты прогона помечены pid, чтобы параллельные запуски не мешали друг другу
+    string run_prefix = "shm_bench_" + to_string(getpid());
+    string file_prefix = bench_options.work_directory + "/" + run_prefix;
+    string output_path = file_prefix + "_output.bin";
+    string session_output_directory = file_prefix + "_output";
+    string producer_report_path = file_prefix + "_producer.report";
+    string consumer_report_path = file_prefix + "_consumer.report";
+    map<pair<string, size_t>, string> corpus_paths;
+    CpuTopology topology = CpuTopology::read();
+    for (const string& layout : bench_options.layouts) {
+        int producer_cpu = 0, consumer_cpu = 0;
+        if (!layout_cpu_pair(topology, layout, producer_cpu, consumer_cpu)) {
+            cerr << "Раскладка " << layout << " на этой машине невозможна и пропускается" << endl;
+        }
+    }
+    size_t run_counter = 0;
+    size_t failed_runs = 0;
+
+    for (const string& corpus_name : bench_options.corpora)
+    for (size_t file_size : bench_options.file_sizes)
+    for (size_t block_size : bench_options.block_sizes)
+    for (size_t segment_size : bench_options.segment_sizes)
+    for (size_t slot_count : bench_options.slot_counts)
+    for (const string& codec_name : bench_options.codecs)
+    for (const string& level : bench_options.levels)
+    for (size_t thread_count : bench_options.thread_counts)
+    for (size_t producer_count : bench_options.producer_counts)
+    for (const string& huge_pages : bench_options.huge_page_modes)
+    for (const string& layout : bench_options.layouts)
+    for (size_t repeat_index = 0; repeat_index < bench_options.repeat_count; ++repeat_index) {
+        int producer_cpu = -1, consumer_cpu = -1;
+        if (!layout_cpu_pair(topology, layout, producer_cpu, consumer_cpu)) continue;
+        string& corpus_path = corpus_paths[{corpus_name, file_size}];
+        if (corpus_path.empty()) {
+            corpus_path = file_prefix + "_" + corpus_name + "_" + to_string(file_size) + ".bin";
+            if (!generate_corpus(corpus_name, file_size, corpus_path)) {
+                cerr << "Ошибка: не удалось создать корпус '" << corpus_path << "'" << endl;
+                return 1;
+            }
+        }
+
+        // Полезная ёмкость фрагмента: слот кольца или почтовый ящик без заголовка
+        size_t ring_slot_size = compute_ring_slot_size(segment_size, static_cast<uint32_t>(slot_count));
+        string fragment_capacity = bench_options.channel_mode == "mailbox"
+            ? to_string(segment_size > sizeof(SharedMemoryHeader) ? segment_size - sizeof(SharedMemoryHeader) : 0)
+            : to_string(ring_slot_size > RING_SLOT_HEADER_SIZE ? ring_slot_size - RING_SLOT_HEADER_SIZE : 0);
+
+        string segment_name = "/" + run_prefix + "_" + to_string(run_counter++);
+        vector<string> common_arguments = {
+            "--channel=" + bench_options.channel_mode,
+            "--segment-name=" + segment_name,
+            "--segment-size=" + to_string(segment_size),
+            "--slots=" + to_string(slot_count),
+            "--block-size=" + to_string(block_size),
+        };
+        if (thread_count != 0) common_arguments.push_back("--threads=" + to_string(thread_count));
+        if (huge_pages != "off") common_arguments.push_back("--huge-pages=" + huge_pages);
+        bool session_run = producer_count > 1;
+        if (session_run) {
+            common_arguments.push_back("--session");
+            common_arguments.push_back("--channels=" + to_string(producer_count));
+        }
+
+        // Несколько producer передают жёсткие ссылки на корпус, чтобы имена файлов сеанса различались
+        vector<string> producer_input_paths;
+        vector<string> producer_report_paths;
+        for (size_t producer_index = 0; producer_index < producer_count; ++producer_index) {
+            string suffix = session_run ? "_" + to_string(producer_index) : string();
+            producer_input_paths.push_back(session_run ? file_prefix + "_input" + suffix + ".bin" : corpus_path);
+            producer_report_paths.push_back(producer_report_path + suffix);
+            if (session_run) {
+                unlink(producer_input_paths.back().c_str());
+                if (link(corpus_path.c_str(), producer_input_paths.back().c_str()) != 0) {
+                    cerr << "Ошибка: не удалось создать ссылку '" << producer_input_paths.back() << "': "
+                         << strerror(errno) << endl;
+                    return 1;
+                }
+            }
+            unlink(producer_report_paths.back().c_str());
+        }
+
+        vector<string> consumer_arguments = common_arguments;
+        vector<string> producer_layout_arguments;
+        if (layout != "free") {
+            // Пул и память каждой стороны следуют за её потоком передачи
+            consumer_arguments.push_back("--pin-transfer=" + to_string(consumer_cpu));
+            consumer_arguments.push_back("--numa=local");
+            producer_layout_arguments = {"--pin-transfer=" + to_string(producer_cpu), "--numa=local"};
+        }
+        consumer_arguments.push_back("--report=" + consumer_report_path);
+        consumer_arguments.push_back(session_run ? session_output_directory : output_path);
+
+        unlink(output_path.c_str());
+        remove_directory_tree(session_output_directory);
+        unlink(consumer_report_path.c_str());
+        cerr << "[" << run_counter << "] " << corpus_name << " " << file_size << " байт, блок " << block_size
+             << ", " << codec_name << " " << level << ", потоков " << thread_count << ", producer " << producer_count
+             << (layout == "free" ? string() : ", раскладка " + layout) << endl;
+
+        auto start_time = chrono::steady_clock::now();
+        pid_t consumer_pid = spawn_process(consumer_path, consumer_arguments, bench_options.verbose);
+        vector<pid_t> producer_pids;
+        for (size_t producer_index = 0; producer_index < producer_count; ++producer_index) {
+            vector<string> producer_arguments = common_arguments;
+            producer_arguments.insert(producer_arguments.end(), producer_layout_arguments.begin(), producer_layout_arguments.end());
+            producer_arguments.push_back("--codec=" + codec_name);
+            if (level != "default") producer_arguments.push_back("--level=" + level);
+            producer_arguments.push_back("--report=" + producer_report_paths[producer_index]);
+            producer_arguments.push_back(producer_input_paths[producer_index]);
+            producer_pids.push_back(spawn_process(producer_path, producer_arguments, bench_options.verbose));
+        }
+        vector<ChildResult> producer_results;
+        ChildResult consumer_result;
+        bool finished_in_time = wait_for_children(producer_pids, consumer_pid, bench_options.timeout_seconds,
+                                                  producer_results, consumer_result);
+        double wall_seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+        for (size_t channel_index = 0; channel_index < producer_count; ++channel_index) {
+            string channel_segment = session_run ? segment_name + "_" + to_string(channel_index) : segment_name;
+            HugePageMode huge_page_mode = HugePageMode::Off;
+            parse_huge_page_mode(huge_pages, huge_page_mode);
+            remove_shared_segment(shared_segment_path(huge_page_mode, DEFAULT_HUGETLBFS_DIRECTORY, channel_segment));
+        }
+
+        // Сводка по всем producer: процессорное время складывается, память - максимум
+        ChildResult producer_result;
+        uint64_t compressed_bytes = 0;
+        bool producers_succeeded = true;
+        for (size_t producer_index = 0; producer_index < producer_count; ++producer_index) {
+            producers_succeeded = producers_succeeded && producer_results[producer_index].exit_code == 0;
+            producer_result.cpu_seconds += producer_results[producer_index].cpu_seconds;
+            producer_result.max_rss_kb = max(producer_result.max_rss_kb, producer_results[producer_index].max_rss_kb);
+            string report_bytes = read_report(producer_report_paths[producer_index])["compressed_bytes"];
+            if (!report_bytes.empty()) compressed_bytes += stoull(report_bytes);
+        }
+
+        string status = "ok";
+        if (!finished_in_time) status = "timeout";
+        else if (!producers_succeeded || consumer_result.exit_code != 0) status = "failed";
+        for (size_t producer_index = 0; producer_index < producer_count && status == "ok"; ++producer_index) {
+            // Имя файла сеанса - путь producer без "/" в начале
+            string received_path = session_run ? session_output_directory + producer_input_paths[producer_index] : output_path;
+            if (!files_identical(corpus_path, received_path)) status = "mismatch";
+        }
+        if (status != "ok") ++failed_runs;
+
+        map<string, string> consumer_report = read_report(consumer_report_path);
+        uint64_t transferred_bytes = static_cast<uint64_t>(file_size) * producer_count;
+        map<string, string> row = {
+            {"corpus", corpus_name}, {"file_bytes", to_string(file_size)}, {"block_bytes", to_string(block_size)},
+            {"segment_bytes", to_string(segment_size)}, {"slots", to_string(slot_count)},
+            {"fragment_bytes", fragment_capacity},
+            {"codec", codec_name}, {"level", level}, {"threads", to_string(thread_count)},
+            {"channel", bench_options.channel_mode}, {"producers", to_string(producer_count)},
+            {"huge_pages", huge_pages}, {"layout", layout},
+            {"producer_cpu", producer_cpu < 0 ? string() : to_string(producer_cpu)},
+            {"consumer_cpu", consumer_cpu < 0 ? string() : to_string(consumer_cpu)},
+            {"repeat", to_string(repeat_index)}, {"status", status},
+            {"wall_seconds", to_string(wall_seconds)},
+            {"throughput_mb_s", to_string(wall_seconds > 0 ? double(transferred_bytes) / 1e6 / wall_seconds : 0.0)},
+            {"compressed_bytes", to_string(compressed_bytes)},
+            {"producer_cpu_seconds", to_string(producer_result.cpu_seconds)},
+            {"consumer_cpu_seconds", to_string(consumer_result.cpu_seconds)},
+            {"producer_max_rss_kb", to_string(producer_result.max_rss_kb)},
+            {"consumer_max_rss_kb", to_string(consumer_result.max_rss_kb)},
+        };
+        if (compressed_bytes > 0 && transferred_bytes > 0) {
+            row["compression_ratio"] = to_string(double(compressed_bytes) / double(transferred_bytes));
+        }
+        for (const char* latency_key : {"latency_samples", "latency_p50_ns", "latency_p90_ns", "latency_p99_ns",
+                                        "latency_p999_ns", "latency_max_ns", "segment_numa_node"}) {
+            row[latency_key] = consumer_report[latency_key];
+        }
+        print_result_row(output, row, bench_options.json_output);
+    }
+
+    for (const auto& corpus_entry : corpus_paths) unlink(corpus_entry.second.c_str());
+    unlink(output_path.c_str());
+    remove_directory_tree(session_output_directory);
+    unlink(producer_report_path.c_str());
+    for (size_t producer_index = 0; producer_index < MAX_CHANNEL_COUNT; ++producer_index) {
+        unlink((file_prefix + "_input_" + to_string(producer_index) + ".bin").c_str());
+        unlink((producer_report_path + "_" + to_string(producer_index)).c_str());
+    }
+    unlink(consumer_report_path.c_str());
+    if (failed_runs > 0) {
+        cerr << "Неудачных прогонов: " << failed_runs << endl;
+        return 1;
+    }
+    return 0;
+}
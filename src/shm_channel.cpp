@@ -0,0 +1,2721 @@
+// Библиотека shm_channel: конвейер блоков producer и consumer за API сообщений (см. shm_channel.h)
+
+#include "shm_channel.h"
+
+#include "block_cache.h"
+#include "block_frame.h"
+#include "codec.h"
+#include "deflate_archive.h"
+#include "delta_transfer.h"
+#include "log.h"
+#include "shm_mailbox.h"
+#include "shm_ring.h"
+#include "stage_stats.h"
+#include "thread_pool.h"
+#include "transfer_checkpoint.h"
+#include "transfer_protocol.h"
+#include "wait_strategy.h"
+
+using namespace std;
+
+// Создаёт пул потоков сжатия или распаковки; отказ системы создать поток становится ошибкой open
+static bool create_worker_pool(const ChannelOptions& options, const CpuPlacement& placement,
+                               unique_ptr<WorkStealingThreadPool>& pool, string& error_message) {
+    // Без --threads потоков столько, сколько процессоров в наборе пула
+    size_t worker_count = options.worker_thread_count ? options.worker_thread_count : placement.worker_cpus.size();
+    try {
+        pool = make_unique<WorkStealingThreadPool>(worker_count, placement.worker_cpus);
+    } catch (const system_error& creation_error) {
+        error_message = string("не удалось создать потоки сжатия/распаковки: ") + creation_error.what();
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Отправка
+// ---------------------------------------------------------------------------
+
+// Передаёт фрагмент через кольцевой буфер; ждёт только при заполненном кольце. false - consumer пропал
+static bool send_ring_fragment(RingChannel& ring, uint32_t transfer_id, uint32_t block_id, uint32_t fragment_number,
+                               bool is_final, const uint8_t* payload, size_t payload_length) {
+    RingSlotHeader* slot = ring_acquire_write_slot(ring);
+    if (!slot) return false;
+    slot->transfer_identifier = transfer_id;
+    slot->data_block_identifier = block_id;
+    slot->fragment_sequence_number = fragment_number;
+    slot->is_final_fragment = is_final ? 1 : 0;
+    slot->actual_payload_length = static_cast<uint32_t>(payload_length);
+    slot->payload_in_arena = 0;
+    if (payload_length > 0) {
+        memcpy(ring_slot_payload(slot), payload, payload_length);
+    }
+    ring_publish_write_slot(ring);
+    return true;
+}
+
+// Отправляет дескриптор блока, уже сжатого в область арены; false - consumer пропал
+static bool send_arena_descriptor(RingChannel& ring, uint32_t transfer_id, uint32_t block_id, uint32_t region_index,
+                                  size_t compressed_length) {
+    RingSlotHeader* slot = ring_acquire_write_slot(ring);
+    if (!slot) return false;
+    slot->transfer_identifier = transfer_id;
+    slot->data_block_identifier = block_id;
+    slot->fragment_sequence_number = 0;
+    slot->is_final_fragment = 1;
+    slot->actual_payload_length = 0;
+    slot->payload_in_arena = 1;
+    slot->arena_payload_offset = static_cast<uint64_t>(region_index) * ring.arena_region_size;
+    slot->arena_payload_length = static_cast<uint32_t>(compressed_length);
+    ring_publish_write_slot(ring);
+    return true;
+}
+
+// Сжимает блок в кадр (заголовок + данные) в заданном буфере; возвращает длину кадра.
+// Если данные не сжимаются, блок передаётся без сжатия (codec_id = Store).
+// dictionary - данные передачи перед блоком для кодека цепочки (nullptr - без словаря).
+static size_t encode_block_frame(const uint8_t* input_data, size_t input_length,
+                                 uint8_t* output_buffer, size_t output_capacity, const CodecChoice& codec_choice,
+                                 const vector<uint8_t>* dictionary = nullptr) {
+    BlockFrameHeader frame_header{};
+    frame_header.frame_magic = BLOCK_FRAME_MAGIC;
+    frame_header.frame_version = BLOCK_FRAME_VERSION;
+    frame_header.codec_id = static_cast<uint8_t>(codec_choice.compressor->codec_id());
+    frame_header.uncompressed_length = static_cast<uint32_t>(input_length);
+    frame_header.checksum = compute_crc32c(input_data, input_length);
+
+    uint8_t* payload_buffer = output_buffer + sizeof(BlockFrameHeader);
+    size_t payload_capacity = output_capacity - sizeof(BlockFrameHeader);
+    size_t payload_length = SIZE_MAX;
+    bool try_compression = input_length > 0 && codec_choice.compressor->codec_id() != BlockCodec::Store &&
+                           (!codec_choice.sample_first || block_looks_compressible(input_data, input_length));
+    if (try_compression) {
+        payload_length = dictionary && !dictionary->empty()
+            ? codec_choice.compressor->compress_with_dictionary(input_data, input_length, payload_buffer, payload_capacity,
+                                                                codec_choice.level, dictionary->data(), dictionary->size())
+            : codec_choice.compressor->compress(input_data, input_length, payload_buffer, payload_capacity, codec_choice.level);
+        if (payload_length == SIZE_MAX) {
+            SHM_LOG(LogLevel::Warn, "Ошибка сжатия " << codec_choice.compressor->codec_name()
+                    << ", блок передаётся без сжатия");
+        }
+    }
+    if (payload_length == SIZE_MAX || payload_length >= input_length) {
+        // Несжимаемые данные передаем как есть: распаковка сводится к копированию
+        frame_header.codec_id = static_cast<uint8_t>(BlockCodec::Store);
+        memcpy(payload_buffer, input_data, input_length);
+        payload_length = input_length;
+    }
+    frame_header.compressed_length = static_cast<uint32_t>(payload_length);
+    memcpy(output_buffer, &frame_header, sizeof(frame_header));
+    return sizeof(BlockFrameHeader) + payload_length;
+}
+
+// Кадр блока из кэша кадров или, при промахе, сжатый заново и сохранённый в кэш
+// (frame_cache == nullptr - без кэша); frame_from_cache - кадр взят из кэша
+static size_t encode_cached_block_frame(const uint8_t* input_data, size_t input_length, uint64_t content_hash,
+                                        uint8_t* output_buffer, size_t output_capacity, const CodecChoice& codec_choice,
+                                        BlockFrameCache* frame_cache, bool& frame_from_cache,
+                                        const vector<uint8_t>* dictionary = nullptr) {
+    frame_from_cache = false;
+    if (frame_cache) {
+        size_t cached_length = frame_cache->lookup(content_hash, input_length, compute_crc32c(input_data, input_length),
+                                                   output_buffer, output_capacity);
+        if (cached_length > 0) {
+            frame_from_cache = true;
+            return cached_length;
+        }
+    }
+    size_t frame_length = encode_block_frame(input_data, input_length, output_buffer, output_capacity, codec_choice, dictionary);
+    if (frame_cache) frame_cache->store(content_hash, output_buffer, frame_length);
+    return frame_length;
+}
+
+// Результат сжатия: буфер кадра из запаса отправителя или область арены
+struct CompressedBlock {
+    vector<uint8_t> frame_buffer;
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    uint64_t content_hash = 0;     // XXH64 несжатого блока (если включён кэш или окно ссылок)
+    bool frame_from_cache = false; // Кадр взят из кэша кадров без сжатия
+    bool unchanged_block = false;  // Дельта-передача: блок совпал со старой копией и не отправляется
+};
+
+// Передача отправителя: сообщение, файл, пакет мелких файлов или поток.
+// Блоки разных передач делят одно окно сжатия и идут в канал вперемешку.
+struct OutgoingTransfer {
+    uint32_t transfer_id = 0;
+    uint32_t next_block_id = 0;
+    uint64_t input_bytes = 0;
+    uint64_t sent_blocks = 0;                     // Блоков отправлено (без совпавших со старой копией и записанных раньше)
+    size_t pending_blocks = 0;                    // Блоков передачи в окне сжатия
+    unique_ptr<DeltaSignature> delta_signature;   // Сигнатура старой копии и карта записанных блоков у consumer
+    bool chained_deflate = false;                 // Блоки сжимаются цепочкой deflate (TRANSFER_FLAG_CHAINED)
+    shared_ptr<const vector<uint8_t>> deflate_dictionary; // Хвост данных передачи перед следующим блоком цепочки
+    BlockInputSource* releasing_source = nullptr; // Источник, которому возвращаются отправленные блоки
+    bool open = false;
+
+    // Буферы ChannelStreamWriter: на один больше окна, поэтому заполняемый буфер никогда не в работе
+    vector<vector<uint8_t>> block_buffers;
+    size_t buffer_index = 0;
+    size_t buffer_fill = 0;
+};
+
+// Блок в работе: входные данные живут, пока сжатый блок не отправлен
+struct PendingBlock {
+    OutgoingTransfer* transfer = nullptr;
+    InputBlock input_block;
+    uint32_t block_id = 0;
+    uint32_t arena_region = 0;
+    future<CompressedBlock> compressed_block;
+};
+
+struct ChannelSender::Impl {
+    ChannelOptions options;
+    SharedMemoryHeader* shared_memory_region = nullptr;
+    RingChannel ring_channel;
+    string channel_segment;                  // Имя сегмента занятого канала
+    uint32_t* channel_owner_word = nullptr;  // PID producer в заголовке канала
+    SharedMemoryHeader* reverse_region = nullptr; // Обратный канал: сигнатуры (--delta, --resume) и итоги передач
+    bool delivery_confirmation = false;      // Ждать от consumer итог каждой передачи (set_delivery_confirmation)
+    size_t fragment_capacity = 0;
+    bool use_arena = false;
+    bool channel_open = false;
+
+    // Живость consumer: ожидания канала прерываются, если он пропал
+    ChannelLiveness* channel_liveness = nullptr;
+    PeerWatch consumer_watch;
+    PeerCheck consumer_check = [this]() { return consumer_watch.peer_present(); };
+    bool consumer_lost = false; // Consumer пропал: передачи завершаются без отправки
+
+    // Счётчики стадий объявлены до пула, чтобы пережить его потоки
+    StageStats stage_stats;
+    unique_ptr<WorkStealingThreadPool> compression_pool;
+    size_t inflight_block_limit = 0;
+
+    const BlockCompressor* fixed_compressor = nullptr;
+    CodecChoice fixed_codec_choice{};
+    AdaptiveCodecSelector adaptive_codec_selector;
+
+    deque<PendingBlock> compression_window;       // Блоки всех передач, сжимаемые впереди отправки
+    vector<vector<uint8_t>> spare_frame_buffers;  // Буферы кадров уже отправленных блоков
+    uint64_t arena_sequence = 0;                  // Сколько блоков сжато в арену: область = номер % R
+    BlockFrameCache frame_cache;                  // Сжатые кадры по хешу блока (--block-cache)
+    SentFrameWindow sent_frame_window;            // Кадры, которые consumer хранит для ссылок (--reference-window)
+    uint8_t reference_frame[REFERENCE_FRAME_LENGTH]; // Кадр-ссылка для отправки фрагментами
+
+    uint32_t next_transfer_id = 1;
+    vector<OutgoingTransfer*> open_transfers;               // Передачи, конец которых ещё не отправлен
+    vector<TransferEntryDescription> transfer_entries;      // Записи описания передачи (переиспользуются)
+    vector<uint8_t> info_payload_buffer;                    // Закодированное описание передачи
+    vector<uint8_t> pack_buffer;                            // Данные пакета мелких файлов подряд
+    vector<vector<vector<uint8_t>>> spare_stream_buffer_sets; // Буферы завершённых потоков
+
+    SenderStatistics statistics;
+    function<void(const SenderStatistics&)> progress_callback;
+    string error_message;
+    CpuPlacement placement; // Привязка потоков и узел памяти, применённые при open
+
+    bool open(const ChannelOptions& channel_options) {
+        if (channel_open) {
+            error_message = "канал уже открыт";
+            return false;
+        }
+        options = channel_options;
+        fixed_compressor = find_block_compressor(options.block_codec);
+        if (!fixed_compressor) {
+            error_message = string("кодек ") + block_codec_name(static_cast<uint8_t>(options.block_codec)) +
+                            " не поддерживается этой сборкой";
+            return false;
+        }
+        fixed_codec_choice = CodecChoice{fixed_compressor,
+            options.compression_level == DEFAULT_COMPRESSION_LEVEL ? fixed_compressor->default_level()
+                                                                   : options.compression_level,
+            false};
+
+        // Поток, открывающий канал, становится потоком передачи: привязываем его до того,
+        // как будут отображены сегменты и созданы потоки сжатия
+        if (!apply_cpu_placement(options.cpu_placement, placement, error_message)) return false;
+        segment_numa_node() = placement.numa_node;
+
+        // Многопоточное сжатие блоков в пуле фиксированного размера. Пул создаётся до того,
+        // как занят канал: при отказе создать потоки в /dev/shm ничего не остаётся
+        if (!create_worker_pool(options, placement, compression_pool, error_message)) return false;
+
+        // Занимаем канал: почтовый ящик или кольцевой буфер
+        if (!claim_free_channel()) {
+            compression_pool.reset();
+            return false;
+        }
+        placement.segment_node = memory_node_of(shared_memory_region ? static_cast<const void*>(shared_memory_region)
+                                                                     : static_cast<const void*>(ring_channel.control));
+
+        // Счётчики стадий для shm_stat в отдельном сегменте рядом с каналом
+        if (options.stats_enabled) {
+            if (!stage_stats.open(stats_segment_name(channel_segment, StatsRole::Producer), StatsRole::Producer)) {
+                SHM_LOG(LogLevel::Warn, "Предупреждение: не удалось создать сегмент счётчиков, shm_stat недоступен");
+            }
+        }
+
+        if (options.delta_transfer || options.resume_transfers) open_reverse_channel();
+        frame_cache.configure(options.block_cache_size, options.block_cache_directory);
+        sent_frame_window.configure(options.reference_window);
+
+        inflight_block_limit = options.inflight_block_limit
+            ? options.inflight_block_limit
+            : 2 * compression_pool->worker_count();
+        if (use_arena) {
+            // Блоки занимают области по кругу, поэтому окно не может быть больше числа областей
+            inflight_block_limit = min<size_t>(inflight_block_limit, ring_channel.arena_region_count);
+        }
+        channel_open = true;
+        return true;
+    }
+
+    // Открывает каналы по порядку и занимает первый, у которого нет живого producer
+    bool claim_free_channel() {
+        const char* default_segment_name = options.channel_mode == ChannelMode::Mailbox ? SHARED_MEMORY_SEGMENT_NAME
+                                                                                          : RING_SEGMENT_NAME;
+        string busy_description;
+        for (uint32_t channel_index = 0; channel_index < options.channel_count; ++channel_index) {
+            string segment_name = indexed_channel_segment_name(options, default_segment_name, channel_index);
+            uint32_t* owner_word = nullptr;
+            if (options.channel_mode == ChannelMode::Mailbox) {
+                shared_memory_region = initialize_shared_memory(segment_name, options.ring_segment_size, error_message);
+                if (!shared_memory_region) return false;
+                owner_word = mailbox_owner_word(shared_memory_region, true);
+            } else {
+                if (!open_ring_channel(options, segment_name, true, ring_channel, error_message)) return false;
+                owner_word = ring_owner_word(ring_channel, true);
+            }
+
+            uint32_t current_owner = 0;
+            if (claim_channel_side(owner_word, current_owner)) {
+                channel_segment = segment_name;
+                channel_owner_word = owner_word;
+                watch_consumer();
+                recover_channel_state(current_owner);
+                if (shared_memory_region) {
+                    fragment_capacity = shared_memory_region->payload_capacity;
+                } else {
+                    fragment_capacity = ring_payload_capacity(ring_channel);
+                    use_arena = ring_has_arena(ring_channel);
+                    if (!adopt_ring_block_size()) {
+                        release_channel_side(owner_word);
+                        close_ring_channel(ring_channel, false);
+                        return false;
+                    }
+                }
+                SHM_LOG(LogLevel::Debug, "Занят канал " << segment_name);
+                return true;
+            }
+            busy_description = "канал " + segment_name + " занят producer (PID " + to_string(current_owner) + ")";
+            SHM_LOG(LogLevel::Debug, busy_description);
+            if (shared_memory_region) {
+                munmap(reinterpret_cast<void*>(shared_memory_region), mailbox_mapped_size(shared_memory_region));
+                shared_memory_region = nullptr;
+            } else {
+                close_ring_channel(ring_channel, false);
+            }
+        }
+        error_message = options.channel_count == 1
+            ? busy_description
+            : "все каналы (" + to_string(options.channel_count) + ") заняты другими producer";
+        return false;
+    }
+
+    // Ожидания канала проверяют consumer: пропавший consumer прерывает передачу, а не вешает producer
+    void watch_consumer() {
+        channel_liveness = shared_memory_region ? mailbox_liveness(shared_memory_region) : ring_liveness(ring_channel);
+        consumer_watch.attach(consumer_owner_word(), &channel_liveness->consumer_heartbeat_ns,
+                              &channel_liveness->producer_heartbeat_ns, uint64_t(options.peer_timeout_seconds) * 1000000000ull);
+        consumer_lost = false;
+        ring_channel.peer_check = &consumer_check;
+    }
+
+    // Состояние канала после прежнего producer. Штатно завершившийся producer оставляет канал
+    // пустым; упавший (previous_owner != 0) - недописанные слоты и занятые области арены.
+    // Без consumer их сбрасывает сам producer. Живой consumer может ещё распаковывать блоки
+    // из арены, поэтому канал восстанавливает он, а producer ждёт подтверждения.
+    void recover_channel_state(uint32_t previous_owner) {
+        uint32_t generation = __atomic_add_fetch(&channel_liveness->producer_generation, 1, __ATOMIC_ACQ_REL);
+        bool state_stale = previous_owner != 0 || __atomic_load_n(&channel_liveness->state_stale, __ATOMIC_ACQUIRE) != 0;
+        if (previous_owner != 0) {
+            SHM_LOG(LogLevel::Warn, "Канал " << channel_segment << " оставлен завершившимся producer (PID " << previous_owner
+                    << "), состояние канала восстанавливается");
+        }
+        if (state_stale && channel_side_alive(consumer_owner_word())) {
+            __atomic_store_n(&channel_liveness->state_stale, 1, __ATOMIC_RELEASE);
+            __atomic_store_n(&channel_liveness->recovery_request, generation, __ATOMIC_RELEASE);
+            if (wait_for_value(&channel_liveness->recovery_acknowledged, generation, options.wait_strategy, &consumer_check)) {
+                SHM_LOG(LogLevel::Debug, "Канал " << channel_segment << " восстановлен consumer");
+                return;
+            }
+            SHM_LOG(LogLevel::Warn, "Consumer не восстановил канал " << channel_segment << ", состояние сбрасывается");
+        }
+        // Consumer нет (или он пропал, не ответив): весь канал принадлежит producer
+        if (shared_memory_region) {
+            mailbox_reset_message_state(shared_memory_region);
+        } else if (state_stale) {
+            ring_discard_state(ring_channel, true);
+        }
+        __atomic_store_n(&channel_liveness->state_stale, 0, __ATOMIC_RELEASE);
+        consumer_watch.forget();
+    }
+
+    // Ожидание канала прервано: consumer пропал. Передачи дальше завершаются без отправки.
+    void mark_consumer_lost() {
+        if (consumer_lost) return;
+        consumer_lost = true;
+        error_message = "consumer (PID " + to_string(consumer_watch.lost_process_id) + ") перестал отвечать, передача прервана";
+        SHM_LOG(LogLevel::Warn, error_message);
+    }
+
+    // Обратный канал занятого канала; без него передачи отправляются целиком
+    void open_reverse_channel() {
+        string reverse_error;
+        reverse_region = initialize_shared_memory(reverse_segment_name(channel_segment), REVERSE_SEGMENT_SIZE, reverse_error);
+        if (!reverse_region) {
+            SHM_LOG(LogLevel::Warn, "Обратный канал недоступен (" << reverse_error << "), передачи отправляются целиком");
+            return;
+        }
+        // Сообщение, оставшееся от прежнего producer, уже никому не нужно
+        mailbox_reset_message_state(reverse_region);
+    }
+
+    uint32_t* consumer_owner_word() {
+        return shared_memory_region ? mailbox_owner_word(shared_memory_region, false) : ring_owner_word(ring_channel, false);
+    }
+
+    // Ответ по обратному каналу присылает consumer, прочитавший сообщения передачи. Ожидание
+    // проверяет его так же, как ожидания кольца (consumer_check): ещё не занявшего канал consumer
+    // ждём, как ждало бы заполненное кольцо, а пропавший или молчащий дольше --peer-timeout
+    // прерывает передачу. false - consumer пропал
+    bool receive_reverse_reply(uint32_t transfer_id, uint32_t block_id, const char* awaited_reply, vector<uint8_t>& payload) {
+        if (!channel_side_alive(consumer_owner_word()) &&
+            __atomic_load_n(mailbox_message_flag(reverse_region), __ATOMIC_ACQUIRE) == 0) {
+            SHM_LOG(LogLevel::Info, "Ожидание consumer для " << awaited_reply << " передачи " << transfer_id << "...");
+        }
+        if (reverse_receive_message(reverse_region, transfer_id, block_id, payload, &consumer_check)) return true;
+        mark_consumer_lost();
+        return false;
+    }
+
+    // Дельта-передача: ждёт сигнатуру старой копии; без неё передача идёт целиком
+    void receive_delta_signature(OutgoingTransfer& transfer) {
+        vector<uint8_t> signature_payload;
+        if (!receive_reverse_reply(transfer.transfer_id, DELTA_SIGNATURE_BLOCK_ID, "сигнатуры", signature_payload)) return;
+        auto delta_signature = make_unique<DeltaSignature>();
+        string signature_error;
+        if (!decode_delta_signature(signature_payload, options.uncompressed_block_size, *delta_signature, signature_error)) {
+            SHM_LOG(LogLevel::Warn, "Сигнатура передачи " << transfer.transfer_id << " отброшена: " << signature_error);
+            return;
+        }
+        SHM_LOG(LogLevel::Debug, "Передача " << transfer.transfer_id << ": "
+                << (delta_signature->available ? "старая копия " + to_string(delta_signature->existing_size) + " байт, блоков " +
+                                                     to_string(delta_signature->content_hashes.size())
+                                               : string("старой копии нет"))
+                << (delta_signature->received_block_count ? ", контрольная точка прошлой попытки" : ""));
+        if (delta_signature->available || delta_signature->received_block_count) transfer.delta_signature = move(delta_signature);
+    }
+
+    // Размер блока берётся из заголовка кольца, если не задан явно; явно заданный блок
+    // должен помещаться в область арены, размеченной другой стороной
+    bool adopt_ring_block_size() {
+        if (!options.uncompressed_block_size_specified && ring_channel.block_size != 0 &&
+            ring_channel.block_size <= MAX_UNCOMPRESSED_BLOCK_SIZE) {
+            if (ring_channel.block_size != options.uncompressed_block_size) {
+                SHM_LOG(LogLevel::Debug, "Размер блока " << ring_channel.block_size << " байт взят из кольца");
+            }
+            options.uncompressed_block_size = ring_channel.block_size;
+        }
+        if (use_arena && arena_region_size_for(options.uncompressed_block_size) > ring_channel.arena_region_size) {
+            error_message = "блок " + to_string(options.uncompressed_block_size) + " байт не помещается в область арены (" +
+                            to_string(ring_channel.arena_region_size) + " байт, размечена под блок " +
+                            to_string(ring_channel.block_size) + " байт)";
+            return false;
+        }
+        return true;
+    }
+
+    // false - consumer пропал (сейчас или раньше), фрагмент не доставлен
+    bool send_fragment(uint32_t transfer_id, uint32_t block_id, uint32_t fragment_number, bool is_final,
+                       const uint8_t* payload, size_t payload_length, bool wait_for_acknowledgement) {
+        if (consumer_lost) return false;
+        bool fragment_sent = shared_memory_region
+            ? send_mailbox_fragment(shared_memory_region, options.wait_strategy, transfer_id, block_id, fragment_number,
+                                    is_final, payload, payload_length, wait_for_acknowledgement, &consumer_check)
+            : send_ring_fragment(ring_channel, transfer_id, block_id, fragment_number, is_final, payload, payload_length);
+        if (!fragment_sent) mark_consumer_lost();
+        return fragment_sent;
+    }
+
+    // Разбивает сообщение канала на фрагменты; фрагменты одного сообщения идут подряд
+    bool send_fragmented(uint32_t transfer_id, uint32_t block_id, const uint8_t* data, size_t length) {
+        size_t current_offset = 0;
+        uint32_t fragment_counter = 0;
+        do {
+            size_t fragment_size = min(fragment_capacity, length - current_offset);
+            bool is_final = current_offset + fragment_size >= length;
+            if (!send_fragment(transfer_id, block_id, fragment_counter, is_final, data + current_offset, fragment_size, true)) {
+                return false;
+            }
+            current_offset += fragment_size;
+            ++fragment_counter;
+        } while (current_offset < length);
+        return true;
+    }
+
+    // Кодек для следующего блока: фиксированный или выбранный адаптивно
+    CodecChoice next_codec_choice() const {
+        return options.adaptive_codec ? adaptive_codec_selector.current_choice() : fixed_codec_choice;
+    }
+
+    vector<uint8_t> take_frame_buffer() {
+        if (spare_frame_buffers.empty()) return {};
+        vector<uint8_t> frame_buffer = move(spare_frame_buffers.back());
+        spare_frame_buffers.pop_back();
+        return frame_buffer;
+    }
+
+    // Записи описания для передачи с именем (безымянная передача описывается без записей)
+    const vector<TransferEntryDescription>& named_entries(const string& name, uint64_t entry_size) {
+        transfer_entries.clear();
+        if (!name.empty()) transfer_entries.push_back(TransferEntryDescription{name, entry_size});
+        return transfer_entries;
+    }
+
+    // Описание передачи: consumer по нему выбирает приёмник, заранее резервирует место
+    // и вычисляет смещения блоков
+    bool begin_transfer(OutgoingTransfer& transfer, uint32_t transfer_flags, uint64_t total_size,
+                        const vector<TransferEntryDescription>& entries, uint64_t source_version = 0) {
+        if (!channel_open) {
+            error_message = "канал не открыт";
+            return false;
+        }
+        if (consumer_lost) return false; // error_message уже описывает пропавший consumer
+        for (const auto& entry : entries) {
+            if (entry.name.size() > MAX_TRANSFER_NAME_LENGTH) {
+                error_message = "имя файла длиннее " + to_string(MAX_TRANSFER_NAME_LENGTH) + " байт";
+                return false;
+            }
+        }
+        TransferInfo transfer_info{};
+        transfer_info.total_size = (transfer_flags & TRANSFER_FLAG_SIZE_KNOWN) ? total_size : 0;
+        transfer_info.block_size = static_cast<uint32_t>(options.uncompressed_block_size);
+        // Дельта и возобновление возможны для файла известного размера с фиксированными блоками;
+        // возобновление - только для источника с версией, по которой consumer сверит контрольную точку
+        if (reverse_region && (transfer_flags & TRANSFER_FLAG_SIZE_KNOWN) &&
+            !(transfer_flags & (TRANSFER_FLAG_PACKED | TRANSFER_FLAG_VARIABLE_BLOCKS))) {
+            if (options.delta_transfer) transfer_flags |= TRANSFER_FLAG_DELTA;
+            if (options.resume_transfers && source_version != 0) transfer_flags |= TRANSFER_FLAG_RESUMABLE;
+        }
+        if (!options.adaptive_codec && options.block_codec == BlockCodec::Deflate) transfer_flags |= TRANSFER_FLAG_CHAINED;
+        transfer_info.transfer_flags = transfer_flags;
+        transfer_info.source_version = source_version;
+        transfer_info.reference_window = sent_frame_window.capacity();
+        transfer_info.next_reference_ordinal = sent_frame_window.next_ordinal();
+        encode_transfer_info(transfer_info, entries, info_payload_buffer);
+
+        transfer.transfer_id = next_transfer_id++;
+        if (next_transfer_id == 0) next_transfer_id = 1; // 0 - сообщения вне передач
+        if (!send_fragmented(transfer.transfer_id, TRANSFER_INFO_BLOCK_ID, info_payload_buffer.data(), info_payload_buffer.size())) {
+            return false;
+        }
+        transfer.open = true;
+        transfer.next_block_id = 0;
+        transfer.input_bytes = 0;
+        transfer.sent_blocks = 0;
+        transfer.pending_blocks = 0;
+        transfer.delta_signature.reset();
+        transfer.chained_deflate = (transfer_flags & TRANSFER_FLAG_CHAINED) != 0;
+        transfer.deflate_dictionary.reset();
+        open_transfers.push_back(&transfer);
+        if (transfer_flags & (TRANSFER_FLAG_DELTA | TRANSFER_FLAG_RESUMABLE)) receive_delta_signature(transfer);
+        SHM_LOG(LogLevel::Debug, "Передача " << transfer.transfer_id << " начата"
+                << (entries.empty() ? string() : ": " + entries.front().name)
+                << (entries.size() > 1 ? " и ещё " + to_string(entries.size() - 1) + " файлов" : string()));
+        return true;
+    }
+
+    // Ставит блок на сжатие; при полном окне сначала отправляет самый старый блок
+    // (возможно, другой передачи). Потоки сжатия читают данные блока без копирования.
+    void push_block(OutgoingTransfer& transfer, InputBlock input_block) {
+        // Блок, записанный прошлой попыткой передачи, не сжимается и не отправляется;
+        // блоки передачи без consumer отправлять некому
+        if (consumer_lost || input_block.not_read ||
+            (transfer.delta_signature && transfer.delta_signature->block_received(transfer.next_block_id))) {
+            skip_received_block(transfer, input_block);
+            return;
+        }
+        while (compression_window.size() >= inflight_block_limit) send_front_block();
+        if (consumer_lost) {
+            skip_received_block(transfer, input_block);
+            return;
+        }
+
+        PendingBlock pending_block;
+        pending_block.transfer = &transfer;
+        pending_block.block_id = transfer.next_block_id++;
+        pending_block.input_block = move(input_block);
+        ++transfer.pending_blocks;
+        const uint8_t* block_data = pending_block.input_block.data;
+        size_t block_length = pending_block.input_block.length;
+        CodecChoice codec_choice = next_codec_choice();
+        StageStats* stats = &stage_stats;
+        // Хеш содержимого считает поток сжатия: по нему ищется кадр в кэше и в окне ссылок
+        BlockFrameCache* cache = frame_cache.enabled() ? &frame_cache : nullptr;
+        bool hash_needed = cache || sent_frame_window.enabled();
+        // Блок, совпавший со старой копией у consumer, не сжимается и не отправляется
+        const DeltaSignature* delta_signature = transfer.delta_signature.get();
+        uint32_t block_id = pending_block.block_id;
+        // Блок цепочки сжимается со словарём - хвостом данных передачи перед ним. Хвост копируется:
+        // данные предыдущего блока могут вернуться источнику раньше, чем сожмётся этот
+        shared_ptr<const vector<uint8_t>> deflate_dictionary;
+        if (transfer.chained_deflate) {
+            deflate_dictionary = transfer.deflate_dictionary;
+            auto next_dictionary = make_shared<vector<uint8_t>>();
+            if (deflate_dictionary && block_length < DEFLATE_WINDOW_SIZE) *next_dictionary = *deflate_dictionary;
+            advance_deflate_dictionary(*next_dictionary, block_data, block_length);
+            transfer.deflate_dictionary = move(next_dictionary);
+        }
+        if (use_arena) {
+            // Сжимаем прямо в область арены, занятую за этим блоком
+            pending_block.arena_region = static_cast<uint32_t>(arena_sequence++ % ring_channel.arena_region_count);
+            if (!arena_acquire_region(ring_channel, pending_block.arena_region)) {
+                mark_consumer_lost();
+                --transfer.pending_blocks;
+                if (transfer.releasing_source) transfer.releasing_source->release_block(pending_block.input_block);
+                return;
+            }
+            uint8_t* region_data = arena_region_data(ring_channel, pending_block.arena_region);
+            size_t region_capacity = ring_channel.arena_region_size;
+            pending_block.compressed_block = compression_pool->submit(
+                [stats, block_data, block_length, region_data, region_capacity, codec_choice, cache, hash_needed,
+                 delta_signature, block_id, deflate_dictionary]() {
+                    uint64_t compress_start = stats->stage_start();
+                    CompressedBlock compressed;
+                    compressed.data = region_data;
+                    if (delta_signature && delta_signature->block_unchanged(block_id, block_data, block_length)) {
+                        compressed.unchanged_block = true;
+                        return compressed;
+                    }
+                    compressed.content_hash = hash_needed ? content_hash64(block_data, block_length) : 0;
+                    compressed.length = encode_cached_block_frame(block_data, block_length, compressed.content_hash, region_data,
+                                                                  region_capacity, codec_choice, cache, compressed.frame_from_cache,
+                                                                  deflate_dictionary.get());
+                    stats->finish_stage(PipelineStage::Compress, compress_start, block_length);
+                    return compressed;
+                });
+        } else {
+            // Кадр пишется в буфер отправленного ранее блока: после разгона новых буферов не выделяется
+            pending_block.compressed_block = compression_pool->submit(
+                [stats, block_data, block_length, codec_choice, cache, hash_needed, delta_signature, block_id,
+                 deflate_dictionary, frame_buffer = take_frame_buffer()]() mutable {
+                    uint64_t compress_start = stats->stage_start();
+                    CompressedBlock compressed;
+                    if (delta_signature && delta_signature->block_unchanged(block_id, block_data, block_length)) {
+                        compressed.unchanged_block = true;
+                        compressed.frame_buffer = move(frame_buffer);
+                        return compressed;
+                    }
+                    size_t frame_bound = block_frame_bound(block_length);
+                    if (frame_buffer.size() < frame_bound) frame_buffer.resize(frame_bound);
+                    compressed.content_hash = hash_needed ? content_hash64(block_data, block_length) : 0;
+                    compressed.length = encode_cached_block_frame(block_data, block_length, compressed.content_hash,
+                                                                  frame_buffer.data(), frame_buffer.size(), codec_choice,
+                                                                  cache, compressed.frame_from_cache, deflate_dictionary.get());
+                    compressed.frame_buffer = move(frame_buffer);
+                    compressed.data = compressed.frame_buffer.data();
+                    stats->finish_stage(PipelineStage::Compress, compress_start, block_length);
+                    return compressed;
+                });
+        }
+        compression_window.push_back(move(pending_block));
+        stage_stats.set_queue_depth(compression_window.size());
+    }
+
+    // Дожидается сжатия самого старого блока и отправляет его
+    void send_front_block() {
+        PendingBlock pending_block = move(compression_window.front());
+        compression_window.pop_front();
+        OutgoingTransfer& transfer = *pending_block.transfer;
+        bool waited_for_compression = pending_block.compressed_block.wait_for(chrono::seconds(0)) != future_status::ready;
+        CompressedBlock compressed_block = pending_block.compressed_block.get();
+        if (!consumer_lost && !consumer_watch.periodic_peer_present()) mark_consumer_lost();
+        if (compressed_block.unchanged_block || consumer_lost) {
+            skip_unchanged_block(pending_block, compressed_block);
+            return;
+        }
+        uint64_t channel_waits_before_send = ring_channel.channel_full_waits;
+        uint64_t send_start = stage_stats.stage_start();
+        BlockFrameHeader sent_frame_header;
+        memcpy(&sent_frame_header, compressed_block.data, sizeof(sent_frame_header));
+        const uint8_t* sent_frame = compressed_block.data;
+        size_t sent_length = compressed_block.length;
+
+        // Тот же блок недавно ушёл полным кадром и ещё лежит в окне consumer: отправляем ссылку
+        uint64_t frame_ordinal = 0;
+        if (sent_frame_window.enabled()) {
+            if (sent_frame_window.find(compressed_block.content_hash, sent_frame_header.checksum, frame_ordinal)) {
+                uint8_t* reference_output = use_arena ? arena_region_data(ring_channel, pending_block.arena_region) : reference_frame;
+                sent_length = encode_reference_frame(compressed_block.data, frame_ordinal, reference_output);
+                sent_frame = reference_output;
+                sent_frame_header.codec_id = static_cast<uint8_t>(BlockCodec::Reference);
+                ++statistics.referenced_blocks;
+            } else {
+                sent_frame_window.record(compressed_block.content_hash, sent_frame_header.checksum, compressed_block.length);
+            }
+        }
+        if (compressed_block.frame_from_cache) ++statistics.cached_blocks;
+        ++statistics.blocks_per_codec[block_codec_name(sent_frame_header.codec_id)];
+
+        bool block_sent = true;
+        if (use_arena) {
+            // Данные уже в shared memory: передаем только дескриптор
+            block_sent = send_arena_descriptor(ring_channel, transfer.transfer_id, pending_block.block_id,
+                                               pending_block.arena_region, sent_length);
+            if (!block_sent) mark_consumer_lost();
+        } else {
+            // Разбиваем на фрагменты и передаем
+            block_sent = send_fragmented(transfer.transfer_id, pending_block.block_id, sent_frame, sent_length);
+        }
+        if (!block_sent) {
+            skip_unchanged_block(pending_block, compressed_block);
+            return;
+        }
+        size_t block_length = pending_block.input_block.length;
+        stage_stats.finish_stage(PipelineStage::Send, send_start, sent_length);
+        stage_stats.add_transferred(block_length, 1);
+
+        // Почтовый ящик ждёт подтверждения каждого фрагмента: канал всегда узкое место
+        bool waited_for_channel = shared_memory_region || ring_channel.channel_full_waits != channel_waits_before_send;
+        adaptive_codec_selector.record_block(waited_for_compression, waited_for_channel);
+
+        statistics.input_bytes += block_length;
+        statistics.compressed_bytes += sent_length;
+        ++statistics.blocks;
+        ++statistics.processed_blocks;
+        transfer.input_bytes += block_length;
+        ++transfer.sent_blocks;
+        --transfer.pending_blocks;
+        if (transfer.releasing_source) transfer.releasing_source->release_block(pending_block.input_block);
+        if (compressed_block.frame_buffer.capacity() > 0) spare_frame_buffers.push_back(move(compressed_block.frame_buffer));
+        stage_stats.set_queue_depth(compression_window.size());
+        SHM_LOG(LogLevel::Debug, "Блок " << transfer.transfer_id << ":" << pending_block.block_id << " отправлен: "
+                << block_length << " -> " << sent_length << " байт"
+                << (sent_frame_header.codec_id == static_cast<uint8_t>(BlockCodec::Reference)
+                        ? " (ссылка на кадр " + to_string(frame_ordinal) + ")" : string()));
+        if (progress_callback) progress_callback(statistics);
+    }
+
+    // Блок совпал со старой копией у consumer (или consumer пропал): в канал ничего не уходит
+    void skip_unchanged_block(PendingBlock& pending_block, CompressedBlock& compressed_block) {
+        OutgoingTransfer& transfer = *pending_block.transfer;
+        if (use_arena) arena_release_region(ring_channel, pending_block.arena_region);
+        size_t block_length = pending_block.input_block.length;
+        transfer.input_bytes += block_length;
+        --transfer.pending_blocks;
+        if (transfer.releasing_source) transfer.releasing_source->release_block(pending_block.input_block);
+        if (compressed_block.frame_buffer.capacity() > 0) spare_frame_buffers.push_back(move(compressed_block.frame_buffer));
+        stage_stats.set_queue_depth(compression_window.size());
+        if (!compressed_block.unchanged_block) return;
+        statistics.input_bytes += block_length;
+        ++statistics.unchanged_blocks;
+        ++statistics.processed_blocks;
+        SHM_LOG(LogLevel::Trace, "Блок " << transfer.transfer_id << ":" << pending_block.block_id << " совпал со старой копией");
+        if (progress_callback) progress_callback(statistics);
+    }
+
+    // Блок уже записан у consumer прошлой попыткой (или consumer пропал): не ставится на сжатие
+    void skip_received_block(OutgoingTransfer& transfer, InputBlock& input_block) {
+        uint32_t block_id = transfer.next_block_id++;
+        transfer.input_bytes += input_block.length;
+        if (!consumer_lost) {
+            statistics.input_bytes += input_block.length;
+            ++statistics.resumed_blocks;
+            ++statistics.processed_blocks;
+            SHM_LOG(LogLevel::Trace, "Блок " << transfer.transfer_id << ":" << block_id << " записан прошлой попыткой");
+        }
+        if (transfer.releasing_source) transfer.releasing_source->release_block(input_block);
+        if (progress_callback && !consumer_lost) progress_callback(statistics);
+    }
+
+    // Отправляет оставшиеся блоки передачи и её конец; блоки других передач из окна
+    // при этом тоже уходят, если стоят впереди
+    // false - конец не доставлен: consumer пропал
+    bool end_transfer(OutgoingTransfer& transfer, bool transfer_aborted) {
+        while (transfer.pending_blocks > 0) send_front_block();
+        TransferEnd transfer_end{};
+        transfer_end.total_size = transfer.input_bytes;
+        transfer_end.block_count = transfer.sent_blocks;
+        bool confirm_delivery = delivery_confirmation && reverse_region && !transfer_aborted && !consumer_lost;
+        transfer_end.end_flags = (transfer_aborted ? TRANSFER_END_FLAG_ABORTED : 0) | (confirm_delivery ? TRANSFER_END_FLAG_CONFIRM : 0);
+        bool end_sent = send_fragment(transfer.transfer_id, TRANSFER_END_BLOCK_ID, 0, true,
+                                      reinterpret_cast<const uint8_t*>(&transfer_end), sizeof(transfer_end), true);
+        transfer.open = false;
+        transfer.releasing_source = nullptr;
+        open_transfers.erase(find(open_transfers.begin(), open_transfers.end(), &transfer));
+        if (end_sent && confirm_delivery) end_sent = receive_transfer_outcome(transfer);
+        if (!transfer_aborted && end_sent) ++statistics.messages;
+        return end_sent;
+    }
+
+    // Итог передачи от consumer: отклонённая или не записанная им передача - ошибка отправки
+    bool receive_transfer_outcome(const OutgoingTransfer& transfer) {
+        vector<uint8_t> outcome_payload;
+        if (!receive_reverse_reply(transfer.transfer_id, TRANSFER_OUTCOME_BLOCK_ID, "итога", outcome_payload)) return false;
+        string outcome_error;
+        if (!decode_transfer_outcome(outcome_payload, outcome_error)) {
+            error_message = "consumer не принял передачу: " + outcome_error;
+            return false;
+        }
+        return true;
+    }
+
+    // Ставит на сжатие блоки непрерывной памяти: она не меняется до конца передачи
+    void push_memory_blocks(OutgoingTransfer& transfer, const uint8_t* data, uint64_t length) {
+        ContentChunker content_chunker(options.uncompressed_block_size);
+        uint64_t block_offset = 0;
+        while (block_offset < length) {
+            InputBlock input_block;
+            input_block.block_index = transfer.next_block_id;
+            input_block.file_offset = block_offset;
+            input_block.data = data + block_offset;
+            input_block.length = static_cast<size_t>(min<uint64_t>(options.uncompressed_block_size, length - block_offset));
+            if (options.chunking_mode == ChunkingMode::ContentDefined) {
+                input_block.length = content_chunker.next_boundary(input_block.data, static_cast<size_t>(length - block_offset), true);
+            }
+            block_offset += input_block.length;
+            push_block(transfer, move(input_block));
+        }
+    }
+
+    // Флаги передачи блоков памяти: при разбиении по содержимому длины блоков переменные
+    uint32_t memory_transfer_flags() const {
+        return options.chunking_mode == ChunkingMode::ContentDefined ? TRANSFER_FLAG_VARIABLE_BLOCKS : 0;
+    }
+
+    bool send_message(ConstByteSpan message, const string& name) {
+        OutgoingTransfer transfer;
+        if (!begin_transfer(transfer, TRANSFER_FLAG_SIZE_KNOWN | memory_transfer_flags(), message.size,
+                            named_entries(name, message.size))) {
+            return false;
+        }
+        // Блоки - окна в памяти вызывающего: она не меняется до возврата из send
+        push_memory_blocks(transfer, message.data, message.size);
+        return end_transfer(transfer, false);
+    }
+
+    bool send_packed(const vector<PackedFile>& files) {
+        if (files.empty() || files.size() > MAX_TRANSFER_ENTRY_COUNT) {
+            error_message = "в пакете должно быть от 1 до " + to_string(MAX_TRANSFER_ENTRY_COUNT) + " файлов";
+            return false;
+        }
+        // Файлы копируются подряд в буфер пакета: блоки пакета сжимаются так же, как блоки файла
+        transfer_entries.clear();
+        pack_buffer.clear();
+        for (const auto& packed_file : files) {
+            transfer_entries.push_back(TransferEntryDescription{packed_file.name, packed_file.data.size});
+            pack_buffer.insert(pack_buffer.end(), packed_file.data.data, packed_file.data.data + packed_file.data.size);
+        }
+        OutgoingTransfer transfer;
+        if (!begin_transfer(transfer, TRANSFER_FLAG_SIZE_KNOWN | TRANSFER_FLAG_PACKED | memory_transfer_flags(),
+                            pack_buffer.size(), transfer_entries)) {
+            return false;
+        }
+        push_memory_blocks(transfer, pack_buffer.data(), pack_buffer.size());
+        return end_transfer(transfer, false);
+    }
+
+    bool send_file(BlockInputSource& input_source, const string& name) {
+        if (input_source.block_size() != options.uncompressed_block_size) {
+            error_message = "источник читает блоки по " + to_string(input_source.block_size()) + " байт, канал ждёт " +
+                            to_string(options.uncompressed_block_size) + " (см. ChannelSender::block_size)";
+            return false;
+        }
+        OutgoingTransfer transfer;
+        uint32_t transfer_flags = input_source.size_known() ? TRANSFER_FLAG_SIZE_KNOWN : 0;
+        if (input_source.chunking() == ChunkingMode::ContentDefined) transfer_flags |= TRANSFER_FLAG_VARIABLE_BLOCKS;
+        if (!begin_transfer(transfer, transfer_flags, input_source.file_size(), named_entries(name, input_source.file_size()),
+                            input_source.content_version())) {
+            return false;
+        }
+        transfer.releasing_source = &input_source;
+        // Блоки, записанные прошлой попыткой, источник не читает с диска
+        const DeltaSignature* resume_signature = transfer.delta_signature.get();
+        if (resume_signature && resume_signature->received_block_count) {
+            input_source.skip_blocks([resume_signature](uint64_t block_index) { return resume_signature->block_received(block_index); });
+        }
+        while (!consumer_lost) {
+            InputBlock input_block;
+            uint64_t read_start = stage_stats.stage_start();
+            if (!input_source.next_block(input_block)) break;
+            if (!input_block.not_read) stage_stats.finish_stage(PipelineStage::Read, read_start, input_block.length);
+            push_block(transfer, move(input_block));
+        }
+        input_source.skip_blocks(nullptr);
+        bool read_failed = input_source.failed();
+        bool end_sent = end_transfer(transfer, read_failed);
+        if (read_failed) {
+            error_message = "передача прервана из-за ошибки чтения";
+            return false;
+        }
+        return end_sent;
+    }
+
+    bool begin_stream(OutgoingTransfer& transfer, const string& name) {
+        if (transfer.block_buffers.empty() && !spare_stream_buffer_sets.empty()) {
+            transfer.block_buffers = move(spare_stream_buffer_sets.back());
+            spare_stream_buffer_sets.pop_back();
+        }
+        transfer.block_buffers.resize(inflight_block_limit + 1);
+        for (auto& block_buffer : transfer.block_buffers) {
+            if (block_buffer.size() != options.uncompressed_block_size) block_buffer.resize(options.uncompressed_block_size);
+        }
+        transfer.buffer_index = 0;
+        transfer.buffer_fill = 0;
+        return begin_transfer(transfer, 0, 0, named_entries(name, 0));
+    }
+
+    // Буферы завершённого потока достаются следующему (запас на несколько одновременных потоков)
+    void release_stream_buffers(OutgoingTransfer& transfer) {
+        if (!transfer.block_buffers.empty() && spare_stream_buffer_sets.size() < 4) {
+            spare_stream_buffer_sets.push_back(move(transfer.block_buffers));
+        }
+        transfer.block_buffers.clear();
+    }
+
+    // Отдаёт заполненный буфер потока на сжатие и переходит к следующему
+    void flush_stream_block(OutgoingTransfer& transfer) {
+        InputBlock input_block;
+        input_block.block_index = transfer.next_block_id;
+        input_block.file_offset = transfer.input_bytes;
+        input_block.data = transfer.block_buffers[transfer.buffer_index].data();
+        input_block.length = transfer.buffer_fill;
+        push_block(transfer, move(input_block));
+        transfer.buffer_index = (transfer.buffer_index + 1) % transfer.block_buffers.size();
+        transfer.buffer_fill = 0;
+    }
+
+    bool write_stream(OutgoingTransfer& transfer, ConstByteSpan data) {
+        if (!transfer.open) {
+            error_message = "поток не открыт";
+            return false;
+        }
+        if (consumer_lost) return false;
+        while (data.size > 0) {
+            vector<uint8_t>& block_buffer = transfer.block_buffers[transfer.buffer_index];
+            size_t copy_length = min(data.size, block_buffer.size() - transfer.buffer_fill);
+            memcpy(block_buffer.data() + transfer.buffer_fill, data.data, copy_length);
+            transfer.buffer_fill += copy_length;
+            data.data += copy_length;
+            data.size -= copy_length;
+            if (transfer.buffer_fill == block_buffer.size()) flush_stream_block(transfer);
+        }
+        return true;
+    }
+
+    bool finish_stream(OutgoingTransfer& transfer, bool stream_aborted) {
+        if (!transfer.open) {
+            release_stream_buffers(transfer);
+            return false;
+        }
+        if (!stream_aborted && transfer.buffer_fill > 0) flush_stream_block(transfer);
+        bool end_sent = end_transfer(transfer, stream_aborted);
+        release_stream_buffers(transfer);
+        return end_sent;
+    }
+
+    void close() {
+        if (!channel_open) return;
+        // Незавершённые передачи получатель отбросит; пропавшему consumer ничего не отправляется
+        while (!open_transfers.empty()) end_transfer(*open_transfers.back(), true);
+        send_fragment(0, TERMINATION_BLOCK_ID, 0, true, nullptr, 0, false);
+        release_channel_side(channel_owner_word);
+        channel_owner_word = nullptr;
+        ring_channel.peer_check = nullptr;
+        channel_liveness = nullptr;
+        compression_pool.reset();
+        if (reverse_region) {
+            munmap(reinterpret_cast<void*>(reverse_region), mailbox_mapped_size(reverse_region));
+            reverse_region = nullptr;
+        }
+        if (shared_memory_region) {
+            munmap(reinterpret_cast<void*>(shared_memory_region), mailbox_mapped_size(shared_memory_region));
+            shared_memory_region = nullptr;
+        } else {
+            close_ring_channel(ring_channel, false);
+        }
+        stage_stats.close();
+        channel_open = false;
+    }
+};
+
+ChannelSender::ChannelSender() : impl(make_unique<Impl>()) {}
+
+ChannelSender::~ChannelSender() { close(); }
+
+bool ChannelSender::open(const ChannelOptions& options) { return impl->open(options); }
+
+bool ChannelSender::send(ConstByteSpan message, const string& name) { return impl->send_message(message, name); }
+
+bool ChannelSender::send_file(BlockInputSource& input_source, const string& name) {
+    return impl->send_file(input_source, name);
+}
+
+bool ChannelSender::send_packed(const vector<PackedFile>& files) { return impl->send_packed(files); }
+
+void ChannelSender::close() { impl->close(); }
+
+void ChannelSender::set_delivery_confirmation(bool confirm_delivery) {
+    impl->delivery_confirmation = confirm_delivery;
+    if (confirm_delivery && impl->channel_open && !impl->reverse_region) impl->open_reverse_channel();
+}
+
+void ChannelSender::set_progress_callback(function<void(const SenderStatistics&)> progress_callback) {
+    impl->progress_callback = move(progress_callback);
+}
+
+const SenderStatistics& ChannelSender::statistics() const { return impl->statistics; }
+
+const string& ChannelSender::error_message() const { return impl->error_message; }
+
+string ChannelSender::channel_description() const {
+    ostringstream description;
+    if (impl->shared_memory_region) {
+        description << "почтовый ящик, " << impl->fragment_capacity << " байт на фрагмент";
+    } else {
+        description << "кольцевой буфер, " << impl->ring_channel.slot_count << " слотов по "
+                    << impl->fragment_capacity << " байт";
+        if (impl->use_arena) {
+            description << "; арена: " << impl->ring_channel.arena_region_count << " областей по "
+                        << impl->ring_channel.arena_region_size << " байт";
+        }
+        if (impl->ring_channel.control->segment_flags & RING_SEGMENT_FLAG_HUGETLBFS) description << "; hugetlbfs";
+        if (impl->ring_channel.control->segment_flags & RING_SEGMENT_FLAG_TRANSPARENT_HUGE_PAGES) description << "; THP";
+    }
+    if (impl->options.channel_count > 1) description << "; канал " << impl->channel_segment;
+    return description.str();
+}
+
+size_t ChannelSender::block_size() const { return impl->options.uncompressed_block_size; }
+
+const CpuPlacement& ChannelSender::cpu_placement() const { return impl->placement; }
+
+size_t ChannelSender::worker_count() const {
+    return impl->compression_pool ? impl->compression_pool->worker_count() : 0;
+}
+
+size_t ChannelSender::inflight_block_limit() const { return impl->inflight_block_limit; }
+
+ChannelStreamWriter::ChannelStreamWriter(ChannelSender& channel_sender, const string& name)
+    : sender(channel_sender), stream_name(name) {}
+
+ChannelStreamWriter::~ChannelStreamWriter() {
+    if (transfer && !stream_finished) finish();
+}
+
+bool ChannelStreamWriter::write(ConstByteSpan data) {
+    if (stream_finished) return false;
+    if (!transfer) {
+        transfer = make_unique<OutgoingTransfer>();
+        if (!sender.impl->begin_stream(*transfer, stream_name)) {
+            transfer.reset();
+            return false;
+        }
+    }
+    return sender.impl->write_stream(*transfer, data);
+}
+
+bool ChannelStreamWriter::finish() {
+    if (stream_finished) return false;
+    if (!transfer) {
+        // Пустой поток - тоже сообщение
+        transfer = make_unique<OutgoingTransfer>();
+        if (!sender.impl->begin_stream(*transfer, stream_name)) {
+            transfer.reset();
+            return false;
+        }
+    }
+    stream_finished = true;
+    return sender.impl->finish_stream(*transfer, false);
+}
+
+void ChannelStreamWriter::abort() {
+    if (stream_finished) return;
+    stream_finished = true;
+    if (transfer) sender.impl->finish_stream(*transfer, true);
+}
+
+// ---------------------------------------------------------------------------
+// Приём
+// ---------------------------------------------------------------------------
+
+// Проверяет кадр блока, распаковывает его за один проход ровно в uncompressed_length байт
+// и сверяет CRC32C. Если задан destination, данные распаковываются прямо в него.
+// dictionary - данные передачи перед блоком цепочки (nullptr - блок независимый).
+static bool decode_block_frame(const uint8_t* frame, size_t frame_length,
+                               uint8_t* destination, size_t destination_capacity,
+                               vector<uint8_t>& owned_output, size_t& decoded_length, string& error_message,
+                               const vector<uint8_t>* dictionary = nullptr) {
+    BlockFrameHeader frame_header;
+    if (!parse_block_frame_header(frame, frame_length, frame_header, error_message)) {
+        return false;
+    }
+    const uint8_t* payload = frame + sizeof(BlockFrameHeader);
+
+    uint8_t* output_buffer = destination;
+    if (destination) {
+        if (destination_capacity != frame_header.uncompressed_length) {
+            error_message = "длина блока " + to_string(frame_header.uncompressed_length) +
+                            " не совпадает с ожидаемой " + to_string(destination_capacity);
+            return false;
+        }
+    } else {
+        // Размер известен из заголовка: буфер подгоняется один раз и без запаса
+        owned_output.resize(frame_header.uncompressed_length);
+        output_buffer = owned_output.data();
+    }
+
+    // Кодек берется из кадра: блоки одной передачи могут быть сжаты разными кодеками
+    const BlockCompressor* block_compressor = find_block_compressor(static_cast<BlockCodec>(frame_header.codec_id));
+    if (!block_compressor) {
+        error_message = string("кодек ") + block_codec_name(frame_header.codec_id) + " (" +
+                        to_string(frame_header.codec_id) + ") не поддерживается этой сборкой";
+        return false;
+    }
+    bool block_decompressed = dictionary && !dictionary->empty()
+        ? block_compressor->decompress_with_dictionary(payload, frame_header.compressed_length, output_buffer,
+                                                       frame_header.uncompressed_length, dictionary->data(),
+                                                       dictionary->size(), error_message)
+        : block_compressor->decompress(payload, frame_header.compressed_length, output_buffer,
+                                       frame_header.uncompressed_length, error_message);
+    if (!block_decompressed) return false;
+
+    if (compute_crc32c(output_buffer, frame_header.uncompressed_length) != frame_header.checksum) {
+        error_message = "контрольная сумма не совпадает";
+        return false;
+    }
+    decoded_length = frame_header.uncompressed_length;
+    return true;
+}
+
+// Результат обработки блока потоком распаковки
+struct DecodedBlock {
+    vector<uint8_t> data;         // Распакованные данные (не используются, если блок записан на место)
+    vector<uint8_t> frame_buffer; // Буфер собранного кадра; возвращается в запас получателя
+    string error_message;         // Пусто - блок распакован и проверен
+};
+
+// Задача распаковки блока, который будет записан по порядку
+struct OrderedDecodeTask {
+    uint32_t block_id = 0;
+    future<DecodedBlock> decoded_block;
+};
+
+// Куда получатель складывает блоки сообщения
+class ReceiveSink {
+public:
+    virtual ~ReceiveSink() = default;
+
+    // Начало сообщения; false - сообщение не может быть принято
+    virtual bool begin_message(const TransferInfo& transfer_info, string& error_message) = 0;
+
+    // Позиционный приёмник: потоки распаковки пишут блоки по смещению в любом порядке
+    virtual bool positional() const = 0;
+
+    // Память под блок для распаковки прямо на место или nullptr
+    virtual uint8_t* block_destination(uint64_t, size_t) { return nullptr; }
+
+    // Позиционная запись блока; вызывается из потоков распаковки
+    virtual bool write_block_at(uint64_t, const uint8_t*, size_t) { return false; }
+
+    // Старая копия, поверх которой можно писать только изменившиеся блоки (дельта-передача), или nullptr
+    virtual const BlockOutputFile* delta_base() const { return nullptr; }
+
+    // Возобновляемая передача: карта блоков, записанных прошлой попыткой, в signature (если есть)
+    virtual void resume_checkpoint(const TransferInfo&, DeltaSignature&) {}
+
+    // Блок записан на место; вызывается из потоков распаковки
+    virtual void block_written(uint64_t) {}
+
+    // Запись очередного блока по порядку; приёмник может забрать буфер блока себе
+    virtual bool append_block(vector<uint8_t>&) { return false; }
+
+    // Приёмник сохраняет поток deflate цепочки как есть (--archive): блоки не распаковываются
+    virtual bool stores_deflate_stream() const { return false; }
+
+    // Данные deflate очередного блока цепочки с CRC32 и Adler-32 его несжатых данных
+    virtual bool append_deflate_block(const uint8_t*, size_t, uint32_t, uint32_t, size_t) { return false; }
+
+    virtual bool end_message(uint64_t final_size, string& error_message) = 0;
+};
+
+// Сообщение в выходной файл (режимы stream, pwrite и mmap)
+class FileReceiveSink : public ReceiveSink {
+public:
+    explicit FileReceiveSink(BlockOutputFile& output) : output_file(output) {}
+
+    // Отложенные отметки контрольной точки выполняются, пока она жива
+    ~FileReceiveSink() override { output_file.wait_writes(); }
+
+    bool begin_message(const TransferInfo& transfer_info, string&) override {
+        if (transfer_info.transfer_flags & TRANSFER_FLAG_SIZE_KNOWN) {
+            output_file.prepare(transfer_info.total_size);
+            SHM_LOG(LogLevel::Debug, "Ожидаемый размер: " << transfer_info.total_size << " байт");
+        } else {
+            output_file.size_unknown();
+        }
+        return true;
+    }
+
+    bool positional() const override { return output_file.positional(); }
+
+    uint8_t* block_destination(uint64_t offset, size_t length) override {
+        return output_file.mapped_destination(offset, length);
+    }
+
+    bool write_block_at(uint64_t offset, const uint8_t* data, size_t length) override {
+        return output_file.write_at(offset, data, length);
+    }
+
+    const BlockOutputFile* delta_base() const override {
+        return output_file.positional() && output_file.existing_size() > 0 ? &output_file : nullptr;
+    }
+
+    // Контрольная точка рядом с выходным файлом; при записи по порядку пропускать блоки нельзя
+    void resume_checkpoint(const TransferInfo& transfer_info, DeltaSignature& signature) override {
+        if (!output_file.positional() || transfer_info.total_size == 0 || output_file.path().empty()) return;
+        string checkpoint_error;
+        if (!checkpoint.open(output_file.path(), transfer_info.total_size, transfer_info.block_size,
+                             transfer_info.source_version, checkpoint_error)) {
+            SHM_LOG(LogLevel::Warn, checkpoint_error << ", передача будет принята целиком");
+            return;
+        }
+        if (checkpoint.recorded_block_count() == 0) return;
+        signature.received_block_count = checkpoint.block_count();
+        checkpoint.copy_bitmap(signature.received_blocks);
+        SHM_LOG(LogLevel::Info, "Передача " << output_file.path() << " возобновляется: записано блоков "
+                << checkpoint.recorded_block_count() << " из " << checkpoint.block_count());
+    }
+
+    // Бит контрольной точки ставится, только когда блок уже записан (в режиме async - после завершения записи)
+    void block_written(uint64_t block_index) override {
+        output_file.after_writes([this, block_index]() { checkpoint.mark_block(block_index); });
+    }
+
+    bool append_block(vector<uint8_t>& block) override {
+        return output_file.append(block.data(), block.size());
+    }
+
+    bool end_message(uint64_t final_size, string& error_message) override {
+        // Фиксируем размер файла и один раз сбрасываем его на диск
+        if (!output_file.finish(final_size)) {
+            error_message = "не удалось сохранить выходной файл";
+            return false;
+        }
+        checkpoint.remove();
+        return true;
+    }
+
+private:
+    BlockOutputFile& output_file;
+    TransferCheckpoint checkpoint; // Записанные блоки возобновляемой передачи (--resume)
+};
+
+// Сообщение в gzip- или zlib-файл без распаковки (--archive, см. deflate_archive.h)
+class ArchiveReceiveSink : public ReceiveSink {
+public:
+    ArchiveReceiveSink(BlockOutputFile& output, ArchiveFormat format) : output_file(output), archive(format) {}
+
+    bool begin_message(const TransferInfo& transfer_info, string& error_message) override {
+        if (!(transfer_info.transfer_flags & TRANSFER_FLAG_CHAINED)) {
+            error_message = "передача сжата не цепочкой deflate (producer --codec=deflate), сохранить её архивом нельзя";
+            return false;
+        }
+        archive.reset();
+        archive_length = 0;
+        container_bytes.clear();
+        archive.append_header(container_bytes);
+        return append_bytes(container_bytes.data(), container_bytes.size());
+    }
+
+    bool positional() const override { return false; }
+    bool stores_deflate_stream() const override { return true; }
+
+    bool append_deflate_block(const uint8_t* deflate_data, size_t length, uint32_t block_crc32, uint32_t block_adler32,
+                              size_t uncompressed_length) override {
+        archive.add_block(block_crc32, block_adler32, uncompressed_length);
+        return append_bytes(deflate_data, length);
+    }
+
+    bool end_message(uint64_t, string& error_message) override {
+        container_bytes.clear();
+        archive.append_trailer(container_bytes);
+        if (!append_bytes(container_bytes.data(), container_bytes.size()) || !output_file.finish(archive_length)) {
+            error_message = "не удалось сохранить архив";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool append_bytes(const uint8_t* data, size_t length) {
+        archive_length += length;
+        return output_file.append(data, length);
+    }
+
+    BlockOutputFile& output_file;
+    DeflateArchive archive;
+    uint64_t archive_length = 0;
+    vector<uint8_t> container_bytes; // Заголовок или концевик контейнера
+};
+
+// Сообщение в буфер вызывающего: блоки распаковываются прямо на место
+class SpanReceiveSink : public ReceiveSink {
+public:
+    explicit SpanReceiveSink(MutableByteSpan buffer) : destination_buffer(buffer) {}
+
+    bool begin_message(const TransferInfo& transfer_info, string& error_message) override {
+        if ((transfer_info.transfer_flags & TRANSFER_FLAG_SIZE_KNOWN) && transfer_info.total_size > destination_buffer.size) {
+            error_message = "сообщение " + to_string(transfer_info.total_size) + " байт не помещается в буфер " +
+                            to_string(destination_buffer.size) + " байт";
+            return false;
+        }
+        return true;
+    }
+
+    bool positional() const override { return true; }
+
+    uint8_t* block_destination(uint64_t offset, size_t length) override {
+        return offset + length <= destination_buffer.size ? destination_buffer.data + offset : nullptr;
+    }
+
+    bool write_block_at(uint64_t offset, const uint8_t* data, size_t length) override {
+        if (offset + length > destination_buffer.size) return false;
+        memcpy(destination_buffer.data + offset, data, length);
+        return true;
+    }
+
+    bool end_message(uint64_t final_size, string&) override {
+        message_length = static_cast<size_t>(final_size);
+        return true;
+    }
+
+    size_t message_length = 0;
+
+private:
+    MutableByteSpan destination_buffer;
+};
+
+// Сообщение в вектор: при известном размере - на место, иначе дописыванием по порядку
+class VectorReceiveSink : public ReceiveSink {
+public:
+    explicit VectorReceiveSink(vector<uint8_t>& message) : message_data(message) {}
+
+    bool begin_message(const TransferInfo& transfer_info, string&) override {
+        size_known = (transfer_info.transfer_flags & TRANSFER_FLAG_SIZE_KNOWN) != 0;
+        if (size_known) {
+            message_data.resize(static_cast<size_t>(transfer_info.total_size));
+        } else {
+            message_data.clear();
+        }
+        return true;
+    }
+
+    bool positional() const override { return size_known; }
+
+    uint8_t* block_destination(uint64_t offset, size_t length) override {
+        return offset + length <= message_data.size() ? message_data.data() + offset : nullptr;
+    }
+
+    bool write_block_at(uint64_t offset, const uint8_t* data, size_t length) override {
+        if (offset + length > message_data.size()) return false;
+        memcpy(message_data.data() + offset, data, length);
+        return true;
+    }
+
+    bool append_block(vector<uint8_t>& block) override {
+        message_data.insert(message_data.end(), block.begin(), block.end());
+        return true;
+    }
+
+    bool end_message(uint64_t final_size, string&) override {
+        message_data.resize(static_cast<size_t>(final_size));
+        return true;
+    }
+
+private:
+    vector<uint8_t>& message_data;
+    bool size_known = false;
+};
+
+// Очередь распакованных блоков для ChannelStreamReader; буферы забираются без копирования
+class StreamReceiveSink : public ReceiveSink {
+public:
+    bool begin_message(const TransferInfo&, string&) override { return true; }
+
+    bool positional() const override { return false; }
+
+    bool append_block(vector<uint8_t>& block) override {
+        ready_blocks.push_back(move(block));
+        return true;
+    }
+
+    bool end_message(uint64_t, string&) override { return true; }
+
+    deque<vector<uint8_t>> ready_blocks;
+    size_t read_offset = 0; // Сколько байт первого блока уже выдано
+};
+
+// Пакет мелких файлов: блоки пакета раскладываются по выходным файлам записей.
+// Блок может захватывать хвост одного файла и начало следующих.
+class PackedFileSink : public ReceiveSink {
+public:
+    PackedFileSink(SessionHandler& handler, const vector<TransferDescription>& entries)
+        : session_handler(handler), entry_descriptions(entries) {}
+
+    bool begin_message(const TransferInfo& transfer_info, string& error_message) override {
+        entry_offsets.assign(1, 0);
+        for (const auto& entry : entry_descriptions) entry_offsets.push_back(entry_offsets.back() + entry.total_size);
+        if (!(transfer_info.transfer_flags & TRANSFER_FLAG_SIZE_KNOWN) || entry_offsets.back() != transfer_info.total_size) {
+            error_message = "размеры файлов пакета не совпадают с размером передачи";
+            return false;
+        }
+        output_files.assign(entry_descriptions.size(), nullptr);
+        all_positional = true;
+        for (size_t entry_index = 0; entry_index < entry_descriptions.size(); ++entry_index) {
+            output_files[entry_index] = session_handler.open_output(entry_descriptions[entry_index]);
+            if (!output_files[entry_index]) {
+                error_message = "выходной файл для " + entry_descriptions[entry_index].name + " не открыт";
+                return false;
+            }
+            output_files[entry_index]->prepare(entry_descriptions[entry_index].total_size);
+            all_positional = all_positional && output_files[entry_index]->positional();
+        }
+        return true;
+    }
+
+    bool positional() const override { return all_positional; }
+
+    // Блок целиком внутри одного отображённого файла распаковывается прямо в него
+    uint8_t* block_destination(uint64_t offset, size_t length) override {
+        size_t entry_index = entry_at(offset);
+        if (offset + length > entry_offsets[entry_index + 1]) return nullptr;
+        return output_files[entry_index]->mapped_destination(offset - entry_offsets[entry_index], length);
+    }
+
+    bool write_block_at(uint64_t offset, const uint8_t* data, size_t length) override {
+        return write_entries(offset, data, length, true);
+    }
+
+    bool append_block(vector<uint8_t>& block) override {
+        bool write_succeeded = write_entries(append_offset, block.data(), block.size(), false);
+        append_offset += block.size();
+        return write_succeeded;
+    }
+
+    bool end_message(uint64_t, string& error_message) override {
+        for (size_t entry_index = 0; entry_index < output_files.size(); ++entry_index) {
+            if (!output_files[entry_index]->finish(entry_descriptions[entry_index].total_size)) {
+                error_message = "не удалось сохранить " + entry_descriptions[entry_index].name;
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    // Запись, которой принадлежит байт offset (пустые записи пропускаются)
+    size_t entry_at(uint64_t offset) const {
+        auto entry_start = upper_bound(entry_offsets.begin(), entry_offsets.end() - 1, offset);
+        return static_cast<size_t>(entry_start - entry_offsets.begin()) - 1;
+    }
+
+    bool write_entries(uint64_t offset, const uint8_t* data, size_t length, bool write_positional) {
+        for (size_t entry_index = entry_at(offset); length > 0 && entry_index < output_files.size(); ++entry_index) {
+            uint64_t entry_end = entry_offsets[entry_index + 1];
+            if (offset >= entry_end) continue;
+            size_t part_length = static_cast<size_t>(min<uint64_t>(length, entry_end - offset));
+            uint64_t entry_offset = offset - entry_offsets[entry_index];
+            bool part_written = write_positional ? output_files[entry_index]->write_at(entry_offset, data, part_length)
+                                                 : output_files[entry_index]->append(data, part_length);
+            if (!part_written) return false;
+            data += part_length;
+            offset += part_length;
+            length -= part_length;
+        }
+        return length == 0;
+    }
+
+    SessionHandler& session_handler;
+    const vector<TransferDescription>& entry_descriptions;
+    vector<uint64_t> entry_offsets;           // Начало каждой записи в пакете и конец пакета
+    vector<BlockOutputFile*> output_files;
+    bool all_positional = true;
+    uint64_t append_offset = 0;
+};
+
+// Канал получателя: почтовый ящик или кольцо одного producer
+struct ReceiveChannel {
+    uint32_t channel_index = 0;
+    string segment_name;
+    SharedMemoryHeader* shared_memory_region = nullptr;
+    RingChannel ring_channel;
+    SharedMemoryHeader* reverse_region = nullptr; // Обратный канал: сигнатуры и карты записанных блоков
+    uint32_t* owner_word = nullptr; // PID consumer в заголовке канала
+    ChannelLiveness* liveness = nullptr;
+    PeerWatch producer_watch;       // Наблюдение за producer канала во время ожиданий
+    bool closed = false;            // Producer канала прислал сигнал завершения
+    // Фрагменты блока идут подряд (блоки передач чередуются целиком), поэтому в канале собирается только один блок
+    vector<uint8_t> assembly_buffer;
+    ReceivedFrameWindow frame_window; // Полные кадры канала, на которые producer может сослаться
+};
+
+// Ключ передачи у получателя: ID передачи уникален только в пределах своего канала
+static inline uint64_t incoming_transfer_key(uint32_t channel_index, uint32_t transfer_id) {
+    return (static_cast<uint64_t>(channel_index) << 32) | transfer_id;
+}
+
+// Сколько сообщений подряд consumer читает из одного канала, прежде чем перейти к следующему
+constexpr uint32_t CHANNEL_POLL_BATCH = 32;
+
+// Передача, принимаемая получателем. Передачи сеанса принимаются одновременно,
+// у каждой свой приёмник, окно распаковки и счётчики для проверки по концу передачи.
+struct IncomingTransfer {
+    uint32_t transfer_id = 0;
+    uint64_t transfer_key = 0;
+    ReceiveSink* sink = nullptr;
+    unique_ptr<ReceiveSink> owned_sink;         // Приёмник передачи сеанса
+    TransferDescription description;
+    vector<TransferDescription> session_outputs; // Файлы, открытые обработчиком сеанса
+
+    bool complete = false; // Получен конец передачи
+    bool failed = false;   // Остаток передачи дочитывается и отбрасывается
+    string error_message;
+
+    bool total_size_known = false;
+    uint64_t expected_total_size = 0;
+    size_t uncompressed_block_size = 0;
+    bool variable_blocks = false;  // Блоки переменной длины идут подряд (TRANSFER_FLAG_VARIABLE_BLOCKS)
+    uint64_t next_block_offset = 0; // Смещение следующего блока при переменной длине блоков
+    TransferEnd transfer_end{};
+    uint32_t next_expected_block_id = 0;
+    bool chained_blocks = false;          // Блоки сжаты цепочкой deflate (TRANSFER_FLAG_CHAINED)
+    vector<uint8_t> deflate_dictionary;   // Хвост распакованных данных перед следующим блоком цепочки
+    uint64_t received_blocks_count = 0;
+    uint64_t appended_bytes = 0;
+    atomic<uint64_t> written_end_offset{0}; // Конец самого дальнего записанного блока
+    deque<OrderedDecodeTask> decompression_tasks;       // Распаковка с записью по порядку
+    deque<future<DecodedBlock>> positional_write_tasks; // Распаковка с записью на место
+
+    // Запоминает первую ошибку передачи; её остаток будет отброшен
+    void fail(const string& transfer_error) {
+        if (failed) return;
+        failed = true;
+        error_message = transfer_error;
+    }
+};
+
+struct ChannelReceiver::Impl {
+    ChannelOptions options;
+    vector<unique_ptr<ReceiveChannel>> channels; // По каналу на producer (--channels)
+    vector<WaitTarget> channel_wait_targets;     // Слова futex каналов для ожидания сразу всех
+    size_t closed_channel_count = 0;
+    size_t poll_channel_index = 0;               // Канал, который сейчас читается пачкой
+    uint32_t poll_batch_remaining = 0;           // Сколько сообщений ещё можно взять из него подряд
+    bool channel_open = false;
+    bool channel_closed = false; // Сигнал завершения получен по всем каналам
+
+    // Ожидания проверяют producer всех каналов; канал, чей producer пропал, запоминается
+    ReceiveChannel* lost_channel = nullptr;
+    PeerCheck producer_check = [this]() {
+        for (auto& channel : channels) {
+            if (channel_peer_present(*channel)) continue;
+            lost_channel = channel.get();
+            return false;
+        }
+        return true;
+    };
+
+    // Счётчики стадий объявлены до пула, чтобы пережить его потоки
+    StageStats stage_stats;
+    unique_ptr<WorkStealingThreadPool> decompression_pool;
+    size_t inflight_block_limit = 0;
+    bool measure_latency = false;
+    LatencyRecorder fragment_latency; // Задержки фрагментов кольца
+
+    // Передачи по ключу (канал, ID); блоки передачи, которой нет в таблице, отбрасываются
+    unordered_map<uint64_t, unique_ptr<IncomingTransfer>> active_transfers;
+    // Приём одного сообщения (recv, recv_file, поток): приёмник достаётся следующей начатой передаче
+    ReceiveSink* pending_sink = nullptr;
+    IncomingTransfer* awaited_transfer = nullptr;
+    TransferDescription awaited_description;
+    // Приём сеанса: приёмник каждой передачи выбирает обработчик
+    SessionHandler* session_handler = nullptr;
+    vector<uint64_t> completed_transfer_keys; // Передачи сеанса, конец которых получен
+    vector<TransferEntryDescription> transfer_entries;
+
+    vector<vector<uint8_t>> spare_buffers; // Буферы кадров и распаковки для повторного использования
+    vector<uint8_t> stored_deflate_buffer; // Блок store, переписанный несжатыми блоками deflate (--archive)
+    StreamReceiveSink stream_sink;
+
+    ReceiverStatistics statistics;
+    string error_message;
+    CpuPlacement placement; // Привязка потоков и узел памяти, применённые при open
+
+    bool open(const ChannelOptions& channel_options) {
+        if (channel_open) {
+            error_message = "канал уже открыт";
+            return false;
+        }
+        options = channel_options;
+        if (!apply_cpu_placement(options.cpu_placement, placement, error_message)) return false;
+        segment_numa_node() = placement.numa_node;
+        if (!create_worker_pool(options, placement, decompression_pool, error_message)) return false;
+
+        // Инициализируем каналы: почтовые ящики, кольцевые буферы или кольца с ареной
+        channel_closed = false;
+        closed_channel_count = 0;
+        poll_channel_index = 0;
+        poll_batch_remaining = 0;
+        for (uint32_t channel_index = 0; channel_index < options.channel_count; ++channel_index) {
+            channels.push_back(make_unique<ReceiveChannel>());
+            channels.back()->channel_index = channel_index;
+            channels.back()->segment_name = indexed_channel_segment_name(options, default_segment_name(), channel_index);
+            if (!open_receive_channel(*channels.back())) {
+                // Сегменты могут принадлежать другому consumer, поэтому не удаляются
+                close_channels(false);
+                decompression_pool.reset();
+                return false;
+            }
+        }
+
+        // Счётчики стадий для shm_stat (одни на все каналы)
+        if (options.stats_enabled) {
+            string channel_segment = channel_segment_name(options, default_segment_name());
+            if (!stage_stats.open(stats_segment_name(channel_segment, StatsRole::Consumer), StatsRole::Consumer)) {
+                SHM_LOG(LogLevel::Warn, "Предупреждение: не удалось создать сегмент счётчиков, shm_stat недоступен");
+            }
+        }
+        const ReceiveChannel& first_channel = *channels.front();
+        placement.segment_node = memory_node_of(first_channel.shared_memory_region
+                                                    ? static_cast<const void*>(first_channel.shared_memory_region)
+                                                    : static_cast<const void*>(first_channel.ring_channel.control));
+        inflight_block_limit = options.inflight_block_limit
+            ? options.inflight_block_limit
+            : 2 * decompression_pool->worker_count();
+        channel_open = true;
+        return true;
+    }
+
+    void close() {
+        if (!channel_open) return;
+        for (auto& [transfer_key, transfer] : active_transfers) {
+            collect_ordered_blocks(*transfer, 0);
+            collect_positional_tasks(*transfer, 0);
+        }
+        active_transfers.clear();
+        awaited_transfer = nullptr;
+        decompression_pool.reset();
+        close_channels(true);
+        stage_stats.close();
+        channel_open = false;
+    }
+
+    const char* default_segment_name() const {
+        return options.channel_mode == ChannelMode::Mailbox ? SHARED_MEMORY_SEGMENT_NAME : RING_SEGMENT_NAME;
+    }
+
+    // Открывает сегмент канала и занимает его сторону consumer
+    bool open_receive_channel(ReceiveChannel& channel) {
+        uint32_t* owner_word = nullptr;
+        if (options.channel_mode == ChannelMode::Mailbox) {
+            channel.shared_memory_region = initialize_shared_memory(channel.segment_name, options.ring_segment_size, error_message);
+            if (!channel.shared_memory_region) return false;
+            owner_word = mailbox_owner_word(channel.shared_memory_region, false);
+            channel_wait_targets.push_back(WaitTarget{mailbox_message_flag(channel.shared_memory_region),
+                                                       mailbox_waiter_count(channel.shared_memory_region)});
+        } else {
+            if (!open_ring_channel(options, channel.segment_name, false, channel.ring_channel, error_message)) return false;
+            owner_word = ring_owner_word(channel.ring_channel, false);
+            WaitPoint& data_available = channel.ring_channel.control->data_available;
+            channel_wait_targets.push_back(WaitTarget{&data_available.sequence, &data_available.waiter_count});
+        }
+        uint32_t current_owner = 0;
+        if (!claim_channel_side(owner_word, current_owner)) {
+            error_message = "канал " + channel.segment_name + " занят consumer (PID " + to_string(current_owner) + ")";
+            return false;
+        }
+        channel.owner_word = owner_word;
+        channel.liveness = channel.shared_memory_region ? mailbox_liveness(channel.shared_memory_region)
+                                                        : ring_liveness(channel.ring_channel);
+        channel.producer_watch.attach(producer_owner_word(channel), &channel.liveness->producer_heartbeat_ns,
+                                      &channel.liveness->consumer_heartbeat_ns,
+                                      uint64_t(options.peer_timeout_seconds) * 1000000000ull);
+        channel.ring_channel.peer_check = &producer_check;
+        recover_claimed_channel(channel, current_owner);
+        string reverse_error;
+        channel.reverse_region = initialize_shared_memory(reverse_segment_name(channel.segment_name), REVERSE_SEGMENT_SIZE, reverse_error);
+        if (!channel.reverse_region) {
+            SHM_LOG(LogLevel::Warn, "Обратный канал недоступен, дельта-передачи не поддерживаются: " << reverse_error);
+        }
+        return true;
+    }
+
+    static uint32_t* producer_owner_word(ReceiveChannel& channel) {
+        return channel.shared_memory_region ? mailbox_owner_word(channel.shared_memory_region, true)
+                                            : ring_owner_word(channel.ring_channel, true);
+    }
+
+    // Канал, оставленный упавшим consumer (previous_owner != 0): непрочитанные слоты и области арены,
+    // занятые его потоками распаковки. Без producer состояние сбрасывается сразу. Живой producer
+    // заметит смену consumer и прервёт передачу; канал сбросится, когда он уйдёт (см. channel_peer_present).
+    void recover_claimed_channel(ReceiveChannel& channel, uint32_t previous_owner) {
+        bool state_stale = previous_owner != 0 || __atomic_load_n(&channel.liveness->state_stale, __ATOMIC_ACQUIRE) != 0;
+        if (!state_stale) return;
+        SHM_LOG(LogLevel::Warn, "Канал " << channel.segment_name << " оставлен завершившимся consumer"
+                << (previous_owner ? " (PID " + to_string(previous_owner) + ")" : string()) << ", состояние восстанавливается");
+        uint32_t producer_process_id = __atomic_load_n(producer_owner_word(channel), __ATOMIC_ACQUIRE);
+        if (producer_process_id != 0 && channel_owner_alive(producer_process_id)) {
+            __atomic_store_n(&channel.liveness->state_stale, 1, __ATOMIC_RELEASE);
+            return;
+        }
+        discard_channel_state(channel);
+        // Сторона упавшего producer освобождается: следующему нечего восстанавливать
+        if (producer_process_id != 0) {
+            __atomic_compare_exchange_n(producer_owner_word(channel), &producer_process_id, 0, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Сбрасывает непрочитанное состояние канала; вызывается, когда producer нет или он ждёт восстановления
+    static void discard_channel_state(ReceiveChannel& channel) {
+        if (channel.shared_memory_region) {
+            mailbox_reset_message_state(channel.shared_memory_region);
+        } else {
+            ring_discard_state(channel.ring_channel, false);
+        }
+        channel.assembly_buffer.clear();
+        channel.frame_window.reset();
+        __atomic_store_n(&channel.liveness->state_stale, 0, __ATOMIC_RELEASE);
+    }
+
+    // Есть ли смысл ждать producer канала: false - он пропал, его сменщик просит восстановить канал
+    // или канал, оставленный упавшим consumer, освободился и может быть сброшен
+    static bool channel_peer_present(ReceiveChannel& channel) {
+        if (channel.closed) return true;
+        ChannelLiveness* liveness = channel.liveness;
+        if (__atomic_load_n(&liveness->recovery_request, __ATOMIC_ACQUIRE) !=
+            __atomic_load_n(&liveness->recovery_acknowledged, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        if (__atomic_load_n(&liveness->state_stale, __ATOMIC_ACQUIRE) && !channel_side_alive(producer_owner_word(channel))) {
+            return false;
+        }
+        return channel.producer_watch.peer_present();
+    }
+
+    // Producer канала пропал (или его сменщик просит восстановить канал): незавершённые передачи
+    // producer отбрасываются, состояние канала сбрасывается. Без сменщика канал считается закрытым,
+    // а постоянный получатель сеанса ждёт следующего producer.
+    void recover_receive_channel(ReceiveChannel& channel) {
+        ChannelLiveness* liveness = channel.liveness;
+        uint32_t lost_process_id = channel.producer_watch.lost_process_id;
+        uint32_t recovery_request = __atomic_load_n(&liveness->recovery_request, __ATOMIC_ACQUIRE);
+        bool recovery_requested = recovery_request != __atomic_load_n(&liveness->recovery_acknowledged, __ATOMIC_ACQUIRE);
+        string producer_description = lost_process_id ? "producer (PID " + to_string(lost_process_id) + ")" : string("producer");
+        SHM_LOG(LogLevel::Warn, "Канал " << channel.segment_name << ": " << producer_description
+                << (recovery_requested ? " сменился" : " перестал отвечать") << ", незавершённые передачи отброшены");
+        for (auto& [transfer_key, transfer] : active_transfers) {
+            if (transfer->description.channel_index != channel.channel_index) continue;
+            // Блоки в арене ещё распаковываются: дожидаемся их до сброса арены
+            collect_ordered_blocks(*transfer, 0);
+            collect_positional_tasks(*transfer, 0);
+            if (transfer->complete) continue;
+            transfer->fail(producer_description + " перестал отвечать, не закончив передачу");
+            transfer->complete = true;
+            if (session_handler) completed_transfer_keys.push_back(transfer_key);
+        }
+        discard_channel_state(channel);
+        channel.producer_watch.forget();
+        if (recovery_requested) {
+            __atomic_store_n(&liveness->recovery_acknowledged, recovery_request, __ATOMIC_RELEASE);
+            futex_wake_value(&liveness->recovery_acknowledged);
+            return;
+        }
+        // Сторона упавшего producer освобождается: следующему нечего восстанавливать
+        if (lost_process_id) {
+            __atomic_compare_exchange_n(producer_owner_word(channel), &lost_process_id, 0, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        }
+        if (session_handler && options.persist) {
+            session_handler->producer_finished(channel.channel_index);
+            return;
+        }
+        channel.closed = true;
+        if (++closed_channel_count == channels.size()) channel_closed = true;
+    }
+
+    void close_channels(bool unlink_segments) {
+        for (auto& channel : channels) {
+            if (channel->owner_word) release_channel_side(channel->owner_word);
+            if (channel->reverse_region) {
+                munmap(reinterpret_cast<void*>(channel->reverse_region), mailbox_mapped_size(channel->reverse_region));
+                if (unlink_segments) remove_shared_segment(reverse_segment_name(channel->segment_name));
+            }
+            if (channel->shared_memory_region) {
+                munmap(reinterpret_cast<void*>(channel->shared_memory_region), mailbox_mapped_size(channel->shared_memory_region));
+                if (unlink_segments) remove_shared_segment(channel->segment_name);
+            } else {
+                close_ring_channel(channel->ring_channel, unlink_segments);
+            }
+        }
+        channels.clear();
+        channel_wait_targets.clear();
+    }
+
+    vector<string> segment_names() const {
+        vector<string> names;
+        for (uint32_t channel_index = 0; channel_index < options.channel_count; ++channel_index) {
+            string segment_name = indexed_channel_segment_name(options, default_segment_name(), channel_index);
+            names.push_back(shared_segment_path(options.huge_page_mode, options.hugetlbfs_directory, segment_name));
+            names.push_back(reverse_segment_name(segment_name));
+        }
+        if (options.stats_enabled) {
+            names.push_back(stats_segment_name(channel_segment_name(options, default_segment_name()), StatsRole::Consumer));
+        }
+        return names;
+    }
+
+    vector<uint8_t> take_spare_buffer() {
+        if (spare_buffers.empty()) return {};
+        vector<uint8_t> spare_buffer = move(spare_buffers.back());
+        spare_buffers.pop_back();
+        return spare_buffer;
+    }
+
+    // Запас ограничен окном: буферов хватает на все блоки в работе
+    void recycle_buffer(vector<uint8_t>&& buffer) {
+        if (buffer.capacity() > 0 && spare_buffers.size() < 2 * inflight_block_limit + 4) {
+            spare_buffers.push_back(move(buffer));
+        }
+    }
+
+    void recycle_decoded_block(DecodedBlock& decoded_block) {
+        recycle_buffer(move(decoded_block.data));
+        recycle_buffer(move(decoded_block.frame_buffer));
+    }
+
+    static void append_fragment(ReceiveChannel& channel, uint32_t fragment_number, const uint8_t* payload, size_t payload_size) {
+        if (fragment_number == 0) channel.assembly_buffer.clear();
+        channel.assembly_buffer.insert(channel.assembly_buffer.end(), payload, payload + payload_size);
+    }
+
+    IncomingTransfer* find_transfer(uint64_t transfer_key) {
+        auto transfer_entry = active_transfers.find(transfer_key);
+        return transfer_entry == active_transfers.end() ? nullptr : transfer_entry->second.get();
+    }
+
+    // Следующая начатая передача будет принята в sink
+    void begin_receive(ReceiveSink& sink) {
+        pending_sink = &sink;
+        awaited_transfer = nullptr;
+        awaited_description = TransferDescription{};
+        error_message.clear();
+    }
+
+    // Приёмник передачи сеанса: файл, выбранный обработчиком, или файлы пакета
+    void open_session_sink(IncomingTransfer& transfer, const TransferInfo& transfer_info) {
+        if (transfer_info.transfer_flags & TRANSFER_FLAG_PACKED) {
+            for (const auto& entry : transfer_entries) {
+                transfer.session_outputs.push_back(
+                    TransferDescription{transfer.transfer_id, transfer.description.channel_index, entry.name, true, entry.entry_size});
+            }
+            transfer.owned_sink = make_unique<PackedFileSink>(*session_handler, transfer.session_outputs);
+        } else {
+            transfer.session_outputs.push_back(transfer.description);
+            BlockOutputFile* output_file = session_handler->open_output(transfer.description);
+            if (!output_file) {
+                transfer.fail("выходной файл не открыт");
+                return;
+            }
+            transfer.owned_sink = make_unique<FileReceiveSink>(*output_file);
+        }
+        transfer.sink = transfer.owned_sink.get();
+    }
+
+    // Сигнатура старой копии: XXH64 и CRC32C её блоков в пределах нового размера.
+    // Блоки хешируются потоками распаковки участками; ошибка чтения - сигнатуры нет.
+    void compute_delta_signature(const BlockOutputFile& base_file, size_t block_size, uint64_t total_size,
+                                 DeltaSignature& signature) {
+        uint64_t hashed_size = min(base_file.existing_size(), total_size);
+        size_t block_count = static_cast<size_t>((hashed_size + block_size - 1) / block_size);
+        if (block_count == 0) return;
+        signature.existing_size = base_file.existing_size();
+        signature.block_size = block_size;
+        signature.content_hashes.resize(block_count);
+        signature.checksums.resize(block_count);
+        size_t range_count = min(block_count, 4 * decompression_pool->worker_count());
+        vector<future<bool>> range_tasks;
+        for (size_t range_index = 0; range_index < range_count; ++range_index) {
+            size_t first_block = block_count * range_index / range_count;
+            size_t end_block = block_count * (range_index + 1) / range_count;
+            range_tasks.push_back(decompression_pool->submit([&, first_block, end_block]() {
+                vector<uint8_t> block_data(block_size);
+                for (size_t block_index = first_block; block_index < end_block; ++block_index) {
+                    uint64_t block_offset = uint64_t(block_index) * block_size;
+                    size_t block_length = static_cast<size_t>(min<uint64_t>(block_size, signature.existing_size - block_offset));
+                    if (!base_file.read_at(block_offset, block_data.data(), block_length)) return false;
+                    signature.content_hashes[block_index] = content_hash64(block_data.data(), block_length);
+                    signature.checksums[block_index] = compute_crc32c(block_data.data(), block_length);
+                }
+                return true;
+            }));
+        }
+        bool all_read = true;
+        for (auto& range_task : range_tasks) all_read = range_task.get() && all_read;
+        signature.available = all_read;
+        if (!all_read) SHM_LOG(LogLevel::Warn, "Старая копия не прочитана, передача будет принята целиком");
+    }
+
+    // Отвечает на запрос дельта- или возобновляемой передачи сигнатурой (пустой, если старой копии
+    // и контрольной точки нет)
+    void send_delta_signature(ReceiveChannel& channel, uint32_t transfer_id, const DeltaSignature& signature) {
+        if (!channel.reverse_region) return;
+        vector<uint8_t> signature_payload;
+        encode_delta_signature(signature, signature_payload);
+        PeerCheck channel_producer_check = [&channel]() { return channel_peer_present(channel); };
+        if (!reverse_send_message(channel.reverse_region, transfer_id, DELTA_SIGNATURE_BLOCK_ID, signature_payload,
+                                  &channel_producer_check)) {
+            SHM_LOG(LogLevel::Warn, "Producer пропал до получения сигнатуры передачи " << transfer_id);
+            return;
+        }
+        SHM_LOG(LogLevel::Debug, "Передача " << transfer_id << ": сигнатура " << signature.content_hashes.size()
+                << " блоков отправлена (" << signature_payload.size() << " байт"
+                << (signature.received_block_count ? ", с картой записанных блоков)" : ")"));
+    }
+
+    // Описание передачи: имя, размер блока и (если известен) размер сообщения.
+    // delta_signature != nullptr - producer ждёт сигнатуру старой копии выходного файла
+    // и (для возобновляемой передачи) карту блоков, записанных прошлой попыткой.
+    void start_transfer(ReceiveChannel& channel, uint32_t transfer_id, DeltaSignature* delta_signature) {
+        uint64_t transfer_key = incoming_transfer_key(channel.channel_index, transfer_id);
+        if (IncomingTransfer* existing_transfer = find_transfer(transfer_key)) {
+            existing_transfer->fail("повторное описание передачи " + to_string(transfer_id));
+            return;
+        }
+        if (!pending_sink && !session_handler) {
+            SHM_LOG(LogLevel::Warn, "Передача " << transfer_id << " не ожидается получателем и будет отброшена");
+            return;
+        }
+        // Передача заводится даже с ошибкой: её остаток отбрасывается до конца передачи
+        IncomingTransfer& transfer = *(active_transfers[transfer_key] = make_unique<IncomingTransfer>());
+        transfer.transfer_id = transfer_id;
+        transfer.transfer_key = transfer_key;
+        transfer.description.transfer_id = transfer_id;
+        transfer.description.channel_index = channel.channel_index;
+        if (pending_sink) {
+            transfer.sink = pending_sink;
+            pending_sink = nullptr;
+            awaited_transfer = &transfer;
+        }
+
+        TransferInfo transfer_info;
+        string decode_error;
+        if (!decode_transfer_info(channel.assembly_buffer.data(), channel.assembly_buffer.size(), transfer_info, transfer_entries, decode_error)) {
+            transfer.fail(decode_error);
+            return;
+        }
+        transfer.uncompressed_block_size = transfer_info.block_size;
+        transfer.variable_blocks = (transfer_info.transfer_flags & TRANSFER_FLAG_VARIABLE_BLOCKS) != 0;
+        transfer.chained_blocks = (transfer_info.transfer_flags & TRANSFER_FLAG_CHAINED) != 0;
+        transfer.total_size_known = (transfer_info.transfer_flags & TRANSFER_FLAG_SIZE_KNOWN) != 0;
+        transfer.expected_total_size = transfer_info.total_size;
+        transfer.description.name = transfer_entries.empty() ? string() : transfer_entries.front().name;
+        transfer.description.size_known = transfer.total_size_known;
+        transfer.description.total_size = transfer.expected_total_size;
+        if (awaited_transfer == &transfer) awaited_description = transfer.description;
+        if (transfer.uncompressed_block_size == 0 || transfer.uncompressed_block_size > MAX_UNCOMPRESSED_BLOCK_SIZE) {
+            transfer.fail("некорректный размер блока " + to_string(transfer.uncompressed_block_size));
+            return;
+        }
+        if (!transfer.sink) open_session_sink(transfer, transfer_info);
+        if (transfer.failed) return;
+        SHM_LOG(LogLevel::Debug, "Передача " << transfer_id << " начата"
+                << (transfer.description.name.empty() ? string() : ": " + transfer.description.name));
+        // Старая копия хешируется до begin_message: подготовка файла может изменить его размер
+        bool delta_requested = delta_signature && (transfer_info.transfer_flags & TRANSFER_FLAG_DELTA);
+        const BlockOutputFile* delta_base = delta_requested ? transfer.sink->delta_base() : nullptr;
+        if (delta_base) {
+            compute_delta_signature(*delta_base, transfer.uncompressed_block_size, transfer.expected_total_size, *delta_signature);
+        }
+        if (delta_signature && (transfer_info.transfer_flags & TRANSFER_FLAG_RESUMABLE)) {
+            transfer.sink->resume_checkpoint(transfer_info, *delta_signature);
+        }
+        string sink_error;
+        if (!transfer.sink->begin_message(transfer_info, sink_error)) transfer.fail(sink_error);
+    }
+
+    // Окно кадров для ссылок: ёмкость и номер следующего кадра из описания передачи.
+    // Расхождение номера (прежний producer канала не дослал кадры) сбрасывает окно.
+    void configure_frame_window(ReceiveChannel& channel) {
+        if (channel.assembly_buffer.size() < sizeof(TransferInfo)) return;
+        TransferInfo transfer_info;
+        memcpy(&transfer_info, channel.assembly_buffer.data(), sizeof(transfer_info));
+        uint64_t window_capacity = transfer_info.reference_window;
+        if (window_capacity > MAX_REFERENCE_WINDOW_SIZE) {
+            SHM_LOG(LogLevel::Warn, "Окно ссылок " << window_capacity << " байт больше допустимого, ссылки не принимаются");
+            window_capacity = 0;
+        }
+        ReceivedFrameWindow& frame_window = channel.frame_window;
+        if (frame_window.capacity() == window_capacity && frame_window.next_ordinal() == transfer_info.next_reference_ordinal) return;
+        if (frame_window.enabled()) {
+            SHM_LOG(LogLevel::Debug, "Канал " << channel.segment_name << ": окно ссылок сброшено");
+        }
+        frame_window.configure(window_capacity, transfer_info.next_reference_ordinal);
+    }
+
+    // Заменяет кадр-ссылку в буфере сборки канала копией кадра из окна; false - ссылка неверна
+    static bool resolve_reference_frame(ReceiveChannel& channel, const uint8_t* reference_frame,
+                                        const BlockFrameHeader& reference_header, string& error_message) {
+        uint64_t frame_ordinal = 0;
+        memcpy(&frame_ordinal, reference_frame + sizeof(BlockFrameHeader), sizeof(frame_ordinal));
+        const vector<uint8_t>* referenced_frame = channel.frame_window.find(frame_ordinal);
+        if (!referenced_frame) {
+            error_message = "кадр " + to_string(frame_ordinal) + " для ссылки отсутствует в окне";
+            return false;
+        }
+        BlockFrameHeader referenced_header;
+        memcpy(&referenced_header, referenced_frame->data(), sizeof(referenced_header));
+        if (referenced_header.uncompressed_length != reference_header.uncompressed_length ||
+            referenced_header.checksum != reference_header.checksum) {
+            error_message = "кадр " + to_string(frame_ordinal) + " не совпадает со ссылкой";
+            return false;
+        }
+        channel.assembly_buffer.assign(referenced_frame->begin(), referenced_frame->end());
+        return true;
+    }
+
+    void finish_transfer_marker(ReceiveChannel& channel, uint32_t transfer_id) {
+        IncomingTransfer* transfer = find_transfer(incoming_transfer_key(channel.channel_index, transfer_id));
+        if (!transfer) return; // Хвост передачи, начало которой не было принято
+        if (channel.assembly_buffer.size() < sizeof(TransferEnd)) {
+            transfer->fail("некорректный конец передачи");
+        } else {
+            memcpy(&transfer->transfer_end, channel.assembly_buffer.data(), sizeof(TransferEnd));
+        }
+        transfer->complete = true;
+        if (session_handler) completed_transfer_keys.push_back(transfer->transfer_key);
+    }
+
+    // Producer канала завершил работу: его незавершённые передачи уже не будут дописаны.
+    // Постоянный получатель сеанса сразу ждёт на канале следующего producer.
+    void close_receive_channel(ReceiveChannel& channel) {
+        for (auto& [transfer_key, transfer] : active_transfers) {
+            if (transfer->description.channel_index != channel.channel_index || transfer->complete) continue;
+            transfer->fail("канал закрыт до конца сообщения");
+            transfer->complete = true;
+            if (session_handler) completed_transfer_keys.push_back(transfer_key);
+        }
+        channel.frame_window.reset();
+        channel.producer_watch.forget();
+        if (session_handler && options.persist) {
+            SHM_LOG(LogLevel::Debug, "Канал " << channel.segment_name << ": producer завершил сеанс");
+            session_handler->producer_finished(channel.channel_index);
+            return;
+        }
+        channel.closed = true;
+        if (++closed_channel_count == channels.size()) channel_closed = true;
+        SHM_LOG(LogLevel::Info, "Получен сигнал завершения"
+                << (channels.size() > 1 ? " по каналу " + channel.segment_name : string()));
+    }
+
+    // Есть ли в канале непрочитанное сообщение (без ожидания)
+    static bool channel_has_message(ReceiveChannel& channel) {
+        if (channel.shared_memory_region) {
+            return __atomic_load_n(mailbox_message_flag(channel.shared_memory_region), __ATOMIC_ACQUIRE) == 1;
+        }
+        RingChannel& ring_channel = channel.ring_channel;
+        if (ring_channel.cached_peer_index != ring_channel.local_index) return true;
+        ring_channel.cached_peer_index = __atomic_load_n(&ring_channel.control->producer_head, __ATOMIC_ACQUIRE);
+        return ring_channel.cached_peer_index != ring_channel.local_index;
+    }
+
+    // Есть ли непрочитанное сообщение хотя бы в одном открытом канале
+    bool channel_has_message() {
+        for (auto& channel : channels) {
+            if (!channel->closed && channel_has_message(*channel)) return true;
+        }
+        return false;
+    }
+
+    // Канал, из которого читается следующее сообщение. Каналы обходятся по кругу: текущий отдаёт
+    // до CHANNEL_POLL_BATCH сообщений подряд, затем очередь переходит к следующему с данными,
+    // поэтому быстрый producer не задерживает остальных дольше одной пачки. Если данных нет
+    // ни в одном канале, consumer ждёт сразу на всех. nullptr - producer одного из каналов пропал
+    // (см. lost_channel).
+    ReceiveChannel* next_ready_channel() {
+        // Единственный канал ждёт внутри receive_one, как и раньше
+        if (channels.size() == 1) return channels.front().get();
+        ReceiveChannel* current_channel = channels[poll_channel_index].get();
+        if (poll_batch_remaining > 0 && !current_channel->closed && channel_has_message(*current_channel)) {
+            --poll_batch_remaining;
+            return current_channel;
+        }
+        ReceiveChannel* ready_channel = nullptr;
+        bool channel_ready = wait_until_any(channel_wait_targets, options.wait_strategy, [&]() {
+            for (size_t step = 1; step <= channels.size(); ++step) {
+                size_t channel_index = (poll_channel_index + step) % channels.size();
+                ReceiveChannel& channel = *channels[channel_index];
+                if (!channel.closed && channel_has_message(channel)) {
+                    poll_channel_index = channel_index;
+                    ready_channel = &channel;
+                    return true;
+                }
+            }
+            return false;
+        }, &producer_check);
+        if (!channel_ready) return nullptr;
+        poll_batch_remaining = CHANNEL_POLL_BATCH - 1;
+        return ready_channel;
+    }
+
+    // Принимает одно сообщение канала и ставит готовый блок на распаковку
+    void receive_one() {
+        ReceiveChannel* ready_channel = next_ready_channel();
+        if (!ready_channel) {
+            recover_receive_channel(*lost_channel);
+            return;
+        }
+        ReceiveChannel& channel = *ready_channel;
+        SharedMemoryHeader* shared_memory_region = channel.shared_memory_region;
+        RingChannel& ring_channel = channel.ring_channel;
+        uint32_t transfer_id = 0;
+        uint32_t current_block_id = 0;
+        uint32_t fragment_number = 0;
+        uint8_t is_last_fragment = 0;
+        uint32_t payload_size = 0;
+        bool payload_in_arena = false;    // Сжатый блок лежит в арене (режим arena)
+        const uint8_t* arena_payload = nullptr;
+        uint32_t arena_region = 0;
+        uint64_t receive_start = stage_stats.stage_start();
+
+        if (shared_memory_region) {
+            // Ожидаем новых данных от producer и читаем их сразу в буфер сборки блока
+            if (!mailbox_acquire_message(shared_memory_region, options.wait_strategy, &producer_check)) {
+                recover_receive_channel(*lost_channel);
+                return;
+            }
+            transfer_id = shared_memory_region->transfer_identifier;
+            current_block_id = shared_memory_region->data_block_identifier;
+            fragment_number = shared_memory_region->fragment_sequence_number;
+            is_last_fragment = shared_memory_region->is_final_fragment;
+            payload_size = min(shared_memory_region->actual_payload_length, shared_memory_region->payload_capacity);
+            if (current_block_id != TERMINATION_BLOCK_ID) {
+                append_fragment(channel, fragment_number, mailbox_payload(shared_memory_region), payload_size);
+            }
+            mailbox_release_message(shared_memory_region);
+        } else {
+            // Ожидаем опубликованный слот; producer тем временем заполняет следующие
+            RingSlotHeader* slot = ring_acquire_read_slot(ring_channel);
+            if (!slot) {
+                recover_receive_channel(*lost_channel);
+                return;
+            }
+            if (measure_latency) fragment_latency.record(monotonic_time_ns() - slot->publish_time_ns);
+            transfer_id = slot->transfer_identifier;
+            current_block_id = slot->data_block_identifier;
+            fragment_number = slot->fragment_sequence_number;
+            is_last_fragment = slot->is_final_fragment;
+            payload_size = slot->actual_payload_length;
+            payload_in_arena = slot->payload_in_arena != 0;
+            if (payload_in_arena) {
+                // Блок лежит в арене: запоминаем только дескриптор
+                arena_payload = ring_channel.arena_area + slot->arena_payload_offset;
+                payload_size = slot->arena_payload_length;
+                arena_region = static_cast<uint32_t>(slot->arena_payload_offset / ring_channel.arena_region_size);
+            } else if (current_block_id != TERMINATION_BLOCK_ID) {
+                // Копируем фрагмент сразу в буфер сборки блока и освобождаем слот
+                append_fragment(channel, fragment_number, ring_slot_payload(slot), payload_size);
+            }
+            ring_release_read_slot(ring_channel);
+        }
+
+        stage_stats.finish_stage(PipelineStage::Receive, receive_start, payload_size);
+        channel.producer_watch.beat();
+        SHM_LOG(LogLevel::Trace, "Получено: transfer_id=" << transfer_id << ", block_id=" << current_block_id
+                << ", last_chunk=" << (int)is_last_fragment << ", размер данных=" << payload_size << " байт");
+
+        if (current_block_id == TERMINATION_BLOCK_ID) {
+            close_receive_channel(channel);
+            return;
+        }
+        if (!is_last_fragment) return;
+        if (current_block_id == TRANSFER_INFO_BLOCK_ID) {
+            configure_frame_window(channel);
+            TransferInfo transfer_info{};
+            memcpy(&transfer_info, channel.assembly_buffer.data(), min(channel.assembly_buffer.size(), sizeof(transfer_info)));
+            // Producer дельта- и возобновляемой передачи ждёт ответа, даже если передача не будет принята
+            bool signature_requested = (transfer_info.transfer_flags & (TRANSFER_FLAG_DELTA | TRANSFER_FLAG_RESUMABLE)) != 0;
+            DeltaSignature delta_signature;
+            start_transfer(channel, transfer_id, signature_requested ? &delta_signature : nullptr);
+            if (signature_requested) send_delta_signature(channel, transfer_id, delta_signature);
+            return;
+        }
+        if (current_block_id == TRANSFER_END_BLOCK_ID) {
+            finish_transfer_marker(channel, transfer_id);
+            return;
+        }
+
+        // Окно кадров ведётся по всем блокам канала, в том числе отбрасываемым: номера кадров
+        // должны совпадать с номерами producer
+        bool referenced_block = false;
+        string reference_error;
+        if (channel.frame_window.enabled()) {
+            const uint8_t* received_frame = payload_in_arena ? arena_payload : channel.assembly_buffer.data();
+            size_t received_length = payload_in_arena ? payload_size : channel.assembly_buffer.size();
+            BlockFrameHeader received_header;
+            string header_error;
+            if (received_length == REFERENCE_FRAME_LENGTH &&
+                parse_block_frame_header(received_frame, received_length, received_header, header_error) &&
+                received_header.codec_id == static_cast<uint8_t>(BlockCodec::Reference)) {
+                // Кадр-ссылка раскрывается в буфер сборки; область арены больше не нужна
+                referenced_block = true;
+                uint8_t reference_frame[REFERENCE_FRAME_LENGTH];
+                memcpy(reference_frame, received_frame, REFERENCE_FRAME_LENGTH);
+                if (payload_in_arena) {
+                    arena_release_region(ring_channel, arena_region);
+                    payload_in_arena = false;
+                }
+                resolve_reference_frame(channel, reference_frame, received_header, reference_error);
+            } else {
+                channel.frame_window.record(received_frame, received_length);
+            }
+        }
+
+        const RingChannel* ring = payload_in_arena ? &ring_channel : nullptr;
+        IncomingTransfer* transfer = find_transfer(incoming_transfer_key(channel.channel_index, transfer_id));
+        if (!transfer || transfer->failed) {
+            // Блок отбрасывается, но область арены нужно вернуть producer
+            if (ring) arena_release_region(*ring, arena_region);
+            if (!transfer) SHM_LOG(LogLevel::Debug, "Блок " << transfer_id << ":" << current_block_id << " вне принимаемых передач отброшен");
+            return;
+        }
+        ++transfer->received_blocks_count;
+        if (!reference_error.empty()) {
+            transfer->fail("блок " + to_string(current_block_id) + ": " + reference_error);
+            return;
+        }
+        if (referenced_block) ++statistics.referenced_blocks;
+
+        // Источник сжатых данных: область арены или собранный буфер (без копирования)
+        vector<uint8_t> frame_buffer;
+        const uint8_t* compressed_input = arena_payload;
+        size_t compressed_length = payload_size;
+        if (payload_in_arena) {
+            SHM_LOG(LogLevel::Debug, "Блок " << transfer_id << ":" << current_block_id << " в арене, размер: " << payload_size << " байт");
+        } else {
+            frame_buffer = move(channel.assembly_buffer);
+            channel.assembly_buffer = take_spare_buffer();
+            compressed_input = frame_buffer.data();
+            compressed_length = frame_buffer.size();
+            SHM_LOG(LogLevel::Debug, "Блок " << transfer_id << ":" << current_block_id << " собран, размер: " << compressed_length << " байт");
+        }
+        dispatch_block(*transfer, current_block_id, move(frame_buffer), compressed_input, compressed_length, ring, arena_region);
+    }
+
+    void dispatch_block(IncomingTransfer& transfer, uint32_t block_id, vector<uint8_t>&& frame_buffer,
+                        const uint8_t* compressed_input, size_t compressed_length, const RingChannel* ring,
+                        uint32_t arena_region) {
+        if (transfer.chained_blocks) {
+            dispatch_chained_block(transfer, block_id, move(frame_buffer), compressed_input, compressed_length, ring, arena_region);
+            return;
+        }
+        ReceiveSink* sink = transfer.sink;
+        if (sink->positional()) {
+            // Смещение блока известно заранее: поток распаковки сам пишет его на место
+            uint64_t block_offset = static_cast<uint64_t>(block_id) * transfer.uncompressed_block_size;
+            size_t expected_length = 0;
+            if (transfer.variable_blocks) {
+                // Блоки переменной длины идут подряд: смещение - сумма длин предыдущих блоков
+                BlockFrameHeader frame_header;
+                string header_error;
+                if (block_id != transfer.next_expected_block_id ||
+                    !parse_block_frame_header(compressed_input, compressed_length, frame_header, header_error) ||
+                    frame_header.uncompressed_length > transfer.uncompressed_block_size ||
+                    (transfer.total_size_known &&
+                     transfer.next_block_offset + frame_header.uncompressed_length > transfer.expected_total_size)) {
+                    if (ring) arena_release_region(*ring, arena_region);
+                    transfer.fail("блок " + to_string(block_id) + " переменной длины не на своём месте");
+                    return;
+                }
+                ++transfer.next_expected_block_id;
+                block_offset = transfer.next_block_offset;
+                expected_length = frame_header.uncompressed_length;
+                transfer.next_block_offset += expected_length;
+            } else if (transfer.total_size_known && block_offset >= transfer.expected_total_size) {
+                if (ring) arena_release_region(*ring, arena_region);
+                transfer.fail("блок " + to_string(block_id) + " за пределами сообщения");
+                return;
+            } else if (transfer.total_size_known) {
+                expected_length = static_cast<size_t>(min<uint64_t>(transfer.uncompressed_block_size,
+                                                                    transfer.expected_total_size - block_offset));
+            }
+            uint8_t* destination = expected_length ? sink->block_destination(block_offset, expected_length) : nullptr;
+            atomic<uint64_t>* written_end_offset = &transfer.written_end_offset;
+            transfer.positional_write_tasks.push_back(decompression_pool->submit(
+                [this, sink, ring, arena_region, block_id, block_offset, expected_length, destination, written_end_offset,
+                 frame_buffer = move(frame_buffer), compressed_input, compressed_length,
+                 decode_buffer = take_spare_buffer()]() mutable {
+                    DecodedBlock decoded_block;
+                    decoded_block.data = move(decode_buffer);
+                    size_t block_length = 0;
+                    // При отображённом приёмнике распаковываем прямо в него
+                    uint64_t inflate_start = stage_stats.stage_start();
+                    bool block_valid = decode_block_frame(compressed_input, compressed_length, destination, expected_length,
+                                                          decoded_block.data, block_length, decoded_block.error_message);
+                    stage_stats.finish_stage(PipelineStage::Inflate, inflate_start, block_length);
+                    if (ring) arena_release_region(*ring, arena_region);
+                    decoded_block.frame_buffer = move(frame_buffer);
+                    if (!block_valid) {
+                        decoded_block.error_message = "блок " + to_string(block_id) + ": " + decoded_block.error_message;
+                        return decoded_block;
+                    }
+                    uint64_t write_start = stage_stats.stage_start();
+                    if (!destination && !sink->write_block_at(block_offset, decoded_block.data.data(), block_length)) {
+                        decoded_block.error_message = "блок " + to_string(block_id) + ": ошибка записи";
+                        return decoded_block;
+                    }
+                    if (!destination) stage_stats.finish_stage(PipelineStage::Write, write_start, block_length);
+                    sink->block_written(block_id);
+                    stage_stats.add_transferred(block_length, 1);
+                    uint64_t block_end = block_offset + block_length;
+                    uint64_t previous_end = written_end_offset->load(memory_order_relaxed);
+                    while (previous_end < block_end &&
+                           !written_end_offset->compare_exchange_weak(previous_end, block_end, memory_order_relaxed)) {
+                    }
+                    return decoded_block;
+                }));
+            collect_positional_tasks(transfer, inflight_block_limit);
+            return;
+        }
+
+        // Распаковка в пуле потоков, запись по порядку в потоке приёма
+        OrderedDecodeTask decode_task;
+        decode_task.block_id = block_id;
+        decode_task.decoded_block = decompression_pool->submit(
+            [this, ring, arena_region, block_id, frame_buffer = move(frame_buffer), compressed_input, compressed_length,
+             decode_buffer = take_spare_buffer()]() mutable {
+                DecodedBlock decoded_block;
+                decoded_block.data = move(decode_buffer);
+                size_t block_length = 0;
+                uint64_t inflate_start = stage_stats.stage_start();
+                if (!decode_block_frame(compressed_input, compressed_length, nullptr, 0,
+                                        decoded_block.data, block_length, decoded_block.error_message)) {
+                    decoded_block.error_message = "блок " + to_string(block_id) + ": " + decoded_block.error_message;
+                }
+                stage_stats.finish_stage(PipelineStage::Inflate, inflate_start, block_length);
+                if (ring) arena_release_region(*ring, arena_region);
+                decoded_block.frame_buffer = move(frame_buffer);
+                return decoded_block;
+            });
+        transfer.decompression_tasks.push_back(move(decode_task));
+        collect_ordered_blocks(transfer, inflight_block_limit);
+    }
+
+    // Блок цепочки deflate: распаковке нужен хвост предыдущего блока, поэтому блоки цепочки
+    // распаковываются по порядку в потоке приёма, а не в пуле (параллельным остаётся сжатие)
+    void dispatch_chained_block(IncomingTransfer& transfer, uint32_t block_id, vector<uint8_t>&& frame_buffer,
+                                const uint8_t* compressed_input, size_t compressed_length, const RingChannel* ring,
+                                uint32_t arena_region) {
+        string block_error;
+        if (block_id != transfer.next_expected_block_id) {
+            transfer.fail("получен блок " + to_string(block_id) + " вместо " + to_string(transfer.next_expected_block_id));
+        } else if (transfer.sink->stores_deflate_stream()
+                       ? !archive_chained_block(transfer, compressed_input, compressed_length, block_error)
+                       : !decode_chained_block(transfer, compressed_input, compressed_length, block_error)) {
+            transfer.fail("блок " + to_string(block_id) + ": " + block_error);
+        } else {
+            ++transfer.next_expected_block_id;
+        }
+        if (ring) arena_release_region(*ring, arena_region);
+        recycle_buffer(move(frame_buffer));
+    }
+
+    // Распаковывает блок цепочки со словарём и пишет его на место или по порядку
+    bool decode_chained_block(IncomingTransfer& transfer, const uint8_t* frame, size_t frame_length, string& block_error) {
+        BlockFrameHeader frame_header;
+        if (!parse_block_frame_header(frame, frame_length, frame_header, block_error)) return false;
+        ReceiveSink* sink = transfer.sink;
+        uint64_t block_offset = transfer.next_block_offset;
+        size_t block_length = frame_header.uncompressed_length;
+        if (block_length > transfer.uncompressed_block_size ||
+            (transfer.total_size_known && block_offset + block_length > transfer.expected_total_size)) {
+            block_error = "за пределами сообщения";
+            return false;
+        }
+        uint8_t* destination = sink->positional() && block_length ? sink->block_destination(block_offset, block_length) : nullptr;
+        vector<uint8_t> decoded_data = take_spare_buffer();
+        size_t decoded_length = 0;
+        uint64_t inflate_start = stage_stats.stage_start();
+        bool block_valid = decode_block_frame(frame, frame_length, destination, block_length, decoded_data, decoded_length,
+                                              block_error, &transfer.deflate_dictionary);
+        stage_stats.finish_stage(PipelineStage::Inflate, inflate_start, decoded_length);
+        if (!block_valid) {
+            recycle_buffer(move(decoded_data));
+            return false;
+        }
+        // Словарь обновляется до записи: приёмник по порядку может забрать буфер блока себе
+        const uint8_t* block_data = destination ? destination : decoded_data.data();
+        advance_deflate_dictionary(transfer.deflate_dictionary, block_data, decoded_length);
+
+        uint64_t write_start = stage_stats.stage_start();
+        bool block_written = true;
+        if (sink->positional()) {
+            if (!destination) block_written = sink->write_block_at(block_offset, block_data, decoded_length);
+            transfer.written_end_offset.store(block_offset + decoded_length, memory_order_relaxed);
+        } else {
+            block_written = sink->append_block(decoded_data);
+            transfer.appended_bytes += decoded_length;
+        }
+        recycle_buffer(move(decoded_data));
+        if (!block_written) {
+            block_error = "ошибка записи";
+            return false;
+        }
+        stage_stats.finish_stage(PipelineStage::Write, write_start, decoded_length);
+        stage_stats.add_transferred(decoded_length, 1);
+        transfer.next_block_offset += decoded_length;
+        return true;
+    }
+
+    // Дописывает данные deflate блока цепочки в архив без распаковки; блок store
+    // записывается несжатыми блоками deflate
+    bool archive_chained_block(IncomingTransfer& transfer, const uint8_t* frame, size_t frame_length, string& block_error) {
+        BlockFrameHeader frame_header;
+        if (!parse_block_frame_header(frame, frame_length, frame_header, block_error)) return false;
+        const uint8_t* payload = frame + sizeof(BlockFrameHeader);
+        size_t block_length = frame_header.uncompressed_length;
+        uint64_t write_start = stage_stats.stage_start();
+        bool block_written = false;
+        if (frame_header.codec_id == static_cast<uint8_t>(BlockCodec::Deflate) &&
+            frame_header.compressed_length >= DEFLATE_BLOCK_PREFIX_LENGTH) {
+            uint32_t block_checksums[2];
+            memcpy(block_checksums, payload, sizeof(block_checksums));
+            block_written = transfer.sink->append_deflate_block(payload + DEFLATE_BLOCK_PREFIX_LENGTH,
+                                                                frame_header.compressed_length - DEFLATE_BLOCK_PREFIX_LENGTH,
+                                                                block_checksums[0], block_checksums[1], block_length);
+        } else if (frame_header.codec_id == static_cast<uint8_t>(BlockCodec::Store) &&
+                   frame_header.compressed_length == block_length) {
+            stored_deflate_buffer.clear();
+            encode_stored_deflate_blocks(payload, block_length, stored_deflate_buffer);
+            block_written = transfer.sink->append_deflate_block(
+                stored_deflate_buffer.data(), stored_deflate_buffer.size(),
+                static_cast<uint32_t>(crc32(0, payload, static_cast<uInt>(block_length))),
+                static_cast<uint32_t>(adler32(1, payload, static_cast<uInt>(block_length))), block_length);
+        } else {
+            block_error = string("кадр ") + block_codec_name(frame_header.codec_id) + " нельзя сохранить в поток deflate";
+            return false;
+        }
+        if (!block_written) {
+            block_error = "ошибка записи";
+            return false;
+        }
+        stage_stats.finish_stage(PipelineStage::Write, write_start, frame_length);
+        stage_stats.add_transferred(block_length, 1);
+        transfer.appended_bytes += block_length;
+        transfer.next_block_offset += block_length;
+        return true;
+    }
+
+    // Забирает завершённые задачи позиционной записи; при переполнении окна ждёт самую старую
+    void collect_positional_tasks(IncomingTransfer& transfer, size_t task_limit) {
+        auto& positional_write_tasks = transfer.positional_write_tasks;
+        while (!positional_write_tasks.empty() &&
+               (positional_write_tasks.size() > task_limit ||
+                positional_write_tasks.front().wait_for(chrono::milliseconds(0)) == future_status::ready)) {
+            DecodedBlock decoded_block = positional_write_tasks.front().get();
+            positional_write_tasks.pop_front();
+            if (!decoded_block.error_message.empty()) transfer.fail(decoded_block.error_message);
+            recycle_decoded_block(decoded_block);
+        }
+        stage_stats.set_queue_depth(positional_write_tasks.size());
+    }
+
+    // Записывает готовые блоки в правильном порядке; при переполнении окна ждёт самый старый
+    void collect_ordered_blocks(IncomingTransfer& transfer, size_t task_limit) {
+        auto& decompression_tasks = transfer.decompression_tasks;
+        while (!decompression_tasks.empty() &&
+               (decompression_tasks.size() > task_limit ||
+                decompression_tasks.front().decoded_block.wait_for(chrono::milliseconds(0)) == future_status::ready)) {
+            uint32_t block_id = decompression_tasks.front().block_id;
+            DecodedBlock decoded_block = decompression_tasks.front().decoded_block.get();
+            decompression_tasks.pop_front();
+            if (!decoded_block.error_message.empty()) {
+                transfer.fail(decoded_block.error_message);
+            } else if (!transfer.failed && block_id != transfer.next_expected_block_id) {
+                transfer.fail("получен блок " + to_string(block_id) + " вместо " + to_string(transfer.next_expected_block_id));
+            } else if (!transfer.failed) {
+                size_t block_length = decoded_block.data.size();
+                uint64_t write_start = stage_stats.stage_start();
+                if (!transfer.sink->append_block(decoded_block.data)) {
+                    transfer.fail("блок " + to_string(block_id) + ": ошибка записи");
+                }
+                stage_stats.finish_stage(PipelineStage::Write, write_start, block_length);
+                stage_stats.add_transferred(block_length, 1);
+                transfer.appended_bytes += block_length;
+                ++transfer.next_expected_block_id;
+                SHM_LOG(LogLevel::Debug, "Блок " << transfer.transfer_id << ":" << block_id << " записан: " << block_length << " байт");
+            }
+            recycle_decoded_block(decoded_block);
+        }
+        stage_stats.set_queue_depth(decompression_tasks.size());
+    }
+
+    // Дожидается оставшихся блоков, проверяет передачу по её концу и закрывает приёмник
+    bool finish_transfer(IncomingTransfer& transfer) {
+        collect_ordered_blocks(transfer, 0);
+        collect_positional_tasks(transfer, 0);
+        if (!transfer.complete) {
+            transfer.fail("канал закрыт до конца сообщения");
+        } else if (transfer.transfer_end.end_flags & TRANSFER_END_FLAG_ABORTED) {
+            transfer.fail("отправитель прервал передачу");
+        } else if (transfer.received_blocks_count != transfer.transfer_end.block_count) {
+            transfer.fail("получено " + to_string(transfer.received_blocks_count) + " блоков из " +
+                          to_string(transfer.transfer_end.block_count));
+        }
+        uint64_t final_size = transfer.total_size_known
+            ? transfer.expected_total_size
+            : max(transfer.written_end_offset.load(), transfer.appended_bytes);
+        if (!transfer.failed && final_size != transfer.transfer_end.total_size) {
+            transfer.fail("размер сообщения " + to_string(final_size) + " не совпадает с отправленным " +
+                          to_string(transfer.transfer_end.total_size));
+        }
+        string sink_error;
+        if (!transfer.failed && !transfer.sink->end_message(final_size, sink_error)) transfer.fail(sink_error);
+        if (transfer.complete && (transfer.transfer_end.end_flags & TRANSFER_END_FLAG_CONFIRM)) send_transfer_outcome(transfer);
+        if (transfer.failed) return false;
+        statistics.output_bytes += final_size;
+        statistics.blocks += transfer.received_blocks_count;
+        ++statistics.messages;
+        return true;
+    }
+
+    // Producer ждёт итог передачи: сообщаем, записана ли она или отклонена и почему
+    void send_transfer_outcome(const IncomingTransfer& transfer) {
+        ReceiveChannel& channel = *channels[transfer.description.channel_index];
+        if (!channel.reverse_region) return;
+        vector<uint8_t> outcome_payload;
+        encode_transfer_outcome(!transfer.failed, transfer.error_message, outcome_payload);
+        PeerCheck channel_producer_check = [&channel]() { return channel_peer_present(channel); };
+        if (!reverse_send_message(channel.reverse_region, transfer.transfer_id, TRANSFER_OUTCOME_BLOCK_ID, outcome_payload,
+                                  &channel_producer_check)) {
+            SHM_LOG(LogLevel::Debug, "Producer пропал до получения итога передачи " << transfer.transfer_id);
+        }
+    }
+
+    // Завершает передачу, которую ждёт recv или поток, и убирает её из таблицы
+    ReceiveStatus finish_awaited_transfer() {
+        pending_sink = nullptr;
+        IncomingTransfer* transfer = awaited_transfer;
+        awaited_transfer = nullptr;
+        if (!transfer) {
+            error_message = "канал закрыт";
+            return ReceiveStatus::Closed;
+        }
+        bool transfer_succeeded = finish_transfer(*transfer);
+        error_message = transfer->error_message;
+        active_transfers.erase(transfer->transfer_key);
+        return transfer_succeeded ? ReceiveStatus::Message : ReceiveStatus::Error;
+    }
+
+    // Завершает передачу сеанса и сообщает результат обработчику по каждому её файлу
+    void finish_session_transfer(uint64_t transfer_key) {
+        IncomingTransfer* transfer = find_transfer(transfer_key);
+        if (!transfer) return;
+        bool transfer_succeeded = finish_transfer(*transfer);
+        if (!transfer_succeeded) {
+            SHM_LOG(LogLevel::Warn, "Передача " << transfer->transfer_id
+                    << (transfer->description.name.empty() ? string() : " (" + transfer->description.name + ")")
+                    << " отброшена: " << transfer->error_message);
+        }
+        if (transfer->session_outputs.empty()) transfer->session_outputs.push_back(transfer->description);
+        for (const auto& session_output : transfer->session_outputs) {
+            session_handler->transfer_finished(session_output, transfer_succeeded, transfer->error_message);
+        }
+        active_transfers.erase(transfer_key);
+    }
+
+    ReceiveStatus receive_session(SessionHandler& handler) {
+        if (!channel_open) {
+            error_message = "канал не открыт";
+            return ReceiveStatus::Error;
+        }
+        session_handler = &handler;
+        error_message.clear();
+        vector<uint64_t> finished_transfer_keys;
+        while (!channel_closed) {
+            receive_one();
+            finished_transfer_keys.swap(completed_transfer_keys);
+            for (uint64_t transfer_key : finished_transfer_keys) finish_session_transfer(transfer_key);
+            finished_transfer_keys.clear();
+        }
+        // Передачи без конца: отправитель закрыл канал, не завершив их
+        while (!active_transfers.empty()) finish_session_transfer(active_transfers.begin()->first);
+        completed_transfer_keys.clear();
+        session_handler = nullptr;
+        return ReceiveStatus::Closed;
+    }
+
+    // Дочитывает ожидаемое сообщение до конца (или до закрытия канала)
+    void receive_until_message_end() {
+        while (!channel_closed && !(awaited_transfer && awaited_transfer->complete)) receive_one();
+    }
+
+    ReceiveStatus receive_message(ReceiveSink& sink) {
+        if (!channel_open) {
+            error_message = "канал не открыт";
+            return ReceiveStatus::Error;
+        }
+        begin_receive(sink);
+        receive_until_message_end();
+        return finish_awaited_transfer();
+    }
+
+    // Возвращает буферы непрочитанных блоков потока в запас
+    void reset_stream_sink() {
+        for (auto& ready_block : stream_sink.ready_blocks) recycle_buffer(move(ready_block));
+        stream_sink.ready_blocks.clear();
+        stream_sink.read_offset = 0;
+    }
+};
+
+ChannelReceiver::ChannelReceiver() : impl(make_unique<Impl>()) {}
+
+ChannelReceiver::~ChannelReceiver() { close(); }
+
+bool ChannelReceiver::open(const ChannelOptions& options) { return impl->open(options); }
+
+ReceiveStatus ChannelReceiver::recv(MutableByteSpan buffer, size_t& message_length) {
+    SpanReceiveSink span_sink(buffer);
+    ReceiveStatus receive_status = impl->receive_message(span_sink);
+    message_length = receive_status == ReceiveStatus::Message ? span_sink.message_length : 0;
+    return receive_status;
+}
+
+ReceiveStatus ChannelReceiver::recv(vector<uint8_t>& message) {
+    VectorReceiveSink vector_sink(message);
+    return impl->receive_message(vector_sink);
+}
+
+ReceiveStatus ChannelReceiver::recv_file(BlockOutputFile& output_file) {
+    if (impl->options.archive_format != ArchiveFormat::None) {
+        ArchiveReceiveSink archive_sink(output_file, impl->options.archive_format);
+        return impl->receive_message(archive_sink);
+    }
+    FileReceiveSink file_sink(output_file);
+    return impl->receive_message(file_sink);
+}
+
+ReceiveStatus ChannelReceiver::receive_session(SessionHandler& session_handler) {
+    return impl->receive_session(session_handler);
+}
+
+void ChannelReceiver::reopen() {
+    for (auto& channel : impl->channels) channel->closed = false;
+    impl->closed_channel_count = 0;
+    impl->channel_closed = false;
+}
+
+vector<string> ChannelReceiver::segment_names() const { return impl->segment_names(); }
+
+const CpuPlacement& ChannelReceiver::cpu_placement() const { return impl->placement; }
+
+void ChannelReceiver::close() { impl->close(); }
+
+void ChannelReceiver::set_latency_recording(bool record_latency) { impl->measure_latency = record_latency; }
+
+LatencyRecorder& ChannelReceiver::fragment_latency() { return impl->fragment_latency; }
+
+const ReceiverStatistics& ChannelReceiver::statistics() const { return impl->statistics; }
+
+const string& ChannelReceiver::error_message() const { return impl->error_message; }
+
+ChannelStreamReader::ChannelStreamReader(ChannelReceiver& channel_receiver) : receiver(channel_receiver) {}
+
+ChannelStreamReader::~ChannelStreamReader() {
+    if (!stream_started || stream_finished) return;
+    ChannelReceiver::Impl& receiver_impl = *receiver.impl;
+    receiver_impl.receive_until_message_end();
+    receiver_impl.finish_awaited_transfer();
+    receiver_impl.reset_stream_sink();
+}
+
+ReceiveStatus ChannelStreamReader::read(MutableByteSpan buffer, size_t& length) {
+    ChannelReceiver::Impl& receiver_impl = *receiver.impl;
+    StreamReceiveSink& stream_sink = receiver_impl.stream_sink;
+    length = 0;
+    if (stream_finished) return ReceiveStatus::Message;
+    if (!stream_started) {
+        if (!receiver_impl.channel_open) {
+            receiver_impl.error_message = "канал не открыт";
+            return ReceiveStatus::Error;
+        }
+        receiver_impl.reset_stream_sink();
+        receiver_impl.begin_receive(stream_sink);
+        stream_started = true;
+        // Ждём описание передачи, чтобы размер сообщения был известен сразу
+        while (!receiver_impl.awaited_transfer && !receiver_impl.channel_closed) {
+            receiver_impl.receive_one();
+        }
+        if (!receiver_impl.awaited_transfer || receiver_impl.awaited_transfer->failed) {
+            receiver_impl.receive_until_message_end();
+            stream_finished = true;
+            return receiver_impl.finish_awaited_transfer();
+        }
+    }
+
+    // Канал читается, только пока это не задерживает уже принятые блоки: иначе
+    // при медленном отправителе готовый блок ждал бы следующего сообщения
+    IncomingTransfer& transfer = *receiver_impl.awaited_transfer;
+    while (stream_sink.ready_blocks.empty()) {
+        auto& decompression_tasks = transfer.decompression_tasks;
+        bool message_received = transfer.complete || receiver_impl.channel_closed;
+        if (transfer.failed) {
+            receiver_impl.receive_until_message_end();
+            stream_finished = true;
+            ReceiveStatus receive_status = receiver_impl.finish_awaited_transfer();
+            receiver_impl.reset_stream_sink();
+            return receive_status;
+        }
+        if (!decompression_tasks.empty() &&
+            decompression_tasks.front().decoded_block.wait_for(chrono::milliseconds(0)) == future_status::ready) {
+            receiver_impl.collect_ordered_blocks(transfer, receiver_impl.inflight_block_limit);
+        } else if (!message_received && (decompression_tasks.empty() || receiver_impl.channel_has_message())) {
+            receiver_impl.receive_one();
+        } else if (!decompression_tasks.empty()) {
+            receiver_impl.collect_ordered_blocks(transfer, decompression_tasks.size() - 1);
+        } else {
+            stream_finished = true;
+            ReceiveStatus receive_status = receiver_impl.finish_awaited_transfer();
+            receiver_impl.reset_stream_sink();
+            return receive_status;
+        }
+    }
+
+    vector<uint8_t>& ready_block = stream_sink.ready_blocks.front();
+    length = min(buffer.size, ready_block.size() - stream_sink.read_offset);
+    memcpy(buffer.data, ready_block.data() + stream_sink.read_offset, length);
+    stream_sink.read_offset += length;
+    if (stream_sink.read_offset == ready_block.size()) {
+        receiver_impl.recycle_buffer(move(ready_block));
+        stream_sink.ready_blocks.pop_front();
+        stream_sink.read_offset = 0;
+    }
+    return ReceiveStatus::Message;
+}
+
+bool ChannelStreamReader::size_known() const { return receiver.impl->awaited_description.size_known; }
+
+uint64_t ChannelStreamReader::total_size() const { return receiver.impl->awaited_description.total_size; }
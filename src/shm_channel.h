@@ -0,0 +1,283 @@
+// Библиотека shm_channel: передача сообщений и потоков между процессами через shared memory
+//
+// ChannelSender и ChannelReceiver скрывают конвейер блоков (разбиение на блоки, параллельное
+// сжатие, кадры с CRC32C, фрагменты кольца, арена или почтовый ящик) за API уровня сообщений:
+//   sender.send(span)               -> receiver.recv(buffer, length) или recv(vector)
+//   sender.send_file(input_source)  -> receiver.recv_file(output_file)
+//   ChannelStreamWriter::write()    -> ChannelStreamReader::read()
+// Каждое сообщение - отдельная передача: TRANSFER_INFO, блоки, TRANSFER_END. close() у отправителя
+// посылает сигнал завершения канала, после которого recv возвращает ReceiveStatus::Closed.
+//
+// Сеанс: канал и пулы потоков живут между передачами. Передачи несут ID и имя файла,
+// несколько ChannelStreamWriter могут писать одновременно (блоки передач чередуются),
+// а мелкие файлы отправляются пакетом (send_packed). Получатель сеанса - receive_session:
+// SessionHandler выбирает выходной файл для каждой передачи по её имени.
+//
+// Несколько producer (ChannelOptions::channel_count): у каждого своё кольцо или ящик, отправитель
+// занимает первый свободный канал, а получатель читает все каналы по очереди пачками сообщений.
+//
+// Повторяющиеся блоки (ChannelOptions::block_cache_size, reference_window): кадр блока берётся
+// из кэша по хешу содержимого, а повторно отправленный блок заменяется ссылкой на кадр,
+// который получатель уже хранит (см. block_cache.h).
+//
+// Дельта-передача (ChannelOptions::delta_transfer): получатель возвращает по обратному каналу
+// сигнатуру старой копии выходного файла, и отправитель не передаёт совпавшие блоки
+// (см. delta_transfer.h).
+//
+// Цепочка deflate (BlockCodec::Deflate): блоки сжимаются параллельно со словарём из хвоста предыдущего
+// блока и распаковываются по порядку; с ChannelOptions::archive_format recv_file сохраняет поток
+// как gzip- или zlib-файл без распаковки (см. deflate_archive.h).
+//
+// Сбои: обе стороны следят друг за другом через заголовок канала (см. channel_owner.h).
+// Отправитель, чей получатель пропал, возвращает ошибку вместо вечного ожидания; получатель
+// отбрасывает незавершённые передачи пропавшего отправителя. С ChannelOptions::resume_transfers
+// получатель ведёт контрольную точку записанных блоков файла (см. transfer_checkpoint.h),
+// и перезапущенный отправитель передаёт только недостающие.
+//
+// Размещение (ChannelOptions::cpu_placement): open() привязывает вызвавший его поток и пул
+// потоков к заданным процессорам и размещает сегменты канала и буферы на узле NUMA
+// (см. cpu_placement.h).
+//
+// Буферы кадров, сборки фрагментов и распаковки переиспользуются между блоками и сообщениями,
+// поэтому в установившемся режиме передача не выделяет память под каждое сообщение.
+// Объекты не потокобезопасны: каждым отправителем и получателем пользуется один поток.
+
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "channel_options.h"
+#include "input_source.h"
+#include "output_file.h"
+#include "run_report.h"
+
+// Непрерывный диапазон байт только для чтения (замена std::span<const uint8_t> в C++17)
+struct ConstByteSpan {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    ConstByteSpan() = default;
+    ConstByteSpan(const void* bytes, size_t length) : data(static_cast<const uint8_t*>(bytes)), size(length) {}
+    template <typename Container, typename = decltype(std::data(std::declval<const Container&>()))>
+    ConstByteSpan(const Container& container)
+        : data(reinterpret_cast<const uint8_t*>(std::data(container))),
+          size(std::size(container) * sizeof(*std::data(container))) {}
+};
+
+// Непрерывный диапазон байт для записи (замена std::span<uint8_t> в C++17)
+struct MutableByteSpan {
+    uint8_t* data = nullptr;
+    size_t size = 0;
+
+    MutableByteSpan() = default;
+    MutableByteSpan(void* bytes, size_t length) : data(static_cast<uint8_t*>(bytes)), size(length) {}
+    template <typename Container, typename = decltype(std::data(std::declval<Container&>()))>
+    MutableByteSpan(Container& container)
+        : data(reinterpret_cast<uint8_t*>(std::data(container))),
+          size(std::size(container) * sizeof(*std::data(container))) {}
+};
+
+enum class ReceiveStatus {
+    Message, // Сообщение принято целиком и проверено
+    Closed,  // Отправитель закрыл канал; сообщений больше не будет
+    Error    // Сообщение не принято, описание в error_message()
+};
+
+struct SenderStatistics {
+    uint64_t input_bytes = 0;      // Несжатых байт отправлено
+    uint64_t compressed_bytes = 0; // Байт кадров отправлено
+    uint64_t blocks = 0;
+    uint64_t messages = 0;
+    uint64_t cached_blocks = 0;     // Кадров взято из кэша кадров без сжатия
+    uint64_t referenced_blocks = 0; // Блоков отправлено ссылкой на ранее переданный кадр
+    uint64_t unchanged_blocks = 0;  // Дельта-передача: блоков не отправлено, они совпали со старой копией
+    uint64_t resumed_blocks = 0;    // Возобновление: блоков не отправлено, их записала прошлая попытка
+    uint64_t processed_blocks = 0;  // Блоков пройдено: отправлено, совпало со старой копией или записано прошлой попыткой
+    std::map<std::string, uint64_t> blocks_per_codec; // Сколько блоков отправлено каждым кодеком
+};
+
+// Описание передачи, которое получает обработчик сеанса
+struct TransferDescription {
+    uint32_t transfer_id = 0;   // ID передачи в пределах канала
+    uint32_t channel_index = 0; // Канал (producer), по которому пришла передача
+    std::string name;           // Имя файла (пусто - безымянное сообщение)
+    bool size_known = false;
+    uint64_t total_size = 0;
+};
+
+// Мелкий файл для отправки пакетом
+struct PackedFile {
+    std::string name;
+    ConstByteSpan data;
+};
+
+struct ReceiverStatistics {
+    uint64_t output_bytes = 0;     // Несжатых байт принято
+    uint64_t blocks = 0;
+    uint64_t messages = 0;
+    uint64_t referenced_blocks = 0; // Блоков принято ссылкой на ранее переданный кадр
+};
+
+class ChannelStreamWriter;
+class ChannelStreamReader;
+struct OutgoingTransfer;
+
+// Отправляющая сторона канала
+class ChannelSender {
+public:
+    ChannelSender();
+    ChannelSender(const ChannelSender&) = delete;
+    ChannelSender& operator=(const ChannelSender&) = delete;
+    ~ChannelSender(); // Вызывает close()
+
+    // Открывает канал и пул потоков сжатия; false - ошибка, описание в error_message()
+    bool open(const ChannelOptions& options);
+
+    // Отправляет сообщение целиком; блоки сжимаются прямо из памяти вызывающего
+    bool send(ConstByteSpan message, const std::string& name = std::string());
+
+    // Отправляет файл блоками по мере чтения; страницы отправленных блоков отдаются ядру.
+    // Источник должен читать блоки размера block_size().
+    bool send_file(BlockInputSource& input_source, const std::string& name = std::string());
+
+    // Отправляет несколько мелких файлов одной передачей: данные идут подряд в общих блоках,
+    // получатель сеанса раскладывает их по отдельным файлам
+    bool send_packed(const std::vector<PackedFile>& files);
+
+    // Посылает сигнал завершения канала и освобождает сегмент; повторный вызов ничего не делает
+    void close();
+
+    // С true каждая передача завершается, только когда consumer сообщит её итог по обратному
+    // каналу: отклонённая или не записанная им передача - ошибка отправки
+    void set_delivery_confirmation(bool confirm_delivery);
+
+    // Вызывается после каждого отправленного блока (например, для вывода прогресса)
+    void set_progress_callback(std::function<void(const SenderStatistics&)> progress_callback);
+
+    const SenderStatistics& statistics() const;
+    const std::string& error_message() const;
+    std::string channel_description() const;
+    // Размер несжатого блока канала: заданный явно или взятый из заголовка кольца при open()
+    size_t block_size() const;
+    size_t worker_count() const;
+    // Привязка потоков к процессорам и узел памяти, применённые при open() (см. cpu_placement.h)
+    const CpuPlacement& cpu_placement() const;
+    size_t inflight_block_limit() const;
+
+private:
+    friend class ChannelStreamWriter;
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+// Сообщение заранее неизвестной длины: данные копируются в блоки отправителя по мере записи.
+// Буферы блоков переиспользуются следующими потоками. Несколько потоков одного отправителя
+// могут быть открыты одновременно: их блоки чередуются в канале.
+class ChannelStreamWriter {
+public:
+    explicit ChannelStreamWriter(ChannelSender& sender, const std::string& name = std::string());
+    ChannelStreamWriter(const ChannelStreamWriter&) = delete;
+    ChannelStreamWriter& operator=(const ChannelStreamWriter&) = delete;
+    ~ChannelStreamWriter(); // Вызывает finish(), если поток не завершён
+
+    bool write(ConstByteSpan data);
+
+    // Отправляет неполный последний блок и конец сообщения
+    bool finish();
+
+    // Завершает поток с отметкой о прерывании: получатель отбросит сообщение
+    void abort();
+
+private:
+    ChannelSender& sender;
+    std::string stream_name;
+    std::unique_ptr<OutgoingTransfer> transfer;
+    bool stream_finished = false;
+};
+
+// Обработчик сеанса: решает, куда записать каждую принятую передачу
+class SessionHandler {
+public:
+    virtual ~SessionHandler() = default;
+
+    // Выходной файл передачи (nullptr - передача отбрасывается); должен жить до transfer_finished.
+    // Для пакета мелких файлов вызывается для каждого файла пакета.
+    virtual BlockOutputFile* open_output(const TransferDescription& transfer) = 0;
+
+    // Передача принята (success) или отброшена с ошибкой error_message
+    virtual void transfer_finished(const TransferDescription& transfer, bool success, const std::string& error_message) = 0;
+
+    // Producer канала channel_index завершил сеанс (только при persist: канал сразу ждёт следующего)
+    virtual void producer_finished(uint32_t channel_index) { (void)channel_index; }
+};
+
+// Принимающая сторона канала
+class ChannelReceiver {
+public:
+    ChannelReceiver();
+    ChannelReceiver(const ChannelReceiver&) = delete;
+    ChannelReceiver& operator=(const ChannelReceiver&) = delete;
+    ~ChannelReceiver(); // Вызывает close()
+
+    // Открывает канал и пул потоков распаковки; false - ошибка, описание в error_message()
+    bool open(const ChannelOptions& options);
+
+    // Принимает сообщение в буфер вызывающего; блоки распаковываются прямо на место
+    ReceiveStatus recv(MutableByteSpan buffer, size_t& message_length);
+
+    // Принимает сообщение в вектор; ёмкость вектора переиспользуется
+    ReceiveStatus recv(std::vector<uint8_t>& message);
+
+    // Принимает сообщение в файл в режиме записи файла (stream, pwrite или mmap)
+    ReceiveStatus recv_file(BlockOutputFile& output_file);
+
+    // Принимает передачи сеанса до сигнала завершения по всем каналам; передачи могут чередоваться.
+    // С persist каналы после завершения producer сразу ждут следующего, и приём не заканчивается.
+    // Ошибки отдельных передач сообщаются обработчику, возвращается Closed или Error канала.
+    ReceiveStatus receive_session(SessionHandler& session_handler);
+
+    // После сигнала завершения ждать следующих отправителей на тех же каналах
+    void reopen();
+
+    // Пути сегментов (имена POSIX shm или файлы hugetlbfs), которые получатель удаляет при закрытии
+    std::vector<std::string> segment_names() const;
+
+    // Отображает и удаляет сегменты канала
+    void close();
+
+    // Запоминать задержку каждого фрагмента кольца (от публикации до получения)
+    void set_latency_recording(bool record_latency);
+    LatencyRecorder& fragment_latency();
+
+    const ReceiverStatistics& statistics() const;
+    const std::string& error_message() const;
+    // Привязка потоков к процессорам и узел памяти, применённые при open() (см. cpu_placement.h)
+    const CpuPlacement& cpu_placement() const;
+
+private:
+    friend class ChannelStreamReader;
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+// Чтение сообщения по частям в порядке блоков, не дожидаясь конца сообщения
+class ChannelStreamReader {
+public:
+    explicit ChannelStreamReader(ChannelReceiver& receiver);
+    ChannelStreamReader(const ChannelStreamReader&) = delete;
+    ChannelStreamReader& operator=(const ChannelStreamReader&) = delete;
+    ~ChannelStreamReader(); // Дочитывает и отбрасывает остаток сообщения
+
+    // Копирует очередную часть сообщения в buffer. Message с length == 0 - конец сообщения,
+    // Closed - канал закрыт до начала сообщения, Error - ошибка приёма
+    ReceiveStatus read(MutableByteSpan buffer, size_t& length);
+
+    // Размер сообщения, если отправитель знал его заранее (известен после первого read)
+    bool size_known() const;
+    uint64_t total_size() const;
+
+private:
+    ChannelReceiver& receiver;
+    bool stream_started = false;
+    bool stream_finished = false;
+};
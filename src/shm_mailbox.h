@@ -0,0 +1,210 @@
+// Почтовый ящик: исходный канал с рукопожатием на каждый фрагмент
+//
+// Сегмент содержит одно сообщение. Producer ждёт, пока флаг message_available
+// станет 0, записывает фрагмент и поднимает флаг; consumer ждёт 1, читает фрагмент
+// и сбрасывает флаг. Флаг служит словом futex для ожидания другой стороны; рядом лежит
+// счётчик спящих на нём, и сторона, сменившая флаг, будит другую, только если та спит.
+//
+// Сегмент начинается с версионного заголовка: первая открывшая его сторона размечает ящик
+// (ёмкость полезной нагрузки = размер сегмента за вычетом заголовка), вторая проверяет
+// версию и размер заголовка и берёт ёмкость из него. Заголовок хранит и PID producer
+// и consumer, занявших ящик, и их живость (см. channel_owner.h). Полезная нагрузка следует
+// за заголовком. Ожидания обеих сторон могут проверять другую сторону (PeerCheck).
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "channel_options.h"
+#include "channel_owner.h"
+#include "shared_segment.h"
+#include "wait_strategy.h"
+
+constexpr const char* SHARED_MEMORY_SEGMENT_NAME = "/shm_shr_channel_example";
+constexpr size_t MAX_MAILBOX_SEGMENT_SIZE = 16 * 1024 * 1024;
+constexpr uint32_t MAILBOX_SEGMENT_MAGIC = 0x584F424D;        // "MBOX"
+constexpr uint32_t MAILBOX_SEGMENT_INITIALIZING = 1;
+constexpr uint32_t MAILBOX_LAYOUT_VERSION = 4;
+
+// Структура для обмена данными через shared memory
+struct SharedMemoryHeader {
+    uint32_t segment_state;           // 0 -> MAILBOX_SEGMENT_INITIALIZING -> MAILBOX_SEGMENT_MAGIC
+    uint32_t layout_version;          // Версия раскладки ящика
+    uint32_t header_size;             // Размер заголовка у разметившей стороны
+    uint32_t payload_capacity;        // Байт полезной нагрузки за заголовком
+    uint32_t producer_process_id;     // PID producer, занявшего ящик (0 - свободен)
+    uint32_t consumer_process_id;     // PID consumer, занявшего ящик (0 - свободен)
+    ChannelLiveness liveness;         // Метки активности сторон и поколения producer
+    uint32_t message_waiter_count;    // Количество спящих на message_available (сброс ящика его не трогает)
+    uint32_t synchronization_flag;    // Spinlock для синхронизации
+    uint32_t message_available;       // Флаг готовности сообщения
+    uint32_t transfer_identifier;     // ID передачи, которой принадлежит фрагмент
+    uint32_t data_block_identifier;   // ID блока данных
+    uint32_t fragment_sequence_number;// Порядковый номер фрагмента в блоке
+    uint32_t actual_payload_length;   // Длина полезных данных
+    uint8_t  is_final_fragment;       // Флаг последнего фрагмента в блоке
+    uint8_t  reserved_padding[3];
+};
+
+static_assert(sizeof(SharedMemoryHeader) % sizeof(uint32_t) == 0, "полезная нагрузка должна начинаться с выровненного адреса");
+
+static inline uint8_t* mailbox_payload(SharedMemoryHeader* shared_mem) {
+    return reinterpret_cast<uint8_t*>(shared_mem) + sizeof(SharedMemoryHeader);
+}
+
+static inline size_t mailbox_mapped_size(const SharedMemoryHeader* shared_mem) {
+    return sizeof(SharedMemoryHeader) + shared_mem->payload_capacity;
+}
+
+// Открывает и отображает сегмент почтового ящика: размечает новый или проверяет заголовок
+// существующего (его ёмкость может отличаться от segment_size). nullptr и текст ошибки при неудаче.
+static inline SharedMemoryHeader* initialize_shared_memory(const std::string& segment_name, size_t segment_size,
+                                                           std::string& error_message) {
+    if (segment_size <= sizeof(SharedMemoryHeader) || segment_size > MAX_MAILBOX_SEGMENT_SIZE) {
+        error_message = "размер почтового ящика должен быть от " + std::to_string(sizeof(SharedMemoryHeader) + 1) +
+                        " до " + std::to_string(MAX_MAILBOX_SEGMENT_SIZE) + " байт";
+        return nullptr;
+    }
+    size_t mapped_size = 0;
+    void* memory_region = map_shared_segment(segment_name, segment_size, 0, mapped_size, error_message);
+    if (!memory_region) return nullptr;
+    auto* shared_mem = reinterpret_cast<SharedMemoryHeader*>(memory_region);
+    if (mapped_size <= sizeof(SharedMemoryHeader) || mapped_size > MAX_MAILBOX_SEGMENT_SIZE) {
+        error_message = "размер сегмента " + segment_name + " (" + std::to_string(mapped_size) + " байт) не подходит для почтового ящика";
+        munmap(memory_region, mapped_size);
+        return nullptr;
+    }
+
+    // Разметку выполняет тот, кто первым переведёт состояние из 0 в "инициализация"
+    uint32_t expected_state = 0;
+    if (__atomic_compare_exchange_n(&shared_mem->segment_state, &expected_state, MAILBOX_SEGMENT_INITIALIZING, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        memset(reinterpret_cast<uint8_t*>(shared_mem) + sizeof(uint32_t), 0, sizeof(SharedMemoryHeader) - sizeof(uint32_t));
+        shared_mem->layout_version = MAILBOX_LAYOUT_VERSION;
+        shared_mem->header_size = sizeof(SharedMemoryHeader);
+        shared_mem->payload_capacity = static_cast<uint32_t>(mapped_size - sizeof(SharedMemoryHeader));
+        __atomic_store_n(&shared_mem->segment_state, MAILBOX_SEGMENT_MAGIC, __ATOMIC_RELEASE);
+        return shared_mem;
+    }
+    while (__atomic_load_n(&shared_mem->segment_state, __ATOMIC_ACQUIRE) != MAILBOX_SEGMENT_MAGIC) {
+        std::this_thread::yield();
+    }
+    if (shared_mem->layout_version != MAILBOX_LAYOUT_VERSION || shared_mem->header_size != sizeof(SharedMemoryHeader) ||
+        mailbox_mapped_size(shared_mem) != mapped_size) {
+        error_message = "почтовый ящик " + segment_name + " размечен несовместимой версией (раскладка " +
+                        std::to_string(shared_mem->layout_version) + ", заголовок " + std::to_string(shared_mem->header_size) +
+                        " байт; ожидается " + std::to_string(MAILBOX_LAYOUT_VERSION) + ", " +
+                        std::to_string(sizeof(SharedMemoryHeader)) + " байт)";
+        munmap(memory_region, mapped_size);
+        return nullptr;
+    }
+    return shared_mem;
+}
+
+// Блокирует shared memory с помощью spinlock
+static inline void acquire_shared_memory_lock(SharedMemoryHeader* shared_mem) {
+    uint32_t desired_state = 0;
+    while (!__atomic_compare_exchange_n(&shared_mem->synchronization_flag, &desired_state, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        desired_state = 0;
+        cpu_relax();
+    }
+}
+
+// Разблокирует shared memory
+static inline void release_shared_memory_lock(SharedMemoryHeader* shared_mem) {
+    __atomic_store_n(&shared_mem->synchronization_flag, 0, __ATOMIC_RELEASE);
+}
+
+// Флаг message_available служит словом futex для ожидания другой стороны
+static inline uint32_t* mailbox_message_flag(SharedMemoryHeader* shared_mem) {
+    return &shared_mem->message_available;
+}
+
+// Счётчик спящих на флаге message_available
+static inline uint32_t* mailbox_waiter_count(SharedMemoryHeader* shared_mem) {
+    return &shared_mem->message_waiter_count;
+}
+
+// Ждёт, пока флаг сообщения станет desired_value; false - peer_check сообщил, что другой стороны нет
+static inline bool mailbox_wait_for_flag(SharedMemoryHeader* shared_mem, uint32_t desired_value,
+                                         const WaitStrategy& wait_strategy, const PeerCheck* peer_check) {
+    return wait_for_value(mailbox_message_flag(shared_mem), desired_value, wait_strategy, peer_check,
+                          mailbox_waiter_count(shared_mem));
+}
+
+// Будит другую сторону после смены флага сообщения, если она спит
+static inline void mailbox_wake_peer(SharedMemoryHeader* shared_mem) {
+    futex_wake_value(mailbox_message_flag(shared_mem), mailbox_waiter_count(shared_mem));
+}
+
+// Слово владельца стороны ящика для claim_channel_side
+static inline uint32_t* mailbox_owner_word(SharedMemoryHeader* shared_mem, bool is_producer) {
+    return is_producer ? &shared_mem->producer_process_id : &shared_mem->consumer_process_id;
+}
+
+static inline ChannelLiveness* mailbox_liveness(SharedMemoryHeader* shared_mem) {
+    return &shared_mem->liveness;
+}
+
+// Producer: сбрасывает состояние сообщения, оставшееся от предыдущего producer (заголовок и владельцев не трогает)
+static inline void mailbox_reset_message_state(SharedMemoryHeader* shared_mem) {
+    size_t state_offset = offsetof(SharedMemoryHeader, synchronization_flag);
+    memset(reinterpret_cast<uint8_t*>(shared_mem) + state_offset, 0, sizeof(SharedMemoryHeader) - state_offset);
+}
+
+// Передаёт фрагмент через почтовый ящик; при необходимости ждёт подтверждения приема.
+// false - consumer пропал (см. peer_check), фрагмент не отправлен или не подтверждён.
+static inline bool send_mailbox_fragment(SharedMemoryHeader* shared_memory_region, const WaitStrategy& wait_strategy,
+                                         uint32_t transfer_id, uint32_t block_id, uint32_t fragment_number, bool is_final,
+                                         const uint8_t* payload, size_t payload_length, bool wait_for_acknowledgement,
+                                         const PeerCheck* peer_check = nullptr) {
+    // Ожидаем освобождения канала
+    while (true) {
+        if (!mailbox_wait_for_flag(shared_memory_region, 0, wait_strategy, peer_check)) return false;
+        acquire_shared_memory_lock(shared_memory_region);
+        if (shared_memory_region->message_available == 0) break;
+        release_shared_memory_lock(shared_memory_region);
+    }
+
+    // Записываем данные в shared memory
+    shared_memory_region->transfer_identifier = transfer_id;
+    shared_memory_region->data_block_identifier = block_id;
+    shared_memory_region->fragment_sequence_number = fragment_number;
+    shared_memory_region->is_final_fragment = is_final ? 1 : 0;
+    shared_memory_region->actual_payload_length = static_cast<uint32_t>(payload_length);
+    if (payload_length > 0) {
+        memcpy(mailbox_payload(shared_memory_region), payload, payload_length);
+    }
+    shared_memory_region->message_available = 1;
+    release_shared_memory_lock(shared_memory_region);
+    mailbox_wake_peer(shared_memory_region);
+
+    // Ожидаем подтверждения приема
+    if (wait_for_acknowledgement) {
+        return mailbox_wait_for_flag(shared_memory_region, 0, wait_strategy, peer_check);
+    }
+    return true;
+}
+
+// Consumer: ждёт сообщение и возвращается, удерживая блокировку ящика; false - producer пропал
+static inline bool mailbox_acquire_message(SharedMemoryHeader* shared_memory_region, const WaitStrategy& wait_strategy,
+                                           const PeerCheck* peer_check = nullptr) {
+    while (true) {
+        if (!mailbox_wait_for_flag(shared_memory_region, 1, wait_strategy, peer_check)) return false;
+        acquire_shared_memory_lock(shared_memory_region);
+        if (shared_memory_region->message_available == 1) return true;
+        release_shared_memory_lock(shared_memory_region);
+    }
+}
+
+// Consumer: освобождает ящик для следующего сообщения и будит producer
+static inline void mailbox_release_message(SharedMemoryHeader* shared_memory_region) {
+    shared_memory_region->message_available = 0;
+    release_shared_memory_lock(shared_memory_region);
+    mailbox_wake_peer(shared_memory_region);
+}
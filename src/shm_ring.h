@@ -0,0 +1,429 @@
+// Кольцевой буфер SPSC (один писатель, один читатель) в shared memory
+//
+// Раскладка сегмента:
+//   [RingControlHeader][слот 0][слот 1]...[слот N-1]
+// Каждый слот начинается с RingSlotHeader, за которым следует полезная нагрузка.
+// producer_head и consumer_tail - монотонные счётчики, индекс слота = счётчик % N.
+// Producer пишет только producer_head, consumer - только consumer_tail, поэтому
+// синхронизация обходится парой acquire/release без synchronization_flag.
+// Ожидание пустого/полного кольца выполняется по WaitStrategy (spin, futex или адаптивно).
+//
+// В режиме арены за слотами следует арена из областей фиксированного размера:
+//   [...слоты][ArenaRegionState x R][область 0]...[область R-1]
+// Потоки producer сжимают блок сразу в свою область, по кольцу идёт только дескриптор
+// (смещение, длина, ID блока), а consumer распаковывает прямо из области и освобождает её.
+//
+// Кольцо одного producer и одного consumer: стороны занимаются по PID (см. channel_owner.h).
+// Одновременная работа нескольких producer - это несколько колец (--channels=N).
+// Ожидания стороны проверяют другую (RingChannel::peer_check): функции, которые ждут,
+// возвращают nullptr/false, если другая сторона пропала. Состояние, оставленное упавшей
+// стороной, сбрасывает ring_discard_state.
+//
+// Геометрию (слоты, арена, размер блока) выбирает сторона, разметившая сегмент; вторая сторона
+// проверяет версию и размер заголовка и принимает геометрию из него, поэтому параметры
+// сторон не обязаны совпадать. Сегмент может лежать в hugetlbfs или просить у ядра THP
+// (см. shared_segment.h).
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "channel_options.h"
+#include "channel_owner.h"
+#include "log.h"
+#include "shared_segment.h"
+#include "stage_stats.h"
+#include "wait_strategy.h"
+
+constexpr const char* RING_SEGMENT_NAME = "/shm_shr_ring_example";
+constexpr size_t CACHE_LINE_SIZE = 64;
+constexpr uint32_t RING_SEGMENT_MAGIC = 0x474E4952; // "RING"
+constexpr uint32_t RING_SEGMENT_INITIALIZING = 1;
+constexpr uint32_t RING_LAYOUT_VERSION = 8;
+constexpr uint32_t RING_SEGMENT_FLAG_HUGETLBFS = 1u << 0;       // Сегмент в hugetlbfs
+constexpr uint32_t RING_SEGMENT_FLAG_TRANSPARENT_HUGE_PAGES = 1u << 1; // Сегмент просит THP
+constexpr size_t ARENA_ALIGNMENT = 4096;
+constexpr uint32_t ARENA_REGION_FREE = 0;
+constexpr uint32_t ARENA_REGION_IN_USE = 1;
+
+// Управляющий заголовок кольца; индексы разнесены по разным кэш-линиям
+struct RingControlHeader {
+    alignas(CACHE_LINE_SIZE) uint32_t segment_state; // 0 -> RING_SEGMENT_INITIALIZING -> RING_SEGMENT_MAGIC
+    uint32_t layout_version;                         // Версия раскладки сегмента
+    uint32_t header_size;                            // sizeof(RingControlHeader) разметившей стороны
+    uint32_t segment_flags;                          // RING_SEGMENT_FLAG_*
+    uint32_t slot_count;                             // Количество слотов
+    uint32_t slot_size;                              // Размер слота вместе с заголовком
+    uint64_t segment_size;                           // Полный размер сегмента
+    uint64_t arena_offset;                           // Смещение арены от начала сегмента (0 - арены нет)
+    uint32_t arena_region_size;                      // Размер области арены
+    uint32_t arena_region_count;                     // Количество областей арены
+    uint32_t producer_process_id;                    // PID producer, занявшего кольцо (0 - свободно)
+    uint32_t consumer_process_id;                    // PID consumer, занявшего кольцо (0 - свободно)
+    uint32_t block_size;                             // Размер несжатого блока, под который размечена арена
+    alignas(CACHE_LINE_SIZE) ChannelLiveness liveness; // Метки активности сторон и поколения producer
+    alignas(CACHE_LINE_SIZE) uint64_t producer_head; // Сколько слотов опубликовано producer
+    alignas(CACHE_LINE_SIZE) uint64_t consumer_tail; // Сколько слотов освобождено consumer
+    alignas(CACHE_LINE_SIZE) WaitPoint data_available;  // Consumer ждёт новых слотов
+    alignas(CACHE_LINE_SIZE) WaitPoint space_available; // Producer ждёт освобождения слотов
+    alignas(CACHE_LINE_SIZE) WaitPoint arena_released;  // Producer ждёт освобождения области арены
+};
+
+// Счётчики и точки ожидания сторон не должны делить кэш-линию ни друг с другом, ни с геометрией
+static_assert(offsetof(RingControlHeader, producer_head) % CACHE_LINE_SIZE == 0 &&
+              offsetof(RingControlHeader, producer_head) - offsetof(RingControlHeader, liveness) >= CACHE_LINE_SIZE,
+              "producer_head в своей кэш-линии");
+static_assert(offsetof(RingControlHeader, consumer_tail) - offsetof(RingControlHeader, producer_head) >= CACHE_LINE_SIZE,
+              "producer_head и consumer_tail в разных кэш-линиях");
+static_assert(offsetof(RingControlHeader, data_available) - offsetof(RingControlHeader, consumer_tail) >= CACHE_LINE_SIZE &&
+              offsetof(RingControlHeader, space_available) - offsetof(RingControlHeader, data_available) >= CACHE_LINE_SIZE &&
+              offsetof(RingControlHeader, arena_released) - offsetof(RingControlHeader, space_available) >= CACHE_LINE_SIZE,
+              "точки ожидания в разных кэш-линиях");
+static_assert(sizeof(RingControlHeader) % CACHE_LINE_SIZE == 0, "слоты начинаются с границы кэш-линии");
+
+// Состояние области арены; каждое в своей кэш-линии, так как их меняют разные потоки
+struct alignas(CACHE_LINE_SIZE) ArenaRegionState {
+    uint32_t region_state; // ARENA_REGION_FREE или ARENA_REGION_IN_USE
+};
+
+// Заголовок слота (аналог полей SharedMemoryHeader)
+struct alignas(CACHE_LINE_SIZE) RingSlotHeader {
+    uint32_t data_block_identifier;    // ID блока данных
+    uint32_t fragment_sequence_number; // Порядковый номер фрагмента в блоке
+    uint32_t actual_payload_length;    // Длина полезных данных
+    uint8_t  is_final_fragment;        // Флаг последнего фрагмента в блоке
+    uint8_t  payload_in_arena;         // Данные лежат в арене, а не в слоте
+    uint32_t transfer_identifier;      // ID передачи, которой принадлежит фрагмент
+    uint32_t arena_payload_length;     // Длина сжатого блока в арене
+    uint64_t arena_payload_offset;     // Смещение сжатого блока от начала арены
+    uint64_t publish_time_ns;          // CLOCK_MONOTONIC в момент публикации (для замера задержки)
+};
+
+constexpr size_t RING_SLOT_HEADER_SIZE = sizeof(RingSlotHeader);
+static_assert(RING_SLOT_HEADER_SIZE == CACHE_LINE_SIZE, "заголовок слота должен занимать одну кэш-линию");
+
+// Локальное состояние одной стороны кольца
+struct RingChannel {
+    std::string segment_name;      // Путь сегмента: имя POSIX shm или файл в hugetlbfs
+    RingControlHeader* control = nullptr;
+    uint8_t* slot_area = nullptr;
+    size_t mapped_size = 0;
+    uint32_t slot_count = 0;
+    uint32_t slot_size = 0;
+    uint64_t local_index = 0;       // Собственный счётчик: head у producer, tail у consumer
+    uint64_t cached_peer_index = 0; // Последнее прочитанное значение счётчика другой стороны
+    WaitStrategy wait_strategy;
+    ArenaRegionState* arena_states = nullptr;
+    uint8_t* arena_area = nullptr;
+    uint32_t arena_region_size = 0;
+    uint32_t arena_region_count = 0;
+    uint32_t block_size = 0;        // Размер блока, под который размечена арена
+    uint64_t channel_full_waits = 0; // Producer: сколько раз ждал освобождения слота или области арены
+    const PeerCheck* peer_check = nullptr; // Проверка другой стороны во время ожидания (nullptr - ждать вечно)
+};
+
+static inline size_t round_up_to(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Размер области арены: с запасом вмещает кадр блока в худшем случае сжатия
+static inline size_t arena_region_size_for(size_t uncompressed_block_size) {
+    return round_up_to(uncompressed_block_size + uncompressed_block_size / 128 + 1024, CACHE_LINE_SIZE);
+}
+
+// Размер слота, получаемый делением сегмента на slot_count (кратен кэш-линии)
+static inline size_t compute_ring_slot_size(size_t segment_size, uint32_t slot_count) {
+    if (slot_count == 0 || segment_size <= sizeof(RingControlHeader)) return 0;
+    size_t slot_size = (segment_size - sizeof(RingControlHeader)) / slot_count;
+    return slot_size / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+static inline size_t ring_payload_capacity(const RingChannel& ring) {
+    return ring.slot_size - RING_SLOT_HEADER_SIZE;
+}
+
+static inline uint8_t* ring_slot_payload(RingSlotHeader* slot) {
+    return reinterpret_cast<uint8_t*>(slot) + RING_SLOT_HEADER_SIZE;
+}
+
+static inline RingSlotHeader* ring_slot_at(const RingChannel& ring, uint64_t counter) {
+    return reinterpret_cast<RingSlotHeader*>(ring.slot_area + (counter % ring.slot_count) * ring.slot_size);
+}
+
+// Проверяет геометрию, записанную другой стороной в заголовок: всё лежит внутри отображения
+static inline bool ring_geometry_valid(const RingControlHeader* control, size_t mapped_size) {
+    if (control->segment_size > mapped_size || control->slot_count == 0) return false;
+    if (control->slot_size % CACHE_LINE_SIZE != 0 || control->slot_size <= RING_SLOT_HEADER_SIZE) return false;
+    uint64_t slots_end = sizeof(RingControlHeader) + static_cast<uint64_t>(control->slot_count) * control->slot_size;
+    if (slots_end > control->segment_size) return false;
+    if (control->arena_offset == 0) return true;
+    uint64_t arena_states_end = slots_end + static_cast<uint64_t>(control->arena_region_count) * sizeof(ArenaRegionState);
+    return control->arena_region_count > 0 && control->arena_region_size > 0 && control->arena_offset >= arena_states_end &&
+           control->arena_offset + static_cast<uint64_t>(control->arena_region_count) * control->arena_region_size <=
+               control->segment_size;
+}
+
+// Открывает сегмент кольца segment_name; первая сторона размечает его по своим параметрам,
+// вторая проверяет заголовок и принимает геометрию разметившей стороны.
+// При ошибке возвращает false и описание в error_message.
+static inline bool open_ring_channel(const ChannelOptions& options, const std::string& segment_name, bool is_producer,
+                                     RingChannel& ring, std::string& error_message) {
+    size_t slot_size = compute_ring_slot_size(options.ring_segment_size, options.ring_slot_count);
+    if (slot_size <= RING_SLOT_HEADER_SIZE || slot_size > UINT32_MAX) {
+        error_message = "сегмент " + std::to_string(options.ring_segment_size) + " байт нельзя разделить на " +
+                        std::to_string(options.ring_slot_count) + " слотов";
+        return false;
+    }
+    size_t segment_size = sizeof(RingControlHeader) + slot_size * options.ring_slot_count;
+
+    size_t arena_offset = 0;
+    size_t arena_region_size = 0;
+    size_t arena_region_count = 0;
+    if (options.channel_mode == ChannelMode::Arena) {
+        arena_region_size = arena_region_size_for(options.uncompressed_block_size);
+        arena_region_count = options.arena_size / arena_region_size;
+        if (arena_region_count == 0 || arena_region_size > UINT32_MAX || arena_region_count > UINT32_MAX) {
+            error_message = "в арену " + std::to_string(options.arena_size) + " байт не помещается ни одной области по " +
+                            std::to_string(arena_region_size) + " байт";
+            return false;
+        }
+        arena_offset = round_up_to(segment_size + arena_region_count * sizeof(ArenaRegionState), ARENA_ALIGNMENT);
+        segment_size = arena_offset + arena_region_count * arena_region_size;
+    }
+
+    // Сегмент в hugetlbfs занимает целое число больших страниц
+    std::string segment_path = shared_segment_path(options.huge_page_mode, options.hugetlbfs_directory, segment_name);
+    size_t requested_size = segment_size;
+    size_t mapping_alignment = 0;
+    uint32_t segment_flags = 0;
+    if (options.huge_page_mode == HugePageMode::Hugetlbfs) {
+        size_t huge_page_size = hugetlbfs_page_size(options.hugetlbfs_directory);
+        if (huge_page_size == 0) {
+            error_message = "каталог " + options.hugetlbfs_directory + " не является смонтированной hugetlbfs";
+            return false;
+        }
+        requested_size = round_up_to(segment_size, huge_page_size);
+        segment_flags = RING_SEGMENT_FLAG_HUGETLBFS;
+    } else if (options.huge_page_mode == HugePageMode::Transparent) {
+        requested_size = round_up_to(segment_size, TRANSPARENT_HUGE_PAGE_SIZE);
+        mapping_alignment = TRANSPARENT_HUGE_PAGE_SIZE;
+        segment_flags = RING_SEGMENT_FLAG_TRANSPARENT_HUGE_PAGES;
+    }
+    size_t mapped_size = 0;
+    void* memory_region = map_shared_segment(segment_path, requested_size, mapping_alignment, mapped_size, error_message);
+    if (!memory_region) {
+        if (options.huge_page_mode == HugePageMode::Hugetlbfs) {
+            error_message += " (свободны ли большие страницы? см. /proc/sys/vm/nr_hugepages)";
+        }
+        return false;
+    }
+    auto* control = reinterpret_cast<RingControlHeader*>(memory_region);
+    if (mapped_size < sizeof(RingControlHeader)) {
+        error_message = "сегмент " + segment_path + " (" + std::to_string(mapped_size) + " байт) меньше заголовка кольца";
+        munmap(memory_region, mapped_size);
+        return false;
+    }
+
+    // Разметку выполняет тот, кто первым переведёт состояние из 0 в "инициализация".
+    // Разметившая сторона может отказаться (сегмент мал) и вернуть 0 - тогда пробуем сами.
+    bool format_segment = false;
+    while (true) {
+        uint32_t expected_state = 0;
+        if (__atomic_compare_exchange_n(&control->segment_state, &expected_state, RING_SEGMENT_INITIALIZING, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            format_segment = true;
+            break;
+        }
+        if (expected_state == RING_SEGMENT_MAGIC) break;
+        std::this_thread::yield();
+    }
+    if (format_segment) {
+        if (mapped_size < segment_size) {
+            // Сегмент оставлен другой стороной другого размера: пусть его разметит она
+            __atomic_store_n(&control->segment_state, 0, __ATOMIC_RELEASE);
+            error_message = "сегмент " + segment_path + " (" + std::to_string(mapped_size) +
+                            " байт) меньше заданной геометрии (" + std::to_string(segment_size) + " байт)";
+            munmap(memory_region, mapped_size);
+            return false;
+        }
+        control->layout_version = RING_LAYOUT_VERSION;
+        control->header_size = sizeof(RingControlHeader);
+        control->segment_flags = segment_flags;
+        control->slot_count = options.ring_slot_count;
+        control->slot_size = static_cast<uint32_t>(slot_size);
+        control->segment_size = segment_size;
+        control->arena_offset = arena_offset;
+        control->arena_region_size = static_cast<uint32_t>(arena_region_size);
+        control->arena_region_count = static_cast<uint32_t>(arena_region_count);
+        control->producer_process_id = 0;
+        control->consumer_process_id = 0;
+        control->liveness = ChannelLiveness{};
+        control->block_size = static_cast<uint32_t>(options.uncompressed_block_size);
+        auto* arena_states = reinterpret_cast<ArenaRegionState*>(reinterpret_cast<uint8_t*>(memory_region) +
+                                                                 sizeof(RingControlHeader) + slot_size * options.ring_slot_count);
+        for (size_t region_index = 0; region_index < arena_region_count; ++region_index) {
+            arena_states[region_index].region_state = ARENA_REGION_FREE;
+        }
+        __atomic_store_n(&control->producer_head, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&control->consumer_tail, 0, __ATOMIC_RELAXED);
+        control->data_available = WaitPoint{};
+        control->space_available = WaitPoint{};
+        control->arena_released = WaitPoint{};
+        __atomic_store_n(&control->segment_state, RING_SEGMENT_MAGIC, __ATOMIC_RELEASE);
+    } else {
+        std::string mismatch_description;
+        if (control->layout_version != RING_LAYOUT_VERSION || control->header_size != sizeof(RingControlHeader)) {
+            mismatch_description = "сегмент размечен несовместимой версией (раскладка " +
+                                   std::to_string(control->layout_version) + ", заголовок " +
+                                   std::to_string(control->header_size) + " байт; ожидается " +
+                                   std::to_string(RING_LAYOUT_VERSION) + ", " + std::to_string(sizeof(RingControlHeader)) + " байт)";
+        } else if (!ring_geometry_valid(control, mapped_size)) {
+            mismatch_description = "геометрия в заголовке выходит за пределы сегмента";
+        } else if ((control->arena_offset != 0) != (options.channel_mode == ChannelMode::Arena)) {
+            mismatch_description = control->arena_offset != 0 ? "сегмент размечен в режиме arena" : "сегмент размечен без арены";
+        }
+        if (!mismatch_description.empty()) {
+            error_message = "кольцо " + segment_path + ": " + mismatch_description;
+            munmap(memory_region, mapped_size);
+            return false;
+        }
+        if (control->slot_count != options.ring_slot_count || control->slot_size != slot_size ||
+            control->arena_region_size != arena_region_size || control->arena_region_count != arena_region_count) {
+            SHM_LOG(LogLevel::Info, "Геометрия кольца " << segment_path << " взята у другой стороны: "
+                    << control->slot_count << " x " << control->slot_size << " байт"
+                    << (control->arena_offset ? ", арена " + std::to_string(control->arena_region_count) + " x " +
+                                                std::to_string(control->arena_region_size) + " байт" : std::string()));
+        }
+    }
+
+    ring = RingChannel{};
+    ring.segment_name = segment_path;
+    ring.control = control;
+    ring.slot_area = reinterpret_cast<uint8_t*>(memory_region) + sizeof(RingControlHeader);
+    ring.mapped_size = mapped_size;
+    ring.slot_count = control->slot_count;
+    ring.slot_size = control->slot_size;
+    ring.block_size = control->block_size;
+    ring.wait_strategy = options.wait_strategy;
+    if (control->arena_offset != 0) {
+        ring.arena_states = reinterpret_cast<ArenaRegionState*>(ring.slot_area + static_cast<size_t>(ring.slot_count) * ring.slot_size);
+        ring.arena_area = reinterpret_cast<uint8_t*>(memory_region) + control->arena_offset;
+        ring.arena_region_size = control->arena_region_size;
+        ring.arena_region_count = control->arena_region_count;
+    }
+    if (control->segment_flags & RING_SEGMENT_FLAG_TRANSPARENT_HUGE_PAGES) {
+        // Совет, а не требование: ядро может не разрешать THP для shmem (shmem_enabled)
+        if (madvise(memory_region, mapped_size, MADV_HUGEPAGE) != 0) {
+            SHM_LOG(LogLevel::Debug, "madvise(MADV_HUGEPAGE) " << segment_path << ": " << strerror(errno));
+        }
+    }
+
+    if (is_producer) {
+        ring.local_index = __atomic_load_n(&ring.control->producer_head, __ATOMIC_ACQUIRE);
+        ring.cached_peer_index = __atomic_load_n(&ring.control->consumer_tail, __ATOMIC_ACQUIRE);
+    } else {
+        ring.local_index = __atomic_load_n(&ring.control->consumer_tail, __ATOMIC_ACQUIRE);
+        ring.cached_peer_index = __atomic_load_n(&ring.control->producer_head, __ATOMIC_ACQUIRE);
+    }
+    return true;
+}
+
+// Producer: ожидает свободный слот и возвращает его для заполнения; nullptr - consumer пропал
+static inline RingSlotHeader* ring_acquire_write_slot(RingChannel& ring) {
+    if (ring.local_index - ring.cached_peer_index >= ring.slot_count) {
+        ++ring.channel_full_waits;
+        bool slot_free = wait_until(&ring.control->space_available, ring.wait_strategy, [&]() {
+            ring.cached_peer_index = __atomic_load_n(&ring.control->consumer_tail, __ATOMIC_ACQUIRE);
+            return ring.local_index - ring.cached_peer_index < ring.slot_count;
+        }, ring.peer_check);
+        if (!slot_free) return nullptr;
+    }
+    return ring_slot_at(ring, ring.local_index);
+}
+
+// Producer: публикует заполненный слот
+static inline void ring_publish_write_slot(RingChannel& ring) {
+    ring_slot_at(ring, ring.local_index)->publish_time_ns = monotonic_time_ns();
+    ++ring.local_index;
+    __atomic_store_n(&ring.control->producer_head, ring.local_index, __ATOMIC_RELEASE);
+    wait_point_notify(&ring.control->data_available);
+}
+
+// Consumer: ожидает опубликованный слот и возвращает его для чтения; nullptr - producer пропал
+static inline RingSlotHeader* ring_acquire_read_slot(RingChannel& ring) {
+    if (ring.cached_peer_index == ring.local_index) {
+        bool slot_published = wait_until(&ring.control->data_available, ring.wait_strategy, [&]() {
+            ring.cached_peer_index = __atomic_load_n(&ring.control->producer_head, __ATOMIC_ACQUIRE);
+            return ring.cached_peer_index != ring.local_index;
+        }, ring.peer_check);
+        if (!slot_published) return nullptr;
+    }
+    return ring_slot_at(ring, ring.local_index);
+}
+
+// Consumer: возвращает прочитанный слот producer
+static inline void ring_release_read_slot(RingChannel& ring) {
+    ++ring.local_index;
+    __atomic_store_n(&ring.control->consumer_tail, ring.local_index, __ATOMIC_RELEASE);
+    wait_point_notify(&ring.control->space_available);
+}
+
+static inline bool ring_has_arena(const RingChannel& ring) {
+    return ring.arena_area != nullptr;
+}
+
+static inline uint8_t* arena_region_data(const RingChannel& ring, uint32_t region_index) {
+    return ring.arena_area + static_cast<size_t>(region_index) * ring.arena_region_size;
+}
+
+// Producer: ждёт, пока consumer освободит область, и занимает её; false - consumer пропал
+static inline bool arena_acquire_region(RingChannel& ring, uint32_t region_index) {
+    uint32_t* region_state = &ring.arena_states[region_index].region_state;
+    if (__atomic_load_n(region_state, __ATOMIC_ACQUIRE) != ARENA_REGION_FREE) ++ring.channel_full_waits;
+    bool region_free = wait_until(&ring.control->arena_released, ring.wait_strategy, [&]() {
+        return __atomic_load_n(region_state, __ATOMIC_ACQUIRE) == ARENA_REGION_FREE;
+    }, ring.peer_check);
+    if (!region_free) return false;
+    __atomic_store_n(region_state, ARENA_REGION_IN_USE, __ATOMIC_RELAXED);
+    return true;
+}
+
+// Consumer: возвращает область producer после распаковки (вызывается из любого потока)
+static inline void arena_release_region(const RingChannel& ring, uint32_t region_index) {
+    __atomic_store_n(&ring.arena_states[region_index].region_state, ARENA_REGION_FREE, __ATOMIC_RELEASE);
+    wait_point_notify(&ring.control->arena_released);
+}
+
+// Слово владельца стороны кольца для claim_channel_side
+static inline uint32_t* ring_owner_word(const RingChannel& ring, bool is_producer) {
+    return is_producer ? &ring.control->producer_process_id : &ring.control->consumer_process_id;
+}
+
+static inline ChannelLiveness* ring_liveness(const RingChannel& ring) {
+    return &ring.control->liveness;
+}
+
+// Сбрасывает состояние кольца, оставленное упавшей стороной: непрочитанные слоты пропускаются,
+// все области арены свободны. Вызывается, только когда другой стороны нет или она ждёт восстановления.
+static inline void ring_discard_state(RingChannel& ring, bool is_producer) {
+    uint64_t producer_head = __atomic_load_n(&ring.control->producer_head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&ring.control->consumer_tail, producer_head, __ATOMIC_RELEASE);
+    for (uint32_t region_index = 0; region_index < ring.arena_region_count; ++region_index) {
+        __atomic_store_n(&ring.arena_states[region_index].region_state, ARENA_REGION_FREE, __ATOMIC_RELEASE);
+    }
+    ring.cached_peer_index = producer_head;
+    if (!is_producer) ring.local_index = producer_head;
+    wait_point_notify(&ring.control->space_available);
+    wait_point_notify(&ring.control->arena_released);
+}
+
+static inline void close_ring_channel(RingChannel& ring, bool unlink_segment) {
+    if (!ring.control) return;
+    munmap(reinterpret_cast<void*>(ring.control), ring.mapped_size);
+    ring.control = nullptr;
+    if (unlink_segment) remove_shared_segment(ring.segment_name);
+}
@@ -0,0 +1,268 @@
+// shm_stat - просмотр счётчиков стадий работающих producer и consumer
+//
+// Находит сегменты счётчиков в /dev/shm, открывает их только на чтение и раз в интервал
+// печатает по каждой стадии частоту событий, пропускную способность и процентили времени
+// за прошедший интервал. На передачу не влияет: читает память, в которую стороны и так пишут.
+
+#include <bits/stdc++.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stage_stats.h"
+
+using namespace std;
+
+struct StatOptions {
+    string segment_name;        // Канал, счётчики которого показывать (пусто - все)
+    double interval_seconds = 1.0;
+    size_t sample_count = 0;    // 0 - пока есть сегменты
+    bool json_output = false;
+};
+
+// Сумма счётчиков всех потоков одной стороны
+struct StatsSnapshot {
+    uint32_t role = 0;
+    uint32_t process_id = 0;
+    uint32_t thread_count = 0;
+    uint64_t start_time_ns = 0;
+    uint64_t sample_time_ns = 0;
+    uint64_t queue_depth = 0;
+    uint64_t transferred_bytes = 0;
+    uint64_t transferred_blocks = 0;
+    bool transfer_finished = false;
+    array<StageCounters, PIPELINE_STAGE_COUNT> stage_counters{};
+};
+
+static void print_stat_usage() {
+    cerr << "Использование: shm_stat [параметры]" << endl;
+    cerr << "  --segment-name=/NAME     показывать только этот канал (по умолчанию все)" << endl;
+    cerr << "  --interval=SECONDS       интервал между снимками (по умолчанию 1)" << endl;
+    cerr << "  --count=N                число снимков (по умолчанию - пока есть сегменты)" << endl;
+    cerr << "  --format=text|json       формат вывода (json - по объекту на строку)" << endl;
+}
+
+static bool parse_stat_options(int argc, char** argv, StatOptions& options) {
+    for (int argument_index = 1; argument_index < argc; ++argument_index) {
+        string argument = argv[argument_index];
+        size_t separator_position = argument.find('=');
+        string option_name = argument.rfind("--", 0) == 0
+            ? argument.substr(2, separator_position == string::npos ? string::npos : separator_position - 2) : "";
+        string option_value = separator_position == string::npos ? "" : argument.substr(separator_position + 1);
+        char* parse_end = nullptr;
+        if (option_name == "segment-name" && !option_value.empty() && option_value[0] == '/') {
+            options.segment_name = option_value;
+        } else if (option_name == "interval") {
+            options.interval_seconds = strtod(option_value.c_str(), &parse_end);
+            if (option_value.empty() || *parse_end != '\0' || options.interval_seconds <= 0) return false;
+        } else if (option_name == "count") {
+            options.sample_count = strtoull(option_value.c_str(), &parse_end, 10);
+            if (option_value.empty() || *parse_end != '\0') return false;
+        } else if (option_name == "format" && (option_value == "text" || option_value == "json")) {
+            options.json_output = option_value == "json";
+        } else {
+            cerr << "Ошибка: некорректный параметр '" << argument << "'" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ends_with(const string& text, const string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Имена сегментов счётчиков ("/имя") из /dev/shm
+static vector<string> find_stats_segments(const string& channel_segment) {
+    vector<string> segment_names;
+    DIR* shm_directory = opendir("/dev/shm");
+    if (!shm_directory) return segment_names;
+    while (dirent* directory_entry = readdir(shm_directory)) {
+        string segment_name = string("/") + directory_entry->d_name;
+        if (!ends_with(segment_name, "_producer_stats") && !ends_with(segment_name, "_consumer_stats")) continue;
+        if (!channel_segment.empty() &&
+            segment_name != stats_segment_name(channel_segment, StatsRole::Producer) &&
+            segment_name != stats_segment_name(channel_segment, StatsRole::Consumer)) {
+            continue;
+        }
+        segment_names.push_back(segment_name);
+    }
+    closedir(shm_directory);
+    sort(segment_names.begin(), segment_names.end());
+    return segment_names;
+}
+
+// Снимает показания сегмента; false - сегмент исчез или ещё не размечен
+static bool read_stats_snapshot(const string& segment_name, StatsSnapshot& snapshot) {
+    int shared_memory_descriptor = shm_open(segment_name.c_str(), O_RDONLY, 0);
+    if (shared_memory_descriptor < 0) return false;
+    struct stat segment_status;
+    size_t segment_size = stats_segment_size();
+    if (fstat(shared_memory_descriptor, &segment_status) != 0 || static_cast<size_t>(segment_status.st_size) != segment_size) {
+        close(shared_memory_descriptor);
+        return false;
+    }
+    void* memory_region = mmap(nullptr, segment_size, PROT_READ, MAP_SHARED, shared_memory_descriptor, 0);
+    close(shared_memory_descriptor);
+    if (memory_region == MAP_FAILED) return false;
+
+    auto* stats_header = static_cast<StatsSegmentHeader*>(memory_region);
+    bool valid = __atomic_load_n(&stats_header->segment_magic, __ATOMIC_ACQUIRE) == STATS_SEGMENT_MAGIC &&
+                 stats_header->layout_version == STATS_LAYOUT_VERSION;
+    if (valid) {
+        snapshot = StatsSnapshot{};
+        snapshot.sample_time_ns = monotonic_time_ns();
+        snapshot.role = stats_header->role;
+        snapshot.process_id = stats_header->process_id;
+        snapshot.start_time_ns = stats_header->start_time_ns;
+        snapshot.queue_depth = __atomic_load_n(&stats_header->queue_depth, __ATOMIC_RELAXED);
+        snapshot.transferred_bytes = __atomic_load_n(&stats_header->transferred_bytes, __ATOMIC_RELAXED);
+        snapshot.transferred_blocks = __atomic_load_n(&stats_header->transferred_blocks, __ATOMIC_RELAXED);
+        snapshot.transfer_finished = __atomic_load_n(&stats_header->transfer_finished, __ATOMIC_ACQUIRE) != 0;
+        uint32_t claimed_slots = min(__atomic_load_n(&stats_header->thread_slots_claimed, __ATOMIC_RELAXED),
+                                     STATS_THREAD_SLOT_COUNT);
+        snapshot.thread_count = claimed_slots;
+        ThreadStatsSlot* thread_slots = stats_thread_slots(stats_header);
+        for (uint32_t slot_index = 0; slot_index < claimed_slots; ++slot_index) {
+            for (size_t stage_index = 0; stage_index < PIPELINE_STAGE_COUNT; ++stage_index) {
+                const StageCounters& source = thread_slots[slot_index].stage_counters[stage_index];
+                StageCounters& total = snapshot.stage_counters[stage_index];
+                total.event_count += __atomic_load_n(&source.event_count, __ATOMIC_RELAXED);
+                total.total_ns += __atomic_load_n(&source.total_ns, __ATOMIC_RELAXED);
+                total.byte_count += __atomic_load_n(&source.byte_count, __ATOMIC_RELAXED);
+                total.max_ns = max(total.max_ns, __atomic_load_n(&source.max_ns, __ATOMIC_RELAXED));
+                for (size_t bucket_index = 0; bucket_index < STATS_LATENCY_BUCKET_COUNT; ++bucket_index) {
+                    total.latency_buckets[bucket_index] += __atomic_load_n(&source.latency_buckets[bucket_index], __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+    munmap(memory_region, segment_size);
+    return valid;
+}
+
+// Разность счётчиков за интервал (максимум остаётся накопленным)
+static StageCounters subtract_counters(const StageCounters& current, const StageCounters& previous) {
+    StageCounters difference = current;
+    difference.event_count -= previous.event_count;
+    difference.total_ns -= previous.total_ns;
+    difference.byte_count -= previous.byte_count;
+    for (size_t bucket_index = 0; bucket_index < STATS_LATENCY_BUCKET_COUNT; ++bucket_index) {
+        difference.latency_buckets[bucket_index] -= previous.latency_buckets[bucket_index];
+    }
+    return difference;
+}
+
+// Дополняет заголовок пробелами до ширины в символах (setw считает байты UTF-8)
+static string pad_column(const string& text, size_t width, bool align_left = false) {
+    size_t character_count = 0;
+    for (unsigned char byte : text) character_count += (byte & 0xC0) != 0x80;
+    string padding(width > character_count ? width - character_count : 0, ' ');
+    return align_left ? text + padding : padding + text;
+}
+
+// Верхняя граница корзины, в которую попадает заданная доля событий
+static uint64_t histogram_percentile_ns(const StageCounters& counters, double fraction) {
+    if (counters.event_count == 0) return 0;
+    uint64_t target_count = static_cast<uint64_t>(ceil(fraction * double(counters.event_count)));
+    uint64_t cumulative_count = 0;
+    for (size_t bucket_index = 0; bucket_index < STATS_LATENCY_BUCKET_COUNT; ++bucket_index) {
+        cumulative_count += counters.latency_buckets[bucket_index];
+        if (cumulative_count >= target_count) return min<uint64_t>(2ull << bucket_index, counters.max_ns);
+    }
+    return counters.max_ns;
+}
+
+static void print_snapshot(const string& segment_name, const StatsSnapshot& snapshot,
+                           const StatsSnapshot* previous_snapshot, bool json_output) {
+    uint64_t window_start_ns = previous_snapshot ? previous_snapshot->sample_time_ns : snapshot.start_time_ns;
+    double window_seconds = max(1e-9, double(snapshot.sample_time_ns - window_start_ns) / 1e9);
+    uint64_t window_bytes = snapshot.transferred_bytes - (previous_snapshot ? previous_snapshot->transferred_bytes : 0);
+    double elapsed_seconds = double(snapshot.sample_time_ns - snapshot.start_time_ns) / 1e9;
+
+    if (json_output) {
+        cout << "{\"segment\":\"" << segment_name << "\",\"role\":\"" << stats_role_name(snapshot.role)
+             << "\",\"pid\":" << snapshot.process_id << ",\"elapsed_seconds\":" << elapsed_seconds
+             << ",\"threads\":" << snapshot.thread_count << ",\"queue_depth\":" << snapshot.queue_depth
+             << ",\"transferred_bytes\":" << snapshot.transferred_bytes
+             << ",\"transferred_blocks\":" << snapshot.transferred_blocks
+             << ",\"throughput_mb_s\":" << double(window_bytes) / 1e6 / window_seconds
+             << ",\"finished\":" << (snapshot.transfer_finished ? "true" : "false") << ",\"stages\":{";
+    } else {
+        cout << segment_name << " " << stats_role_name(snapshot.role) << " (pid " << snapshot.process_id
+             << ", потоков " << snapshot.thread_count << ", очередь " << snapshot.queue_depth << "): "
+             << fixed << setprecision(2) << double(window_bytes) / 1e6 / window_seconds << " MB/s, всего "
+             << double(snapshot.transferred_bytes) / 1e6 << " MB, " << snapshot.transferred_blocks << " блоков, "
+             << elapsed_seconds << " с" << (snapshot.transfer_finished ? ", завершено" : "") << endl;
+        cout << "  " << pad_column("стадия", 10, true) << pad_column("событий/с", 12) << pad_column("MB/s", 10)
+             << pad_column("сред. мкс", 12) << pad_column("p50 мкс", 11) << pad_column("p99 мкс", 11)
+             << pad_column("макс мкс", 12) << endl;
+    }
+
+    bool first_stage = true;
+    for (size_t stage_index = 0; stage_index < PIPELINE_STAGE_COUNT; ++stage_index) {
+        StageCounters window_counters = previous_snapshot
+            ? subtract_counters(snapshot.stage_counters[stage_index], previous_snapshot->stage_counters[stage_index])
+            : snapshot.stage_counters[stage_index];
+        if (snapshot.stage_counters[stage_index].event_count == 0) continue;
+        double events_per_second = double(window_counters.event_count) / window_seconds;
+        double stage_mb_per_second = double(window_counters.byte_count) / 1e6 / window_seconds;
+        double average_us = window_counters.event_count ? double(window_counters.total_ns) / 1e3 / double(window_counters.event_count) : 0.0;
+        double p50_us = double(histogram_percentile_ns(window_counters, 0.50)) / 1e3;
+        double p99_us = double(histogram_percentile_ns(window_counters, 0.99)) / 1e3;
+        double max_us = double(window_counters.max_ns) / 1e3;
+        if (json_output) {
+            cout << (first_stage ? "" : ",") << "\"" << pipeline_stage_name(stage_index) << "\":{"
+                 << "\"events\":" << window_counters.event_count << ",\"events_per_second\":" << events_per_second
+                 << ",\"mb_s\":" << stage_mb_per_second << ",\"average_us\":" << average_us
+                 << ",\"p50_us\":" << p50_us << ",\"p99_us\":" << p99_us << ",\"max_us\":" << max_us << "}";
+        } else {
+            cout << "  " << left << setw(10) << pipeline_stage_name(stage_index) << right << fixed << setprecision(1)
+                 << setw(12) << events_per_second << setw(10) << stage_mb_per_second << setw(12) << average_us
+                 << setw(11) << p50_us << setw(11) << p99_us << setw(12) << max_us << endl;
+        }
+        first_stage = false;
+    }
+    if (json_output) cout << "}}" << endl;
+}
+
+int main(int argc, char** argv) {
+    StatOptions stat_options;
+    if (!parse_stat_options(argc, argv, stat_options)) {
+        print_stat_usage();
+        return 1;
+    }
+
+    map<string, StatsSnapshot> previous_snapshots;
+    for (size_t sample_index = 0; stat_options.sample_count == 0 || sample_index < stat_options.sample_count; ++sample_index) {
+        if (sample_index > 0) {
+            this_thread::sleep_for(chrono::duration<double>(stat_options.interval_seconds));
+        }
+        vector<string> segment_names = find_stats_segments(stat_options.segment_name);
+        if (segment_names.empty()) {
+            if (sample_index == 0) {
+                cerr << "Сегменты счётчиков не найдены (producer/consumer не запущены или запущены с --stats=off)" << endl;
+                return 1;
+            }
+            break;
+        }
+
+        map<string, StatsSnapshot> current_snapshots;
+        for (const string& segment_name : segment_names) {
+            StatsSnapshot snapshot;
+            if (!read_stats_snapshot(segment_name, snapshot)) continue;
+            auto previous_iterator = previous_snapshots.find(segment_name);
+            bool same_process = previous_iterator != previous_snapshots.end() &&
+                                previous_iterator->second.process_id == snapshot.process_id &&
+                                previous_iterator->second.start_time_ns == snapshot.start_time_ns;
+            print_snapshot(segment_name, snapshot, same_process ? &previous_iterator->second : nullptr, stat_options.json_output);
+            current_snapshots[segment_name] = snapshot;
+        }
+        if (!stat_options.json_output) cout << endl;
+        cout.flush();
+        previous_snapshots = move(current_snapshots);
+    }
+    return 0;
+}
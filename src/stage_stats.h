@@ -0,0 +1,200 @@
+// Счётчики стадий конвейера в отдельном сегменте shared memory
+//
+// Каждая сторона создаёт сегмент "<имя канала>_producer_stats" или "_consumer_stats" и
+// пишет в него время и объём каждой стадии (чтение, сжатие, отправка, приём, распаковка,
+// запись). Каждый поток получает собственный слот счётчиков в своей кэш-линии, поэтому
+// запись - это несколько атомарных сложений без блокировок и без общих кэш-линий.
+// Утилита shm_stat открывает сегмент только на чтение и снимает показания на ходу.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wait_strategy.h"
+
+constexpr uint32_t STATS_SEGMENT_MAGIC = 0x54415453; // "STAT"
+constexpr uint32_t STATS_LAYOUT_VERSION = 1;
+constexpr uint32_t STATS_THREAD_SLOT_COUNT = 64;     // Последний слот делят потоки сверх лимита
+constexpr size_t STATS_LATENCY_BUCKET_COUNT = 40;    // Корзина i: [2^i, 2^(i+1)) нс
+
+enum class PipelineStage : uint32_t {
+    Read,     // Producer: чтение блока из файла
+    Compress, // Producer: сжатие блока в кадр
+    Send,     // Producer: отправка кадра в канал (вместе с ожиданием места)
+    Receive,  // Consumer: получение сообщения из канала (вместе с ожиданием данных)
+    Inflate,  // Consumer: проверка и распаковка кадра
+    Write,    // Consumer: запись блока в выходной файл
+    Count
+};
+
+constexpr size_t PIPELINE_STAGE_COUNT = static_cast<size_t>(PipelineStage::Count);
+
+enum class StatsRole : uint32_t {
+    Producer = 0,
+    Consumer = 1
+};
+
+static inline const char* pipeline_stage_name(size_t stage_index) {
+    static const char* const stage_names[PIPELINE_STAGE_COUNT] = {"read", "compress", "send", "receive", "inflate", "write"};
+    return stage_index < PIPELINE_STAGE_COUNT ? stage_names[stage_index] : "unknown";
+}
+
+static inline const char* stats_role_name(uint32_t role) {
+    return role == static_cast<uint32_t>(StatsRole::Producer) ? "producer" : "consumer";
+}
+
+// Счётчики одной стадии одного потока
+struct StageCounters {
+    uint64_t event_count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t byte_count;
+    uint64_t latency_buckets[STATS_LATENCY_BUCKET_COUNT];
+};
+
+struct alignas(64) ThreadStatsSlot {
+    uint32_t thread_id; // TID потока-владельца (0 - слот свободен)
+    StageCounters stage_counters[PIPELINE_STAGE_COUNT];
+};
+
+struct StatsSegmentHeader {
+    alignas(64) uint32_t segment_magic;      // STATS_SEGMENT_MAGIC после инициализации
+    uint32_t layout_version;
+    uint32_t role;                           // StatsRole
+    uint32_t process_id;
+    uint32_t thread_slot_count;
+    uint32_t thread_slots_claimed;           // Выдано слотов потокам
+    uint64_t start_time_ns;                  // monotonic_time_ns() при создании
+    alignas(64) uint64_t queue_depth;        // Блоков в работе (сжатие или распаковка)
+    uint64_t transferred_bytes;              // Несжатых байт отправлено / записано
+    uint64_t transferred_blocks;
+    uint32_t transfer_finished;              // Передача завершена
+};
+
+static inline size_t stats_segment_size() {
+    return sizeof(StatsSegmentHeader) + STATS_THREAD_SLOT_COUNT * sizeof(ThreadStatsSlot);
+}
+
+static inline ThreadStatsSlot* stats_thread_slots(StatsSegmentHeader* header) {
+    return reinterpret_cast<ThreadStatsSlot*>(reinterpret_cast<uint8_t*>(header) + sizeof(StatsSegmentHeader));
+}
+
+static inline std::string stats_segment_name(const std::string& channel_segment, StatsRole role) {
+    return channel_segment + "_" + stats_role_name(static_cast<uint32_t>(role)) + "_stats";
+}
+
+static inline size_t latency_bucket_index(uint64_t elapsed_ns) {
+    size_t bucket_index = elapsed_ns == 0 ? 0 : static_cast<size_t>(63 - __builtin_clzll(elapsed_ns));
+    return std::min(bucket_index, STATS_LATENCY_BUCKET_COUNT - 1);
+}
+
+// Сторона, публикующая счётчики; без open() все вызовы ничего не делают
+class StageStats {
+public:
+    StageStats() = default;
+    StageStats(const StageStats&) = delete;
+    StageStats& operator=(const StageStats&) = delete;
+    ~StageStats() { close(); }
+
+    bool open(const std::string& segment_name, StatsRole role) {
+        int shared_memory_descriptor = shm_open(segment_name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+        if (shared_memory_descriptor < 0) return false;
+        size_t segment_size = stats_segment_size();
+        if (ftruncate(shared_memory_descriptor, static_cast<off_t>(segment_size)) != 0) {
+            ::close(shared_memory_descriptor);
+            shm_unlink(segment_name.c_str());
+            return false;
+        }
+        void* memory_region = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, shared_memory_descriptor, 0);
+        ::close(shared_memory_descriptor);
+        if (memory_region == MAP_FAILED) {
+            shm_unlink(segment_name.c_str());
+            return false;
+        }
+        stats_header = static_cast<StatsSegmentHeader*>(memory_region);
+        stats_name = segment_name;
+        // Новое отображение может получить прежний адрес: слоты потоков ищутся заново по номеру открытия
+        mapping_generation = next_mapping_generation().fetch_add(1, std::memory_order_relaxed) + 1;
+        stats_header->layout_version = STATS_LAYOUT_VERSION;
+        stats_header->role = static_cast<uint32_t>(role);
+        stats_header->process_id = static_cast<uint32_t>(getpid());
+        stats_header->thread_slot_count = STATS_THREAD_SLOT_COUNT;
+        stats_header->start_time_ns = monotonic_time_ns();
+        __atomic_store_n(&stats_header->segment_magic, STATS_SEGMENT_MAGIC, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Отмечает конец передачи и удаляет сегмент
+    void close() {
+        if (!stats_header) return;
+        __atomic_store_n(&stats_header->transfer_finished, 1, __ATOMIC_RELEASE);
+        munmap(stats_header, stats_segment_size());
+        shm_unlink(stats_name.c_str());
+        stats_header = nullptr;
+    }
+
+    bool enabled() const { return stats_header != nullptr; }
+
+    // Учитывает одно выполнение стадии; вызывается из любого потока
+    void record(PipelineStage stage, uint64_t elapsed_ns, uint64_t byte_count) {
+        if (!stats_header) return;
+        StageCounters& counters = thread_slot()->stage_counters[static_cast<size_t>(stage)];
+        __atomic_fetch_add(&counters.event_count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&counters.total_ns, elapsed_ns, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&counters.byte_count, byte_count, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&counters.latency_buckets[latency_bucket_index(elapsed_ns)], 1, __ATOMIC_RELAXED);
+        uint64_t previous_max = __atomic_load_n(&counters.max_ns, __ATOMIC_RELAXED);
+        while (elapsed_ns > previous_max &&
+               !__atomic_compare_exchange_n(&counters.max_ns, &previous_max, elapsed_ns, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    // Время начала стадии (0, если счётчики выключены - тогда часы не опрашиваются)
+    uint64_t stage_start() const { return stats_header ? monotonic_time_ns() : 0; }
+
+    void finish_stage(PipelineStage stage, uint64_t start_ns, uint64_t byte_count) {
+        if (stats_header) record(stage, monotonic_time_ns() - start_ns, byte_count);
+    }
+
+    void set_queue_depth(uint64_t queue_depth) {
+        if (stats_header) __atomic_store_n(&stats_header->queue_depth, queue_depth, __ATOMIC_RELAXED);
+    }
+
+    void add_transferred(uint64_t byte_count, uint64_t block_count) {
+        if (!stats_header) return;
+        __atomic_fetch_add(&stats_header->transferred_bytes, byte_count, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats_header->transferred_blocks, block_count, __ATOMIC_RELAXED);
+    }
+
+private:
+    // Номера открытий сегментов счётчиков, общие для процесса: номер не повторяется после close/open
+    static std::atomic<uint64_t>& next_mapping_generation() {
+        static std::atomic<uint64_t> generation{0};
+        return generation;
+    }
+
+    // Слот текущего потока; выдаётся при первой записи в каждое открытое отображение
+    ThreadStatsSlot* thread_slot() {
+        thread_local uint64_t slot_generation = 0;
+        thread_local ThreadStatsSlot* cached_slot = nullptr;
+        if (slot_generation != mapping_generation) {
+            uint32_t slot_index = __atomic_fetch_add(&stats_header->thread_slots_claimed, 1, __ATOMIC_RELAXED);
+            slot_index = std::min(slot_index, STATS_THREAD_SLOT_COUNT - 1);
+            cached_slot = &stats_thread_slots(stats_header)[slot_index];
+            __atomic_store_n(&cached_slot->thread_id, static_cast<uint32_t>(syscall(SYS_gettid)), __ATOMIC_RELAXED);
+            slot_generation = mapping_generation;
+        }
+        return cached_slot;
+    }
+
+    StatsSegmentHeader* stats_header = nullptr;
+    std::string stats_name;
+    uint64_t mapping_generation = 0; // Номер открытия текущего отображения (0 - не открыт)
+};
@@ -0,0 +1,139 @@
+// Пул потоков фиксированного размера с очередями для перехвата задач (work stealing)
+//
+// У каждого рабочего потока своя очередь. Внешние потоки раскладывают задачи по очередям
+// по кругу, задачи, порождённые рабочим потоком, попадают в его собственную очередь.
+// Поток берёт задачи из хвоста своей очереди, а опустевший поток забирает задачи
+// с головы чужих очередей. Количество потоков задаётся один раз, поэтому стоимость
+// создания потоков не зависит от размера файла. С worker_cpus каждый поток до первой задачи
+// привязывается к этим процессорам, и его буферы выделяются на их узле NUMA.
+
+#pragma once
+
+#include <bits/stdc++.h>
+
+#include "cpu_placement.h"
+
+class WorkStealingThreadPool {
+public:
+    explicit WorkStealingThreadPool(size_t worker_count = 0, std::vector<int> worker_cpus = {}) {
+        if (worker_count == 0) worker_count = default_worker_count();
+        worker_queues.reserve(worker_count);
+        for (size_t worker_index = 0; worker_index < worker_count; ++worker_index) {
+            worker_queues.push_back(std::make_unique<WorkerQueue>());
+        }
+        worker_threads.reserve(worker_count);
+        try {
+            for (size_t worker_index = 0; worker_index < worker_count; ++worker_index) {
+                worker_threads.emplace_back([this, worker_index, worker_cpus]() {
+                    pin_current_thread(worker_cpus);
+                    worker_loop(worker_index);
+                });
+            }
+        } catch (...) {
+            // Система не дала создать очередной поток: останавливаем уже запущенные и передаём ошибку дальше
+            stop_workers();
+            throw;
+        }
+    }
+
+    WorkStealingThreadPool(const WorkStealingThreadPool&) = delete;
+    WorkStealingThreadPool& operator=(const WorkStealingThreadPool&) = delete;
+
+    // Дожидается выполнения всех поставленных задач и останавливает потоки
+    ~WorkStealingThreadPool() { stop_workers(); }
+
+    static size_t default_worker_count() {
+        return std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+
+    size_t worker_count() const { return worker_threads.size(); }
+
+    // Ставит задачу в очередь и возвращает future с её результатом
+    template <typename Callable>
+    auto submit(Callable&& callable) -> std::future<std::invoke_result_t<std::decay_t<Callable>>> {
+        using ResultType = std::invoke_result_t<std::decay_t<Callable>>;
+        auto packaged = std::make_shared<std::packaged_task<ResultType()>>(std::forward<Callable>(callable));
+        std::future<ResultType> result = packaged->get_future();
+
+        size_t queue_index = current_worker_index != SIZE_MAX && current_worker_pool == this
+            ? current_worker_index
+            : next_queue_index.fetch_add(1, std::memory_order_relaxed) % worker_queues.size();
+        {
+            std::lock_guard<std::mutex> queue_guard(worker_queues[queue_index]->queue_mutex);
+            worker_queues[queue_index]->tasks.emplace_back([packaged]() { (*packaged)(); });
+        }
+        {
+            std::lock_guard<std::mutex> sleep_guard(sleep_mutex);
+            ++pending_task_count;
+        }
+        sleep_condition.notify_one();
+        return result;
+    }
+
+private:
+    struct WorkerQueue {
+        std::mutex queue_mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // Берёт задачу из своей очереди (LIFO) или перехватывает из чужой (FIFO)
+    bool try_take_task(size_t worker_index, std::function<void()>& task) {
+        {
+            WorkerQueue& own_queue = *worker_queues[worker_index];
+            std::lock_guard<std::mutex> queue_guard(own_queue.queue_mutex);
+            if (!own_queue.tasks.empty()) {
+                task = std::move(own_queue.tasks.back());
+                own_queue.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < worker_queues.size(); ++offset) {
+            WorkerQueue& victim_queue = *worker_queues[(worker_index + offset) % worker_queues.size()];
+            std::lock_guard<std::mutex> queue_guard(victim_queue.queue_mutex);
+            if (!victim_queue.tasks.empty()) {
+                task = std::move(victim_queue.tasks.front());
+                victim_queue.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void stop_workers() {
+        {
+            std::lock_guard<std::mutex> sleep_guard(sleep_mutex);
+            stopping = true;
+        }
+        sleep_condition.notify_all();
+        for (auto& worker_thread : worker_threads) worker_thread.join();
+    }
+
+    void worker_loop(size_t worker_index) {
+        current_worker_pool = this;
+        current_worker_index = worker_index;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> sleep_lock(sleep_mutex);
+                sleep_condition.wait(sleep_lock, [this]() { return stopping || pending_task_count > 0; });
+                if (pending_task_count == 0 && stopping) return;
+                --pending_task_count;
+            }
+            // Задача гарантированно лежит в одной из очередей: счётчик увеличивается после вставки
+            std::function<void()> task;
+            while (!try_take_task(worker_index, task)) std::this_thread::yield();
+            task();
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkerQueue>> worker_queues;
+    std::vector<std::thread> worker_threads;
+    std::atomic<size_t> next_queue_index{0};
+
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_condition;
+    size_t pending_task_count = 0;
+    bool stopping = false;
+
+    static inline thread_local WorkStealingThreadPool* current_worker_pool = nullptr;
+    static inline thread_local size_t current_worker_index = SIZE_MAX;
+};
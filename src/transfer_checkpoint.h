@@ -0,0 +1,128 @@
+// Контрольная точка приёма файла: карта уже записанных блоков
+//
+// Consumer с --resume ведёт рядом с выходным файлом "<файл>.shm-resume": заголовок с описанием
+// передачи (размер, размер блока, версия содержимого источника) и битовую карту блоков, уже
+// записанных на место. Файл отображён в память (MAP_SHARED), поэтому бит, выставленный потоком
+// распаковки, переживает падение consumer без отдельной записи. Бит ставится только после
+// записи блока в выходной файл, и оба попадают в кэш страниц одного ядра: после падения
+// процесса блок с битом гарантированно записан. Падение машины такой гарантии не даёт
+// (для неё понадобился бы fsync каждого блока): после него контрольную точку стоит удалить.
+//
+// Следующая попытка передачи того же источника (совпали размер, размер блока и версия)
+// получает карту и отправляет только недостающие блоки; после успешной передачи файл
+// контрольной точки удаляется.
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr uint32_t CHECKPOINT_MAGIC = 0x504B4843; // "CHKP"
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+constexpr const char* CHECKPOINT_SUFFIX = ".shm-resume";
+
+// Заголовок файла контрольной точки; за ним карта блоков (block_count бит, по байтам от младшего бита)
+struct CheckpointHeader {
+    uint32_t checkpoint_magic;
+    uint32_t checkpoint_version;
+    uint64_t total_size;     // Размер передаваемого файла
+    uint64_t source_version; // Версия содержимого источника (см. BlockInputSource::content_version)
+    uint32_t block_size;
+    uint32_t reserved;
+    uint64_t block_count;
+};
+
+class TransferCheckpoint {
+public:
+    TransferCheckpoint() = default;
+    TransferCheckpoint(const TransferCheckpoint&) = delete;
+    TransferCheckpoint& operator=(const TransferCheckpoint&) = delete;
+
+    ~TransferCheckpoint() { close(); }
+
+    // Открывает контрольную точку передачи в output_path. Карта прошлой попытки сохраняется,
+    // только если она описывает ту же передачу; иначе заводится пустая.
+    bool open(const std::string& output_path, uint64_t total_size, size_t block_size, uint64_t source_version,
+              std::string& error_message) {
+        close();
+        checkpoint_path = output_path + CHECKPOINT_SUFFIX;
+        uint64_t block_count = (total_size + block_size - 1) / block_size;
+        size_t file_length = sizeof(CheckpointHeader) + static_cast<size_t>((block_count + 7) / 8);
+        int file_descriptor = ::open(checkpoint_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (file_descriptor < 0) {
+            error_message = "контрольная точка " + checkpoint_path + ": " + strerror(errno);
+            return false;
+        }
+        struct stat file_status;
+        bool length_matches = fstat(file_descriptor, &file_status) == 0 &&
+                              static_cast<uint64_t>(file_status.st_size) == file_length;
+        if (!length_matches &&
+            (ftruncate(file_descriptor, 0) != 0 || ftruncate(file_descriptor, static_cast<off_t>(file_length)) != 0)) {
+            error_message = "контрольная точка " + checkpoint_path + ": " + strerror(errno);
+            ::close(file_descriptor);
+            return false;
+        }
+        void* mapping = mmap(nullptr, file_length, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+        ::close(file_descriptor);
+        if (mapping == MAP_FAILED) {
+            error_message = "контрольная точка " + checkpoint_path + ": " + strerror(errno);
+            return false;
+        }
+        mapped_header = static_cast<CheckpointHeader*>(mapping);
+        mapped_length = file_length;
+
+        CheckpointHeader expected_header{CHECKPOINT_MAGIC, CHECKPOINT_VERSION, total_size, source_version,
+                                         static_cast<uint32_t>(block_size), 0, block_count};
+        if (memcmp(mapped_header, &expected_header, sizeof(expected_header)) != 0) {
+            // Другая передача, другой источник или недописанный заголовок: начинаем с пустой карты
+            memset(mapping, 0, file_length);
+            memcpy(mapped_header, &expected_header, sizeof(expected_header));
+        }
+        for (size_t byte_index = 0; byte_index < bitmap_bytes(); ++byte_index) {
+            recorded_blocks += static_cast<uint64_t>(__builtin_popcount(bitmap()[byte_index]));
+        }
+        return true;
+    }
+
+    bool is_open() const { return mapped_header != nullptr; }
+    uint64_t block_count() const { return mapped_header ? mapped_header->block_count : 0; }
+
+    // Сколько блоков было записано прошлыми попытками на момент открытия
+    uint64_t recorded_block_count() const { return recorded_blocks; }
+
+    // Блок записан на место; вызывается из потоков распаковки
+    void mark_block(uint64_t block_index) {
+        if (!mapped_header || block_index >= mapped_header->block_count) return;
+        __atomic_fetch_or(&bitmap()[block_index / 8], static_cast<uint8_t>(1u << (block_index % 8)), __ATOMIC_RELAXED);
+    }
+
+    void copy_bitmap(std::vector<uint8_t>& block_bitmap) const {
+        block_bitmap.assign(bitmap(), bitmap() + bitmap_bytes());
+    }
+
+    // Передача завершена: контрольная точка больше не нужна
+    void remove() {
+        if (!mapped_header) return;
+        close();
+        unlink(checkpoint_path.c_str());
+    }
+
+    void close() {
+        if (mapped_header) munmap(mapped_header, mapped_length);
+        mapped_header = nullptr;
+        mapped_length = 0;
+        recorded_blocks = 0;
+    }
+
+private:
+    uint8_t* bitmap() const { return reinterpret_cast<uint8_t*>(mapped_header) + sizeof(CheckpointHeader); }
+    size_t bitmap_bytes() const { return mapped_length - sizeof(CheckpointHeader); }
+
+    std::string checkpoint_path;
+    CheckpointHeader* mapped_header = nullptr;
+    size_t mapped_length = 0;
+    uint64_t recorded_blocks = 0;
+};
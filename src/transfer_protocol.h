@@ -0,0 +1,118 @@
+// Служебные сообщения протокола передачи (общие для producer и consumer)
+//
+// Каждый фрагмент канала несёт ID передачи, поэтому в одном сеансе несколько передач могут
+// идти одна за другой или вперемешку (с точностью до блока). Передача начинается описанием
+// TRANSFER_INFO и заканчивается TRANSFER_END. Описание передачи:
+//   [TransferInfo][TransferEntry x entry_count][имена записей подряд, name_bytes байт]
+// Обычная передача содержит не больше одной записи (имя файла); пакет мелких файлов
+// (TRANSFER_FLAG_PACKED) - по записи на файл, данные файлов идут подряд в порядке записей.
+
+#pragma once
+
+#include <bits/stdc++.h>
+
+constexpr uint32_t TERMINATION_BLOCK_ID = UINT32_MAX;         // Сигнал завершения передачи
+constexpr uint32_t TRANSFER_INFO_BLOCK_ID = UINT32_MAX - 1;   // Описание передачи (первое сообщение)
+constexpr uint32_t TRANSFER_END_BLOCK_ID = UINT32_MAX - 2;    // Конец передачи (после последнего блока)
+
+constexpr uint32_t TRANSFER_FLAG_SIZE_KNOWN = 1u << 0;        // Размер файла известен заранее
+constexpr uint32_t TRANSFER_FLAG_PACKED = 1u << 1;            // Пакет мелких файлов
+constexpr uint32_t TRANSFER_FLAG_VARIABLE_BLOCKS = 1u << 2;   // Блоки переменной длины (разбиение по содержимому)
+constexpr uint32_t TRANSFER_FLAG_DELTA = 1u << 3;             // Producer ждёт сигнатуру старой копии (см. delta_transfer.h)
+constexpr uint32_t TRANSFER_FLAG_RESUMABLE = 1u << 4;         // Producer ждёт карту блоков, уже записанных прошлой попыткой
+constexpr uint32_t TRANSFER_FLAG_CHAINED = 1u << 5;           // Блоки сжаты цепочкой deflate: распаковываются по порядку
+constexpr uint32_t TRANSFER_END_FLAG_ABORTED = 1u << 0;       // Отправитель прервал передачу (ошибка чтения)
+constexpr uint32_t TRANSFER_END_FLAG_CONFIRM = 1u << 1;       // Producer ждёт итог передачи по обратному каналу
+
+constexpr size_t MAX_TRANSFER_NAME_LENGTH = 4096;             // Длина имени файла
+constexpr size_t MAX_TRANSFER_ENTRY_COUNT = 65536;            // Файлов в одном пакете
+
+// Заголовок полезной нагрузки сообщения TRANSFER_INFO_BLOCK_ID
+struct TransferInfo {
+    uint64_t total_size;       // Размер несжатых данных (если известен)
+    uint32_t block_size;       // Размер несжатого блока; блок N начинается со смещения N * block_size
+                               // (с TRANSFER_FLAG_VARIABLE_BLOCKS - наибольшая длина блока, блоки идут подряд)
+    uint32_t transfer_flags;   // TRANSFER_FLAG_*
+    uint32_t entry_count;      // Сколько записей TransferEntry следует за заголовком
+    uint32_t name_bytes;       // Суммарная длина имён записей
+    uint64_t reference_window; // Байт полных кадров, которые consumer хранит для кадров-ссылок (0 - без ссылок)
+    uint64_t next_reference_ordinal; // Номер, который получит следующий полный кадр канала
+    uint64_t source_version;   // Версия содержимого источника (устройство, inode, размер, mtime); 0 - неизвестна
+};
+
+// Запись о файле в описании передачи
+struct TransferEntry {
+    uint64_t entry_size;       // Размер файла (для пакета; у обычной передачи совпадает с total_size)
+    uint32_t name_length;
+    uint32_t reserved;
+};
+
+// Полезная нагрузка сообщения TRANSFER_END_BLOCK_ID: по ней consumer узнаёт границу
+// сообщения, не дожидаясь сигнала завершения канала
+struct TransferEnd {
+    uint64_t total_size;       // Сколько несжатых байт отправлено
+    uint64_t block_count;      // Сколько блоков отправлено
+    uint32_t end_flags;        // TRANSFER_END_FLAG_*
+    uint32_t reserved;
+};
+
+// Имя и размер файла из описания передачи
+struct TransferEntryDescription {
+    std::string name;
+    uint64_t entry_size = 0;
+};
+
+// Собирает описание передачи в payload (ёмкость буфера переиспользуется)
+static inline void encode_transfer_info(const TransferInfo& transfer_info,
+                                        const std::vector<TransferEntryDescription>& entries,
+                                        std::vector<uint8_t>& payload) {
+    TransferInfo header = transfer_info;
+    header.entry_count = static_cast<uint32_t>(entries.size());
+    header.name_bytes = 0;
+    for (const auto& entry : entries) header.name_bytes += static_cast<uint32_t>(entry.name.size());
+    payload.resize(sizeof(TransferInfo) + entries.size() * sizeof(TransferEntry) + header.name_bytes);
+    uint8_t* write_position = payload.data();
+    memcpy(write_position, &header, sizeof(header));
+    write_position += sizeof(header);
+    for (const auto& entry : entries) {
+        TransferEntry entry_header{entry.entry_size, static_cast<uint32_t>(entry.name.size()), 0};
+        memcpy(write_position, &entry_header, sizeof(entry_header));
+        write_position += sizeof(entry_header);
+    }
+    for (const auto& entry : entries) {
+        memcpy(write_position, entry.name.data(), entry.name.size());
+        write_position += entry.name.size();
+    }
+}
+
+// Разбирает описание передачи; false - payload повреждён
+static inline bool decode_transfer_info(const uint8_t* payload, size_t payload_length, TransferInfo& transfer_info,
+                                        std::vector<TransferEntryDescription>& entries, std::string& error_message) {
+    if (payload_length < sizeof(TransferInfo)) {
+        error_message = "некорректное описание передачи";
+        return false;
+    }
+    memcpy(&transfer_info, payload, sizeof(TransferInfo));
+    if (transfer_info.entry_count > MAX_TRANSFER_ENTRY_COUNT ||
+        payload_length != sizeof(TransferInfo) + size_t(transfer_info.entry_count) * sizeof(TransferEntry) + transfer_info.name_bytes) {
+        error_message = "некорректный список файлов в описании передачи";
+        return false;
+    }
+    entries.resize(transfer_info.entry_count);
+    const uint8_t* entry_position = payload + sizeof(TransferInfo);
+    const uint8_t* name_position = entry_position + size_t(transfer_info.entry_count) * sizeof(TransferEntry);
+    const uint8_t* name_end = payload + payload_length;
+    for (auto& entry : entries) {
+        TransferEntry entry_header;
+        memcpy(&entry_header, entry_position, sizeof(entry_header));
+        entry_position += sizeof(entry_header);
+        if (entry_header.name_length > MAX_TRANSFER_NAME_LENGTH || entry_header.name_length > size_t(name_end - name_position)) {
+            error_message = "некорректное имя файла в описании передачи";
+            return false;
+        }
+        entry.name.assign(reinterpret_cast<const char*>(name_position), entry_header.name_length);
+        entry.entry_size = entry_header.entry_size;
+        name_position += entry_header.name_length;
+    }
+    return true;
+}
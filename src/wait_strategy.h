@@ -0,0 +1,296 @@
+// Стратегии ожидания между процессами: активное ожидание, блокировка на futex и адаптивный режим
+//
+// Точка ожидания (WaitPoint) лежит в shared memory. Ждущая сторона увеличивает waiter_count,
+// повторно проверяет условие и засыпает на sequence. Будящая сторона после изменения
+// состояния вызывает wait_point_notify: системный вызов futex делается только если есть
+// спящий, поэтому в активном режиме уведомление стоит одной загрузки.
+//
+// wait_until_any ждёт сразу нескольких слов futex (consumer нескольких каналов): спит
+// в одном вызове futex_waitv, а на ядрах без него - короткими интервалами на первом слове.
+//
+// Ожидание с проверкой другой стороны (PeerCheck) спит на futex не дольше PEER_CHECK_INTERVAL_NS
+// и между интервалами вызывает проверку; если другая сторона пропала, ожидание возвращает false
+// вместо того, чтобы ждать вечно (в активном режиме - вечно жечь ядро).
+
+#pragma once
+
+#include <bits/stdc++.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+
+enum class WaitMode {
+    Spin,     // Только активное ожидание (минимальная задержка, ядро занято)
+    Block,    // Сразу засыпать на futex
+    Adaptive  // Короткое активное ожидание, затем futex
+};
+
+constexpr uint32_t DEFAULT_SPIN_ITERATIONS = 4096;
+constexpr uint64_t PEER_CHECK_INTERVAL_NS = 100000000; // Как часто ждущая сторона проверяет другую
+constexpr uint32_t SPIN_CLOCK_CHECK_ITERATIONS = 1024;  // Итераций активного ожидания между чтениями часов
+
+// Проверка другой стороны во время ожидания (см. channel_owner.h); false - ждать бессмысленно
+using PeerCheck = std::function<bool()>;
+
+struct WaitStrategy {
+    WaitMode wait_mode = WaitMode::Adaptive;
+    uint32_t spin_iterations = DEFAULT_SPIN_ITERATIONS; // Длительность активной фазы в адаптивном режиме
+};
+
+// Точка ожидания в shared memory
+struct WaitPoint {
+    uint32_t sequence;     // Слово futex, увеличивается при каждом пробуждении
+    uint32_t waiter_count; // Количество спящих на sequence
+};
+
+// Монотонное время в наносекундах; общее для процессов одной машины
+static inline uint64_t monotonic_time_ns() {
+    struct timespec current_time;
+    clock_gettime(CLOCK_MONOTONIC, &current_time);
+    return static_cast<uint64_t>(current_time.tv_sec) * 1000000000ull + static_cast<uint64_t>(current_time.tv_nsec);
+}
+
+// Отсчёт интервалов проверки другой стороны внутри одного ожидания; без проверки ничего не стоит
+class PeerCheckClock {
+public:
+    explicit PeerCheckClock(const PeerCheck* check) : peer_check(check) {
+        if (peer_check) next_check_ns = monotonic_time_ns() + PEER_CHECK_INTERVAL_NS;
+    }
+
+    // Тайм-аут одного сна на futex: без проверки - бесконечный
+    const struct timespec* sleep_timeout() const {
+        static const struct timespec check_interval = {0, static_cast<long>(PEER_CHECK_INTERVAL_NS)};
+        return peer_check ? &check_interval : nullptr;
+    }
+
+    // false - другая сторона пропала; сама проверка выполняется не чаще раза в интервал
+    bool peer_present() {
+        if (!peer_check) return true;
+        uint64_t current_time_ns = monotonic_time_ns();
+        if (current_time_ns < next_check_ns) return true;
+        next_check_ns = current_time_ns + PEER_CHECK_INTERVAL_NS;
+        return (*peer_check)();
+    }
+
+    // Для активного ожидания: часы читаются раз в SPIN_CLOCK_CHECK_ITERATIONS итераций
+    bool spin_peer_present(uint32_t spin_index) {
+        return !peer_check || spin_index % SPIN_CLOCK_CHECK_ITERATIONS != 0 || peer_present();
+    }
+
+private:
+    const PeerCheck* peer_check;
+    uint64_t next_check_ns = 0;
+};
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+static inline long futex_wait(uint32_t* futex_word, uint32_t expected_value, const struct timespec* timeout = nullptr) {
+    return syscall(SYS_futex, futex_word, FUTEX_WAIT, expected_value, timeout, nullptr, 0);
+}
+
+static inline long futex_wake(uint32_t* futex_word, int wake_count) {
+    return syscall(SYS_futex, futex_word, FUTEX_WAKE, wake_count, nullptr, nullptr, 0);
+}
+
+// Слово futex, на котором ждёт wait_until_any; waiter_count - счётчик спящих на слове
+// (nullptr у слов, которые будятся безусловно)
+struct WaitTarget {
+    uint32_t* futex_word;
+    uint32_t* waiter_count;
+};
+
+// Засыпает, пока не изменится любое из слов (observed_values - их значения перед сном)
+// или не истечёт timeout (nullptr - без ограничения)
+static inline void futex_wait_any(const std::vector<WaitTarget>& wait_targets, const std::vector<uint32_t>& observed_values,
+                                  const struct timespec* timeout = nullptr) {
+#if defined(__NR_futex_waitv) && defined(FUTEX_32)
+    // Функцию вызывают потоки всех получателей процесса; флаг меняется один раз, порядок не важен
+    static std::atomic<bool> futex_waitv_supported{true};
+    if (futex_waitv_supported.load(std::memory_order_relaxed) && wait_targets.size() <= FUTEX_WAITV_MAX) {
+        std::vector<struct futex_waitv> waiters(wait_targets.size());
+        for (size_t target_index = 0; target_index < wait_targets.size(); ++target_index) {
+            waiters[target_index] = {};
+            waiters[target_index].uaddr = reinterpret_cast<uintptr_t>(wait_targets[target_index].futex_word);
+            waiters[target_index].val = observed_values[target_index];
+            waiters[target_index].flags = FUTEX_32; // Без FUTEX_PRIVATE_FLAG: слова лежат в shared memory
+        }
+        // Тайм-аут futex_waitv - абсолютное время по выбранным часам
+        struct timespec deadline = {};
+        if (timeout) {
+            uint64_t deadline_ns = monotonic_time_ns() + static_cast<uint64_t>(timeout->tv_sec) * 1000000000ull +
+                                   static_cast<uint64_t>(timeout->tv_nsec);
+            deadline.tv_sec = static_cast<time_t>(deadline_ns / 1000000000ull);
+            deadline.tv_nsec = static_cast<long>(deadline_ns % 1000000000ull);
+        }
+        if (syscall(__NR_futex_waitv, waiters.data(), waiters.size(), 0, timeout ? &deadline : nullptr, CLOCK_MONOTONIC) >= 0 ||
+            errno != ENOSYS) {
+            return;
+        }
+        futex_waitv_supported.store(false, std::memory_order_relaxed);
+    }
+#endif
+    // futex_waitv недоступен: спим на первом слове не дольше миллисекунды, затем проверяем все
+    struct timespec poll_interval = {0, 1000000};
+    syscall(SYS_futex, wait_targets.front().futex_word, FUTEX_WAIT, observed_values.front(), &poll_interval, nullptr, 0);
+}
+
+static inline const char* wait_mode_name(WaitMode wait_mode) {
+    switch (wait_mode) {
+        case WaitMode::Spin: return "spin";
+        case WaitMode::Block: return "block";
+        default: return "adaptive";
+    }
+}
+
+static inline bool parse_wait_mode(const std::string& text, WaitMode& wait_mode) {
+    if (text == "spin") wait_mode = WaitMode::Spin;
+    else if (text == "block") wait_mode = WaitMode::Block;
+    else if (text == "adaptive") wait_mode = WaitMode::Adaptive;
+    else return false;
+    return true;
+}
+
+// Будит сторону, ожидающую на точке; вызывается после публикации нового состояния
+static inline void wait_point_notify(WaitPoint* wait_point) {
+    // Барьер упорядочивает публикацию состояния и чтение waiter_count (пара к барьеру в wait_until)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&wait_point->waiter_count, __ATOMIC_RELAXED) != 0) {
+        __atomic_fetch_add(&wait_point->sequence, 1, __ATOMIC_RELEASE);
+        futex_wake(&wait_point->sequence, INT_MAX);
+    }
+}
+
+// Ждёт выполнения условия согласно стратегии; false - peer_check сообщил, что другой стороны нет
+template <typename Predicate>
+static inline bool wait_until(WaitPoint* wait_point, const WaitStrategy& strategy, Predicate&& condition_met,
+                              const PeerCheck* peer_check = nullptr) {
+    if (condition_met()) return true;
+    PeerCheckClock check_clock(peer_check);
+
+    if (strategy.wait_mode == WaitMode::Spin) {
+        for (uint32_t spin_index = 1; !condition_met(); ++spin_index) {
+            cpu_relax();
+            if (!check_clock.spin_peer_present(spin_index)) return false;
+        }
+        return true;
+    }
+
+    if (strategy.wait_mode == WaitMode::Adaptive) {
+        for (uint32_t spin_index = 0; spin_index < strategy.spin_iterations; ++spin_index) {
+            cpu_relax();
+            if (condition_met()) return true;
+        }
+    }
+
+    while (true) {
+        uint32_t observed_sequence = __atomic_load_n(&wait_point->sequence, __ATOMIC_ACQUIRE);
+        __atomic_fetch_add(&wait_point->waiter_count, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        bool satisfied = condition_met();
+        if (!satisfied) {
+            futex_wait(&wait_point->sequence, observed_sequence, check_clock.sleep_timeout());
+        }
+        __atomic_fetch_sub(&wait_point->waiter_count, 1, __ATOMIC_RELAXED);
+        if (satisfied || condition_met()) return true;
+        if (!check_clock.peer_present()) return false;
+    }
+}
+
+// Ждёт выполнения условия, которое могут выполнить изменения любого из слов wait_targets
+template <typename Predicate>
+static inline bool wait_until_any(const std::vector<WaitTarget>& wait_targets, const WaitStrategy& strategy,
+                                  Predicate&& condition_met, const PeerCheck* peer_check = nullptr) {
+    if (condition_met()) return true;
+    PeerCheckClock check_clock(peer_check);
+
+    if (strategy.wait_mode == WaitMode::Spin || wait_targets.empty()) {
+        for (uint32_t spin_index = 1; !condition_met(); ++spin_index) {
+            cpu_relax();
+            if (!check_clock.spin_peer_present(spin_index)) return false;
+        }
+        return true;
+    }
+
+    if (strategy.wait_mode == WaitMode::Adaptive) {
+        for (uint32_t spin_index = 0; spin_index < strategy.spin_iterations; ++spin_index) {
+            cpu_relax();
+            if (condition_met()) return true;
+        }
+    }
+
+    std::vector<uint32_t> observed_values(wait_targets.size());
+    while (true) {
+        for (size_t target_index = 0; target_index < wait_targets.size(); ++target_index) {
+            observed_values[target_index] = __atomic_load_n(wait_targets[target_index].futex_word, __ATOMIC_ACQUIRE);
+            if (wait_targets[target_index].waiter_count) {
+                __atomic_fetch_add(wait_targets[target_index].waiter_count, 1, __ATOMIC_RELAXED);
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        bool satisfied = condition_met();
+        if (!satisfied) futex_wait_any(wait_targets, observed_values, check_clock.sleep_timeout());
+        for (const WaitTarget& wait_target : wait_targets) {
+            if (wait_target.waiter_count) __atomic_fetch_sub(wait_target.waiter_count, 1, __ATOMIC_RELAXED);
+        }
+        if (satisfied || condition_met()) return true;
+        if (!check_clock.peer_present()) return false;
+    }
+}
+
+// Ждёт, пока 32-битное слово в shared memory примет нужное значение.
+// Само слово используется как futex; сторона, меняющая его, вызывает futex_wake_value.
+// waiter_count (если есть) на время сна учитывает ждущего, чтобы будящая сторона
+// обходилась без системного вызова, когда никто не спит.
+// false - peer_check сообщил, что другой стороны нет.
+static inline bool wait_for_value(uint32_t* futex_word, uint32_t desired_value, const WaitStrategy& strategy,
+                                  const PeerCheck* peer_check = nullptr, uint32_t* waiter_count = nullptr) {
+    auto value_reached = [&]() { return __atomic_load_n(futex_word, __ATOMIC_ACQUIRE) == desired_value; };
+    if (value_reached()) return true;
+    PeerCheckClock check_clock(peer_check);
+
+    if (strategy.wait_mode == WaitMode::Spin) {
+        for (uint32_t spin_index = 1; !value_reached(); ++spin_index) {
+            cpu_relax();
+            if (!check_clock.spin_peer_present(spin_index)) return false;
+        }
+        return true;
+    }
+
+    if (strategy.wait_mode == WaitMode::Adaptive) {
+        for (uint32_t spin_index = 0; spin_index < strategy.spin_iterations; ++spin_index) {
+            cpu_relax();
+            if (value_reached()) return true;
+        }
+    }
+
+    while (true) {
+        uint32_t observed_value = __atomic_load_n(futex_word, __ATOMIC_ACQUIRE);
+        if (observed_value == desired_value) return true;
+        if (waiter_count) {
+            __atomic_fetch_add(waiter_count, 1, __ATOMIC_RELAXED);
+            // Пара к барьеру в futex_wake_value: либо будящий увидит ждущего, либо futex - новое значение
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        }
+        futex_wait(futex_word, observed_value, check_clock.sleep_timeout());
+        if (waiter_count) __atomic_fetch_sub(waiter_count, 1, __ATOMIC_RELAXED);
+        if (value_reached()) return true;
+        if (!check_clock.peer_present()) return false;
+    }
+}
+
+// Будит ожидающих на слове после его изменения. С waiter_count системный вызов делается
+// только если кто-то спит; без счётчика пробуждение безусловное.
+static inline void futex_wake_value(uint32_t* futex_word, uint32_t* waiter_count = nullptr) {
+    if (waiter_count) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(waiter_count, __ATOMIC_RELAXED) == 0) return;
+    }
+    futex_wake(futex_word, INT_MAX);
+}